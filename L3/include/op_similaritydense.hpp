@@ -27,6 +27,22 @@ namespace xf {
 namespace graph {
 namespace L3 {
 
+// Per-CU state kept between queries.  The device type is cached at init; the pinned I/O buffers and kernel
+// arguments are built on the first query after the CU's graph is loaded and reused until the next load.
+struct SimDenseCuContext {
+    bool isHBM = false;          // u50/u55 HBM kernel layout, otherwise the DDR layout
+    bool ready = false;          // buffers and kernel args match the currently loaded graph
+    int32_t sourceCap = 0;       // capacity of the pinned source buffers, in elements
+    int32_t topKCap = 0;         // capacity of the pinned result buffers, in entries
+    uint32_t* config = nullptr;  // 64-word kernel config block
+    int32_t* sourceWeight = nullptr;
+    int32_t* sourceCoeffs = nullptr;
+    int32_t* resultID = nullptr;
+    float* similarity = nullptr;
+    std::vector<cl::Memory> ob_in;   // buffers written per query
+    std::vector<cl::Memory> ob_out;  // buffers read back per query
+};
+
 class opSimilarityDense : public opBase {
    public:
     static uint32_t cuPerBoardSimDense;
@@ -39,6 +55,8 @@ class opSimilarityDense : public opBase {
 
     class clHandle* handles = nullptr;
 
+    SimDenseCuContext* cuContexts = nullptr; // one per handle
+
     opSimilarityDense() : opBase() {};
 
     void setHWInfo(uint32_t numDevices, uint32_t maxCU);
@@ -59,6 +77,15 @@ class opSimilarityDense : public opBase {
 
     void loadGraphMultiCardBlocking(unsigned int deviceID, unsigned int cuID, xf::graph::Graph<int32_t, int32_t> g);
 
+    // Copies size bytes from hostPtr to byte offset of weight channel `channel` of the graph loaded on a CU.
+    // hostPtr is normally weightsDense[channel] + offset of that graph, after the caller changed it.
+    void updateGraphRegion(unsigned int deviceID,
+                           unsigned int cuID,
+                           uint32_t channel,
+                           size_t offset,
+                           size_t size,
+                           const void* hostPtr);
+
     static int computeInt(unsigned int deviceID,
                           unsigned int cuID,
                           unsigned int channelID,
@@ -66,13 +93,14 @@ class opSimilarityDense : public opBase {
                           xrmCuResource* resR,
                           std::string instanceName,
                           clHandle* handles,
+                          SimDenseCuContext* contexts,
                           int32_t similarityType,
                           int32_t dataType,
                           int32_t sourceNUM,
                           int32_t* sourceWeight,
                           int32_t* sourceCoeffs,
                           int32_t topK,
-                          xf::graph::Graph<int32_t, int32_t> g,
+                          const xf::graph::Graph<int32_t, int32_t>& g,
                           int32_t* resultID,
                           float* similarity);
 
@@ -86,6 +114,31 @@ class opSimilarityDense : public opBase {
                           int32_t* resultID,
                           float* similarity);
 
+    /**
+     * @brief Merge per-CU top-K results into a single top-K list
+     *
+     * Each input list must be sorted by descending similarity, as the kernel returns it.  A heap over the list
+     * cursors yields O(topK * log(numLists)) merging.  Ties between lists are broken by ascending ID and then by
+     * list index (each list keeps its own order), and an ID already emitted is skipped, so the output is
+     * deterministic and duplicate-free.
+     *
+     * @param numLists number of input lists (one per CU)
+     * @param resultIDs per-list row IDs
+     * @param similarities per-list similarity scores
+     * @param numResults per-list result counts; lists may have different lengths
+     * @param topK maximum number of merged results
+     * @param resultID merged row IDs, at least topK entries
+     * @param similarity merged similarity scores, at least topK entries
+     * @return number of merged results written
+     */
+    static int32_t mergeTopK(uint32_t numLists,
+                             const int32_t* const* resultIDs,
+                             const float* const* similarities,
+                             const int32_t* numResults,
+                             int32_t topK,
+                             int32_t* resultID,
+                             float* similarity);
+
    private:
     std::vector<int> deviceOffset;
     uint32_t numDevices_;
@@ -137,6 +190,21 @@ class opSimilarityDense : public opBase {
 
     static void cuRelease(xrmContext* ctx, xrmCuResource* resR);
 
+    static bool isHBMDevice(const cl::Device& device);
+
+    static void buildCuContext(clHandle* hds,
+                               SimDenseCuContext& ctx,
+                               const xf::graph::Graph<int32_t, int32_t>& g,
+                               int cuID,
+                               int32_t similarityType,
+                               int32_t dataType,
+                               int32_t topK,
+                               int32_t sourceNUM);
+
+    static void freeCuContext(SimDenseCuContext& ctx);
+
+    void invalidateCuContexts(unsigned int deviceID, unsigned int cuID);
+
     static void postProcessKNN(
         uint32_t topK, std::string* knownLabels, uint32_t* resultID, float* similarity, std::string* label);
 };
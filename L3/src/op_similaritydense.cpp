@@ -19,8 +19,10 @@
 
 #include "op_similaritydense.hpp"
 #include <chrono>
+#include <queue>
 #include <regex>
 #include <unordered_map>
+#include <unordered_set>
 
 namespace xf {
 namespace graph {
@@ -83,12 +85,14 @@ void opSimilarityDense::setHWInfo(uint32_t numDevices, uint32_t maxCU) {
   numDevices_ = numDevices;
   cuPerBoardSimDense = maxCU_ / numDevices_;
   handles = new clHandle[maxCU_];
+  cuContexts = new SimDenseCuContext[maxCU_];
 };
 
 void opSimilarityDense::freeSimDense(xrmContext *ctx) {
   std::cout << "INFO: " << __FUNCTION__ << " maxCU_=" << maxCU_ << std::endl;
 
   for (unsigned int i = 0; i < maxCU_; ++i) {
+    freeCuContext(cuContexts[i]);
     delete[] handles[i].buffer;
     int deviceId = handles[i].resR->deviceId;
     int cuId = handles[i].resR->cuId;
@@ -108,6 +112,7 @@ void opSimilarityDense::freeSimDense(xrmContext *ctx) {
   }
 
   delete[] handles;
+  delete[] cuContexts;
 };
 
 void opSimilarityDense::cuRelease(xrmContext *ctx, xrmCuResource *resR) {
@@ -115,6 +120,41 @@ void opSimilarityDense::cuRelease(xrmContext *ctx, xrmCuResource *resR) {
   };
 };
 
+bool opSimilarityDense::isHBMDevice(const cl::Device &device) {
+  std::string devName = device.getInfo<CL_DEVICE_NAME>();
+  std::regex u50(".*u50.*");
+  std::regex u55(".*u55.*");
+  return std::regex_match(devName, u50) || std::regex_match(devName, u55);
+}
+
+void opSimilarityDense::freeCuContext(SimDenseCuContext &ctx) {
+  free(ctx.config);
+  free(ctx.sourceWeight);
+  free(ctx.sourceCoeffs);
+  free(ctx.resultID);
+  free(ctx.similarity);
+  ctx.config = nullptr;
+  ctx.sourceWeight = nullptr;
+  ctx.sourceCoeffs = nullptr;
+  ctx.resultID = nullptr;
+  ctx.similarity = nullptr;
+  ctx.sourceCap = 0;
+  ctx.topKCap = 0;
+  ctx.ob_in.clear();
+  ctx.ob_out.clear();
+  ctx.ready = false;
+}
+
+// Drop the cached I/O state of every handle on the CU so that the next query
+// rebinds the kernel to the newly loaded weights
+void opSimilarityDense::invalidateCuContexts(unsigned int deviceID,
+                                             unsigned int cuID) {
+  for (unsigned int j = 0; j < maxCU_; ++j) {
+    if ((handles[j].deviceID == deviceID) && (handles[j].cuID == cuID))
+      cuContexts[j].ready = false;
+  }
+}
+
 // Currently active for cosine similarity
 void opSimilarityDense::init(class openXRM *xrm, std::string kernelName,
                              std::string kernelAlias, std::string xclbinFile,
@@ -133,6 +173,7 @@ void opSimilarityDense::init(class openXRM *xrm, std::string kernelName,
   createHandleSimDense(xrm, handles[cnt], kernelName, kernelAlias, xclbinFile,
                        deviceIDs[cnt], requestLoad);
   handles[cnt].buffer = new cl::Buffer[numBuffers];
+  cuContexts[cnt].isHBM = isHBMDevice(handles[cnt].device);
   unsigned int prev = deviceIDs[0];
   deviceOffset.push_back(0);
   for (unsigned int i = 1; i < maxCU_; ++i) {
@@ -142,6 +183,7 @@ void opSimilarityDense::init(class openXRM *xrm, std::string kernelName,
     createHandleSimDense(xrm, handles[i], kernelName, kernelAlias, xclbinFile,
                          deviceIDs[i], requestLoad);
     handles[i].buffer = new cl::Buffer[numBuffers];
+    cuContexts[i].isHBM = isHBMDevice(handles[i].device);
     if (deviceIDs[i] != prev) {
       prev = deviceIDs[i];
       deviceOffset.push_back(i);
@@ -415,14 +457,12 @@ void opSimilarityDense::loadGraphMultiCardBlocking(
   int nnz = g.edgeNum;
   int nrows = g.nodeNum;
   int cnt = 0;
+  invalidateCuContexts(deviceID, cuID);
   for (unsigned int j = 0; j < maxCU_; ++j) {
     if ((handles[j].deviceID == (unsigned int)deviceID) &&
         (handles[j].cuID == cuID) && (handles[j].dupID == 0)) {
       cnt = j;
-      std::string devName = handles[0].device.getInfo<CL_DEVICE_NAME>();
-      std::regex u50(".*u50.*");
-      std::regex u55(".*u55.*");
-      if (std::regex_match(devName, u50) || std::regex_match(devName, u55)) {
+      if (cuContexts[j].isHBM) {
         std::cout << "INFO: Run loadGraphCoreSimDenseInt.... " << std::endl;
         loadGraphCoreSimDenseInt(&handles[j], nrows, nnz, cuID, g);
       } else {
@@ -457,19 +497,17 @@ void opSimilarityDense::loadGraphMultiCardNonBlocking(
   std::thread *th = new std::thread[maxCU_];
   std::future<void> *fut = new std::future<void>[ maxCU_ ];
   int cnt = 0;
+  invalidateCuContexts(deviceID, cuID);
   for (unsigned int j = 0; j < maxCU_; ++j) {
     if ((handles[j].deviceID == (unsigned int)deviceID) &&
         (handles[j].cuID == (unsigned int)cuID) && (handles[j].dupID == 0)) {
       cnt = j;
-      std::string devName = handles[0].device.getInfo<CL_DEVICE_NAME>();
       // std::packaged_task<void(clHandle *, int, int, int,
       // xf::graph::Graph<int32_t, int32_t>)>t(loadGraphCoreSimDenseInt);
       // fut[j] = t.get_future();
       // th[j] = std::thread(std::move(t), &handles[j], nrows, nnz, cuID,
       // graph);
-      std::regex u50(".*u50.*");
-      std::regex u55(".*u55.*");
-      if (std::regex_match(devName, u50) || std::regex_match(devName, u55)) {
+      if (cuContexts[j].isHBM) {
         std::cout << "INFO: Run loadGraphCoreSimDenseInt" << std::endl;
         std::packaged_task<void(clHandle *, int, int, int,
                                 xf::graph::Graph<int32_t, int32_t>)>
@@ -518,6 +556,25 @@ void opSimilarityDense::loadGraphMultiCardNonBlocking(
   delete[] fut;
 };
 
+void opSimilarityDense::updateGraphRegion(unsigned int deviceID,
+                                          unsigned int cuID, uint32_t channel,
+                                          size_t offset, size_t size,
+                                          const void *hostPtr) {
+  for (unsigned int j = 0; j < maxCU_; ++j) {
+    if ((handles[j].deviceID == deviceID) && (handles[j].cuID == cuID) &&
+        (handles[j].dupID == 0)) {
+      // weight buffers follow the I/O buffers: 5 of them for HBM, 4 for DDR
+      uint32_t first = cuContexts[j].isHBM ? 5 : 4;
+      // duplicated handles share this buffer
+      handles[j].q.enqueueWriteBuffer(handles[j].buffer[first + channel],
+                                      CL_TRUE, offset, size, hostPtr);
+      return;
+    }
+  }
+  std::cout << "ERROR: " << __FUNCTION__ << " no CU for deviceID=" << deviceID
+            << " cuID=" << cuID << std::endl;
+};
+
 // Initialize Buffers
 void opSimilarityDense::bufferInitInt(clHandle *hds, std::string instanceName0,
                                       xf::graph::Graph<int32_t, int32_t> g,
@@ -777,17 +834,117 @@ void opSimilarityDense::postProcessKNN(uint32_t topK, std::string *knownLabels,
   }
 };
 
+namespace {
+struct TopKCursor {
+  float similarity;
+  int32_t id;
+  uint32_t list;
+  int32_t pos;
+};
+
+// std::priority_queue keeps the largest element on top, so "less" here means a worse result
+struct TopKCursorWorse {
+  bool operator()(const TopKCursor &a, const TopKCursor &b) const {
+    if (a.similarity != b.similarity)
+      return a.similarity < b.similarity;
+    if (a.id != b.id)
+      return a.id > b.id;
+    return a.list > b.list;
+  }
+};
+} // namespace
+
+int32_t opSimilarityDense::mergeTopK(uint32_t numLists,
+                                     const int32_t *const *resultIDs,
+                                     const float *const *similarities,
+                                     const int32_t *numResults, int32_t topK,
+                                     int32_t *resultID, float *similarity) {
+  std::priority_queue<TopKCursor, std::vector<TopKCursor>, TopKCursorWorse>
+      heap;
+  for (uint32_t i = 0; i < numLists; ++i) {
+    if (numResults[i] > 0)
+      heap.push({similarities[i][0], resultIDs[i][0], i, 0});
+  }
+
+  std::unordered_set<int32_t> emitted;
+  emitted.reserve(topK);
+  int32_t cnt = 0;
+  while (cnt < topK && !heap.empty()) {
+    TopKCursor cur = heap.top();
+    heap.pop();
+    if (emitted.insert(cur.id).second) {
+      resultID[cnt] = cur.id;
+      similarity[cnt] = cur.similarity;
+      ++cnt;
+    }
+    if (++cur.pos < numResults[cur.list]) {
+      cur.similarity = similarities[cur.list][cur.pos];
+      cur.id = resultIDs[cur.list][cur.pos];
+      heap.push(cur);
+    }
+  }
+  return cnt;
+}
+
+// Allocate the pinned I/O buffers of one CU handle, bind them and the loaded
+// weights to its kernel, and place them in device memory once
+void opSimilarityDense::buildCuContext(
+    clHandle *hds, SimDenseCuContext &ctx,
+    const xf::graph::Graph<int32_t, int32_t> &g, int cuID,
+    int32_t similarityType, int32_t dataType, int32_t topK,
+    int32_t sourceNUM) {
+  bool isHBM = ctx.isHBM;
+  freeCuContext(ctx);
+  ctx.isHBM = isHBM;
+  ctx.sourceCap = std::max(sourceNUM, (int32_t)g.edgeNum);
+  ctx.topKCap = topK;
+  // both kernel layouts pad the source by at most 16 elements
+  int32_t sourceLen = ctx.sourceCap + 16;
+  ctx.config = aligned_alloc<uint32_t>(64);
+  ctx.sourceWeight = aligned_alloc<int32_t>(sourceLen);
+  ctx.sourceCoeffs = aligned_alloc<int32_t>(sourceLen);
+  ctx.resultID = aligned_alloc<int32_t>(topK);
+  ctx.similarity = aligned_alloc<float>(topK);
+  memset(ctx.config, 0, sizeof(uint32_t) * 64);
+  memset(ctx.sourceWeight, 0, sizeof(int32_t) * sourceLen);
+  memset(ctx.sourceCoeffs, 0, sizeof(int32_t) * sourceLen);
+
+  std::vector<cl::Memory> init;
+  if (ctx.isHBM) {
+    std::cout << "INFO: Begin bufferInitInt....." << std::endl;
+    bufferInitInt(hds, "", g, cuID, similarityType, dataType, topK,
+                  ctx.sourceCap, ctx.sourceWeight, ctx.sourceCoeffs,
+                  ctx.config, ctx.resultID, ctx.similarity, init, ctx.ob_out);
+    // config, source weight, source coeffs
+    ctx.ob_in.assign(init.begin(), init.begin() + 3);
+  } else {
+    std::cout << "INFO: Begin bufferInitIntDDR....." << std::endl;
+    bufferInitIntDDR(hds, "", g, cuID, similarityType, dataType, topK,
+                     ctx.sourceCap, ctx.sourceWeight, ctx.sourceCoeffs,
+                     ctx.config, ctx.resultID, ctx.similarity, init,
+                     ctx.ob_out);
+    // source weight, config
+    ctx.ob_in.assign(init.begin(), init.begin() + 2);
+  }
+
+  cl::Event ev;
+  hds[0].q.enqueueMigrateMemObjects(init, 0, nullptr, &ev);
+  ev.wait();
+  ctx.ready = true;
+}
+
 //-----------------------------------------------------------------------------
 // currently used
 //-----------------------------------------------------------------------------
 int opSimilarityDense::computeInt(unsigned int deviceID, unsigned int cuID,
                                   unsigned int channelID, xrmContext *ctx,
                                   xrmCuResource *resR, std::string instanceName,
-                                  clHandle *handles, int32_t similarityType,
-                                  int32_t dataType, int32_t sourceNUM,
-                                  int32_t *sourceWeight, int32_t *sourceCoeffs,
-                                  int32_t topK,
-                                  xf::graph::Graph<int32_t, int32_t> g,
+                                  clHandle *handles,
+                                  SimDenseCuContext *contexts,
+                                  int32_t similarityType, int32_t dataType,
+                                  int32_t sourceNUM, int32_t *sourceWeight,
+                                  int32_t *sourceCoeffs, int32_t topK,
+                                  const xf::graph::Graph<int32_t, int32_t> &g,
                                   int32_t *resultID, float *similarity) {
 
   std::thread::id this_id = std::this_thread::get_id();
@@ -812,12 +969,13 @@ int opSimilarityDense::computeInt(unsigned int deviceID, unsigned int cuID,
 #endif
 
   clHandle *hds = &handles[which];
+  SimDenseCuContext &cuCtx = contexts[which];
   cl::Kernel kernel0 = hds[0].kernel;
-  std::vector<cl::Memory> ob_in;
-  std::vector<cl::Memory> ob_out;
 
-  uint32_t *config;
-  config = aligned_alloc<uint32_t>(64);
+  // first query after a graph load, or a query larger than the pinned buffers
+  if (!cuCtx.ready || topK > cuCtx.topKCap || sourceNUM > cuCtx.sourceCap)
+    buildCuContext(hds, cuCtx, g, cuID, similarityType, dataType,
+                   std::max(topK, cuCtx.topKCap), sourceNUM);
 
   unsigned int num_runs = 1;
 
@@ -825,45 +983,33 @@ int opSimilarityDense::computeInt(unsigned int deviceID, unsigned int cuID,
   std::vector<cl::Event> events_kernel(num_runs);
   std::vector<cl::Event> events_read(1);
 
-  // inside computeInt function
-  std::string devName = hds->device.getInfo<CL_DEVICE_NAME>();
-  // std::string devName = handles[0].device.getInfo<CL_DEVICE_NAME>();
+  // both kernel layouts share the first four config words
+  cuCtx.config[0] = topK;
+  cuCtx.config[1] = sourceNUM;
+  cuCtx.config[2] = similarityType;
+  cuCtx.config[3] = dataType;
+  memcpy(cuCtx.sourceWeight, sourceWeight, sizeof(int32_t) * sourceNUM);
+  if (cuCtx.isHBM)
+    memcpy(cuCtx.sourceCoeffs, sourceCoeffs, sizeof(int32_t) * sourceNUM);
 
-  std::cout << "INFO: DevName " << devName << std::endl;
-  std::regex u50(".*u50.*");
-  std::regex u55(".*u55.*");
-  int ret;
-  if (std::regex_match(devName, u50) || std::regex_match(devName, u55)) {
-    std::cout << "INFO: Begin bufferInitInt....." << std::endl;
-    bufferInitInt(hds, instanceName, g, cuID, similarityType, dataType, topK,
-                  sourceNUM, sourceWeight, sourceCoeffs, config, resultID,
-                  similarity, ob_in, ob_out);
-    migrateMemObj(hds, 0, num_runs, ob_in, nullptr, &events_write[0]);
-    ret = cuExecute(hds, kernel0, num_runs, &events_write, &events_kernel[0]);
-    migrateMemObj(hds, 1, num_runs, ob_out, &events_kernel, &events_read[0]);
-  } else {
-    std::cout << "INFO: Begin bufferInitIntDDR....." << std::endl;
-    // TODO : why?? hds or handles
-    bufferInitIntDDR(hds, instanceName, g, cuID, similarityType, dataType, topK,
-                     sourceNUM, sourceWeight, sourceCoeffs, config, resultID,
-                     similarity, ob_in, ob_out);
-    migrateMemObj(hds, 0, num_runs, ob_in, nullptr, &events_write[0]);
-    ret = cuExecute(hds, kernel0, num_runs, &events_write, &events_kernel[0]);
-    migrateMemObj(hds, 1, num_runs, ob_out, &events_kernel, &events_read[0]);
-  }
+  migrateMemObj(hds, 0, num_runs, cuCtx.ob_in, nullptr, &events_write[0]);
+  int ret = cuExecute(hds, kernel0, num_runs, &events_write, &events_kernel[0]);
+  migrateMemObj(hds, 1, num_runs, cuCtx.ob_out, &events_kernel,
+                &events_read[0]);
 
   events_read[0].wait();
 
+  memcpy(resultID, cuCtx.resultID, sizeof(int32_t) * topK);
+  memcpy(similarity, cuCtx.similarity, sizeof(float) * topK);
+
 #ifndef NDEBUG
-  for(int i = 0; i < 10; i++) {
+  for(int i = 0; i < 10 && i < topK; i++) {
       std::cout<<"i="<<i<<" ID="<<resultID[i]<< " similarity="<<similarity[i]<<std::endl;
   }
 #endif
 
   // cuRelease(ctx, resR);
 
-  free(config);
-
 #ifdef __PROFILING__
   std::chrono::time_point<std::chrono::high_resolution_clock> l_end_time =
       std::chrono::high_resolution_clock::now();
@@ -885,9 +1031,9 @@ event<int> opSimilarityDense::addworkInt(int32_t similarityType,
                                          int32_t *sourceCoeffs, int32_t topK,
                                          xf::graph::Graph<int32_t, int32_t> g,
                                          int32_t *resultID, float *similarity) {
-  return createL3(task_queue[0], &(computeInt), handles, similarityType,
-                  dataType, sourceNUM, sourceWeight, sourceCoeffs, topK, g,
-                  resultID, similarity);
+  return createL3(task_queue[0], &(computeInt), handles, cuContexts,
+                  similarityType, dataType, sourceNUM, sourceWeight,
+                  sourceCoeffs, topK, g, resultID, similarity);
 };
 
 } // L3
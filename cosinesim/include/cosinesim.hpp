@@ -63,11 +63,18 @@ namespace cosinesim
  * Alveo acceleration cards.  If you specify fewer than the number of installed cards, the choice of which cards are
  * used is undefined.
  * 
+ * To run without an Alveo accelerator card, set Options::cpuBackend to `true`.  Population vectors are then kept in
+ * host memory and matched with AVX2 or AVX-512 instructions when the CPU supports them, using AVX-512 VNNI for
+ * 8-bit elements.
+ * 
  * NOTE: Setting the `xclbinPath` and `xcbinPathCStr` data members of the Options object currently has no effect,
  * as the XCLBIN (FPGA program) file is always picked up from the default installation location under `/opt/xilinx`.
  * 
  * Next, instantiate the CosineSim object.  The template parameter specifies the integral type of each target and
- * population vector element.  Currently, only 32-bit signed integer types, such as `std::int32_t`, are supported.
+ * population vector element.  Alveo accelerator cards support 32-bit signed integer types, such as `std::int32_t`.
+ * With Options::cpuBackend, `std::int8_t` and `std::int16_t` are supported as well and shrink the population, and
+ * the memory traffic of every match, 4x and 2x.  A 16-bit element of -32768 is stored and matched as -32767, a
+ * value quantizeVector() never produces.  quantizeVector() converts floating-point embeddings to any of these types.
  * 
  * ~~~
  * xilinx_apps::cosinesim::CosineSim<std::int32_t> cosineSim(options);
@@ -127,6 +134,20 @@ namespace cosinesim
  * The get and finish calls do not need to be in the same critical section.  That is, you can unlock the mutex
  * between the two function calls.
  * 
+ * **Bulk loading:** If the population vectors are already in one array, call CosineSim::loadPopulation() instead
+ * of the get/finish pair.  It places each vector directly into its device buffer and splits the work across all
+ * hardware threads.  CosineSim::loadPopulationRows() loads one range of rows and may be called concurrently from
+ * your own threads for disjoint ranges.
+ * 
+ * **Changing the population:** Once loaded, single vectors can be replaced with
+ * CosineSim::updatePopulationVector() or removed with CosineSim::deletePopulationVector(), and new vectors added with
+ * CosineSim::appendPopulationVectors().  Each call rewrites only the affected rows on the Alveo accelerator card.
+ * Set Options::reserveVectors to leave room for appended vectors.
+ * 
+ * **Restarts:** After loading, CosineSim::saveSnapshot() writes the partitioned population, and optionally your
+ * row-to-ID map, to a file.  CosineSim::loadSnapshot() restores it later with sequential reads, skipping the
+ * whole load sequence.
+ * 
  * ### Run a match ###
  * 
  * After the population vectors have been loaded into the Alveo accelerator card, you can call
@@ -151,6 +172,31 @@ namespace cosinesim
  * need to be present in the set of population vectors, as each call to CosineSim::matchTargetVector() transfers the
  * target vector to the Alveo accelerator card before running the cosine similarity search.
  * 
+ * When you have many target vectors at once, CosineSim::matchTargetVectors() takes them as one array of
+ * `numTargets` consecutive vectors and returns one result list per target, which avoids paying the per-call
+ * overhead for each target.
+ * 
+ * CosineSim::matchTargetVectorAsync() starts a match and returns a `std::future` right away.  Matches started
+ * this way, from any number of threads, are queued together and keep all Alveo cards busy while the callers do
+ * other work.
+ * 
+ * **Approximate search:** On the host CPU backend, Options::ivfLists builds an inverted-file index when the
+ * population is loaded, and each match scans only the Options::nprobe lists nearest the target vector.  For very
+ * large populations this trades a little recall for a large cut in match time.
+ * CosineSim::matchTargetVectorExact() still scans every vector, per query.
+ * 
+ * **Filtered search:** To restrict a match to some of the population, for example to the vertices that pass a
+ * query condition, pass a Bitmap of allowed row indexes, or a RowPredicate, to CosineSim::matchTargetVector().
+ * The results are the best matches among the allowed rows, so there is no need to ask for a larger `numResults`
+ * and filter afterwards.  On the host CPU backend, excluded rows are skipped 64 at a time before any dot product is
+ * computed, so a selective filter makes the match faster.
+ * 
+ * The Alveo kernels always rank the whole population and cannot skip excluded rows.  A Bitmap that allows at most
+ * 1/16 of the population is therefore matched on the host, scanning only the allowed rows.  For other filters the
+ * cards rank the population for at most two rounds, asking for more results than the filter's density predicts,
+ * and any target still short of `numResults` allowed rows is then matched on the host.  A RowPredicate on its own
+ * gives no density estimate, so on Alveo cards a selective filter is better expressed as a Bitmap.
+ * 
  * ## Alveo accelerator card storage capacity ##
  * 
  * The number of population vectors that an Alveo accelerator card can hold depends on both the vector length of
@@ -244,6 +290,10 @@ namespace cosinesim
 #include <cstring>
 #include <algorithm>  // std::copy
 #include <iterator>  // std::back_inserter
+#include <future>
+#include <thread>
+#include <cmath>
+#include <limits>
 
 #include "xilinx_apps_common.hpp"
 
@@ -329,6 +379,61 @@ struct Result {
     }
 };
 
+/**
+ * @brief Set of population vector row indexes, one bit per row, that limits a filtered match
+ */
+class Bitmap {
+public:
+    /**
+     * Constructs an empty set that can hold the row indexes 0 to `numRows` - 1.
+     * 
+     * @param numRows the number of row indexes covered, normally the population size.  Rows at or past it are
+     * never in the set.
+     */
+    explicit Bitmap(RowIndex numRows = 0) : words_(numRows / 64 + 1, 0), numRows_(numRows) {}
+
+    /**
+     * Adds a row index to the set, or removes it.
+     * 
+     * @param rowIndex a row index less than size()
+     * @param value true to add the row, false to remove it
+     */
+    void set(RowIndex rowIndex, bool value = true) {
+        const std::uint64_t bit = std::uint64_t(1) << (rowIndex % 64);
+        if (value)
+            words_[rowIndex / 64] |= bit;
+        else
+            words_[rowIndex / 64] &= ~bit;
+    }
+
+    /**
+     * Returns whether a row index is in the set.
+     */
+    bool test(RowIndex rowIndex) const {
+        return rowIndex >= 0 && rowIndex < numRows_ && ((words_[rowIndex / 64] >> (rowIndex % 64)) & 1) != 0;
+    }
+
+    /**
+     * Returns the number of row indexes covered, as passed to the constructor.
+     */
+    RowIndex size() const { return numRows_; }
+
+    /**
+     * Returns the bits: row index `r` is bit `r % 64` of word `r / 64`.
+     */
+    const std::uint64_t *words() const { return words_.data(); }
+
+private:
+    std::vector<std::uint64_t> words_;
+    RowIndex numRows_ = 0;
+};
+
+/**
+ * Filter for CosineSim::matchTargetVector(): returns true if the population vector at `rowIndex` may be matched.
+ * `context` is the pointer passed along with the predicate.
+ */
+typedef bool (*RowPredicate)(void *context, RowIndex rowIndex);
+
 /**
  * @brief Struct containing CosineSim configuration options
  */
@@ -345,6 +450,33 @@ struct Options {
      */
     XString xclbinPath;
 
+    /**
+     * Run matches on the host CPU with SIMD dot products instead of Alveo cards.  No XCLBIN or device is needed,
+     * and @ref numDevices, @ref deviceNames and @ref xclbinPath are ignored.  Default is false.
+     */
+    bool cpuBackend = false;
+
+    /**
+     * Extra rows that startLoadPopulation() reserves beyond its vector count, for later
+     * CosineSim::appendPopulationVectors() calls.  On Alveo cards the population cannot grow past this reserve
+     * without a reload.  Default is 0.
+     */
+    std::int64_t reserveVectors = 0;
+
+    /**
+     * Number of inverted-file (IVF) lists to index the population with on the host CPU backend.  When positive,
+     * finishLoadPopulation() clusters the population vectors into this many lists with k-means, and matches scan
+     * only the @ref nprobe lists whose centroids are nearest the target vector.  0, the default, scans every
+     * vector.  Ignored on Alveo cards.
+     */
+    std::int32_t ivfLists = 0;
+
+    /**
+     * Number of IVF lists scanned per target vector when @ref ivfLists is positive.  More lists raise recall and
+     * match time.  Default is 8.
+     */
+    std::int32_t nprobe = 8;
+
     /**
      * Destroys this Options object.
      */
@@ -397,6 +529,10 @@ private:
         //setXclbinPath(opt.xclbinPath);
         xclbinPath = opt.xclbinPath;
         deviceNames = opt.deviceNames;
+        cpuBackend = opt.cpuBackend;
+        reserveVectors = opt.reserveVectors;
+        ivfLists = opt.ivfLists;
+        nprobe = opt.nprobe;
 
     }
 };
@@ -406,14 +542,47 @@ template <typename Value>
 class CosineSim;
 
 /// @cond INTERNAL
+// Completion callback of ImplBase::matchTargetVectorAsync(): exactly one of results and error is non-null
+typedef void (*MatchCallback)(void *context, const XVector<Result> *results, const char *error);
+
+// Rows a filtered match may return: those set in allowBits (laid out like Bitmap::words(), numBits rows) and
+// accepted by predicate.  A null allowBits or predicate lets every row through.
+struct RowFilter {
+    const std::uint64_t *allowBits;
+    RowIndex numBits;
+    RowPredicate predicate;
+    void *context;
+};
+
+inline bool isRowAllowed(const RowFilter &filter, RowIndex row) {
+    if (filter.allowBits != nullptr
+            && (row < 0 || row >= filter.numBits || ((filter.allowBits[row / 64] >> (row % 64)) & 1) == 0))
+        return false;
+    return filter.predicate == nullptr || filter.predicate(filter.context, row);
+}
+
 class ImplBase {
 public:
     virtual ~ImplBase(){};
     virtual void startLoadPopulation(std::int64_t numVertices) = 0;
     virtual void *getPopulationVectorBuffer(RowIndex &rowIndex) = 0;
     virtual void finishCurrentPopulationVector(void * pbuf) = 0;
+    virtual void loadPopulationRows(RowIndex firstRow, const void *matrix, RowIndex numRows, ColIndex stride) = 0;
     virtual void finishLoadPopulation() =0;
+    virtual void updatePopulationVector(RowIndex rowIndex, const void *elements) = 0;
+    virtual RowIndex appendPopulationVectors(const void *matrix, RowIndex numRows, ColIndex stride) = 0;
+    virtual void deletePopulationVector(RowIndex rowIndex) = 0;
     virtual XVector<Result> matchTargetVector(unsigned numResults, void *elements) = 0;
+    virtual XVector<XVector<Result>> matchTargetVectors(unsigned numResults, void *elements,
+                                                        std::size_t numTargets) = 0;
+    virtual XVector<XVector<Result>> matchTargetVectorsExact(unsigned numResults, void *elements,
+                                                             std::size_t numTargets) = 0;
+    virtual XVector<XVector<Result>> matchTargetVectorsFiltered(unsigned numResults, void *elements,
+                                                                std::size_t numTargets, const RowFilter &filter) = 0;
+    virtual void matchTargetVectorAsync(unsigned numResults, void *elements, MatchCallback callback,
+                                        void *context) = 0;
+    virtual void saveSnapshot(const char *path, const std::uint64_t *rowIds, RowIndex numRowIds) = 0;
+    virtual XVector<std::uint64_t> loadSnapshot(const char *path) = 0;
     virtual void cleanGraph() =0;
 };
 /// @endcond
@@ -431,10 +600,10 @@ public:
      * Constructs a CosineSimBase object.
      * 
      * @param options the configuration options for consine similarity operations.  See the Options struct for details.
-     * @param valueSize the size in bytes of each vector element.  4 is the only supported value for this release.
+     * @param valueSize the size in bytes of each vector element: 4, or 1 or 2 with Options::cpuBackend
      */
     CosineSimBase(const Options &options, unsigned valueSize)
-    : options_(options), pImpl_(::xilinx_cosinesim_createImpl(options, valueSize))
+    : options_(options), valueSize_(valueSize), pImpl_(::xilinx_cosinesim_createImpl(options, valueSize))
     {}
 
     /**
@@ -477,6 +646,58 @@ public:
      */
     void finishCurrentPopulationVector(void *pbuf){pImpl_->finishCurrentPopulationVector(pbuf);}
 
+    /**
+     * Copies a block of consecutive population vectors into place.
+     * 
+     * @param firstRow the row index of the first vector in the block
+     * @param matrix `numRows` vectors, each starting `stride` elements after the previous one
+     * @param numRows the number of vectors in the block
+     * @param stride the distance between vectors in elements, at least Options::vecLength
+     * 
+     * This function is the same as CosineSim::loadPopulationRows(), except without the type safety of the
+     * array type.
+     */
+    void loadPopulationRows(RowIndex firstRow, const void *matrix, RowIndex numRows, ColIndex stride) {
+        pImpl_->loadPopulationRows(firstRow, matrix, numRows, stride);
+    }
+
+    /**
+     * Copies all population vectors into place, using one thread per hardware thread.
+     * 
+     * @param matrix `numRows` vectors, each starting `stride` elements after the previous one
+     * @param numRows the number of vectors, which must equal the count passed to startLoadPopulation()
+     * @param stride the distance between vectors in elements, at least Options::vecLength
+     * 
+     * This function is the same as CosineSim::loadPopulation(), except without the type safety of the array type.
+     */
+    void loadPopulation(const void *matrix, RowIndex numRows, ColIndex stride) {
+        const RowIndex minRowsPerThread = 4096;
+        RowIndex numThreads = std::max(1u, std::thread::hardware_concurrency());
+        numThreads = std::max(RowIndex(1), std::min(numThreads, numRows / minRowsPerThread));
+        const RowIndex rowsPerThread = (numRows + numThreads - 1) / numThreads;
+        std::vector<std::thread> threads;
+        std::vector<std::exception_ptr> errors(numThreads);
+        for (RowIndex t = 0; t < numThreads; ++t) {
+            const RowIndex firstRow = t * rowsPerThread;
+            const RowIndex count = std::min(rowsPerThread, numRows - firstRow);
+            if (count <= 0)
+                break;
+            const void *block = static_cast<const char *>(matrix) + firstRow * stride * valueSize_;
+            threads.push_back(std::thread([this, firstRow, block, count, stride, &errors, t]() {
+                try {
+                    pImpl_->loadPopulationRows(firstRow, block, count, stride);
+                } catch (...) {
+                    errors[t] = std::current_exception();
+                }
+            }));
+        }
+        for (std::thread &thread : threads)
+            thread.join();
+        for (const std::exception_ptr &error : errors)
+            if (error)
+                std::rethrow_exception(error);
+    }
+
     /**
      * Ends the procedure for loading population vectors to the Alveo accelerator card.
      * 
@@ -485,6 +706,66 @@ public:
      */
     void finishLoadPopulation(){pImpl_->finishLoadPopulation();}
 
+    /**
+     * Replaces one population vector in place.
+     * 
+     * This function is the same as CosineSim::updatePopulationVector(), except without the type safety of the
+     * array type.
+     */
+    void updatePopulationVector(RowIndex rowIndex, const void *elements) {
+        pImpl_->updatePopulationVector(rowIndex, elements);
+    }
+
+    /**
+     * Adds population vectors after the loaded ones.
+     * 
+     * This function is the same as CosineSim::appendPopulationVectors(), except without the type safety of the
+     * array type.
+     */
+    RowIndex appendPopulationVectors(const void *matrix, RowIndex numRows, ColIndex stride) {
+        return pImpl_->appendPopulationVectors(matrix, numRows, stride);
+    }
+
+    /**
+     * Removes one population vector from all later match results.
+     * 
+     * @param rowIndex the row index of the vector to remove
+     * 
+     * The row keeps its index.  A later updatePopulationVector() call for it brings it back.
+     */
+    void deletePopulationVector(RowIndex rowIndex) { pImpl_->deletePopulationVector(rowIndex); }
+
+    /**
+     * Writes the loaded population to a snapshot file.
+     * 
+     * @param path the file to create or overwrite
+     * @param rowIds an optional map from row index to the caller's vector ID, stored alongside the population
+     * 
+     * The snapshot holds the population vectors exactly as they are partitioned across devices, CUs and memory
+     * channels, so loadSnapshot() can restore them with sequential reads.  Call this function after
+     * finishLoadPopulation().
+     */
+    void saveSnapshot(const std::string &path, const std::vector<std::uint64_t> &rowIds = std::vector<std::uint64_t>()) {
+        pImpl_->saveSnapshot(path.c_str(), rowIds.data(), RowIndex(rowIds.size()));
+    }
+
+    /**
+     * Replaces the population with the contents of a snapshot file and sends it to the Alveo accelerator cards.
+     * 
+     * @param path a file written by saveSnapshot()
+     * @return the row ID map that was passed to saveSnapshot(), or an empty vector if none was saved
+     * 
+     * This function takes the place of the whole startLoadPopulation() ... finishLoadPopulation() sequence.
+     * The snapshot must have been saved with the same Options::vecLength, element size, number of devices and
+     * device type; otherwise this function throws an Exception.
+     */
+    std::vector<std::uint64_t> loadSnapshot(const std::string &path) {
+        XVector<std::uint64_t> xvRowIds = pImpl_->loadSnapshot(path.c_str());
+        std::vector<std::uint64_t> rowIds;
+        std::copy(xvRowIds.cbegin(), xvRowIds.cend(), std::back_inserter(rowIds));
+        return rowIds;
+    }
+
     /**
      * Runs a match of a given target vector against all population vectors.
      * 
@@ -501,8 +782,149 @@ public:
         return svResult;
     }
 
+    /**
+     * Runs matches of several target vectors against all population vectors in one batch.
+     * 
+     * @param numResults the number of match results to return per target vector
+     * @param elements a C array of `numTargets` target vectors stored back to back
+     * @param numTargets the number of target vectors in `elements`
+     * @return a `std::vector` holding one result list per target vector, in target order
+     * 
+     * This function is the same as CosineSim::matchTargetVectors(), except without the type safety of the array type.
+     */
+    std::vector<std::vector<Result>> matchTargetVectors(unsigned numResults, void *elements, std::size_t numTargets) {
+        return toStdVectors(pImpl_->matchTargetVectors(numResults, elements, numTargets));
+    }
+
+    /**
+     * Runs a match of a given target vector against every population vector, bypassing the IVF index.
+     * 
+     * @param numResults the number of match results to return
+     * @param elements a C array of target vector elements
+     * @return a `std::vector` of Result objects, one per match result
+     * 
+     * This function is the same as CosineSim::matchTargetVectorExact(), except without the type safety of the
+     * array type.
+     */
+    std::vector<Result> matchTargetVectorExact(unsigned numResults, void *elements) {
+        return toStdVectors(pImpl_->matchTargetVectorsExact(numResults, elements, 1))[0];
+    }
+
+    /**
+     * Runs matches of several target vectors against every population vector, bypassing the IVF index.
+     * 
+     * @param numResults the number of match results to return per target vector
+     * @param elements a C array of `numTargets` target vectors stored back to back
+     * @param numTargets the number of target vectors in `elements`
+     * @return a `std::vector` holding one result list per target vector, in target order
+     * 
+     * This function is the same as CosineSim::matchTargetVectorsExact(), except without the type safety of the
+     * array type.
+     */
+    std::vector<std::vector<Result>> matchTargetVectorsExact(unsigned numResults, void *elements,
+                                                             std::size_t numTargets)
+    {
+        return toStdVectors(pImpl_->matchTargetVectorsExact(numResults, elements, numTargets));
+    }
+
+    /**
+     * Runs a match of a given target vector against the population vectors in a Bitmap.
+     * 
+     * @param numResults the number of match results to return
+     * @param elements a C array of target vector elements
+     * @param allow the row indexes that may be matched
+     * @return a `std::vector` of Result objects, one per match result
+     * 
+     * This function is the same as CosineSim::matchTargetVector() with a Bitmap, except without the type safety
+     * of the array type.
+     */
+    std::vector<Result> matchTargetVector(unsigned numResults, void *elements, const Bitmap &allow) {
+        return toStdVectors(pImpl_->matchTargetVectorsFiltered(numResults, elements, 1, makeFilter(allow)))[0];
+    }
+
+    /**
+     * Runs a match of a given target vector against the population vectors accepted by a predicate.
+     * 
+     * @param numResults the number of match results to return
+     * @param elements a C array of target vector elements
+     * @param predicate called with `context` and a row index; returns true if the row may be matched
+     * @param context passed through to `predicate`
+     * @return a `std::vector` of Result objects, one per match result
+     * 
+     * This function is the same as CosineSim::matchTargetVector() with a RowPredicate, except without the type
+     * safety of the array type.
+     */
+    std::vector<Result> matchTargetVector(unsigned numResults, void *elements, RowPredicate predicate,
+                                          void *context)
+    {
+        const RowFilter filter = {nullptr, 0, predicate, context};
+        return toStdVectors(pImpl_->matchTargetVectorsFiltered(numResults, elements, 1, filter))[0];
+    }
+
+    /**
+     * Runs matches of several target vectors against the population vectors in a Bitmap.
+     * 
+     * @param numResults the number of match results to return per target vector
+     * @param elements a C array of `numTargets` target vectors stored back to back
+     * @param numTargets the number of target vectors in `elements`
+     * @param allow the row indexes that may be matched, the same for every target
+     * @return a `std::vector` holding one result list per target vector, in target order
+     * 
+     * This function is the same as CosineSim::matchTargetVectors() with a Bitmap, except without the type safety
+     * of the array type.
+     */
+    std::vector<std::vector<Result>> matchTargetVectors(unsigned numResults, void *elements, std::size_t numTargets,
+                                                        const Bitmap &allow)
+    {
+        return toStdVectors(pImpl_->matchTargetVectorsFiltered(numResults, elements, numTargets,
+                                                               makeFilter(allow)));
+    }
+
+    /**
+     * Starts a match of a given target vector against all population vectors without waiting for it.
+     * 
+     * @param numResults the number of match results to return
+     * @param elements a C array of target vector elements
+     * @return a `std::future` that receives the Result objects, or an Exception if the match fails
+     * 
+     * This function is the same as CosineSim::matchTargetVectorAsync(), except without the type safety of the
+     * array type.
+     */
+    std::future<std::vector<Result>> matchTargetVectorAsync(unsigned numResults, void *elements) {
+        std::unique_ptr<std::promise<std::vector<Result>>> promise(new std::promise<std::vector<Result>>());
+        std::future<std::vector<Result>> future = promise->get_future();
+        pImpl_->matchTargetVectorAsync(numResults, elements, &fulfillMatch, promise.get());
+        promise.release();  // now owned by fulfillMatch()
+        return future;
+    }
+
 private:
+    static void fulfillMatch(void *context, const XVector<Result> *results, const char *error) {
+        std::unique_ptr<std::promise<std::vector<Result>>> promise(
+            static_cast<std::promise<std::vector<Result>> *>(context));
+        if (error != nullptr) {
+            promise->set_exception(std::make_exception_ptr(Exception(error)));
+            return;
+        }
+        std::vector<Result> svResult;
+        std::copy(results->cbegin(), results->cend(), std::back_inserter(svResult));
+        promise->set_value(std::move(svResult));
+    }
+
+    static RowFilter makeFilter(const Bitmap &allow) {
+        const RowFilter filter = {allow.words(), allow.size(), nullptr, nullptr};
+        return filter;
+    }
+
+    static std::vector<std::vector<Result>> toStdVectors(const XVector<XVector<Result>> &xvResults) {
+        std::vector<std::vector<Result>> svResults(xvResults.size());
+        for (std::size_t i = 0; i < xvResults.size(); ++i)
+            std::copy(xvResults[i].cbegin(), xvResults[i].cend(), std::back_inserter(svResults[i]));
+        return svResults;
+    }
+
     Options options_;
+    unsigned valueSize_ = 4;
     ImplBase *pImpl_ = nullptr;
 };
 
@@ -571,6 +993,64 @@ public:
      */
     void finishCurrentPopulationVector(Value *pbuf){CosineSimBase::finishCurrentPopulationVector(pbuf);}
 
+    /**
+     * Copies a block of consecutive population vectors into place.
+     * 
+     * @param firstRow the row index of the first vector in the block
+     * @param matrix `numRows` vectors, each starting `stride` elements after the previous one
+     * @param numRows the number of vectors in the block
+     * @param stride the distance between vectors in elements, at least Options::vecLength
+     * 
+     * Row `firstRow + i` receives vector `i` of the block; match results refer to vectors by these row indexes.
+     * Call this function between startLoadPopulation() and finishLoadPopulation(), instead of
+     * getPopulationVectorBuffer().  Calls for disjoint row ranges may run concurrently from several threads.
+     */
+    void loadPopulationRows(RowIndex firstRow, const Value *matrix, RowIndex numRows, ColIndex stride) {
+        CosineSimBase::loadPopulationRows(firstRow, matrix, numRows, stride);
+    }
+
+    /**
+     * Copies all population vectors into place in parallel.
+     * 
+     * @param matrix `numRows` vectors, each starting `stride` elements after the previous one
+     * @param numRows the number of vectors, which must equal the count passed to startLoadPopulation()
+     * @param stride the distance between vectors in elements, at least Options::vecLength
+     * 
+     * Vector `i` gets row index `i`.  The rows are split into one range per hardware thread and loaded with
+     * loadPopulationRows().
+     */
+    void loadPopulation(const Value *matrix, RowIndex numRows, ColIndex stride) {
+        CosineSimBase::loadPopulation(matrix, numRows, stride);
+    }
+
+    /**
+     * Replaces one population vector in place.
+     * 
+     * @param rowIndex the row index of the vector to replace
+     * @param elements a C array of Options::vecLength elements
+     * 
+     * Call this function after finishLoadPopulation().  Only the memory of this one row is rewritten on the Alveo
+     * accelerator card.  Do not call it while matches are running.
+     */
+    void updatePopulationVector(RowIndex rowIndex, const Value *elements) {
+        CosineSimBase::updatePopulationVector(rowIndex, elements);
+    }
+
+    /**
+     * Adds population vectors after the loaded ones, without a reload.
+     * 
+     * @param matrix `numRows` vectors, each starting `stride` elements after the previous one
+     * @param numRows the number of vectors to add
+     * @param stride the distance between vectors in elements, at least Options::vecLength
+     * @return the row index of the first added vector; the others follow consecutively
+     * 
+     * On Alveo cards the new rows come out of the Options::reserveVectors rows set aside by
+     * startLoadPopulation(), and an Exception is thrown when the reserve is used up.
+     */
+    RowIndex appendPopulationVectors(const Value *matrix, RowIndex numRows, ColIndex stride) {
+        return CosineSimBase::appendPopulationVectors(matrix, numRows, stride);
+    }
+
     /**
      * Runs a match of a given target vector against all population vectors.
      * 
@@ -583,12 +1063,157 @@ public:
     std::vector<Result> matchTargetVector(unsigned numResults, const Value *elements) {
         return CosineSimBase::matchTargetVector(numResults, const_cast<Value *>(elements));  // TODO: fix constness
     }
+
+    /**
+     * Runs matches of several target vectors against all population vectors in one batch.
+     * 
+     * @param numResults the number of match results to return per target vector
+     * @param targets a C array of `numTargets` target vectors stored back to back, each of Options::vecLength elements
+     * @param numTargets the number of target vectors in `targets`
+     * @return a `std::vector` holding one result list per target vector, in target order
+     * 
+     * Batching amortizes the per-call setup of matchTargetVector().  On Alveo cards all targets are queued before
+     * waiting for any of them; on the CPU backend the batch runs as a blocked matrix-matrix product.
+     */
+    std::vector<std::vector<Result>> matchTargetVectors(unsigned numResults, const Value *targets,
+                                                        std::size_t numTargets) {
+        return CosineSimBase::matchTargetVectors(numResults, const_cast<Value *>(targets), numTargets);
+    }
+
+    /**
+     * Runs a match of a given target vector against every population vector, bypassing the IVF index.
+     * 
+     * @param numResults the number of match results to return
+     * @param elements a C array of target vector elements
+     * @return a `std::vector` of Result objects, one per match result
+     * 
+     * With Options::ivfLists set, matchTargetVector() scans only the Options::nprobe nearest lists and may miss
+     * some of the true best matches.  This function always scans the whole population, for queries that need
+     * the exact answer or for measuring the recall of the index.  Without an index it is the same as
+     * matchTargetVector().
+     */
+    std::vector<Result> matchTargetVectorExact(unsigned numResults, const Value *elements) {
+        return CosineSimBase::matchTargetVectorExact(numResults, const_cast<Value *>(elements));
+    }
+
+    /**
+     * Runs matches of several target vectors against every population vector, bypassing the IVF index.
+     * 
+     * @param numResults the number of match results to return per target vector
+     * @param targets `numTargets` target vectors of Options::vecLength elements each, stored back to back
+     * @param numTargets the number of target vectors
+     * @return one result list per target vector, in target order
+     * 
+     * The batched form of matchTargetVectorExact().
+     */
+    std::vector<std::vector<Result>> matchTargetVectorsExact(unsigned numResults, const Value *targets,
+                                                             std::size_t numTargets)
+    {
+        return CosineSimBase::matchTargetVectorsExact(numResults, const_cast<Value *>(targets), numTargets);
+    }
+
+    /**
+     * Runs a match of a given target vector against the population vectors in a Bitmap.
+     * 
+     * @param numResults the number of match results to return
+     * @param elements a C array of target vector elements
+     * @param allow the row indexes that may be matched
+     * @return the best `numResults` matches among the allowed rows, fewer if fewer rows are allowed
+     * 
+     * Use this in place of asking matchTargetVector() for extra results and discarding the unwanted ones.  On the
+     * host CPU backend the scan skips excluded rows, 64 at a time, before computing any dot products, and ignores
+     * the IVF index.  Alveo cards rank the whole population and the filter is applied to their results, fetching
+     * more of them until `numResults` allowed rows are found.
+     */
+    std::vector<Result> matchTargetVector(unsigned numResults, const Value *elements, const Bitmap &allow) {
+        return CosineSimBase::matchTargetVector(numResults, const_cast<Value *>(elements), allow);
+    }
+
+    /**
+     * Runs a match of a given target vector against the population vectors accepted by a predicate.
+     * 
+     * @param numResults the number of match results to return
+     * @param elements a C array of target vector elements
+     * @param predicate called with `context` and a row index; returns true if the row may be matched
+     * @param context passed through to `predicate`
+     * @return the best `numResults` matches among the accepted rows
+     * 
+     * Like the Bitmap form, but for filters that are easier to compute than to store.  The predicate is called
+     * from the calling thread, at most once per row on the host CPU backend and once per ranked result on Alveo
+     * cards.
+     */
+    std::vector<Result> matchTargetVector(unsigned numResults, const Value *elements, RowPredicate predicate,
+                                          void *context)
+    {
+        return CosineSimBase::matchTargetVector(numResults, const_cast<Value *>(elements), predicate, context);
+    }
+
+    /**
+     * Runs matches of several target vectors against the population vectors in a Bitmap.
+     * 
+     * @param numResults the number of match results to return per target vector
+     * @param targets `numTargets` target vectors of Options::vecLength elements each, stored back to back
+     * @param numTargets the number of target vectors
+     * @param allow the row indexes that may be matched, the same for every target
+     * @return one result list per target vector, in target order
+     * 
+     * The batched form of matchTargetVector() with a Bitmap.
+     */
+    std::vector<std::vector<Result>> matchTargetVectors(unsigned numResults, const Value *targets,
+                                                        std::size_t numTargets, const Bitmap &allow)
+    {
+        return CosineSimBase::matchTargetVectors(numResults, const_cast<Value *>(targets), numTargets, allow);
+    }
+
+    /**
+     * Starts a match of a given target vector against all population vectors and returns without waiting.
+     * 
+     * @param numResults the number of match results to return
+     * @param elements a C array of target vector elements
+     * @return a `std::future` that receives the same results as matchTargetVector(), or an Exception on failure
+     * 
+     * The target vector is copied before this function returns, so the caller may reuse `elements` right away.
+     * Several matches may be in flight at once, from one thread or many; on Alveo cards they share the CU pool
+     * and run in submission order.  Do not reload the population while matches are in flight.
+     */
+    std::future<std::vector<Result>> matchTargetVectorAsync(unsigned numResults, const Value *elements) {
+        return CosineSimBase::matchTargetVectorAsync(numResults, const_cast<Value *>(elements));
+    }
 private:
     Options options_;
     ImplBase *pImpl_ = nullptr;
 
 };
 
+/**
+ * Quantizes a floating-point vector to the element type of a CosineSim object.
+ * 
+ * @param in `length` floating-point values
+ * @param length the number of elements, normally Options::vecLength
+ * @param out an array of `length` elements to receive the quantized vector
+ * @return the scale factor of the vector: `in[i]` is approximately `scale * out[i]`
+ * 
+ * Each vector gets its own symmetric scale, which maps its largest magnitude to 127 for `std::int8_t`, 32767 for
+ * `std::int16_t` and 2^20 - 1 for 32-bit types (small enough that 64-bit dot products cannot overflow).
+ * Cosine similarity does not change when a vector is multiplied by a positive number, so the scale is not needed
+ * for matching.  Keep it only to recover approximate floating-point values.
+ */
+template <typename Value>
+float quantizeVector(const float *in, ColIndex length, Value *out) {
+    const double limit = (sizeof(Value) >= 4) ? double((1 << 20) - 1) : double(std::numeric_limits<Value>::max());
+    float maxAbs = 0.0f;
+    for (ColIndex i = 0; i < length; ++i)
+        maxAbs = std::max(maxAbs, std::fabs(in[i]));
+    if (maxAbs == 0.0f) {
+        std::fill(out, out + length, Value(0));
+        return 0.0f;
+    }
+    const double scale = maxAbs / limit;
+    for (ColIndex i = 0; i < length; ++i)
+        out[i] = Value(std::max(-limit, std::min(limit, double(std::lround(in[i] / scale)))));
+    return float(scale);
+}
+
 } // namespace cosinesim
 } // namespace xilinx_apps
 
@@ -16,16 +16,24 @@
  */
 
 #include <vector>
+#include <algorithm>
 #include <cstdint>
 #include <stdlib.h>
 #include <cstring>
+#include <cmath>
 #include <memory>
 #include <unordered_map>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 #include <iostream>
 #include <sstream>
 #include <assert.h>
 
 #include "cosinesim.hpp"
+#include "cosinesim_cpu.hpp"
+#include "cosinesim_snapshot.hpp"
 #include "xf_graph_L3.hpp"
 #include "xilinx_apps_common.hpp"
 
@@ -63,6 +71,16 @@ public:
     //xf::graph::Graph<int32_t, int32_t>** g = new xf::graph::Graph<int32_t, int32_t>*[deviceNeeded * cuNm];
     //currently only support int32_t graph
     std::vector<xf::graph::Graph<int32_t, int32_t>*> g;
+
+    // Incremental population changes.  The partition holds populationCapacity_ rows: numVertices loaded or
+    // appended ones followed by zeroed reserve rows.  Deleted rows are zeroed too.  The kernel scores every
+    // zero row 0 and ranks it like any other, so a match asks it for enough extra results to cover them all
+    // (kernelTopK()) and drops the dead rows on the host.
+    std::int64_t reserveVectors_ = 0;
+    std::int64_t populationCapacity_ = 0;
+    bool populationLoaded_ = false;  // finishLoadPopulation() has sent the rows to the cards
+    std::vector<bool> deleted_;      // per-row tombstones
+    std::int64_t numDeleted_ = 0;
     //xf::graph::Graph<int32_t, int32_t>** g;
 
     int load_xgraph_fpga(uint32_t numVertices, uint32_t numEdges, xf::graph::Graph<uint32_t, float> g);
@@ -70,14 +88,96 @@ public:
     void load_graph_cosinesim_ss_dense_fpga(uint32_t deviceNeeded, uint32_t cuNm, xf::graph::Graph<int32_t, int32_t>** graph);
 
 
-    void cosinesim_ss_dense_fpga(uint32_t devicesNeeded,
+    struct MatchBuffers;
+    void cosinesim_ss_dense_fpga(MatchBuffers& buffers,
+                                 uint32_t devicesNeeded,
                                  int32_t sourceLen,
+                                 int32_t requestNm,
                                  int32_t* sourceWeight,
                                  int32_t* sourceCoeffs,
                                  int32_t topK,
                                  xf::graph::Graph<int32_t, int32_t>** g,
                                  int32_t* resultID,
-                                 float* similarity);
+                                 float* similarity,
+                                 int32_t* resultCounts);
+
+    // Host buffers reused across matches.  Every slot starts on a 4 KB boundary so that the cl::Buffers built
+    // on them stay zero-copy.
+    static const std::size_t BufferSlotAlign = 4096 / sizeof(int32_t);
+    static std::size_t bufferSlotSize(std::size_t n) {
+        return ((n + BufferSlotAlign - 1) / BufferSlotAlign) * BufferSlotAlign;
+    }
+    int32_t* sourceCoeffs_ = nullptr;    // edgeAlign8 ones, read-only once the population is loaded
+
+    // Buffers of one synchronous match.  Concurrent matches each take a set from the pool for the duration
+    // of the call, so the CUs never write into buffers that another call is reallocating or reading.
+    struct MatchBuffers {
+        int32_t* sourceBatch = nullptr;     // one slot of edgeAlign8 per target
+        int32_t* resultID = nullptr;        // merged results, topK per target
+        float* similarity = nullptr;
+        int32_t* perCuResultID = nullptr;   // one slot of topK per target per CU
+        float* perCuSimilarity = nullptr;
+        std::size_t sourceBatchCap = 0, resultIDCap = 0, similarityCap = 0;  // in elements
+        std::size_t perCuResultIDCap = 0, perCuSimilarityCap = 0;
+        ~MatchBuffers() {
+            free(sourceBatch);
+            free(resultID);
+            free(similarity);
+            free(perCuResultID);
+            free(perCuSimilarity);
+        }
+    };
+    std::mutex matchBuffersMutex_;
+    std::vector<std::unique_ptr<MatchBuffers> > freeMatchBuffers_;
+
+    std::unique_ptr<MatchBuffers> acquireMatchBuffers() {
+        std::lock_guard<std::mutex> lock(matchBuffersMutex_);
+        if (freeMatchBuffers_.empty())
+            return std::unique_ptr<MatchBuffers>(new MatchBuffers());
+        std::unique_ptr<MatchBuffers> buffers = std::move(freeMatchBuffers_.back());
+        freeMatchBuffers_.pop_back();
+        return buffers;
+    }
+
+    void releaseMatchBuffers(std::unique_ptr<MatchBuffers> buffers) {
+        std::lock_guard<std::mutex> lock(matchBuffersMutex_);
+        freeMatchBuffers_.push_back(std::move(buffers));
+    }
+
+    // Asynchronous matches.  Each match owns its target copy and per-CU result slots.  Its hwNm L3 tasks are
+    // queued under submitMutex_ so that they stay consecutive, since the L3 worker maps tasks to CUs by queue
+    // position.  One completion thread waits for the matches in submission order, merges and reports them.
+    struct AsyncMatch {
+        unsigned numResults = 0;
+        int32_t topK = 0;              // kernelTopK(numResults) when the match was queued
+        int32_t* source = nullptr;
+        int32_t* resultID = nullptr;   // one slot of topK per CU
+        float* similarity = nullptr;
+        std::vector<xf::graph::L3::event<int> > events;
+        MatchCallback callback = nullptr;
+        void* context = nullptr;
+        ~AsyncMatch() { free(source); free(resultID); free(similarity); }
+    };
+    std::mutex submitMutex_;
+    std::mutex asyncMutex_;
+    std::condition_variable asyncCv_;  // new match, match completed, or stop
+    std::deque<std::unique_ptr<AsyncMatch> > asyncQueue_;  // in flight, oldest first
+    bool asyncStop_ = false;
+    std::thread asyncThread_;
+
+    void asyncCompletionLoop();
+    void drainAsyncMatches();
+
+    template <typename T>
+    static void reserveBuffer(T*& buf, std::size_t& cap, std::size_t num) {
+        if (num <= cap)
+            return;
+        free(buf);
+        buf = nullptr;
+        cap = 0;
+        buf = xf::graph::internal::aligned_alloc<T>(num);
+        cap = num;
+    }
 
     PrivateImpl(const Options &options, unsigned valueSize){
         //errorCode_ = NoError;
@@ -85,7 +185,7 @@ public:
         if(valueSize_ != 4) {
             std::cout << "DEBUG: valueType is not supported" << std::endl;
             std::ostringstream oss;
-            oss << "the only Value size currently supported is 32 bits.  Please ensure that you have constructed the CosineSim object with a 32-bit template parameter" <<std::endl;
+            oss << "the only Value size supported on Alveo cards is 32 bits.  Please ensure that you have constructed the CosineSim object with a 32-bit template parameter, or set Options::cpuBackend for 8 and 16-bit elements" <<std::endl;
             throw xilinx_apps::cosinesim::Exception(oss.str());
             std::cerr << "ERROR: valueType is not supported" <<std::endl;
             abort();
@@ -105,6 +205,7 @@ public:
         numDevices = 1;
         if (options.numDevices > 0)
             numDevices = options.numDevices;
+        reserveVectors_ = std::max(std::int64_t(0), options.reserveVectors);
 
         shortDeviceNames = options.deviceNames;
         // default xclbin to load
@@ -169,6 +270,10 @@ public:
 
         edgeAlign8 = ((numEdges + channelW - 1) / channelW) * channelW;
 
+        sourceCoeffs_ = xf::graph::internal::aligned_alloc<int32_t>(edgeAlign8);
+        for (int i = 0; i < edgeAlign8; i++)
+            sourceCoeffs_[i] = 1; // set weights to 1 for now. TODO: need to pass ths from graph
+
         loadPopulationCnt.resize(channelsPU,0);
         g.resize(numDevices*cuNm);
         // g = new xf::graph::Graph<int32_t, int32_t>*[devicesNeeded * cuNm];
@@ -177,12 +282,26 @@ public:
     }
 
     ~PrivateImpl(){
+      drainAsyncMatches();
+      {
+          std::lock_guard<std::mutex> lock(asyncMutex_);
+          asyncStop_ = true;
+      }
+      asyncCv_.notify_all();
+      if (asyncThread_.joinable())
+          asyncThread_.join();
       for (unsigned i = 0; i < numDevices * cuNm; ++i)
             delete[] numVerticesPU[i];
       delete[] numVerticesPU;
+      free(sourceCoeffs_);
     }
 
     virtual void startLoadPopulation(std::int64_t numVertices){
+        startLoadPopulationCapacity(numVertices, numVertices + reserveVectors_);
+    }
+
+    // Partitions `capacity` rows over the CUs and PUs, of which the first numVertices are to be loaded
+    void startLoadPopulationCapacity(std::int64_t numVertices, std::int64_t capacity){
         //--------------- Free and delete -----------------------------------
 
         cleanGraph();
@@ -192,14 +311,17 @@ public:
         indexNumVertices=0;
         populationVectorRowNm=0;
         this->numVertices = numVertices;
-        //the following calculation and assignment is based on numVertices
-        int general = ((numVertices - (numDevices * cuNm * numPUs_ * channelsPU + 1)) /
+        populationCapacity_ = capacity;
+        deleted_.assign(capacity, false);
+        numDeleted_ = 0;
+        //the following calculation and assignment is based on the capacity
+        int general = ((capacity - (numDevices * cuNm * numPUs_ * channelsPU + 1)) /
                 (numDevices * cuNm * numPUs_ * channelsPU)) * channelsPU;
-        // handle the case where numVertices is too small
+        // handle the case where capacity is too small
         if (general == 0)
-            general = numVertices/(numDevices * cuNm * numPUs_);
+            general = capacity/(numDevices * cuNm * numPUs_);
 
-        int rest = numVertices - general * (numDevices * cuNm * numPUs_ - 1);
+        int rest = capacity - general * (numDevices * cuNm * numPUs_ - 1);
 
 #ifndef NDEBUG
         std::cout << "DEBUG: " << __FILE__ << "::" << __FUNCTION__
@@ -250,7 +372,7 @@ public:
             g[i]->numEdgesPU = new int32_t[numPUs_];
             g[i]->numVerticesPU = new int32_t[numPUs_];
             g[i]->edgeNum = numEdges;
-            g[i]->nodeNum = numVertices;
+            g[i]->nodeNum = capacity;
             g[i]->splitNum = numPUs_;
             g[i]->refID = fpgaNodeNm;
             for (unsigned j = 0; j < numPUs_; ++j) {
@@ -269,7 +391,8 @@ public:
     virtual void *getPopulationVectorBuffer(RowIndex &rowIndex){
 
         void * pbuf;
-        if(indexDeviceCuNm == numDevices * cuNm)
+        // rows past numVertices are the Options::reserveVectors reserve
+        if(indexDeviceCuNm == numDevices * cuNm || populationVectorRowNm == numVertices)
             return nullptr;
         subChNm = (numVerticesPU[indexDeviceCuNm][indexSplitNm] + channelsPU - 1) / channelsPU;
 #ifndef NDEBUG
@@ -306,22 +429,238 @@ public:
 
     }
 
+    // Rows fill the CUs, then the PUs of each CU, in order.  Within a PU of n rows, local row l goes to channel
+    // l / ceil(n/4) at depth l % ceil(n/4), which is where getPopulationVectorBuffer() would have put it.
+    virtual void loadPopulationRows(RowIndex firstRow, const void *matrix, RowIndex numRows, ColIndex stride) {
+        if (firstRow < 0 || numRows < 0 || firstRow + numRows > this->numVertices || stride < vecLength) {
+            std::ostringstream oss;
+            oss << "invalid population row range: firstRow=" << firstRow << " numRows=" << numRows
+                << " stride=" << stride << " numVertices=" << this->numVertices << " vecLength=" << vecLength;
+            throw xilinx_apps::cosinesim::Exception(oss.str());
+        }
+        loadPopulationRowsUnchecked(firstRow, matrix, numRows, stride);
+    }
+
+    void loadPopulationRowsUnchecked(RowIndex firstRow, const void *matrix, RowIndex numRows, ColIndex stride) {
+        if (numRows == 0)
+            return;
+        RowCursor cur = locateRow(firstRow);
+        const int32_t* src = static_cast<const int32_t*>(matrix);
+        for (RowIndex r = 0; r < numRows; ++r, src += stride, nextRow(cur)) {
+            int32_t* dst = rowAddress(cur);
+            std::memcpy(dst, src, vecLength * sizeof(int32_t));
+            std::memset(dst + vecLength, 0, (edgeAlign8 - vecLength) * sizeof(int32_t));
+        }
+    }
+
+    // Position of a row in the partition: CU, PU and row within the PU
+    struct RowCursor {
+        unsigned cu = 0;
+        unsigned pu = 0;
+        RowIndex local = 0;
+    };
+
+    RowCursor locateRow(RowIndex row) const {
+        RowCursor cur;
+        cur.local = row;
+        while (cur.local >= numVerticesPU[cur.cu][cur.pu]) {
+            cur.local -= numVerticesPU[cur.cu][cur.pu];
+            if (++cur.pu == numPUs_) {
+                cur.pu = 0;
+                ++cur.cu;
+            }
+        }
+        return cur;
+    }
+
+    void nextRow(RowCursor& cur) const {
+        ++cur.local;
+        while (cur.cu < numDevices * cuNm && cur.local == numVerticesPU[cur.cu][cur.pu]) {
+            cur.local = 0;
+            if (++cur.pu == numPUs_) {
+                cur.pu = 0;
+                ++cur.cu;
+            }
+        }
+    }
+
+    RowIndex rowDepth(const RowCursor& cur) const {
+        return (numVerticesPU[cur.cu][cur.pu] + channelsPU - 1) / channelsPU;
+    }
+
+    unsigned rowChannel(const RowCursor& cur) const {
+        return cur.pu * channelsPU + cur.local / rowDepth(cur);
+    }
+
+    int32_t* rowAddress(const RowCursor& cur) const {
+        return &g[cur.cu]->weightsDense[rowChannel(cur)][(cur.local % rowDepth(cur)) * edgeAlign8];
+    }
+
+    // Sends rows [firstRow, firstRow + numRows) from weightsDense to the cards
+    void syncRows(RowIndex firstRow, RowIndex numRows);
+
+    void checkPopulationChange(const char* function, RowIndex row, RowIndex numRows) {
+        if (!populationLoaded_) {
+            std::ostringstream oss;
+            oss << function << ": the population must be loaded with finishLoadPopulation() first";
+            throw xilinx_apps::cosinesim::Exception(oss.str());
+        }
+        if (row < 0 || numRows < 0 || row + numRows > numVertices) {
+            std::ostringstream oss;
+            oss << function << ": row " << row + numRows - 1 << " is out of range (" << numVertices
+                << " population vectors)";
+            throw xilinx_apps::cosinesim::Exception(oss.str());
+        }
+        // in-flight matches read the rows being changed
+        drainAsyncMatches();
+    }
+
+    virtual void updatePopulationVector(RowIndex rowIndex, const void *elements) {
+        checkPopulationChange(__FUNCTION__, rowIndex, 1);
+        int32_t* dst = rowAddress(locateRow(rowIndex));
+        std::memcpy(dst, elements, vecLength * sizeof(int32_t));
+        std::memset(dst + vecLength, 0, (edgeAlign8 - vecLength) * sizeof(int32_t));
+        syncRows(rowIndex, 1);
+        if (deleted_[rowIndex]) {
+            deleted_[rowIndex] = false;
+            --numDeleted_;
+        }
+    }
+
+    virtual RowIndex appendPopulationVectors(const void *matrix, RowIndex numRows, ColIndex stride) {
+        checkPopulationChange(__FUNCTION__, 0, 0);
+        if (numRows < 0 || stride < vecLength || numVertices + numRows > populationCapacity_) {
+            std::ostringstream oss;
+            oss << __FUNCTION__ << ": cannot append " << numRows << " vectors with stride " << stride << ", "
+                << populationCapacity_ - numVertices << " reserved rows left.  "
+                << "Set Options::reserveVectors and reload the population to make room";
+            throw xilinx_apps::cosinesim::Exception(oss.str());
+        }
+        const RowIndex firstRow = numVertices;
+        loadPopulationRowsUnchecked(firstRow, matrix, numRows, stride);
+        syncRows(firstRow, numRows);
+        numVertices += numRows;
+        return firstRow;
+    }
+
+    virtual void deletePopulationVector(RowIndex rowIndex) {
+        checkPopulationChange(__FUNCTION__, rowIndex, 1);
+        if (deleted_[rowIndex])
+            return;
+        // a zero row still scores 0 in the kernel; matches filter it out of the results
+        std::memset(rowAddress(locateRow(rowIndex)), 0, edgeAlign8 * sizeof(int32_t));
+        syncRows(rowIndex, 1);
+        deleted_[rowIndex] = true;
+        ++numDeleted_;
+    }
+
+    bool isLiveRow(RowIndex row) const { return row >= 0 && row < numVertices && !deleted_[row]; }
+
+    // The kernels rank into a sortTopK of MAX_K (101) entries
+    static const int32_t MaxKernelTopK = 100;
+
+    // Number of results to ask the kernel for so that numResults live rows survive the host filter: every
+    // deleted or reserve row can rank above a live row with negative similarity.  Capped at MaxKernelTopK;
+    // targets left short of numResults live rows are then scored on the host.
+    int32_t kernelTopK(unsigned numResults) const {
+        const std::int64_t numDead = numDeleted_ + (populationCapacity_ - numVertices);
+        return int32_t(std::min<std::int64_t>({numResults + numDead, populationCapacity_, MaxKernelTopK}));
+    }
+
     //padding the row and loadgraph
     virtual void finishLoadPopulation() {
-        //for the last PU, the last channels may need to padded as the row will be the multiple of channelsPU
+        // The channel padding of the last PU needs no work: Graph zero-fills weightsDense when it is built, and
+        // rows may arrive through loadPopulationRows() without moving the getPopulationVectorBuffer() cursor.
+        load_graph_cosinesim_ss_dense_fpga(numDevices, cuNm, g.data());
+        populationLoaded_ = true;
+    }
+
+    // Snapshot buffers are the weightsDense channels of each CU, numVerticesPU[cu][pu] / channelsPU rows deep
+    std::size_t snapshotChannelBytes(unsigned cu, unsigned pu) const {
+        const std::size_t depth = (numVerticesPU[cu][pu] + channelsPU - 1) / channelsPU;
+        return depth * edgeAlign8 * sizeof(int32_t);
+    }
+
+    virtual void saveSnapshot(const char *path, const std::uint64_t *rowIds, RowIndex numRowIds) {
         const unsigned numCus = numDevices * cuNm;
-        int paddingDepth = ((numVerticesPU[numCus - 1][numPUs_ - 1] + channelsPU - 1) / channelsPU) * channelsPU
-                - numVerticesPU[numCus - 1][numPUs_ - 1];
-        int startPaddingDepth = numVerticesPU[numCus - 1][numPUs_ - 1] * edgeAlign8;
-        for (int k = startPaddingDepth; k < paddingDepth*edgeAlign8; ++k) {
-            g[indexDeviceCuNm]->weightsDense[ (indexSplitNm-1) * channelsPU + 3][k] = 0;
-        }
+        if (g.empty() || g[0] == nullptr)
+            throw xilinx_apps::cosinesim::Exception("saveSnapshot: no population has been loaded");
+
+        SnapshotHeader header = makeSnapshotHeader(SnapshotBackendFpga);
+        header.valueSize = valueSize_;
+        header.vecLength = vecLength;
+        header.rowStride = edgeAlign8;
+        header.numVertices = numVertices;
+        header.numCus = numCus;
+        header.numPUs = numPUs_;
+        header.channelsPU = channelsPU;
+        header.numRowIds = numRowIds;
+        header.capacity = populationCapacity_;
+        header.numDeleted = numDeleted_;
+        std::vector<int32_t> layout;
+        for (unsigned cu = 0; cu < numCus; ++cu)
+            layout.insert(layout.end(), numVerticesPU[cu], numVerticesPU[cu] + numPUs_);
+
+        SnapshotWriter writer(path);
+        writer.writeHeader(header, layout);
+        for (unsigned cu = 0; cu < numCus; ++cu)
+            for (unsigned pu = 0; pu < numPUs_; ++pu)
+                for (unsigned ch = 0; ch < channelsPU; ++ch)
+                    writer.writeSection(g[cu]->weightsDense[pu * channelsPU + ch], snapshotChannelBytes(cu, pu));
+        writer.writeSection(rowIds, numRowIds * sizeof(std::uint64_t));
+        std::vector<std::int64_t> deletedRows;
+        for (RowIndex r = 0; r < numVertices; ++r)
+            if (deleted_[r])
+                deletedRows.push_back(r);
+        writer.writeSection(deletedRows.data(), deletedRows.size() * sizeof(std::int64_t));
+        writer.close();
+        std::cout << "INFO: " << __FUNCTION__ << " saved " << numVertices << " vectors to " << path << std::endl;
+    }
 
-        load_graph_cosinesim_ss_dense_fpga(numDevices, cuNm, g.data());
+    virtual XVector<std::uint64_t> loadSnapshot(const char *path) {
+        const unsigned numCus = numDevices * cuNm;
+        SnapshotReader reader(path);
+        SnapshotHeader header;
+        std::vector<int32_t> layout;
+        reader.readHeader(SnapshotBackendFpga, header, layout);
+        checkSnapshotField(path, "valueSize", header.valueSize, valueSize_);
+        checkSnapshotField(path, "vecLength", header.vecLength, vecLength);
+        checkSnapshotField(path, "rowStride", header.rowStride, edgeAlign8);
+        checkSnapshotField(path, "numCus", header.numCus, numCus);
+        checkSnapshotField(path, "numPUs", header.numPUs, numPUs_);
+        checkSnapshotField(path, "channelsPU", header.channelsPU, channelsPU);
+
+        // The partition is a function of the capacity, so rebuilding it must reproduce the saved layout
+        startLoadPopulationCapacity(header.numVertices, header.capacity);
+        for (unsigned cu = 0; cu < numCus; ++cu)
+            for (unsigned pu = 0; pu < numPUs_; ++pu)
+                checkSnapshotField(path, "numVerticesPU", layout[cu * numPUs_ + pu], numVerticesPU[cu][pu]);
+
+        for (unsigned cu = 0; cu < numCus; ++cu)
+            for (unsigned pu = 0; pu < numPUs_; ++pu)
+                for (unsigned ch = 0; ch < channelsPU; ++ch)
+                    reader.readSection(g[cu]->weightsDense[pu * channelsPU + ch], snapshotChannelBytes(cu, pu));
+        XVector<std::uint64_t> rowIds(header.numRowIds);
+        reader.readSection(rowIds.data(), header.numRowIds * sizeof(std::uint64_t));
+        std::vector<std::int64_t> deletedRows(header.numDeleted);
+        reader.readSection(deletedRows.data(), deletedRows.size() * sizeof(std::int64_t));
+        for (std::int64_t r : deletedRows) {
+            if (r < 0 || r >= numVertices || deleted_[r])
+                throw xilinx_apps::cosinesim::Exception(std::string("snapshot ") + path + ": corrupt deleted row list");
+            deleted_[r] = true;
+        }
+        numDeleted_ = header.numDeleted;
 
+        populationVectorRowNm = numVertices;
+        indexDeviceCuNm = numCus;  // the getPopulationVectorBuffer() cursor is exhausted
+        finishLoadPopulation();
+        std::cout << "INFO: " << __FUNCTION__ << " restored " << numVertices << " vectors from " << path << std::endl;
+        return rowIds;
     }
 
     virtual void cleanGraph() {
+        // in-flight matches still read the device buffers
+        drainAsyncMatches();
 
         for (unsigned i = 0; i < numDevices * cuNm; ++i) {
             if (!g[i])
@@ -336,7 +675,7 @@ public:
             g[i] = nullptr;
 
         }
-
+        populationLoaded_ = false;
     }
 
 
@@ -377,59 +716,86 @@ public:
     };
 
     virtual XVector<Result> matchTargetVector(unsigned numResults, void *elements){
+        XVector<XVector<Result>> results = matchTargetVectors(numResults, elements, 1);
+        return results[0];
+    }
+
+    // the cards always scan every population vector
+    virtual XVector<XVector<Result>> matchTargetVectorsExact(unsigned numResults, void *elements,
+                                                             std::size_t numTargets) {
+        return matchTargetVectors(numResults, elements, numTargets);
+    }
+
+    virtual XVector<XVector<Result>> matchTargetVectorsFiltered(unsigned numResults, void *elements,
+                                                                std::size_t numTargets, const RowFilter &filter);
+
+    // Filtered matches whose filter allows at most 1/HostFilterRatio of the live rows are scored on the host;
+    // the others rank the population on the cards for at most MaxFilterRounds rounds before falling back too.
+    static const RowIndex HostFilterRatio = 16;
+    static const int MaxFilterRounds = 2;
+
+    RowIndex countAllowedRows(const RowFilter &filter) const;
+    void matchAllowedRowsOnHost(unsigned numResults, const int32_t *elements, const std::vector<std::size_t> &targets,
+                                const RowFilter &filter, XVector<XVector<Result>> &results) const;
+
+    virtual XVector<XVector<Result>> matchTargetVectors(unsigned numResults, void *elements, std::size_t numTargets){
         // Don't allow more results to be returned than the number of population vectors.  The kernel would return
         // blank results (index and similarity 0) in that case, so we need to prevent it here.
-        if (numResults > this->numVertices)
-            numResults = this->numVertices;
+        if (numResults > this->numVertices - numDeleted_)
+            numResults = this->numVertices - numDeleted_;
         
-        XVector<Result> result;
+        XVector<XVector<Result>> results(numTargets);
+        if (numTargets == 0 || numResults == 0)
+            return results;
+
         //---------------- Generate Source Indice and Weight Array -------
         int sourceLen = edgeAlign8; // sourceIndice array length
-        int32_t* sourceFeatures = xf::graph::internal::aligned_alloc<int32_t>(sourceLen); // values of features in source
-        int32_t* sourceCoeffs = xf::graph::internal::aligned_alloc<int32_t>(sourceLen);   // weights of features in source 
+        const std::size_t sourceSlot = bufferSlotSize(sourceLen);
+        const int32_t topK = kernelTopK(numResults);
+        std::unique_ptr<MatchBuffers> buffers = acquireMatchBuffers();
+        reserveBuffer(buffers->sourceBatch, buffers->sourceBatchCap, numTargets * sourceSlot);
+        reserveBuffer(buffers->resultID, buffers->resultIDCap, numTargets * topK);
+        reserveBuffer(buffers->similarity, buffers->similarityCap, numTargets * topK);
 #ifndef NDEBUG
-        std::cout << "DEBUG: " << __FUNCTION__ << " sourceLen=" << sourceLen << std::endl;
+        std::cout << "DEBUG: " << __FUNCTION__ << " sourceLen=" << sourceLen << " numTargets=" << numTargets
+                  << std::endl;
 #endif
-        for (int i = 0; i < sourceLen; i++) {
-            if (i < vecLength) {
-                if(valueSize_ == 4)
-                    sourceFeatures[i] = (reinterpret_cast<int32_t*>(elements))[i];
-                else {
-                    // must exit at this point, or else crash on next line.  Throw exception here.
-                    std::cout << "DEBUG: valueType is not supported" << std::endl;
-                    std::ostringstream oss;
-                    oss << "the only Value size currently supported is 32 bits.  Please ensure that you have constructed the CosineSim object with a 32-bit template parameter" <<std::endl;
-                    throw xilinx_apps::cosinesim::Exception(oss.str());
-                    std::cerr << "ERROR: valueType is not supported." <<std::endl;
-                    abort();
-
-                }
-            } else
-                sourceFeatures[i] = 0;
-
-            sourceCoeffs[i] = 1; // set weights to 1 for now. TODO: need to pass ths from graph
+        for (std::size_t t = 0; t < numTargets; t++) {
+            int32_t* sourceFeatures = buffers->sourceBatch + t * sourceSlot; // values of features in source
+            std::memcpy(sourceFeatures, reinterpret_cast<int32_t*>(elements) + t * vecLength,
+                        vecLength * sizeof(int32_t));
+            std::memset(sourceFeatures + vecLength, 0, (sourceLen - vecLength) * sizeof(int32_t));
         }
-            
-        float* similarity = xf::graph::internal::aligned_alloc<float>(numResults);
-        int32_t* resultID = xf::graph::internal::aligned_alloc<int32_t>(numResults);
-        std::memset(resultID, 0, numResults * sizeof(int32_t));
-        std::memset(similarity, 0, numResults * sizeof(float));
 
         //---------------- Run L3 API -----------------------------------
-        cosinesim_ss_dense_fpga(numDevices * cuNm, sourceLen, sourceFeatures, sourceCoeffs,
-                                numResults, g.data(),resultID, similarity);
-
-        for (unsigned int k = 0; k < numResults; k++) 
-            result.push_back(Result(resultID[k], similarity[k]));
-
-        free(sourceFeatures);
-        free(sourceCoeffs);
-        free(similarity);
-        free(resultID);
+        std::vector<int32_t> resultCounts(numTargets);
+        cosinesim_ss_dense_fpga(*buffers, numDevices * cuNm, sourceLen, numTargets, buffers->sourceBatch,
+                                sourceCoeffs_, topK, g.data(), buffers->resultID, buffers->similarity,
+                                resultCounts.data());
+
+        std::vector<std::size_t> shortTargets;
+        for (std::size_t t = 0; t < numTargets; t++) {
+            results[t].reserve(numResults);
+            for (int32_t k = 0; k < resultCounts[t] && results[t].size() < numResults; k++) {
+                const int32_t row = buffers->resultID[t * topK + k];
+                if (isLiveRow(row))
+                    results[t].push_back(Result(row, buffers->similarity[t * topK + k]));
+            }
+            if (results[t].size() < numResults)
+                shortTargets.push_back(t);
+        }
+        releaseMatchBuffers(std::move(buffers));
 
-        return result;
+        // more dead rows ranked above the live ones than the kernel could return
+        if (!shortTargets.empty())
+            matchAllowedRowsOnHost(numResults, reinterpret_cast<const int32_t *>(elements), shortTargets,
+                                   RowFilter{nullptr, 0, nullptr, nullptr}, results);
+        return results;
     }
 
+    virtual void matchTargetVectorAsync(unsigned numResults, void *elements, MatchCallback callback,
+                                        void *context);
+
 }; // class PrivateImpl
 
 
@@ -586,14 +952,17 @@ void PrivateImpl::load_graph_cosinesim_ss_dense_fpga(
 //-----------------------------------------------------------------------------
 // Execute kernel to compute cosine similarity and return topK values
 //-----------------------------------------------------------------------------
-void PrivateImpl::cosinesim_ss_dense_fpga(uint32_t devicesNeeded,
+void PrivateImpl::cosinesim_ss_dense_fpga(MatchBuffers& buffers,
+                                           uint32_t devicesNeeded,
                                            int32_t sourceLen,
+                                           int32_t requestNm,
                                            int32_t* sourceWeight,
                                            int32_t* sourceCoeffs,
                                            int32_t topK,
                                            xf::graph::Graph<int32_t, int32_t>** g,
                                            int32_t* resultID,
-                                           float* similarity) 
+                                           float* similarity,
+                                           int32_t* resultCounts) 
 {
     //---------------- Run Load Graph -----------------------------------
 #ifdef __PROFILING__
@@ -620,29 +989,32 @@ void PrivateImpl::cosinesim_ss_dense_fpga(uint32_t devicesNeeded,
     std::shared_ptr<xf::graph::L3::Handle> handle0 =
                         sharedHandlesCosSimDense::instance().handlesMap[0];
     handle0->showHandleInfo();  // no-op in Release
-    int32_t requestNm = 1;
     int32_t hwNm = devicesNeeded;
-    std::vector<xf::graph::L3::event<int> > eventQueue[requestNm];
-    float** similarity0[requestNm];
-    int32_t** resultID0[requestNm];
-    int counter[requestNm][hwNm];
-    for (int m = 0; m < requestNm; ++m) {
-        similarity0[m] = new float*[hwNm];
-        resultID0[m] = new int32_t*[hwNm];
-        for (int i = 0; i < hwNm; ++i) {
-            counter[m][i] = 0;
-            similarity0[m][i] = xf::graph::internal::aligned_alloc<float>(topK);
-            resultID0[m][i] = xf::graph::internal::aligned_alloc<int32_t>(topK);
-            memset(resultID0[m][i], 0, topK * sizeof(int32_t));
-            memset(similarity0[m][i], 0, topK * sizeof(float));
-        }
+    const std::size_t sourceSlot = bufferSlotSize(sourceLen);
+    const std::size_t resultSlot = bufferSlotSize(topK);
+    reserveBuffer(buffers.perCuResultID, buffers.perCuResultIDCap, std::size_t(requestNm) * hwNm * resultSlot);
+    reserveBuffer(buffers.perCuSimilarity, buffers.perCuSimilarityCap, std::size_t(requestNm) * hwNm * resultSlot);
+
+    // per-CU results of request m, CU i live in slot (m * hwNm + i) of the per-CU pools
+    std::vector<std::vector<xf::graph::L3::event<int> > > eventQueue(requestNm);
+    std::vector<float*> similarity0(std::size_t(requestNm) * hwNm);
+    std::vector<int32_t*> resultID0(std::size_t(requestNm) * hwNm);
+    for (std::size_t k = 0; k < similarity0.size(); ++k) {
+        similarity0[k] = buffers.perCuSimilarity + k * resultSlot;
+        resultID0[k] = buffers.perCuResultID + k * resultSlot;
+        memset(resultID0[k], 0, topK * sizeof(int32_t));
+        memset(similarity0[k], 0, topK * sizeof(float));
     }
     //---------------- Run L3 API -----------------------------------
+    // Queue every request before waiting on any, so the CUs run back to back.  The L3 worker assigns CUs
+    // round-robin, which keeps request m's i-th task on CU i as long as tasks are queued in this order.
+    std::unique_lock<std::mutex> submitLock(submitMutex_);
     for (int m = 0; m < requestNm; ++m) {
         eventQueue[m] = cosineSimilaritySSDenseMultiCard(
-            handle0, hwNm, sourceLen, sourceWeight, sourceCoeffs, topK, g,
-            resultID0[m], similarity0[m]);
+            handle0, hwNm, sourceLen, sourceWeight + m * sourceSlot, sourceCoeffs, topK, g,
+            &resultID0[m * hwNm], &similarity0[m * hwNm]);
     }
+    submitLock.unlock();
 
     int ret = 0;
     for (int m = 0; m < requestNm; ++m) {
@@ -650,31 +1022,12 @@ void PrivateImpl::cosinesim_ss_dense_fpga(uint32_t devicesNeeded,
             ret += eventQueue[m][i].wait();
         }
     }
+    // every CU returns topK entries sorted by descending similarity
+    const std::vector<int32_t> perCuCounts(hwNm, topK);
     for (int m = 0; m < requestNm; ++m) {
-        for (int i = 0; i < topK; ++i) {
-            similarity[i] = similarity0[m][0][counter[m][0]];
-            int32_t prev = 0;
-            resultID[i] = resultID0[m][0][counter[m][0]];
-            counter[m][0]++;
-            for (int j = 1; j < hwNm; ++j) {
-                if (similarity[i] < similarity0[m][j][counter[m][j]]) {
-                    similarity[i] = similarity0[m][j][counter[m][j]];
-                    resultID[i] = resultID0[m][j][counter[m][j]];
-                    counter[m][prev]--;
-                    prev = j;
-                    counter[m][j]++;
-                }
-            }
-        }
-    }
-
-    for (int m = 0; m < requestNm; ++m) {
-        for (int i = 0; i < hwNm; ++i) {
-            free(similarity0[m][i]);
-            free(resultID0[m][i]);
-        }
-        delete[] similarity0[m];
-        delete[] resultID0[m];
+        resultCounts[m] = xf::graph::L3::opSimilarityDense::mergeTopK(
+            hwNm, &resultID0[m * hwNm], &similarity0[m * hwNm], perCuCounts.data(), topK,
+            resultID + std::size_t(m) * topK, similarity + std::size_t(m) * topK);
     }
 #ifdef __PROFILING__
     std::chrono::time_point<std::chrono::high_resolution_clock> l_end_time =
@@ -688,6 +1041,267 @@ void PrivateImpl::cosinesim_ss_dense_fpga(uint32_t devicesNeeded,
 #endif
 }
 
+//-----------------------------------------------------------------------------
+// Write changed population rows to the cards, one write per run of rows that
+// are adjacent in the same channel
+//-----------------------------------------------------------------------------
+void PrivateImpl::syncRows(RowIndex firstRow, RowIndex numRows)
+{
+    std::shared_ptr<xf::graph::L3::Handle> handle0 = sharedHandlesCosSimDense::instance().handlesMap[0];
+    RowCursor cur = locateRow(firstRow);
+    while (numRows > 0) {
+        const RowIndex depth = rowDepth(cur);
+        const RowIndex runStart = cur.local % depth;
+        const RowIndex runLength = std::min(numRows, depth - runStart);
+        const unsigned channel = rowChannel(cur);
+        (handle0->opsimdense)->updateGraphRegion(handle0->supportedDeviceIds_[cur.cu / cuNm], cur.cu % cuNm,
+                                                 channel, runStart * edgeAlign8 * sizeof(int32_t),
+                                                 runLength * edgeAlign8 * sizeof(int32_t), rowAddress(cur));
+        for (RowIndex r = 0; r < runLength; ++r)
+            nextRow(cur);
+        numRows -= runLength;
+    }
+}
+
+// Upper bound on the live rows a filter allows: the rows set in its allow-list, or every live row when it only
+// has a predicate
+RowIndex PrivateImpl::countAllowedRows(const RowFilter &filter) const
+{
+    const RowIndex numLive = this->numVertices - numDeleted_;
+    if (filter.allowBits == nullptr)
+        return numLive;
+    const RowIndex end = std::min<RowIndex>(filter.numBits, this->numVertices);
+    RowIndex count = 0;
+    for (RowIndex base = 0; base < end; base += 64) {
+        std::uint64_t bits = filter.allowBits[base / 64];
+        if (end - base < 64)
+            bits &= (std::uint64_t(1) << (end - base)) - 1;
+        count += __builtin_popcountll(bits);
+    }
+    return std::min(count, numLive);
+}
+
+// Scores the allowed rows against the given targets from the host copy of the population, so the work is
+// proportional to the number of allowed rows rather than to the population size
+void PrivateImpl::matchAllowedRowsOnHost(unsigned numResults, const int32_t *elements,
+                                         const std::vector<std::size_t> &targets, const RowFilter &filter,
+                                         XVector<XVector<Result>> &results) const
+{
+    std::vector<std::int64_t> targetSquares(targets.size(), 0);
+    std::vector<float> targetNorms(targets.size());
+    for (std::size_t k = 0; k < targets.size(); ++k) {
+        const int32_t *target = elements + targets[k] * vecLength;
+        for (int i = 0; i < vecLength; ++i)
+            targetSquares[k] += std::int64_t(target[i]) * target[i];
+        targetNorms[k] = std::sqrt(float(targetSquares[k]));
+    }
+
+    std::vector<std::vector<Result> > heaps(targets.size());
+    const RowIndex end = filter.allowBits == nullptr
+        ? this->numVertices : std::min<RowIndex>(filter.numBits, this->numVertices);
+    for (RowIndex base = 0; base < end; base += 64) {
+        std::uint64_t bits = filter.allowBits == nullptr ? ~std::uint64_t(0) : filter.allowBits[base / 64];
+        if (end - base < 64)
+            bits &= (std::uint64_t(1) << (end - base)) - 1;
+        for (; bits != 0; bits &= bits - 1) {
+            const RowIndex r = base + __builtin_ctzll(bits);
+            if (deleted_[r])
+                continue;
+            if (filter.predicate != nullptr && !filter.predicate(filter.context, r))
+                continue;
+            const int32_t *row = rowAddress(locateRow(r));
+            std::int64_t rowSquare = 0;
+            for (int i = 0; i < vecLength; ++i)
+                rowSquare += std::int64_t(row[i]) * row[i];
+            const float rowNorm = std::sqrt(float(rowSquare));
+            for (std::size_t k = 0; k < targets.size(); ++k) {
+                const int32_t *target = elements + targets[k] * vecLength;
+                std::int64_t dot = 0;
+                for (int i = 0; i < vecLength; ++i)
+                    dot += std::int64_t(row[i]) * target[i];
+                pushResult(heaps[k], numResults, r,
+                           cosineSimilarity(dot, rowSquare, rowNorm, targetSquares[k], targetNorms[k]));
+            }
+        }
+    }
+
+    for (std::size_t k = 0; k < targets.size(); ++k) {
+        std::sort_heap(heaps[k].begin(), heaps[k].end(), isBetterResult);
+        XVector<Result> &out = results[targets[k]];
+        out.clear();
+        out.reserve(heaps[k].size());
+        for (const Result &res : heaps[k])
+            out.push_back(res);
+    }
+}
+
+// The kernels rank the whole population and cannot skip excluded rows, so a selective filter is matched on the
+// host instead, as is one whose density cannot yield numResults allowed rows within MaxKernelTopK ranked rows.
+// Otherwise the filter is applied to the kernels' results: the first round asks for twice the number of results
+// that the filter's density predicts, the next for four times as many (both capped at MaxKernelTopK), and any
+// target still short of numResults allowed rows is then matched on the host.
+XVector<XVector<Result>> PrivateImpl::matchTargetVectorsFiltered(unsigned numResults, void *elements,
+                                                                 std::size_t numTargets, const RowFilter &filter)
+{
+    const RowIndex numLive = this->numVertices - numDeleted_;
+    const int32_t *targets = reinterpret_cast<const int32_t *>(elements);
+    XVector<XVector<Result>> results(numTargets);
+    if (numTargets == 0 || numResults == 0 || numLive == 0)
+        return results;
+
+    const RowIndex numAllowed = countAllowedRows(filter);
+    std::vector<std::size_t> pending(numTargets);
+    for (std::size_t t = 0; t < numTargets; ++t)
+        pending[t] = t;
+    const RowIndex maxRanked = std::min<RowIndex>(numLive, MaxKernelTopK);
+    if (numAllowed * HostFilterRatio <= numLive || maxRanked * numAllowed / numLive < numResults) {
+        matchAllowedRowsOnHost(numResults, targets, pending, filter, results);
+        return results;
+    }
+
+    RowIndex numRanked = std::min(maxRanked, 2 * numResults * numLive / std::max<RowIndex>(numAllowed, 1));
+    numRanked = std::max<RowIndex>(numRanked, std::min<RowIndex>(numResults, maxRanked));
+    for (int round = 0; round < MaxFilterRounds && !pending.empty(); ++round) {
+        const XVector<XVector<Result>> ranked = matchTargetVectors(unsigned(numRanked), elements, numTargets);
+        std::vector<std::size_t> stillPending;
+        for (std::size_t t : pending) {
+            results[t].clear();
+            for (const Result &res : ranked[t]) {
+                if (results[t].size() == numResults)
+                    break;
+                if (isRowAllowed(filter, res.index))
+                    results[t].push_back(res);
+            }
+            // ranking every live row leaves nothing more to find
+            if (results[t].size() < numResults && numRanked < numLive)
+                stillPending.push_back(t);
+        }
+        pending.swap(stillPending);
+        if (numRanked == maxRanked)
+            break;
+        numRanked = std::min(maxRanked, numRanked * 4);
+    }
+    if (!pending.empty())
+        matchAllowedRowsOnHost(numResults, targets, pending, filter, results);
+    return results;
+}
+
+//-----------------------------------------------------------------------------
+// Queue one target on every CU and hand it to the completion thread
+//-----------------------------------------------------------------------------
+void PrivateImpl::matchTargetVectorAsync(unsigned numResults, void *elements, MatchCallback callback,
+                                         void *context)
+{
+    if (numResults > this->numVertices - numDeleted_)
+        numResults = this->numVertices - numDeleted_;
+    if (sharedHandlesCosSimDense::instance().handlesMap.empty()) {
+        std::ostringstream oss;
+        oss << "ERROR: " << __FUNCTION__ << " CUs need to be set up first:" <<std::endl;
+        throw xilinx_apps::cosinesim::Exception(oss.str());
+    }
+
+    std::unique_ptr<AsyncMatch> match(new AsyncMatch());
+    match->numResults = numResults;
+    match->callback = callback;
+    match->context = context;
+    if (numResults > 0) {
+        const int32_t hwNm = numDevices * cuNm;
+        const int sourceLen = edgeAlign8;
+        match->topK = kernelTopK(numResults);
+        const std::size_t resultSlot = bufferSlotSize(match->topK);
+        match->source = xf::graph::internal::aligned_alloc<int32_t>(bufferSlotSize(sourceLen));
+        std::memcpy(match->source, elements, vecLength * sizeof(int32_t));
+        std::memset(match->source + vecLength, 0, (sourceLen - vecLength) * sizeof(int32_t));
+        match->resultID = xf::graph::internal::aligned_alloc<int32_t>(hwNm * resultSlot);
+        match->similarity = xf::graph::internal::aligned_alloc<float>(hwNm * resultSlot);
+        std::memset(match->resultID, 0, hwNm * resultSlot * sizeof(int32_t));
+        std::memset(match->similarity, 0, hwNm * resultSlot * sizeof(float));
+
+        std::vector<int32_t*> resultID0(hwNm);
+        std::vector<float*> similarity0(hwNm);
+        for (int32_t i = 0; i < hwNm; ++i) {
+            resultID0[i] = match->resultID + i * resultSlot;
+            similarity0[i] = match->similarity + i * resultSlot;
+        }
+        std::shared_ptr<xf::graph::L3::Handle> handle0 = sharedHandlesCosSimDense::instance().handlesMap[0];
+        std::lock_guard<std::mutex> submitLock(submitMutex_);
+        match->events = cosineSimilaritySSDenseMultiCard(handle0, hwNm, sourceLen, match->source, sourceCoeffs_,
+                                                         match->topK, g.data(), resultID0.data(),
+                                                         similarity0.data());
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(asyncMutex_);
+        asyncQueue_.push_back(std::move(match));
+        if (!asyncThread_.joinable())
+            asyncThread_ = std::thread(&PrivateImpl::asyncCompletionLoop, this);
+    }
+    asyncCv_.notify_all();
+}
+
+void PrivateImpl::asyncCompletionLoop()
+{
+    std::unique_lock<std::mutex> lock(asyncMutex_);
+    while (true) {
+        asyncCv_.wait(lock, [this] { return asyncStop_ || !asyncQueue_.empty(); });
+        if (asyncQueue_.empty())
+            return;
+        AsyncMatch& match = *asyncQueue_.front();
+        lock.unlock();
+
+        XVector<Result> results;
+        std::string error;
+        try {
+            const int32_t hwNm = match.events.size();
+            const std::size_t resultSlot = bufferSlotSize(match.topK);
+            for (int32_t i = 0; i < hwNm; ++i)
+                match.events[i].wait();
+            std::vector<const int32_t*> resultID0(hwNm);
+            std::vector<const float*> similarity0(hwNm);
+            for (int32_t i = 0; i < hwNm; ++i) {
+                resultID0[i] = match.resultID + i * resultSlot;
+                similarity0[i] = match.similarity + i * resultSlot;
+            }
+            // every CU returns topK entries sorted by descending similarity
+            const std::vector<int32_t> perCuCounts(hwNm, match.topK);
+            std::vector<int32_t> mergedID(match.topK);
+            std::vector<float> mergedSimilarity(match.topK);
+            int32_t count = 0;
+            if (hwNm > 0)
+                count = xf::graph::L3::opSimilarityDense::mergeTopK(
+                    hwNm, resultID0.data(), similarity0.data(), perCuCounts.data(), match.topK,
+                    mergedID.data(), mergedSimilarity.data());
+            results.reserve(match.numResults);
+            for (int32_t k = 0; k < count && results.size() < match.numResults; ++k)
+                if (isLiveRow(mergedID[k]))
+                    results.push_back(Result(mergedID[k], mergedSimilarity[k]));
+            if (results.size() < match.numResults) {
+                XVector<XVector<Result>> hostResults(1);
+                matchAllowedRowsOnHost(match.numResults, match.source, std::vector<std::size_t>(1, 0),
+                                       RowFilter{nullptr, 0, nullptr, nullptr}, hostResults);
+                results = std::move(hostResults[0]);
+            }
+        } catch (const std::exception& e) {
+            error = e.what();
+        }
+        if (error.empty())
+            match.callback(match.context, &results, nullptr);
+        else
+            match.callback(match.context, nullptr, error.c_str());
+
+        lock.lock();
+        asyncQueue_.pop_front();
+        asyncCv_.notify_all();
+    }
+}
+
+// Block until every asynchronous match submitted so far has been reported
+void PrivateImpl::drainAsyncMatches()
+{
+    std::unique_lock<std::mutex> lock(asyncMutex_);
+    asyncCv_.wait(lock, [this] { return asyncQueue_.empty(); });
+}
+
 //-----------------------------------------------------------------------------
 // close_fpga
 //-----------------------------------------------------------------------------
@@ -712,6 +1326,8 @@ xilinx_apps::cosinesim::ImplBase *xilinx_cosinesim_createImpl(
 #ifndef NDEBUG    
     std::cout << "DEBUG: inside .so xilinx_cosinesim_createImpl" << std::endl;
 #endif    
+    if (options.cpuBackend)
+        return new xilinx_apps::cosinesim::CpuImpl(options, valueSize);
     return new xilinx_apps::cosinesim::PrivateImpl(options,valueSize);
 }
 
@@ -0,0 +1,1015 @@
+/*
+ * Copyright 2021 Xilinx, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <iterator>
+#include <numeric>
+#include <string>
+#include <thread>
+
+#include "cosinesim_cpu.hpp"
+#include "cosinesim_snapshot.hpp"
+
+// SIMD dot products are compiled per function with target attributes and picked at run time, so the library
+// itself does not need to be built with -mavx2/-mavx512f
+#if defined(__x86_64__) && (defined(__clang__) || (__GNUC__ >= 5))
+#define XILINX_COSINESIM_X86_SIMD
+#include <immintrin.h>
+#endif
+
+// AVX-512 VNNI (vpdpbusd) needs GCC 8 or later
+#if defined(XILINX_COSINESIM_X86_SIMD) && (defined(__clang__) || (__GNUC__ >= 8))
+#define XILINX_COSINESIM_X86_VNNI
+#endif
+
+namespace xilinx_apps {
+namespace cosinesim {
+
+namespace {
+
+template <typename T>
+std::int64_t dotProductScalar(const void *va, const void *vb, std::int64_t stride) {
+    const T *a = static_cast<const T *>(va);
+    const T *b = static_cast<const T *>(vb);
+    std::int64_t sum = 0;
+    for (std::int64_t i = 0; i < stride; ++i)
+        sum += std::int64_t(a[i]) * b[i];
+    return sum;
+}
+
+template <typename T>
+void dotProductBlockScalar(const void *a, const void *b, std::int64_t stride, std::int64_t *out) {
+    for (int j = 0; j < DotBlock; ++j)
+        out[j] = dotProductScalar<T>(a, static_cast<const T *>(b) + j * stride, stride);
+}
+
+// The int16 kernels sum pairs of products in 32 bits with vpmaddwd, which only (-32768)^2 + (-32768)^2 overflows,
+// so 16-bit rows and targets are stored with -32768 saturated to -32767
+void saturateInt16(void *values, int count) {
+    std::int16_t *p = static_cast<std::int16_t *>(values);
+    for (int i = 0; i < count; ++i)
+        p[i] = std::max<std::int16_t>(p[i], -32767);
+}
+
+#ifdef XILINX_COSINESIM_X86_SIMD
+// int8 products are summed in 32-bit lanes, widened to 64 bits every Int8Flush elements so no lane can overflow
+const std::int64_t Int8Flush = std::int64_t(1) << 19;
+
+__attribute__((target("avx2")))
+std::int64_t sumLanes(__m256i acc64) {
+    alignas(32) std::int64_t lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), acc64);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+__attribute__((target("avx2")))
+__m256i widenAdd(__m256i acc64, __m256i acc32) {
+    acc64 = _mm256_add_epi64(acc64, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(acc32)));
+    return _mm256_add_epi64(acc64, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(acc32, 1)));
+}
+
+// _mm*_mul_epi32 multiplies the signed low halves of each 64-bit lane; shifting by 32 brings the odd elements down
+
+__attribute__((target("avx2")))
+std::int64_t dotProductAvx2(const void *va, const void *vb, std::int64_t stride) {
+    const std::int32_t *a = static_cast<const std::int32_t *>(va);
+    const std::int32_t *b = static_cast<const std::int32_t *>(vb);
+    __m256i accEven = _mm256_setzero_si256();
+    __m256i accOdd = _mm256_setzero_si256();
+    for (std::int64_t i = 0; i < stride; i += 8) {
+        const __m256i va = _mm256_load_si256(reinterpret_cast<const __m256i *>(a + i));
+        const __m256i vb = _mm256_load_si256(reinterpret_cast<const __m256i *>(b + i));
+        accEven = _mm256_add_epi64(accEven, _mm256_mul_epi32(va, vb));
+        accOdd = _mm256_add_epi64(accOdd, _mm256_mul_epi32(_mm256_srli_epi64(va, 32), _mm256_srli_epi64(vb, 32)));
+    }
+    return sumLanes(_mm256_add_epi64(accEven, accOdd));
+}
+
+// Register-blocked form: each load of a is reused for DotBlock rows of b
+__attribute__((target("avx2")))
+void dotProductBlockAvx2(const void *va, const void *vb, std::int64_t stride, std::int64_t *out) {
+    const std::int32_t *a = static_cast<const std::int32_t *>(va);
+    const std::int32_t *b = static_cast<const std::int32_t *>(vb);
+    __m256i acc[DotBlock];
+    for (int j = 0; j < DotBlock; ++j)
+        acc[j] = _mm256_setzero_si256();
+    for (std::int64_t i = 0; i < stride; i += 8) {
+        const __m256i va = _mm256_load_si256(reinterpret_cast<const __m256i *>(a + i));
+        const __m256i vaOdd = _mm256_srli_epi64(va, 32);
+        for (int j = 0; j < DotBlock; ++j) {
+            const __m256i vb = _mm256_load_si256(reinterpret_cast<const __m256i *>(b + j * stride + i));
+            acc[j] = _mm256_add_epi64(acc[j], _mm256_mul_epi32(va, vb));
+            acc[j] = _mm256_add_epi64(acc[j], _mm256_mul_epi32(vaOdd, _mm256_srli_epi64(vb, 32)));
+        }
+    }
+    for (int j = 0; j < DotBlock; ++j)
+        out[j] = sumLanes(acc[j]);
+}
+
+// int16: vpmaddwd sums pairs of products into 32 bits, which is only safe for one step, so widen every step.
+// The pair sum cannot overflow because saturateInt16() keeps -32768 out of rows and targets.
+__attribute__((target("avx2")))
+std::int64_t dotProduct16Avx2(const void *va, const void *vb, std::int64_t stride) {
+    const std::int16_t *a = static_cast<const std::int16_t *>(va);
+    const std::int16_t *b = static_cast<const std::int16_t *>(vb);
+    __m256i acc = _mm256_setzero_si256();
+    for (std::int64_t i = 0; i < stride; i += 16) {
+        const __m256i va = _mm256_load_si256(reinterpret_cast<const __m256i *>(a + i));
+        const __m256i vb = _mm256_load_si256(reinterpret_cast<const __m256i *>(b + i));
+        acc = widenAdd(acc, _mm256_madd_epi16(va, vb));
+    }
+    return sumLanes(acc);
+}
+
+__attribute__((target("avx2")))
+void dotProductBlock16Avx2(const void *va, const void *vb, std::int64_t stride, std::int64_t *out) {
+    const std::int16_t *a = static_cast<const std::int16_t *>(va);
+    const std::int16_t *b = static_cast<const std::int16_t *>(vb);
+    __m256i acc[DotBlock];
+    for (int j = 0; j < DotBlock; ++j)
+        acc[j] = _mm256_setzero_si256();
+    for (std::int64_t i = 0; i < stride; i += 16) {
+        const __m256i va = _mm256_load_si256(reinterpret_cast<const __m256i *>(a + i));
+        for (int j = 0; j < DotBlock; ++j) {
+            const __m256i vb = _mm256_load_si256(reinterpret_cast<const __m256i *>(b + j * stride + i));
+            acc[j] = widenAdd(acc[j], _mm256_madd_epi16(va, vb));
+        }
+    }
+    for (int j = 0; j < DotBlock; ++j)
+        out[j] = sumLanes(acc[j]);
+}
+
+// int8: sign-extend 16 elements to int16, then vpmaddwd
+__attribute__((target("avx2")))
+std::int64_t dotProduct8Avx2(const void *va, const void *vb, std::int64_t stride) {
+    const std::int8_t *a = static_cast<const std::int8_t *>(va);
+    const std::int8_t *b = static_cast<const std::int8_t *>(vb);
+    __m256i acc = _mm256_setzero_si256();
+    for (std::int64_t chunk = 0; chunk < stride; chunk += Int8Flush) {
+        const std::int64_t chunkEnd = std::min(chunk + Int8Flush, stride);
+        __m256i acc32 = _mm256_setzero_si256();
+        for (std::int64_t i = chunk; i < chunkEnd; i += 16) {
+            const __m256i va = _mm256_cvtepi8_epi16(_mm_load_si128(reinterpret_cast<const __m128i *>(a + i)));
+            const __m256i vb = _mm256_cvtepi8_epi16(_mm_load_si128(reinterpret_cast<const __m128i *>(b + i)));
+            acc32 = _mm256_add_epi32(acc32, _mm256_madd_epi16(va, vb));
+        }
+        acc = widenAdd(acc, acc32);
+    }
+    return sumLanes(acc);
+}
+
+__attribute__((target("avx2")))
+void dotProductBlock8Avx2(const void *va, const void *vb, std::int64_t stride, std::int64_t *out) {
+    const std::int8_t *a = static_cast<const std::int8_t *>(va);
+    const std::int8_t *b = static_cast<const std::int8_t *>(vb);
+    __m256i acc[DotBlock];
+    for (int j = 0; j < DotBlock; ++j)
+        acc[j] = _mm256_setzero_si256();
+    for (std::int64_t chunk = 0; chunk < stride; chunk += Int8Flush) {
+        const std::int64_t chunkEnd = std::min(chunk + Int8Flush, stride);
+        __m256i acc32[DotBlock];
+        for (int j = 0; j < DotBlock; ++j)
+            acc32[j] = _mm256_setzero_si256();
+        for (std::int64_t i = chunk; i < chunkEnd; i += 16) {
+            const __m256i va = _mm256_cvtepi8_epi16(_mm_load_si128(reinterpret_cast<const __m128i *>(a + i)));
+            for (int j = 0; j < DotBlock; ++j) {
+                const __m256i vb = _mm256_cvtepi8_epi16(
+                        _mm_load_si128(reinterpret_cast<const __m128i *>(b + j * stride + i)));
+                acc32[j] = _mm256_add_epi32(acc32[j], _mm256_madd_epi16(va, vb));
+            }
+        }
+        for (int j = 0; j < DotBlock; ++j)
+            acc[j] = widenAdd(acc[j], acc32[j]);
+    }
+    for (int j = 0; j < DotBlock; ++j)
+        out[j] = sumLanes(acc[j]);
+}
+
+__attribute__((target("avx512f")))
+std::int64_t sumLanes512(__m512i acc64) {
+    alignas(64) std::int64_t lanes[8];
+    _mm512_store_si512(lanes, acc64);
+    std::int64_t sum = 0;
+    for (int i = 0; i < 8; ++i)
+        sum += lanes[i];
+    return sum;
+}
+
+__attribute__((target("avx512f")))
+std::int64_t dotProductAvx512(const void *va, const void *vb, std::int64_t stride) {
+    const std::int32_t *a = static_cast<const std::int32_t *>(va);
+    const std::int32_t *b = static_cast<const std::int32_t *>(vb);
+    __m512i accEven = _mm512_setzero_si512();
+    __m512i accOdd = _mm512_setzero_si512();
+    for (std::int64_t i = 0; i < stride; i += 16) {
+        const __m512i va = _mm512_load_si512(a + i);
+        const __m512i vb = _mm512_load_si512(b + i);
+        // full-mask maskz forms: same code as the plain intrinsics, without GCC's uninitialized-source warning
+        accEven = _mm512_add_epi64(accEven, _mm512_maskz_mul_epi32(0xFF, va, vb));
+        accOdd = _mm512_add_epi64(accOdd, _mm512_maskz_mul_epi32(0xFF, _mm512_maskz_srli_epi64(0xFF, va, 32),
+                                                                  _mm512_maskz_srli_epi64(0xFF, vb, 32)));
+    }
+    return sumLanes512(_mm512_add_epi64(accEven, accOdd));
+}
+
+__attribute__((target("avx512f")))
+void dotProductBlockAvx512(const void *va, const void *vb, std::int64_t stride, std::int64_t *out) {
+    const std::int32_t *a = static_cast<const std::int32_t *>(va);
+    const std::int32_t *b = static_cast<const std::int32_t *>(vb);
+    __m512i acc[DotBlock];
+    for (int j = 0; j < DotBlock; ++j)
+        acc[j] = _mm512_setzero_si512();
+    for (std::int64_t i = 0; i < stride; i += 16) {
+        const __m512i va = _mm512_load_si512(a + i);
+        const __m512i vaOdd = _mm512_maskz_srli_epi64(0xFF, va, 32);
+        for (int j = 0; j < DotBlock; ++j) {
+            const __m512i vb = _mm512_load_si512(b + j * stride + i);
+            acc[j] = _mm512_add_epi64(acc[j], _mm512_maskz_mul_epi32(0xFF, va, vb));
+            acc[j] = _mm512_add_epi64(acc[j], _mm512_maskz_mul_epi32(0xFF, vaOdd, _mm512_maskz_srli_epi64(0xFF, vb, 32)));
+        }
+    }
+    for (int j = 0; j < DotBlock; ++j)
+        out[j] = sumLanes512(acc[j]);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+__m512i widenAdd512(__m512i acc64, __m512i acc32) {
+    // full-mask maskz forms, as in dotProductAvx512()
+    acc64 = _mm512_add_epi64(acc64, _mm512_maskz_cvtepi32_epi64(0xFF, _mm512_maskz_extracti64x4_epi64(0xF, acc32, 0)));
+    return _mm512_add_epi64(acc64, _mm512_maskz_cvtepi32_epi64(0xFF, _mm512_maskz_extracti64x4_epi64(0xF, acc32, 1)));
+}
+
+__attribute__((target("avx512f,avx512bw")))
+void dotProductBlock16Avx512(const void *va, const void *vb, std::int64_t stride, std::int64_t *out) {
+    const std::int16_t *a = static_cast<const std::int16_t *>(va);
+    const std::int16_t *b = static_cast<const std::int16_t *>(vb);
+    __m512i acc[DotBlock];
+    for (int j = 0; j < DotBlock; ++j)
+        acc[j] = _mm512_setzero_si512();
+    for (std::int64_t i = 0; i < stride; i += 32) {
+        const __m512i va = _mm512_load_si512(a + i);
+        for (int j = 0; j < DotBlock; ++j)
+            acc[j] = widenAdd512(acc[j], _mm512_madd_epi16(va, _mm512_load_si512(b + j * stride + i)));
+    }
+    for (int j = 0; j < DotBlock; ++j)
+        out[j] = sumLanes512(acc[j]);
+}
+#endif
+
+#ifdef XILINX_COSINESIM_X86_VNNI
+// vpdpbusd multiplies unsigned by signed bytes, so the b rows are biased by 128 (flipping the sign bit) and the
+// bias term 128 * sum(a), itself a vpdpbusd of a with all-ones, is subtracted at the end
+__attribute__((target("avx512f,avx512bw,avx512vnni")))
+void dotProductBlock8Vnni(const void *va, const void *vb, std::int64_t stride, std::int64_t *out) {
+    const std::int8_t *a = static_cast<const std::int8_t *>(va);
+    const std::int8_t *b = static_cast<const std::int8_t *>(vb);
+    const __m512i signBits = _mm512_set1_epi8(-128);
+    const __m512i ones = _mm512_set1_epi8(1);
+    __m512i acc[DotBlock];
+    for (int j = 0; j < DotBlock; ++j)
+        acc[j] = _mm512_setzero_si512();
+    __m512i accSumA = _mm512_setzero_si512();
+    for (std::int64_t chunk = 0; chunk < stride; chunk += Int8Flush) {
+        const std::int64_t chunkEnd = std::min(chunk + Int8Flush, stride);
+        __m512i acc32[DotBlock];
+        for (int j = 0; j < DotBlock; ++j)
+            acc32[j] = _mm512_setzero_si512();
+        __m512i sumA32 = _mm512_setzero_si512();
+        for (std::int64_t i = chunk; i < chunkEnd; i += 64) {
+            const __m512i va = _mm512_load_si512(a + i);
+            sumA32 = _mm512_dpbusd_epi32(sumA32, ones, va);
+            for (int j = 0; j < DotBlock; ++j) {
+                const __m512i vbBiased = _mm512_xor_si512(_mm512_load_si512(b + j * stride + i), signBits);
+                acc32[j] = _mm512_dpbusd_epi32(acc32[j], vbBiased, va);
+            }
+        }
+        for (int j = 0; j < DotBlock; ++j)
+            acc[j] = widenAdd512(acc[j], acc32[j]);
+        accSumA = widenAdd512(accSumA, sumA32);
+    }
+    const std::int64_t bias = 128 * sumLanes512(accSumA);
+    for (int j = 0; j < DotBlock; ++j)
+        out[j] = sumLanes512(acc[j]) - bias;
+}
+#endif
+
+// Runs body(begin, end) over [0, n) split across the hardware threads, at least minPerThread items to a thread
+template <typename Body>
+void parallelFor(std::int64_t n, std::int64_t minPerThread, Body body) {
+    std::int64_t numThreads = std::max(1u, std::thread::hardware_concurrency());
+    numThreads = std::max(std::int64_t(1), std::min(numThreads, n / minPerThread));
+    const std::int64_t perThread = (n + numThreads - 1) / numThreads;
+    std::vector<std::thread> threads;
+    for (std::int64_t begin = perThread; begin < n; begin += perThread)
+        threads.push_back(std::thread(body, begin, std::min(begin + perThread, n)));
+    body(std::int64_t(0), std::min(perThread, n));
+    for (std::thread &thread : threads)
+        thread.join();
+}
+
+void normalize(float *vec, std::size_t length) {
+    double sum = 0.0;
+    for (std::size_t i = 0; i < length; ++i)
+        sum += double(vec[i]) * vec[i];
+    if (sum == 0.0)
+        return;
+    const float scale = float(1.0 / std::sqrt(sum));
+    for (std::size_t i = 0; i < length; ++i)
+        vec[i] *= scale;
+}
+
+template <typename T>
+void copyToFloat(const void *row, std::size_t length, float *out) {
+    const T *elements = static_cast<const T *>(row);
+    for (std::size_t i = 0; i < length; ++i)
+        out[i] = float(elements[i]);
+}
+
+} // namespace
+
+
+bool isBetterResult(const Result &a, const Result &b) {
+    if (a.similarity != b.similarity)
+        return a.similarity > b.similarity;
+    return a.index < b.index;
+}
+
+double cosineSimilarity(std::int64_t dot, std::int64_t squareA, float normA, std::int64_t squareB, float normB) {
+    if (squareA == 0 && squareB == 0)
+        return 1.0;
+    if (squareA == 0 || squareB == 0)
+        return 0.0;
+    return float(dot) / (normA * normB);
+}
+
+void pushResult(std::vector<Result> &heap, unsigned numResults, RowIndex index, double similarity) {
+    const Result cur(index, similarity);
+    if (heap.size() < numResults) {
+        heap.push_back(cur);
+        std::push_heap(heap.begin(), heap.end(), isBetterResult);
+    } else if (isBetterResult(cur, heap.front())) {
+        std::pop_heap(heap.begin(), heap.end(), isBetterResult);
+        heap.back() = cur;
+        std::push_heap(heap.begin(), heap.end(), isBetterResult);
+    }
+}
+
+DotProductFunc selectDotProduct(unsigned valueSize) {
+#ifdef XILINX_COSINESIM_X86_SIMD
+    __builtin_cpu_init();
+    if (valueSize == 4 && __builtin_cpu_supports("avx512f"))
+        return dotProductAvx512;
+    if (__builtin_cpu_supports("avx2"))
+        return valueSize == 1 ? dotProduct8Avx2 : valueSize == 2 ? dotProduct16Avx2 : dotProductAvx2;
+#endif
+    return valueSize == 1 ? dotProductScalar<std::int8_t>
+        : valueSize == 2 ? dotProductScalar<std::int16_t> : dotProductScalar<std::int32_t>;
+}
+
+DotProductBlockFunc selectDotProductBlock(unsigned valueSize) {
+#ifdef XILINX_COSINESIM_X86_SIMD
+    __builtin_cpu_init();
+#ifdef XILINX_COSINESIM_X86_VNNI
+    if (valueSize == 1 && __builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512bw"))
+        return dotProductBlock8Vnni;
+#endif
+    if (valueSize == 2 && __builtin_cpu_supports("avx512bw"))
+        return dotProductBlock16Avx512;
+    if (valueSize == 4 && __builtin_cpu_supports("avx512f"))
+        return dotProductBlockAvx512;
+    if (__builtin_cpu_supports("avx2"))
+        return valueSize == 1 ? dotProductBlock8Avx2 : valueSize == 2 ? dotProductBlock16Avx2 : dotProductBlockAvx2;
+#endif
+    return valueSize == 1 ? dotProductBlockScalar<std::int8_t>
+        : valueSize == 2 ? dotProductBlockScalar<std::int16_t> : dotProductBlockScalar<std::int32_t>;
+}
+
+
+CpuImpl::CpuImpl(const Options &options, unsigned valueSize) {
+    if (valueSize != 1 && valueSize != 2 && valueSize != 4) {
+        std::ostringstream oss;
+        oss << "unsupported Value size of " << valueSize << " bytes.  The host CPU backend supports 8, 16 and "
+            << "32-bit integer elements";
+        throw xilinx_apps::cosinesim::Exception(oss.str());
+    }
+    valueSize_ = valueSize;
+
+    vecLength_ = 200;
+    if (options.vecLength > 0)
+        vecLength_ = options.vecLength;
+    const std::int64_t rowAlign = RowBytes / valueSize_;
+    stride_ = ((vecLength_ + rowAlign - 1) / rowAlign) * rowAlign;
+    rowBytes_ = stride_ * valueSize_;
+    reserveVectors_ = std::max(std::int64_t(0), options.reserveVectors);
+    ivfLists_ = std::max(0, options.ivfLists);
+    nprobe_ = std::max(1, options.nprobe);
+    dot_ = selectDotProduct(valueSize_);
+    dotBlock_ = selectDotProductBlock(valueSize_);
+    std::cout << "INFO: CosineSim running on host CPU, vecLength=" << vecLength_ << ", " << valueSize_ * 8
+        << "-bit elements" << std::endl;
+}
+
+CpuImpl::~CpuImpl() {
+    drainAsyncMatches();
+    {
+        std::lock_guard<std::mutex> lock(asyncMutex_);
+        asyncStop_ = true;
+    }
+    asyncCv_.notify_all();
+    if (asyncThread_.joinable())
+        asyncThread_.join();
+    cleanGraph();
+    free(targets_);
+}
+
+void CpuImpl::startLoadPopulation(std::int64_t numVertices) {
+    cleanGraph();
+    if (numVertices <= 0)
+        return;
+    allocateRows(numVertices + reserveVectors_);
+    numVertices_ = numVertices;
+}
+
+// Grows rows_ to hold capacity rows, keeping the rows loaded so far
+void CpuImpl::allocateRows(std::int64_t capacity) {
+    char *rows = nullptr;
+    const std::size_t bytes = std::size_t(capacity) * rowBytes_;
+    if (posix_memalign(reinterpret_cast<void **>(&rows), 64, bytes) != 0) {
+        std::ostringstream oss;
+        oss << "failed to allocate " << bytes << " bytes for " << capacity << " population vectors";
+        throw xilinx_apps::cosinesim::Exception(oss.str());
+    }
+    if (rows_ != nullptr)
+        std::memcpy(rows, rows_, std::size_t(numRows_) * rowBytes_);
+    free(rows_);
+    rows_ = rows;
+    capacity_ = capacity;
+}
+
+void CpuImpl::copyRow(RowIndex r, const void *src) {
+    std::memcpy(row(r), src, vecLength_ * valueSize_);
+    std::memset(row(r) + vecLength_ * valueSize_, 0, rowBytes_ - vecLength_ * valueSize_);
+}
+
+void CpuImpl::computeNorm(RowIndex r) {
+    if (valueSize_ == 2)
+        saturateInt16(row(r), vecLength_);
+    squares_[r] = dot_(row(r), row(r), stride_);
+    norms_[r] = std::sqrt(float(squares_[r]));
+}
+
+void *CpuImpl::getPopulationVectorBuffer(RowIndex &rowIndex) {
+    if (numRows_ == numVertices_)
+        return nullptr;
+    rowIndex = numRows_++;
+    return row(rowIndex);
+}
+
+void CpuImpl::finishCurrentPopulationVector(void *pbuf) {
+    std::memset(static_cast<char *>(pbuf) + vecLength_ * valueSize_, 0, rowBytes_ - vecLength_ * valueSize_);
+}
+
+void CpuImpl::loadPopulationRows(RowIndex firstRow, const void *matrix, RowIndex numRows, ColIndex stride) {
+    if (firstRow < 0 || numRows < 0 || firstRow + numRows > numVertices_ || stride < vecLength_) {
+        std::ostringstream oss;
+        oss << "invalid population row range: firstRow=" << firstRow << " numRows=" << numRows
+            << " stride=" << stride << " numVertices=" << numVertices_ << " vecLength=" << vecLength_;
+        throw xilinx_apps::cosinesim::Exception(oss.str());
+    }
+    const char *src = static_cast<const char *>(matrix);
+    for (RowIndex r = firstRow; r < firstRow + numRows; ++r, src += stride * valueSize_)
+        copyRow(r, src);
+    std::lock_guard<std::mutex> lock(loadMutex_);
+    numRows_ = std::max(numRows_, firstRow + numRows);
+}
+
+void CpuImpl::finishLoadPopulation() {
+    squares_.resize(numRows_);
+    norms_.resize(numRows_);
+    deleted_.assign(numRows_, 0);
+    numDeleted_ = 0;
+    for (RowIndex r = 0; r < numRows_; ++r)
+        computeNorm(r);
+    buildIndex();
+    populationLoaded_ = true;
+}
+
+void CpuImpl::toFloat(const void *row, float *out) const {
+    if (valueSize_ == 1)
+        copyToFloat<std::int8_t>(row, vecLength_, out);
+    else if (valueSize_ == 2)
+        copyToFloat<std::int16_t>(row, vecLength_, out);
+    else
+        copyToFloat<std::int32_t>(row, vecLength_, out);
+}
+
+// Dot products of vec with every centroid.  Centroids are stored element-major, so the inner loop runs across
+// the lists and vectorizes without reordering any float sums.
+void CpuImpl::scoreLists(const float *vec, float *scores) const {
+    const std::size_t numLists = centroids_.size() / vecLength_;
+    std::fill_n(scores, numLists, 0.0f);
+    for (int i = 0; i < vecLength_; ++i) {
+        const float x = vec[i];
+        const float *column = &centroids_[i * numLists];
+        for (std::size_t c = 0; c < numLists; ++c)
+            scores[c] += column[c] * x;
+    }
+}
+
+// The centroid with the largest dot product with vec, which for unit centroids is the most similar one
+int CpuImpl::nearestList(const float *vec, float *scores) const {
+    const std::size_t numLists = centroids_.size() / vecLength_;
+    scoreLists(vec, scores);
+    return int(std::max_element(scores, scores + numLists) - scores);
+}
+
+// Spherical k-means over an evenly spaced sample of rows, then every row goes to the list of its nearest centroid
+void CpuImpl::buildIndex() {
+    centroids_.clear();
+    listOffsets_.clear();
+    listRows_.clear();
+    rowList_.clear();
+    pendingRows_.clear();
+    if (ivfLists_ == 0 || numRows_ < ivfLists_)
+        return;
+
+    const std::size_t vl = vecLength_;
+    const RowIndex numSamples = std::min(numRows_, ivfLists_ * IvfTrainPerList);
+    std::vector<float> samples(numSamples * vl);
+    for (RowIndex s = 0; s < numSamples; ++s) {
+        toFloat(row(s * numRows_ / numSamples), &samples[s * vl]);
+        normalize(&samples[s * vl], vl);
+    }
+    const std::size_t numLists = ivfLists_;
+    centroids_.resize(numLists * vl);
+    for (std::size_t c = 0; c < numLists; ++c)
+        for (std::size_t i = 0; i < vl; ++i)
+            centroids_[i * numLists + c] = samples[(c * numSamples / numLists) * vl + i];
+
+    std::vector<std::int32_t> sampleList(numSamples);
+    for (int iter = 0; iter < IvfIterations; ++iter) {
+        parallelFor(numSamples, 256, [&](std::int64_t begin, std::int64_t end) {
+            std::vector<float> scores(numLists);
+            for (RowIndex s = begin; s < end; ++s)
+                sampleList[s] = nearestList(&samples[s * vl], scores.data());
+        });
+        std::vector<float> sums(numLists * vl, 0.0f);
+        std::vector<RowIndex> counts(numLists, 0);
+        for (RowIndex s = 0; s < numSamples; ++s) {
+            float *sum = &sums[sampleList[s] * vl];
+            for (std::size_t i = 0; i < vl; ++i)
+                sum[i] += samples[s * vl + i];
+            ++counts[sampleList[s]];
+        }
+        for (std::size_t c = 0; c < numLists; ++c) {
+            // an empty list restarts from some other sample
+            float *centroid = (counts[c] > 0) ? &sums[c * vl] : &samples[((c * 7919 + iter) % numSamples) * vl];
+            normalize(centroid, vl);
+            for (std::size_t i = 0; i < vl; ++i)
+                centroids_[i * numLists + c] = centroid[i];
+        }
+    }
+
+    rowList_.resize(numRows_);
+    parallelFor(numRows_, 1024, [&](std::int64_t begin, std::int64_t end) {
+        std::vector<float> vec(vl), scores(numLists);
+        for (RowIndex r = begin; r < end; ++r) {
+            toFloat(row(r), vec.data());
+            rowList_[r] = nearestList(vec.data(), scores.data());
+        }
+    });
+    buildLists();
+    std::cout << "INFO: CosineSim IVF index built with " << ivfLists_ << " lists over " << numRows_
+        << " vectors, nprobe=" << nprobe_ << std::endl;
+}
+
+// Assigns the pending rows to their nearest lists and lays the lists out again
+void CpuImpl::buildLists() {
+    const int numLists = int(centroids_.size() / vecLength_);
+    std::vector<float> vec(vecLength_), scores(numLists);
+    for (RowIndex r : pendingRows_) {
+        toFloat(row(r), vec.data());
+        rowList_[r] = nearestList(vec.data(), scores.data());
+    }
+    pendingRows_.clear();
+
+    listOffsets_.assign(numLists + 1, 0);
+    for (RowIndex r = 0; r < numRows_; ++r)
+        ++listOffsets_[rowList_[r] + 1];
+    std::partial_sum(listOffsets_.begin(), listOffsets_.end(), listOffsets_.begin());
+    listRows_.resize(numRows_);
+    std::vector<RowIndex> next(listOffsets_.begin(), listOffsets_.end() - 1);
+    for (RowIndex r = 0; r < numRows_; ++r)
+        listRows_[next[rowList_[r]]++] = r;
+}
+
+// Takes a new or changed row out of its list until the next buildLists()
+void CpuImpl::markPending(RowIndex r) {
+    if (centroids_.empty())
+        return;
+    if (r < RowIndex(rowList_.size()) && rowList_[r] < 0)
+        return;
+    if (r >= RowIndex(rowList_.size()))
+        rowList_.resize(r + 1);
+    rowList_[r] = -1;
+    pendingRows_.push_back(r);
+    if (RowIndex(pendingRows_.size()) > std::max(RowIndex(1024), numRows_ / 8))
+        buildLists();
+}
+
+void CpuImpl::checkPopulationChange(const char *function, RowIndex rowIndex, RowIndex numRows) {
+    if (!populationLoaded_) {
+        std::ostringstream oss;
+        oss << function << ": the population must be loaded with finishLoadPopulation() first";
+        throw xilinx_apps::cosinesim::Exception(oss.str());
+    }
+    if (rowIndex < 0 || numRows < 0 || rowIndex + numRows > numRows_) {
+        std::ostringstream oss;
+        oss << function << ": row " << rowIndex + numRows - 1 << " is out of range (" << numRows_
+            << " population vectors)";
+        throw xilinx_apps::cosinesim::Exception(oss.str());
+    }
+    // matches submitted before the change see the old population
+    drainAsyncMatches();
+}
+
+void CpuImpl::updatePopulationVector(RowIndex rowIndex, const void *elements) {
+    checkPopulationChange(__FUNCTION__, rowIndex, 1);
+    std::lock_guard<std::mutex> matchLock(matchMutex_);
+    copyRow(rowIndex, elements);
+    computeNorm(rowIndex);
+    markPending(rowIndex);
+    if (deleted_[rowIndex]) {
+        deleted_[rowIndex] = 0;
+        --numDeleted_;
+    }
+}
+
+RowIndex CpuImpl::appendPopulationVectors(const void *matrix, RowIndex numRows, ColIndex stride) {
+    checkPopulationChange(__FUNCTION__, 0, 0);
+    if (numRows < 0 || stride < vecLength_) {
+        std::ostringstream oss;
+        oss << __FUNCTION__ << ": invalid arguments numRows=" << numRows << " stride=" << stride
+            << " vecLength=" << vecLength_;
+        throw xilinx_apps::cosinesim::Exception(oss.str());
+    }
+    std::lock_guard<std::mutex> matchLock(matchMutex_);
+    const RowIndex firstRow = numRows_;
+    if (firstRow + numRows > capacity_)
+        allocateRows(std::max(firstRow + numRows, capacity_ + capacity_ / 2));
+    const char *src = static_cast<const char *>(matrix);
+    squares_.resize(firstRow + numRows);
+    norms_.resize(firstRow + numRows);
+    deleted_.resize(firstRow + numRows, 0);
+    for (RowIndex r = firstRow; r < firstRow + numRows; ++r, src += stride * valueSize_) {
+        copyRow(r, src);
+        computeNorm(r);
+    }
+    numRows_ = firstRow + numRows;
+    for (RowIndex r = firstRow; r < numRows_; ++r)
+        markPending(r);
+    return firstRow;
+}
+
+void CpuImpl::deletePopulationVector(RowIndex rowIndex) {
+    checkPopulationChange(__FUNCTION__, rowIndex, 1);
+    std::lock_guard<std::mutex> matchLock(matchMutex_);
+    if (!deleted_[rowIndex]) {
+        deleted_[rowIndex] = 1;
+        ++numDeleted_;
+    }
+}
+
+XVector<Result> CpuImpl::matchTargetVector(unsigned numResults, void *elements) {
+    XVector<XVector<Result>> results = matchTargetVectors(numResults, elements, 1);
+    return results[0];
+}
+
+XVector<XVector<Result>> CpuImpl::matchTargetVectors(unsigned numResults, void *elements, std::size_t numTargets) {
+    return matchTargets(numResults, elements, numTargets, false, nullptr);
+}
+
+XVector<XVector<Result>> CpuImpl::matchTargetVectorsExact(unsigned numResults, void *elements,
+                                                          std::size_t numTargets) {
+    return matchTargets(numResults, elements, numTargets, true, nullptr);
+}
+
+XVector<XVector<Result>> CpuImpl::matchTargetVectorsFiltered(unsigned numResults, void *elements,
+                                                             std::size_t numTargets, const RowFilter &filter) {
+    return matchTargets(numResults, elements, numTargets, true, &filter);
+}
+
+// A filtered match always scans the whole population: the filter already skips most of it when selective, and
+// the rows it allows may sit in lists the IVF index would not probe
+XVector<XVector<Result>> CpuImpl::matchTargets(unsigned numResults, void *elements, std::size_t numTargets,
+                                               bool exact, const RowFilter *filter) {
+    std::lock_guard<std::mutex> matchLock(matchMutex_);
+    XVector<XVector<Result>> results(numTargets);
+    if (numResults > norms_.size() - numDeleted_)
+        numResults = norms_.size() - numDeleted_;
+    if (numResults == 0 || numTargets == 0)
+        return results;
+
+    // Targets are padded to the population row stride, with room for a partial DotBlock at the end
+    const std::size_t numTargetRows = ((numTargets + DotBlock - 1) / DotBlock) * DotBlock;
+    if (numTargetRows > targetsCapacity_) {
+        free(targets_);
+        targets_ = nullptr;
+        targetsCapacity_ = 0;
+        if (posix_memalign(reinterpret_cast<void **>(&targets_), 64, numTargetRows * rowBytes_) != 0)
+            throw xilinx_apps::cosinesim::Exception("failed to allocate the target vector buffer");
+        targetsCapacity_ = numTargetRows;
+    }
+    std::memset(targets_, 0, numTargetRows * rowBytes_);
+    std::vector<std::int64_t> targetSquares(numTargets);
+    std::vector<float> targetNorms(numTargets);
+    for (std::size_t t = 0; t < numTargets; ++t) {
+        char *target = targets_ + t * rowBytes_;
+        std::memcpy(target, static_cast<const char *>(elements) + t * vecLength_ * valueSize_,
+                    vecLength_ * valueSize_);
+        if (valueSize_ == 2)
+            saturateInt16(target, vecLength_);
+        targetSquares[t] = dot_(target, target, stride_);
+        targetNorms[t] = std::sqrt(float(targetSquares[t]));
+    }
+
+    std::vector<std::vector<Result>> heaps(numTargets);
+    for (std::size_t t = 0; t < numTargets; ++t)
+        heaps[t].reserve(numResults);
+    if (exact || centroids_.empty()) {
+        scanAll(numResults, numTargets, targetSquares, targetNorms, filter, heaps);
+    } else {
+        parallelFor(numTargets, 4, [&](std::int64_t begin, std::int64_t end) {
+            for (std::size_t t = begin; t < std::size_t(end); ++t)
+                scanIvf(numResults, t, targetSquares[t], targetNorms[t], heaps[t]);
+        });
+    }
+
+    for (std::size_t t = 0; t < numTargets; ++t) {
+        std::sort_heap(heaps[t].begin(), heaps[t].end(), isBetterResult);
+        results[t].reserve(heaps[t].size());
+        for (const Result &res : heaps[t])
+            results[t].push_back(res);
+    }
+    return results;
+}
+
+// Appends the rows of [begin, end) that are live and pass the filter; begin is a multiple of 64.  A whole word of
+// excluded rows costs one test.
+void CpuImpl::collectRows(RowIndex begin, RowIndex end, const RowFilter *filter, std::vector<RowIndex> &rows) const {
+    rows.clear();
+    for (RowIndex base = begin; base < end; base += 64) {
+        std::uint64_t bits = ~std::uint64_t(0);
+        if (filter != nullptr && filter->allowBits != nullptr) {
+            if (base >= filter->numBits)
+                break;
+            bits = filter->allowBits[base / 64];
+            if (filter->numBits - base < 64)
+                bits &= (std::uint64_t(1) << (filter->numBits - base)) - 1;
+        }
+        if (end - base < 64)
+            bits &= (std::uint64_t(1) << (end - base)) - 1;
+        for (; bits != 0; bits &= bits - 1) {
+            const RowIndex r = base + __builtin_ctzll(bits);
+            if (deleted_[r])
+                continue;
+            if (filter != nullptr && filter->predicate != nullptr && !filter->predicate(filter->context, r))
+                continue;
+            rows.push_back(r);
+        }
+    }
+}
+
+void CpuImpl::scanAll(unsigned numResults, std::size_t numTargets, const std::vector<std::int64_t> &targetSquares,
+                      const std::vector<float> &targetNorms, const RowFilter *filter,
+                      std::vector<std::vector<Result>> &heaps) {
+    // Blocked matrix-matrix product: a block of population rows stays in cache while every target streams over
+    // it, and each row load feeds DotBlock targets at once
+    const RowIndex numRows = norms_.size();
+    std::vector<RowIndex> blockRows;
+    blockRows.reserve(RowBlock);
+    std::int64_t dots[DotBlock];
+    for (RowIndex blockStart = 0; blockStart < numRows; blockStart += RowBlock) {
+        const RowIndex blockEnd = std::min(blockStart + RowBlock, numRows);
+        collectRows(blockStart, blockEnd, filter, blockRows);
+        if (blockRows.empty())
+            continue;
+        for (std::size_t t = 0; t < numTargets; t += DotBlock) {
+            const std::size_t tEnd = std::min(t + DotBlock, numTargets);
+            for (RowIndex r : blockRows) {
+                dotBlock_(row(r), targets_ + t * rowBytes_, stride_, dots);
+                for (std::size_t k = t; k < tEnd; ++k)
+                    pushResult(heaps[k], numResults, r, cosineSimilarity(dots[k - t], squares_[r], norms_[r],
+                                                                         targetSquares[k], targetNorms[k]));
+            }
+        }
+    }
+}
+
+// Scans the nprobe lists whose centroids are nearest target t, then the pending rows
+void CpuImpl::scanIvf(unsigned numResults, std::size_t t, std::int64_t targetSquare, float targetNorm,
+                      std::vector<Result> &heap) {
+    const char *target = targets_ + t * rowBytes_;
+    const int numLists = int(listOffsets_.size()) - 1;
+    std::vector<float> query(vecLength_), scores(numLists);
+    toFloat(target, query.data());
+    scoreLists(query.data(), scores.data());
+    std::vector<std::pair<float, int>> order(numLists);
+    for (int c = 0; c < numLists; ++c)
+        order[c] = std::make_pair(-scores[c], c);
+    const int numProbes = std::min(nprobe_, numLists);
+    std::partial_sort(order.begin(), order.begin() + numProbes, order.end());
+
+    for (int p = 0; p < numProbes; ++p) {
+        const int list = order[p].second;
+        const RowIndex end = listOffsets_[list + 1];
+        for (RowIndex i = listOffsets_[list]; i < end; ++i) {
+            const RowIndex r = listRows_[i];
+            // list rows are scattered through the population, so fetch the next one while this one is scored
+            if (i + 1 < end) {
+                const RowIndex next = listRows_[i + 1];
+                for (std::size_t b = 0; b < rowBytes_; b += RowBytes)
+                    __builtin_prefetch(row(next) + b);
+                __builtin_prefetch(&rowList_[next]);
+                __builtin_prefetch(&deleted_[next]);
+                __builtin_prefetch(&squares_[next]);
+                __builtin_prefetch(&norms_[next]);
+            }
+            // rows that moved to pendingRows_ are scanned below
+            if (rowList_[r] != list || deleted_[r])
+                continue;
+            pushResult(heap, numResults, r, cosineSimilarity(dot_(row(r), target, stride_), squares_[r], norms_[r],
+                                                             targetSquare, targetNorm));
+        }
+    }
+    for (RowIndex r : pendingRows_)
+        if (!deleted_[r])
+            pushResult(heap, numResults, r, cosineSimilarity(dot_(row(r), target, stride_), squares_[r], norms_[r],
+                                                             targetSquare, targetNorm));
+}
+
+void CpuImpl::matchTargetVectorAsync(unsigned numResults, void *elements, MatchCallback callback,
+                                     void *context) {
+    AsyncMatch match;
+    match.numResults = numResults;
+    match.target.assign(static_cast<const char *>(elements),
+                        static_cast<const char *>(elements) + vecLength_ * valueSize_);
+    match.callback = callback;
+    match.context = context;
+    {
+        std::lock_guard<std::mutex> lock(asyncMutex_);
+        asyncQueue_.push_back(std::move(match));
+        if (!asyncThread_.joinable())
+            asyncThread_ = std::thread(&CpuImpl::asyncLoop, this);
+    }
+    asyncCv_.notify_all();
+}
+
+void CpuImpl::asyncLoop() {
+    std::unique_lock<std::mutex> lock(asyncMutex_);
+    while (true) {
+        asyncCv_.wait(lock, [this] { return asyncStop_ || !asyncQueue_.empty(); });
+        if (asyncQueue_.empty())
+            return;
+        std::vector<AsyncMatch> batch(std::make_move_iterator(asyncQueue_.begin()),
+                                      std::make_move_iterator(asyncQueue_.end()));
+        asyncQueue_.clear();
+        asyncRunning_ = batch.size();
+        lock.unlock();
+
+        // Run the batch at its largest numResults; the best k of a sorted list of more are its first k
+        unsigned maxResults = 0;
+        const std::size_t targetBytes = vecLength_ * valueSize_;
+        std::vector<char> targets(batch.size() * targetBytes);
+        for (std::size_t t = 0; t < batch.size(); ++t) {
+            maxResults = std::max(maxResults, batch[t].numResults);
+            std::copy(batch[t].target.begin(), batch[t].target.end(), targets.begin() + t * targetBytes);
+        }
+        XVector<XVector<Result>> results;
+        std::string error;
+        try {
+            results = matchTargetVectors(maxResults, targets.data(), batch.size());
+        } catch (const std::exception &e) {
+            error = e.what();
+        }
+        for (std::size_t t = 0; t < batch.size(); ++t) {
+            if (!error.empty()) {
+                batch[t].callback(batch[t].context, nullptr, error.c_str());
+                continue;
+            }
+            const std::size_t count = std::min<std::size_t>(results[t].size(), batch[t].numResults);
+            XVector<Result> result;
+            result.reserve(count);
+            for (std::size_t k = 0; k < count; ++k)
+                result.push_back(results[t][k]);
+            batch[t].callback(batch[t].context, &result, nullptr);
+        }
+
+        lock.lock();
+        asyncRunning_ = 0;
+        asyncCv_.notify_all();
+    }
+}
+
+// Block until every asynchronous match submitted so far has been reported
+void CpuImpl::drainAsyncMatches() {
+    std::unique_lock<std::mutex> lock(asyncMutex_);
+    asyncCv_.wait(lock, [this] { return asyncQueue_.empty() && asyncRunning_ == 0; });
+}
+
+void CpuImpl::saveSnapshot(const char *path, const std::uint64_t *rowIds, RowIndex numRowIds) {
+    if (rows_ == nullptr)
+        throw xilinx_apps::cosinesim::Exception("saveSnapshot: no population has been loaded");
+
+    SnapshotHeader header = makeSnapshotHeader(SnapshotBackendCpu);
+    header.valueSize = valueSize_;
+    header.vecLength = vecLength_;
+    header.rowStride = stride_;
+    header.numVertices = numRows_;
+    header.numCus = 1;
+    header.numPUs = 1;
+    header.channelsPU = 1;
+    header.numRowIds = numRowIds;
+    header.capacity = numRows_;
+    header.numDeleted = numDeleted_;
+    std::vector<std::int32_t> layout(1, std::int32_t(numRows_));
+
+    SnapshotWriter writer(path);
+    writer.writeHeader(header, layout);
+    writer.writeSection(rows_, std::size_t(numRows_) * rowBytes_);
+    writer.writeSection(rowIds, numRowIds * sizeof(std::uint64_t));
+    std::vector<std::int64_t> deletedRows;
+    for (RowIndex r = 0; r < RowIndex(deleted_.size()); ++r)
+        if (deleted_[r])
+            deletedRows.push_back(r);
+    writer.writeSection(deletedRows.data(), deletedRows.size() * sizeof(std::int64_t));
+    writer.close();
+}
+
+XVector<std::uint64_t> CpuImpl::loadSnapshot(const char *path) {
+    SnapshotReader reader(path);
+    SnapshotHeader header;
+    std::vector<std::int32_t> layout;
+    reader.readHeader(SnapshotBackendCpu, header, layout);
+    checkSnapshotField(path, "valueSize", header.valueSize, valueSize_);
+    checkSnapshotField(path, "vecLength", header.vecLength, vecLength_);
+    checkSnapshotField(path, "rowStride", header.rowStride, stride_);
+
+    startLoadPopulation(header.numVertices);
+    reader.readSection(rows_, std::size_t(header.numVertices) * rowBytes_);
+    XVector<std::uint64_t> rowIds(header.numRowIds);
+    reader.readSection(rowIds.data(), header.numRowIds * sizeof(std::uint64_t));
+    std::vector<std::int64_t> deletedRows(header.numDeleted);
+    reader.readSection(deletedRows.data(), deletedRows.size() * sizeof(std::int64_t));
+    numRows_ = header.numVertices;
+    finishLoadPopulation();
+    for (std::int64_t r : deletedRows) {
+        if (r < 0 || r >= numRows_ || deleted_[r])
+            throw xilinx_apps::cosinesim::Exception(std::string("snapshot ") + path + ": corrupt deleted row list");
+        deleted_[r] = 1;
+    }
+    numDeleted_ = header.numDeleted;
+    return rowIds;
+}
+
+void CpuImpl::cleanGraph() {
+    drainAsyncMatches();
+    free(rows_);
+    rows_ = nullptr;
+    numVertices_ = 0;
+    numRows_ = 0;
+    capacity_ = 0;
+    squares_.clear();
+    norms_.clear();
+    deleted_.clear();
+    numDeleted_ = 0;
+    centroids_.clear();
+    listOffsets_.clear();
+    listRows_.clear();
+    rowList_.clear();
+    pendingRows_.clear();
+    populationLoaded_ = false;
+}
+
+} // namespace cosinesim
+} // namespace xilinx_apps
@@ -0,0 +1,166 @@
+/*
+ * Copyright 2021 Xilinx, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef XILINX_APPS_COSINESIM_CPU_HPP
+#define XILINX_APPS_COSINESIM_CPU_HPP
+
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "cosinesim.hpp"
+
+namespace xilinx_apps {
+namespace cosinesim {
+
+// dot product of two rows of stride elements (a whole number of 64-byte lines), accumulated in 64 bits like the
+// kernel.  The element type is int8, int16 or int32, as picked by the valueSize given to the select functions.
+typedef std::int64_t (*DotProductFunc)(const void *a, const void *b, std::int64_t stride);
+
+// dot products of one row with DotBlock consecutive rows (stride apart), written to out[0..DotBlock-1]
+const int DotBlock = 4;
+typedef void (*DotProductBlockFunc)(const void *a, const void *b, std::int64_t stride, std::int64_t *out);
+
+DotProductFunc selectDotProduct(unsigned valueSize);
+DotProductBlockFunc selectDotProductBlock(unsigned valueSize);
+
+// Cosine similarity from a dot product and each vector's sum of squares and norm, with the same single-precision
+// arithmetic and zero-norm rules as the kernel's ALU stage, so host scores match the FPGA's
+double cosineSimilarity(std::int64_t dot, std::int64_t squareA, float normA, std::int64_t squareB, float normB);
+
+// Higher similarity first, ties by lower index.  Used as a heap comparator, the root is the worst of the top K
+bool isBetterResult(const Result &a, const Result &b);
+
+// Offers a result to a top-numResults heap ordered by isBetterResult()
+void pushResult(std::vector<Result> &heap, unsigned numResults, RowIndex index, double similarity);
+
+//-----------------------------------------------------------------------------
+// Host CPU implementation of ImplBase (Options::cpuBackend).
+// Population vectors live in one 64-byte aligned matrix of 8, 16 or 32-bit
+// elements (the CosineSim Value type) whose rows are padded to a multiple of
+// 64 bytes, so every row starts on a cache line and the SIMD loops need no
+// tail handling.  Narrow elements cut memory and scan bandwidth 2-4x.
+//-----------------------------------------------------------------------------
+class CpuImpl : public ImplBase {
+public:
+    static const std::int64_t RowBytes = 64;  // rows are padded to a multiple of one cache line
+    static const std::int64_t RowBlock = 256;  // population rows kept cache-resident while a batch streams over them
+    static const std::int64_t IvfTrainPerList = 64;  // k-means training rows per IVF list
+    static const int IvfIterations = 10;             // k-means iterations
+
+    CpuImpl(const Options &options, unsigned valueSize);
+    virtual ~CpuImpl();
+
+    virtual void startLoadPopulation(std::int64_t numVertices);
+    virtual void *getPopulationVectorBuffer(RowIndex &rowIndex);
+    virtual void finishCurrentPopulationVector(void *pbuf);
+    virtual void loadPopulationRows(RowIndex firstRow, const void *matrix, RowIndex numRows, ColIndex stride);
+    virtual void finishLoadPopulation();
+    virtual void updatePopulationVector(RowIndex rowIndex, const void *elements);
+    virtual RowIndex appendPopulationVectors(const void *matrix, RowIndex numRows, ColIndex stride);
+    virtual void deletePopulationVector(RowIndex rowIndex);
+    virtual XVector<Result> matchTargetVector(unsigned numResults, void *elements);
+    virtual XVector<XVector<Result>> matchTargetVectors(unsigned numResults, void *elements, std::size_t numTargets);
+    virtual XVector<XVector<Result>> matchTargetVectorsExact(unsigned numResults, void *elements,
+                                                             std::size_t numTargets);
+    virtual XVector<XVector<Result>> matchTargetVectorsFiltered(unsigned numResults, void *elements,
+                                                                std::size_t numTargets, const RowFilter &filter);
+    virtual void matchTargetVectorAsync(unsigned numResults, void *elements, MatchCallback callback, void *context);
+    virtual void saveSnapshot(const char *path, const std::uint64_t *rowIds, RowIndex numRowIds);
+    virtual XVector<std::uint64_t> loadSnapshot(const char *path);
+    virtual void cleanGraph();
+
+private:
+    // A target queued by matchTargetVectorAsync().  The worker thread takes every queued target at once and
+    // runs them as one matchTargetVectors() batch.
+    struct AsyncMatch {
+        unsigned numResults;
+        std::vector<char> target;
+        MatchCallback callback;
+        void *context;
+    };
+
+    char *row(RowIndex r) const { return rows_ + r * rowBytes_; }
+    void allocateRows(std::int64_t capacity);
+    void copyRow(RowIndex r, const void *src);
+    void computeNorm(RowIndex r);  // also saturates 16-bit elements, see saturateInt16()
+    void checkPopulationChange(const char *function, RowIndex rowIndex, RowIndex numRows);
+    XVector<XVector<Result>> matchTargets(unsigned numResults, void *elements, std::size_t numTargets, bool exact,
+                                          const RowFilter *filter);
+    void collectRows(RowIndex begin, RowIndex end, const RowFilter *filter, std::vector<RowIndex> &rows) const;
+    void scanAll(unsigned numResults, std::size_t numTargets, const std::vector<std::int64_t> &targetSquares,
+                 const std::vector<float> &targetNorms, const RowFilter *filter,
+                 std::vector<std::vector<Result>> &heaps);
+    void scanIvf(unsigned numResults, std::size_t t, std::int64_t targetSquare, float targetNorm,
+                 std::vector<Result> &heap);
+    void toFloat(const void *row, float *out) const;
+    void scoreLists(const float *vec, float *scores) const;
+    int nearestList(const float *vec, float *scores) const;
+    void buildIndex();
+    void buildLists();
+    void markPending(RowIndex r);
+    void asyncLoop();
+    void drainAsyncMatches();
+
+    int vecLength_;
+    unsigned valueSize_;            // bytes per element: 1, 2 or 4
+    std::int64_t stride_;           // row length in elements, a multiple of RowBytes / valueSize_
+    std::size_t rowBytes_;          // stride_ * valueSize_
+    std::int64_t reserveVectors_ = 0;  // Options::reserveVectors
+    std::int64_t numVertices_ = 0;  // rows requested by startLoadPopulation
+    std::int64_t numRows_ = 0;      // rows handed out or bulk loaded so far (highest row + 1), then appended
+    std::int64_t capacity_ = 0;     // rows allocated in rows_
+    char *rows_ = nullptr;          // capacity_ x stride_ matrix
+    char *targets_ = nullptr;       // padded copies of the current batch of target vectors
+    std::size_t targetsCapacity_ = 0;  // number of target rows targets_ can hold
+    std::vector<std::int64_t> squares_;  // per-row sum of squares
+    std::vector<float> norms_;           // per-row sqrt(squares_), float like the kernel
+    std::vector<char> deleted_;          // per-row tombstones, skipped by matchTargetVectors()
+    std::int64_t numDeleted_ = 0;
+    bool populationLoaded_ = false;      // finishLoadPopulation() has run
+    DotProductFunc dot_;
+    DotProductBlockFunc dotBlock_;
+
+    // Optional IVF index: spherical k-means centroids, and the rows of each centroid's list stored back to back
+    // (CSR).  Rows appended or changed after the build wait in pendingRows_, which every match scans, until enough
+    // gather to rebuild the lists.
+    int ivfLists_ = 0;                     // Options::ivfLists
+    int nprobe_ = 8;                       // Options::nprobe
+    std::vector<float> centroids_;         // vecLength_ x numLists (centroid c is column c), unit length;
+                                           // empty if there is no index
+    std::vector<RowIndex> listOffsets_;    // numLists + 1 offsets into listRows_
+    std::vector<RowIndex> listRows_;       // row indexes, list by list, ascending within a list
+    std::vector<std::int32_t> rowList_;    // list of each row, -1 while the row is pending
+    std::vector<RowIndex> pendingRows_;
+
+    std::mutex loadMutex_;   // guards numRows_ during concurrent loadPopulationRows() calls
+    std::mutex matchMutex_;  // matchTargetVectors() callers and the async worker share targets_
+    std::mutex asyncMutex_;
+    std::condition_variable asyncCv_;  // new match, batch reported, or stop
+    std::deque<AsyncMatch> asyncQueue_;
+    std::size_t asyncRunning_ = 0;     // matches taken by the worker and not yet reported
+    bool asyncStop_ = false;
+    std::thread asyncThread_;
+};
+
+} // namespace cosinesim
+} // namespace xilinx_apps
+
+#endif /* XILINX_APPS_COSINESIM_CPU_HPP */
@@ -0,0 +1,139 @@
+/*
+ * Copyright 2021 Xilinx, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstring>
+#include <sstream>
+
+#include "cosinesim.hpp"
+#include "cosinesim_snapshot.hpp"
+
+namespace xilinx_apps {
+namespace cosinesim {
+
+namespace {
+
+const char SnapshotMagic[8] = {'X', 'C', 'O', 'S', 'S', 'N', 'A', 'P'};
+
+void throwSnapshotError(const std::string &path, const std::string &what) {
+    std::ostringstream oss;
+    oss << "snapshot " << path << ": " << what;
+    throw xilinx_apps::cosinesim::Exception(oss.str());
+}
+
+} // namespace
+
+SnapshotHeader makeSnapshotHeader(SnapshotBackend backend) {
+    SnapshotHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, SnapshotMagic, sizeof(header.magic));
+    header.version = SnapshotVersion;
+    header.backend = backend;
+    return header;
+}
+
+void checkSnapshotField(const std::string &path, const char *field, std::int64_t saved, std::int64_t current) {
+    if (saved == current)
+        return;
+    std::ostringstream oss;
+    oss << "saved with " << field << "=" << saved << " but this CosineSim object has " << field << "=" << current;
+    throwSnapshotError(path, oss.str());
+}
+
+
+SnapshotWriter::SnapshotWriter(const std::string &path)
+: path_(path), out_(path, std::ios::binary | std::ios::trunc)
+{
+    if (!out_)
+        throwSnapshotError(path_, "cannot be opened for writing");
+}
+
+void SnapshotWriter::writeHeader(const SnapshotHeader &header, const std::vector<std::int32_t> &layout) {
+    write(&header, sizeof(header));
+    write(layout.data(), layout.size() * sizeof(std::int32_t));
+    pad();
+}
+
+void SnapshotWriter::writeSection(const void *data, std::size_t bytes) {
+    write(data, bytes);
+    pad();
+}
+
+void SnapshotWriter::close() {
+    out_.close();
+    if (!out_)
+        throwSnapshotError(path_, "write failed");
+}
+
+void SnapshotWriter::write(const void *data, std::size_t bytes) {
+    out_.write(static_cast<const char *>(data), bytes);
+    if (!out_)
+        throwSnapshotError(path_, "write failed");
+    pos_ += bytes;
+}
+
+void SnapshotWriter::pad() {
+    static const char zeros[SnapshotAlign] = {};
+    const std::size_t rest = pos_ % SnapshotAlign;
+    if (rest != 0)
+        write(zeros, SnapshotAlign - rest);
+}
+
+
+SnapshotReader::SnapshotReader(const std::string &path)
+: path_(path), in_(path, std::ios::binary)
+{
+    if (!in_)
+        throwSnapshotError(path_, "cannot be opened for reading");
+}
+
+void SnapshotReader::readHeader(SnapshotBackend backend, SnapshotHeader &header, std::vector<std::int32_t> &layout) {
+    read(&header, sizeof(header));
+    if (std::memcmp(header.magic, SnapshotMagic, sizeof(header.magic)) != 0)
+        throwSnapshotError(path_, "not a CosineSim snapshot file");
+    checkSnapshotField(path_, "version", header.version, SnapshotVersion);
+    checkSnapshotField(path_, "backend", header.backend, backend);
+    if (header.numVertices < 0 || header.numRowIds < 0 || header.capacity < header.numVertices
+            || header.numDeleted < 0 || header.numDeleted > header.numVertices || header.numCus == 0
+            || header.numPUs == 0)
+        throwSnapshotError(path_, "corrupt header");
+    layout.resize(std::size_t(header.numCus) * header.numPUs);
+    read(layout.data(), layout.size() * sizeof(std::int32_t));
+    skipPadding();
+}
+
+void SnapshotReader::readSection(void *data, std::size_t bytes) {
+    read(data, bytes);
+    skipPadding();
+}
+
+void SnapshotReader::read(void *data, std::size_t bytes) {
+    in_.read(static_cast<char *>(data), bytes);
+    if (std::size_t(in_.gcount()) != bytes)
+        throwSnapshotError(path_, "file is truncated");
+    pos_ += bytes;
+}
+
+void SnapshotReader::skipPadding() {
+    const std::size_t rest = pos_ % SnapshotAlign;
+    if (rest == 0)
+        return;
+    in_.seekg(SnapshotAlign - rest, std::ios::cur);
+    pos_ += SnapshotAlign - rest;
+}
+
+} // namespace cosinesim
+} // namespace xilinx_apps
@@ -0,0 +1,107 @@
+/*
+ * Copyright 2021 Xilinx, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef XILINX_APPS_COSINESIM_SNAPSHOT_HPP
+#define XILINX_APPS_COSINESIM_SNAPSHOT_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace xilinx_apps {
+namespace cosinesim {
+
+//-----------------------------------------------------------------------------
+// Population snapshot file (CosineSim::saveSnapshot() / loadSnapshot()).
+//
+// The file holds a SnapshotHeader, a layout table of numCus * numPUs int32 row
+// counts, then every population buffer in device order, the row ID map and
+// finally the indices of deleted rows (int64).  Each section after the header starts on a SnapshotAlign boundary, so
+// a section can be read, or mmap'ed, straight into an aligned buffer.  Values
+// are stored in host byte order.
+//-----------------------------------------------------------------------------
+const std::uint32_t SnapshotVersion = 2;
+const std::size_t SnapshotAlign = 4096;
+
+enum SnapshotBackend {
+    SnapshotBackendFpga = 1,  // one buffer per CU per HBM/DDR channel, numCus * numPUs * channelsPU in all
+    SnapshotBackendCpu = 2    // one buffer holding every row
+};
+
+struct SnapshotHeader {
+    char magic[8];                // SnapshotMagic
+    std::uint32_t version;        // SnapshotVersion
+    std::uint32_t backend;        // SnapshotBackend
+    std::uint32_t valueSize;      // bytes per vector element
+    std::int32_t vecLength;       // elements per vector
+    std::int64_t rowStride;       // elements per stored (padded) row
+    std::int64_t numVertices;     // population vectors
+    std::uint32_t numCus;
+    std::uint32_t numPUs;         // PUs per CU
+    std::uint32_t channelsPU;     // channels per PU
+    std::uint32_t reserved;
+    std::int64_t numRowIds;       // entries in the row ID map, 0 if none was saved
+    std::int64_t capacity;        // rows the population buffers were sized for, numVertices plus reserve
+    std::int64_t numDeleted;      // entries in the deleted row list
+};
+
+// Fills in the fields common to every snapshot
+SnapshotHeader makeSnapshotHeader(SnapshotBackend backend);
+
+class SnapshotWriter {
+public:
+    explicit SnapshotWriter(const std::string &path);
+
+    void writeHeader(const SnapshotHeader &header, const std::vector<std::int32_t> &layout);
+    void writeSection(const void *data, std::size_t bytes);
+    void close();  // throws if any write failed
+
+private:
+    void write(const void *data, std::size_t bytes);
+    void pad();
+
+    std::string path_;
+    std::ofstream out_;
+    std::size_t pos_ = 0;
+};
+
+class SnapshotReader {
+public:
+    explicit SnapshotReader(const std::string &path);
+
+    // Throws unless the file is a snapshot of the current version for the given backend
+    void readHeader(SnapshotBackend backend, SnapshotHeader &header, std::vector<std::int32_t> &layout);
+    void readSection(void *data, std::size_t bytes);
+
+private:
+    void read(void *data, std::size_t bytes);
+    void skipPadding();
+
+    std::string path_;
+    std::ifstream in_;
+    std::size_t pos_ = 0;
+};
+
+// Throws an Exception naming the first header field that does not match the current configuration
+void checkSnapshotField(const std::string &path, const char *field, std::int64_t saved, std::int64_t current);
+
+} // namespace cosinesim
+} // namespace xilinx_apps
+
+#endif /* XILINX_APPS_COSINESIM_SNAPSHOT_HPP */
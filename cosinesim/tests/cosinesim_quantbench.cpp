@@ -0,0 +1,214 @@
+/*
+ * Copyright 2021 Xilinx, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Recall and throughput of quantized population storage on the host CPU backend.
+//
+// Generates clustered floating-point embeddings, finds the exact top K of each query in floating point, then
+// quantizes the population and queries to 32, 16 and 8-bit elements with quantizeVector() and reports, for each
+// width, the population size, match throughput and recall@K against the floating-point top K.  With -i the matches
+// go through an IVF index of that many lists, probing -p of them.
+
+#include "cosinesim.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+using RowIndex = xilinx_apps::cosinesim::RowIndex;
+using ColIndex = xilinx_apps::cosinesim::ColIndex;
+using Result = xilinx_apps::cosinesim::Result;
+
+struct BenchParams {
+    RowIndex numVectors = 100000;
+    ColIndex vecLength = 200;
+    unsigned numQueries = 100;
+    unsigned numResults = 10;
+    unsigned numClusters = 1000;
+    int ivfLists = 0;
+    int nprobe = 8;
+};
+
+
+// Population and query vectors scattered around random cluster centers, like word embeddings
+void generateVectors(const BenchParams &params, std::vector<float> &population, std::vector<float> &queries) {
+    std::mt19937 rng(0x12345);
+    std::normal_distribution<float> normal(0.0f, 1.0f);
+    std::vector<float> centers(std::size_t(params.numClusters) * params.vecLength);
+    for (float &x : centers)
+        x = normal(rng);
+
+    population.resize(std::size_t(params.numVectors) * params.vecLength);
+    for (RowIndex r = 0; r < params.numVectors; ++r) {
+        const float *center = &centers[(rng() % params.numClusters) * params.vecLength];
+        for (ColIndex i = 0; i < params.vecLength; ++i)
+            population[r * params.vecLength + i] = center[i] + 0.5f * normal(rng);
+    }
+
+    queries.resize(std::size_t(params.numQueries) * params.vecLength);
+    for (unsigned q = 0; q < params.numQueries; ++q) {
+        const float *base = &population[(rng() % params.numVectors) * params.vecLength];
+        for (ColIndex i = 0; i < params.vecLength; ++i)
+            queries[q * params.vecLength + i] = base[i] + 0.25f * normal(rng);
+    }
+}
+
+
+// Exact top K row indexes of each query by floating-point cosine similarity
+std::vector<std::set<RowIndex>> exactTopK(const BenchParams &params, const std::vector<float> &population,
+                                          const std::vector<float> &queries)
+{
+    std::vector<double> norms(params.numVectors);
+    for (RowIndex r = 0; r < params.numVectors; ++r) {
+        double sum = 0.0;
+        for (ColIndex i = 0; i < params.vecLength; ++i)
+            sum += double(population[r * params.vecLength + i]) * population[r * params.vecLength + i];
+        norms[r] = std::sqrt(sum);
+    }
+
+    std::vector<std::set<RowIndex>> topK(params.numQueries);
+    std::vector<std::pair<double, RowIndex>> scores(params.numVectors);
+    for (unsigned q = 0; q < params.numQueries; ++q) {
+        const float *query = &queries[q * params.vecLength];
+        for (RowIndex r = 0; r < params.numVectors; ++r) {
+            const float *row = &population[r * params.vecLength];
+            double dot = 0.0;
+            for (ColIndex i = 0; i < params.vecLength; ++i)
+                dot += double(query[i]) * row[i];
+            scores[r] = std::make_pair(-dot / norms[r], r);
+        }
+        std::partial_sort(scores.begin(), scores.begin() + params.numResults, scores.end());
+        for (unsigned k = 0; k < params.numResults; ++k)
+            topK[q].insert(scores[k].second);
+    }
+    return topK;
+}
+
+
+template <typename Value>
+void runBench(const BenchParams &params, const std::vector<float> &population, const std::vector<float> &queries,
+              const std::vector<std::set<RowIndex>> &reference)
+{
+    std::vector<Value> quantPopulation(population.size());
+    for (RowIndex r = 0; r < params.numVectors; ++r)
+        xilinx_apps::cosinesim::quantizeVector(&population[r * params.vecLength], params.vecLength,
+                                               &quantPopulation[r * params.vecLength]);
+    std::vector<Value> quantQueries(queries.size());
+    for (unsigned q = 0; q < params.numQueries; ++q)
+        xilinx_apps::cosinesim::quantizeVector(&queries[q * params.vecLength], params.vecLength,
+                                               &quantQueries[q * params.vecLength]);
+
+    xilinx_apps::cosinesim::Options options;
+    options.vecLength = params.vecLength;
+    options.cpuBackend = true;
+    options.ivfLists = params.ivfLists;
+    options.nprobe = params.nprobe;
+    xilinx_apps::cosinesim::CosineSim<Value> cosineSim(options);
+    cosineSim.startLoadPopulation(params.numVectors);
+    cosineSim.loadPopulation(quantPopulation.data(), params.numVectors, params.vecLength);
+    cosineSim.finishLoadPopulation();
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::vector<Result>> results =
+        cosineSim.matchTargetVectors(params.numResults, quantQueries.data(), params.numQueries);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::size_t hits = 0;
+    for (unsigned q = 0; q < params.numQueries; ++q)
+        for (const Result &result : results[q])
+            hits += reference[q].count(result.index);
+    const double recall = double(hits) / (double(params.numQueries) * params.numResults);
+    const double megabytes = double(params.numVectors) * params.vecLength * sizeof(Value) / (1024.0 * 1024.0);
+
+    std::printf("%5u-bit  %10.1f  %12.1f  %14.1f  %9.4f\n", unsigned(sizeof(Value) * 8), megabytes,
+                params.numQueries / seconds, params.numQueries * double(params.numVectors) / seconds / 1.0e6,
+                recall);
+}
+
+
+void printUsage(const char *progName) {
+    std::cout << progName << " [options]" << std::endl
+        << "where 'options' is one or more of:" << std::endl
+        << "  -n <numVectors>     the number of population vectors (default = 100000)" << std::endl
+        << "  -l <vecLength>      the number of elements per vector (default = 200)" << std::endl
+        << "  -q <numQueries>     the number of target vectors to match (default = 100)" << std::endl
+        << "  -k <numResults>     the number of results per match, K of recall@K (default = 10)" << std::endl
+        << "  -i <ivfLists>       the number of IVF lists, 0 to scan every vector (default = 0)" << std::endl
+        << "  -p <nprobe>         the number of IVF lists probed per match (default = 8)" << std::endl
+        << "  -h                  prints this help message" << std::endl;
+}
+
+
+int main(int argc, char **argv) {
+    BenchParams params;
+    for (int curArgNum = 1; curArgNum < argc; ++curArgNum) {
+        const std::string curArg(argv[curArgNum]);
+        if (curArg == "-h" || curArg == "-help" || curArg == "--help") {
+            printUsage(argv[0]);
+            return 0;
+        }
+        if (curArgNum + 1 >= argc || curArg.size() != 2 || curArg[0] != '-') {
+            std::cout << "ERROR: Unrecognized argument '" << curArg << "'." << std::endl;
+            printUsage(argv[0]);
+            return 2;
+        }
+        const long value = std::stol(argv[++curArgNum]);
+        switch (curArg[1]) {
+        case 'n': params.numVectors = value; break;
+        case 'l': params.vecLength = ColIndex(value); break;
+        case 'q': params.numQueries = unsigned(value); break;
+        case 'k': params.numResults = unsigned(value); break;
+        case 'i': params.ivfLists = int(value); break;
+        case 'p': params.nprobe = int(value); break;
+        default:
+            std::cout << "ERROR: Unrecognized option '" << curArg << "'." << std::endl;
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+    if (params.numVectors < params.numResults || params.vecLength <= 0 || params.numQueries == 0
+            || params.numResults == 0)
+    {
+        std::cout << "ERROR: need numVectors >= numResults > 0, vecLength > 0 and numQueries > 0" << std::endl;
+        return 2;
+    }
+
+    std::cout << "======== Generating " << params.numVectors << " population and " << params.numQueries
+        << " target vectors of length " << params.vecLength << std::endl;
+    std::vector<float> population, queries;
+    generateVectors(params, population, queries);
+    std::cout << "======== Computing the floating-point top " << params.numResults << std::endl;
+    const std::vector<std::set<RowIndex>> reference = exactTopK(params, population, queries);
+
+    try {
+        std::cout << "======== Running quantized matches on the host CPU" << std::endl;
+        std::printf("%9s  %10s  %12s  %14s  %9s\n", "elements", "pop MiB", "matches/s", "Mvectors/s", "recall");
+        runBench<std::int32_t>(params, population, queries, reference);
+        runBench<std::int16_t>(params, population, queries, reference);
+        runBench<std::int8_t>(params, population, queries, reference);
+    }
+    catch (const xilinx_apps::cosinesim::Exception &ex) {
+        std::cout << "ERROR: " << ex.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -33,6 +33,8 @@
 #include <string>
 #include <cmath>
 #include <algorithm>
+#include <future>
+#include <thread>
 
 
 // Enable this macro to include tests with long run times (lots of population vectors)
@@ -397,6 +399,506 @@ bool areMatchesEqual(const ResultVector &refVec, const ResultVector &testVec) {
 }
 
 
+//#####################################################################################################################
+// Feature tests: checks of the API beyond a single match against the SW model.  They run after the match tests
+// unless -1 picks a single test; those marked CPU-only need --cpu.
+
+// Writes population vectors into a CosineSim object whose Value type may be narrower than Element
+template <typename Value>
+void loadPopulation(xilinx_apps::cosinesim::CosineSim<Value> &cosineSim,
+                    const std::vector<CosineSimVector> &populationVecs)
+{
+    cosineSim.startLoadPopulation(populationVecs.size());
+    for (RowIndex vecNum = 0; vecNum < RowIndex(populationVecs.size()); ++vecNum) {
+        Value *pBuf = cosineSim.getPopulationVectorBuffer(vecNum);
+        Value *p = pBuf;
+        for (Element value : populationVecs[vecNum].m_elements)
+            *p++ = Value(value);
+        cosineSim.finishCurrentPopulationVector(pBuf);
+    }
+    cosineSim.finishLoadPopulation();
+}
+
+
+// SW model over the rows whose isAllowed entry is true
+ResultVector runSwCosineSimOver(unsigned numResults, const CosineSimVector &targetVec,
+    const std::vector<CosineSimVector> &populationVecs, const std::vector<bool> &isAllowed)
+{
+    MatchHeap heap(numResults);
+    for (RowIndex rowNum = 0, end = populationVecs.size(); rowNum < end; ++rowNum)
+        if (isAllowed[rowNum])
+            heap.addMatch(targetVec.cosineSimilarity(populationVecs[rowNum]), rowNum);
+    return heap.toMatchVector();
+}
+
+
+// Matches one target and compares the results with the SW model over the rows whose isAllowed entry is true
+template <typename Value>
+bool checkMatch(xilinx_apps::cosinesim::CosineSim<Value> &cosineSim, unsigned numResults,
+                const CosineSimVector &targetVec, const std::vector<CosineSimVector> &populationVecs,
+                const std::vector<bool> &isAllowed)
+{
+    const std::vector<Value> target(targetVec.m_elements.begin(), targetVec.m_elements.end());
+    const ResultVector swResults = runSwCosineSimOver(numResults, targetVec, populationVecs, isAllowed);
+    return areMatchesEqual(swResults, cosineSim.matchTargetVector(numResults, target.data()));
+}
+
+
+// int8 population: exact top K against the SW model over the whole population
+bool testInt8Match(const xilinx_apps::cosinesim::Options &baseOptions) {
+    const TestParams testParams(-128, 127, 100, 2000);
+    CosineSimVector targetVec;
+    std::vector<CosineSimVector> populationVecs;
+    generateVectors(testParams, targetVec, populationVecs);
+
+    xilinx_apps::cosinesim::Options options = baseOptions;
+    options.vecLength = testParams.m_vectorLength;
+    xilinx_apps::cosinesim::CosineSim<std::int8_t> cosineSim(options);
+    loadPopulation(cosineSim, populationVecs);
+
+    const std::vector<bool> isLive(populationVecs.size(), true);
+    bool isSuccess = true;
+    for (unsigned numResults : {1u, 10u, 100u})
+        isSuccess = checkMatch(cosineSim, numResults, targetVec, populationVecs, isLive) && isSuccess;
+    return isSuccess;
+}
+
+
+// int16 vectors full of -32768.  The backend stores -32768 as -32767, so the SW model runs on saturated copies,
+// where two adjacent products still sum to within 2^17 of the 32-bit limit.
+bool testInt16Extremes(const xilinx_apps::cosinesim::Options &baseOptions) {
+    const TestParams testParams(-32768, 32767, 64, 1000);
+    CosineSimVector targetVec;
+    std::vector<CosineSimVector> populationVecs;
+    generateVectors(testParams, targetVec, populationVecs);
+    for (Element &value : targetVec.m_elements)
+        if (std::rand() % 2 == 0)
+            value = -32768;
+    for (CosineSimVector &vec : populationVecs)
+        for (Element &value : vec.m_elements)
+            if (std::rand() % 2 == 0)
+                value = -32768;
+    populationVecs[0].m_elements.assign(testParams.m_vectorLength, -32768);
+
+    xilinx_apps::cosinesim::Options options = baseOptions;
+    options.vecLength = testParams.m_vectorLength;
+    xilinx_apps::cosinesim::CosineSim<std::int16_t> cosineSim(options);
+    loadPopulation(cosineSim, populationVecs);
+    const std::vector<std::int16_t> target(targetVec.m_elements.begin(), targetVec.m_elements.end());
+
+    auto saturate = [](CosineSimVector &vec) {
+        for (Element &value : vec.m_elements)
+            value = std::max<Element>(value, -32767);
+        vec.setNormal();
+    };
+    CosineSimVector swTargetVec = targetVec;
+    saturate(swTargetVec);
+    std::vector<CosineSimVector> swPopulationVecs = populationVecs;
+    for (CosineSimVector &vec : swPopulationVecs)
+        saturate(vec);
+
+    const std::vector<bool> isLive(populationVecs.size(), true);
+    bool isSuccess = true;
+    for (unsigned numResults : {1u, 10u, 100u}) {
+        const ResultVector swResults = runSwCosineSimOver(numResults, swTargetVec, swPopulationVecs, isLive);
+        isSuccess = areMatchesEqual(swResults, cosineSim.matchTargetVector(numResults, target.data())) && isSuccess;
+    }
+    return isSuccess;
+}
+
+
+// Batches of targets, in several batch sizes and result counts so the per-call buffers grow and get reused.
+// Every target's merged top K must match the SW model.
+bool testBatchMatch(const xilinx_apps::cosinesim::Options &baseOptions) {
+    const TestParams testParams(-8192, 8192, 100, 3000);
+    CosineSimVector targetVec;
+    std::vector<CosineSimVector> populationVecs;
+    generateVectors(testParams, targetVec, populationVecs);
+
+    xilinx_apps::cosinesim::Options options = baseOptions;
+    options.vecLength = testParams.m_vectorLength;
+    CosineSim cosineSim(options);
+    loadPopulation(cosineSim, populationVecs);
+
+    // targets are population vectors with noise, so each has a distinct nearest neighborhood
+    const std::size_t MaxTargets = 32;
+    std::vector<CosineSimVector> targetVecs(MaxTargets);
+    Vector targets;
+    for (std::size_t t = 0; t < MaxTargets; ++t) {
+        targetVecs[t].m_elements = populationVecs[std::rand() % populationVecs.size()].m_elements;
+        for (Element &value : targetVecs[t].m_elements)
+            value += generateRandomElement(-1000, 1000);
+        targetVecs[t].setNormal();
+        targets.insert(targets.end(), targetVecs[t].m_elements.begin(), targetVecs[t].m_elements.end());
+    }
+
+    const std::vector<bool> isLive(populationVecs.size(), true);
+    bool isSuccess = true;
+    for (std::size_t numTargets : {std::size_t(1), std::size_t(7), MaxTargets, std::size_t(7)}) {
+        for (unsigned numResults : {1u, 10u, 100u}) {
+            std::cout << "======== Batch of " << numTargets << " targets, numResults = " << numResults << std::endl;
+            const std::vector<ResultVector> hwResults
+                = cosineSim.matchTargetVectors(numResults, targets.data(), numTargets);
+            if (hwResults.size() != numTargets) {
+                std::cout << "#### FAIL: " << hwResults.size() << " result lists for " << numTargets
+                    << " targets" << std::endl;
+                return false;
+            }
+            for (std::size_t t = 0; t < numTargets; ++t)
+                isSuccess = areMatchesEqual(runSwCosineSimOver(numResults, targetVecs[t], populationVecs, isLive),
+                                            hwResults[t]) && isSuccess;
+        }
+    }
+    return isSuccess;
+}
+
+
+// Asynchronous matches submitted from several threads at once, all in flight before any result is read
+bool testAsyncMatch(const xilinx_apps::cosinesim::Options &baseOptions) {
+    const TestParams testParams(-8192, 8192, 100, 3000);
+    CosineSimVector targetVec;
+    std::vector<CosineSimVector> populationVecs;
+    generateVectors(testParams, targetVec, populationVecs);
+
+    xilinx_apps::cosinesim::Options options = baseOptions;
+    options.vecLength = testParams.m_vectorLength;
+    CosineSim cosineSim(options);
+    loadPopulation(cosineSim, populationVecs);
+
+    const unsigned NumThreads = 3;
+    const unsigned NumPerThread = 8;
+    const unsigned numResults = 20;
+    std::vector<CosineSimVector> targetVecs(NumThreads * NumPerThread);
+    for (CosineSimVector &vec : targetVecs) {
+        vec.m_elements = populationVecs[std::rand() % populationVecs.size()].m_elements;
+        for (Element &value : vec.m_elements)
+            value += generateRandomElement(-1000, 1000);
+        vec.setNormal();
+    }
+
+    std::vector<std::future<ResultVector>> futures(targetVecs.size());
+    std::vector<std::thread> threads;
+    for (unsigned th = 0; th < NumThreads; ++th) {
+        threads.push_back(std::thread([&, th]() {
+            for (unsigned i = th * NumPerThread; i < (th + 1) * NumPerThread; ++i) {
+                // the target is copied on submission, so a temporary copy exercises that too
+                Vector target = targetVecs[i].m_elements;
+                futures[i] = cosineSim.matchTargetVectorAsync(numResults, target.data());
+            }
+        }));
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+
+    const std::vector<bool> isLive(populationVecs.size(), true);
+    bool isSuccess = true;
+    for (std::size_t i = 0; i < targetVecs.size(); ++i)
+        isSuccess = areMatchesEqual(runSwCosineSimOver(numResults, targetVecs[i], populationVecs, isLive),
+                                    futures[i].get()) && isSuccess;
+    return isSuccess;
+}
+
+
+// Bulk loads: the whole population from one padded matrix, and disjoint row ranges from several threads in
+// reverse order.  Both must give the same matches as the SW model.
+bool testBulkLoad(const xilinx_apps::cosinesim::Options &baseOptions) {
+    const TestParams testParams(-8192, 8192, 50, 5000);
+    CosineSimVector targetVec;
+    std::vector<CosineSimVector> populationVecs;
+    generateVectors(testParams, targetVec, populationVecs);
+
+    // the padding after each vector holds junk that must not be loaded
+    const ColIndex stride = testParams.m_vectorLength + 3;
+    Vector matrix(testParams.m_numVectors * stride, 0x7fff);
+    for (RowIndex row = 0; row < testParams.m_numVectors; ++row)
+        std::copy(populationVecs[row].m_elements.begin(), populationVecs[row].m_elements.end(),
+                  matrix.begin() + row * stride);
+
+    xilinx_apps::cosinesim::Options options = baseOptions;
+    options.vecLength = testParams.m_vectorLength;
+    const std::vector<bool> isLive(populationVecs.size(), true);
+    bool isSuccess = true;
+    {
+        std::cout << "======== Loading the whole matrix at once" << std::endl;
+        CosineSim cosineSim(options);
+        cosineSim.startLoadPopulation(testParams.m_numVectors);
+        cosineSim.loadPopulation(matrix.data(), testParams.m_numVectors, stride);
+        cosineSim.finishLoadPopulation();
+        for (unsigned numResults : {1u, 100u})
+            isSuccess = checkMatch(cosineSim, numResults, targetVec, populationVecs, isLive) && isSuccess;
+    }
+    {
+        std::cout << "======== Loading row ranges from several threads" << std::endl;
+        CosineSim cosineSim(options);
+        cosineSim.startLoadPopulation(testParams.m_numVectors);
+        const RowIndex NumRanges = 4;
+        const RowIndex rowsPerRange = (testParams.m_numVectors + NumRanges - 1) / NumRanges;
+        std::vector<std::thread> threads;
+        for (RowIndex firstRow = (NumRanges - 1) * rowsPerRange; firstRow >= 0; firstRow -= rowsPerRange) {
+            const RowIndex numRows = std::min(rowsPerRange, testParams.m_numVectors - firstRow);
+            threads.push_back(std::thread([&, firstRow, numRows]() {
+                cosineSim.loadPopulationRows(firstRow, matrix.data() + firstRow * stride, numRows, stride);
+            }));
+        }
+        for (std::thread &thread : threads)
+            thread.join();
+        cosineSim.finishLoadPopulation();
+        for (unsigned numResults : {1u, 100u})
+            isSuccess = checkMatch(cosineSim, numResults, targetVec, populationVecs, isLive) && isSuccess;
+    }
+    return isSuccess;
+}
+
+
+// Snapshot round trip: a population with deleted rows is saved with its row ID map and restored into a new
+// object, which must return the same IDs and exactly the same matches
+bool testSnapshot(const xilinx_apps::cosinesim::Options &baseOptions) {
+    const TestParams testParams(-8192, 8192, 100, 2000);
+    CosineSimVector targetVec;
+    std::vector<CosineSimVector> populationVecs;
+    generateVectors(testParams, targetVec, populationVecs);
+
+    xilinx_apps::cosinesim::Options options = baseOptions;
+    options.vecLength = testParams.m_vectorLength;
+    const std::string path = "cosinesim_test.snapshot";
+    const unsigned numResults = 50;
+    std::vector<std::uint64_t> rowIds(testParams.m_numVectors);
+    for (RowIndex row = 0; row < testParams.m_numVectors; ++row)
+        rowIds[row] = 1000000 + 7 * row;
+    std::vector<bool> isLive(populationVecs.size(), true);
+    ResultVector savedResults;
+    {
+        CosineSim cosineSim(options);
+        loadPopulation(cosineSim, populationVecs);
+        // delete some of the best matches, so a restore that lost the deletions would return them
+        for (const Result &res : cosineSim.matchTargetVector(10, targetVec.m_elements.data())) {
+            cosineSim.deletePopulationVector(res.index);
+            isLive[res.index] = false;
+        }
+        savedResults = cosineSim.matchTargetVector(numResults, targetVec.m_elements.data());
+        cosineSim.saveSnapshot(path, rowIds);
+    }
+
+    bool isSuccess = true;
+    {
+        CosineSim cosineSim(options);
+        const std::vector<std::uint64_t> loadedRowIds = cosineSim.loadSnapshot(path);
+        if (loadedRowIds != rowIds) {
+            std::cout << "#### FAIL: restored row ID map differs from the saved one" << std::endl;
+            isSuccess = false;
+        }
+        const ResultVector loadedResults = cosineSim.matchTargetVector(numResults, targetVec.m_elements.data());
+        isSuccess = areMatchesEqual(savedResults, loadedResults) && isSuccess;
+        isSuccess = checkMatch(cosineSim, numResults, targetVec, populationVecs, isLive) && isSuccess;
+    }
+    std::remove(path.c_str());
+    return isSuccess;
+}
+
+
+// Incremental changes: deletes, in-place updates (some reviving deleted rows) and appends into reserved rows.
+// Matches must equal the SW model over the live rows, including a request for more results than there are live
+// rows, which must return every live row and nothing else.
+bool testUpsertDelete(const xilinx_apps::cosinesim::Options &baseOptions) {
+    const TestParams testParams(-8192, 8192, 100, 2000);
+    CosineSimVector targetVec;
+    std::vector<CosineSimVector> populationVecs;
+    generateVectors(testParams, targetVec, populationVecs);
+
+    xilinx_apps::cosinesim::Options options = baseOptions;
+    options.vecLength = testParams.m_vectorLength;
+    options.reserveVectors = 200;
+    CosineSim cosineSim(options);
+    loadPopulation(cosineSim, populationVecs);
+    std::vector<bool> isLive(populationVecs.size(), true);
+
+    // delete the 30 best matches and 50 random rows
+    std::vector<RowIndex> deletedRows;
+    for (const Result &res : cosineSim.matchTargetVector(30, targetVec.m_elements.data()))
+        deletedRows.push_back(res.index);
+    for (int i = 0; i < 50; ++i)
+        deletedRows.push_back(std::rand() % testParams.m_numVectors);
+    for (RowIndex row : deletedRows) {
+        cosineSim.deletePopulationVector(row);
+        isLive[row] = false;
+    }
+
+    // replace 20 rows, half of them deleted ones, with vectors near the target
+    for (int i = 0; i < 20; ++i) {
+        const RowIndex row = (i % 2 == 0) ? deletedRows[i] : std::rand() % testParams.m_numVectors;
+        CosineSimVector &vec = populationVecs[row];
+        vec.m_elements = targetVec.m_elements;
+        for (Element &value : vec.m_elements)
+            value += generateRandomElement(-2000, 2000);
+        vec.setNormal();
+        cosineSim.updatePopulationVector(row, vec.m_elements.data());
+        isLive[row] = true;
+    }
+
+    // append 150 rows, a third of them near the target
+    const RowIndex NumAppended = 150;
+    Vector appended;
+    for (RowIndex i = 0; i < NumAppended; ++i) {
+        CosineSimVector vec;
+        for (Element targetElt : targetVec.m_elements)
+            vec.m_elements.push_back(i % 3 == 0 ? targetElt + generateRandomElement(-3000, 3000)
+                                                : generateRandomElement(-8192, 8192));
+        vec.setNormal();
+        appended.insert(appended.end(), vec.m_elements.begin(), vec.m_elements.end());
+        populationVecs.push_back(vec);
+        isLive.push_back(true);
+    }
+    const RowIndex firstAppended = cosineSim.appendPopulationVectors(appended.data(), NumAppended,
+                                                                     testParams.m_vectorLength);
+    if (firstAppended != testParams.m_numVectors) {
+        std::cout << "#### FAIL: appended rows start at " << firstAppended << " instead of "
+            << testParams.m_numVectors << std::endl;
+        return false;
+    }
+
+    const unsigned numLive = std::count(isLive.begin(), isLive.end(), true);
+    bool isSuccess = true;
+    for (unsigned numResults : {1u, 10u, 100u, numLive + 5})
+        isSuccess = checkMatch(cosineSim, numResults, targetVec, populationVecs, isLive) && isSuccess;
+    return isSuccess;
+}
+
+
+// IVF index: scanning every list must give exact results, and so must matchTargetVectorExact() with few lists
+// probed.  Deleted rows must stay out of both.
+bool testIvf(const xilinx_apps::cosinesim::Options &baseOptions) {
+    const TestParams testParams(-8192, 8192, 64, 5000);
+    CosineSimVector targetVec;
+    std::vector<CosineSimVector> populationVecs;
+    generateVectors(testParams, targetVec, populationVecs);
+    std::vector<bool> isLive(populationVecs.size(), true);
+    for (int i = 0; i < 100; ++i) {
+        const RowIndex row = std::rand() % testParams.m_numVectors;
+        isLive[row] = false;
+    }
+
+    xilinx_apps::cosinesim::Options options = baseOptions;
+    options.vecLength = testParams.m_vectorLength;
+    options.ivfLists = 32;
+    bool isSuccess = true;
+    for (std::int32_t nprobe : {options.ivfLists, 2}) {
+        std::cout << "======== IVF with " << options.ivfLists << " lists, nprobe = " << nprobe << std::endl;
+        options.nprobe = nprobe;
+        CosineSim cosineSim(options);
+        loadPopulation(cosineSim, populationVecs);
+        for (RowIndex row = 0; row < testParams.m_numVectors; ++row)
+            if (!isLive[row])
+                cosineSim.deletePopulationVector(row);
+        for (unsigned numResults : {1u, 10u, 100u}) {
+            const ResultVector swResults = runSwCosineSimOver(numResults, targetVec, populationVecs, isLive);
+            if (nprobe == options.ivfLists)
+                isSuccess = areMatchesEqual(swResults,
+                    cosineSim.matchTargetVector(numResults, targetVec.m_elements.data())) && isSuccess;
+            isSuccess = areMatchesEqual(swResults,
+                cosineSim.matchTargetVectorExact(numResults, targetVec.m_elements.data())) && isSuccess;
+        }
+    }
+    return isSuccess;
+}
+
+
+static bool isRowMultipleOf3(void *context, RowIndex rowIndex) {
+    (void) context;
+    return rowIndex % 3 == 0;
+}
+
+
+// Filtered matches: sparse and dense Bitmaps, a RowPredicate and a batch of targets with a Bitmap, over a
+// population with deleted rows.  Results must be the best allowed live rows, even when fewer than numResults.
+bool testFilter(const xilinx_apps::cosinesim::Options &baseOptions) {
+    const TestParams testParams(-8192, 8192, 100, 4000);
+    CosineSimVector targetVec;
+    std::vector<CosineSimVector> populationVecs;
+    generateVectors(testParams, targetVec, populationVecs);
+
+    xilinx_apps::cosinesim::Options options = baseOptions;
+    options.vecLength = testParams.m_vectorLength;
+    CosineSim cosineSim(options);
+    loadPopulation(cosineSim, populationVecs);
+    std::vector<bool> isLive(populationVecs.size(), true);
+    for (const Result &res : cosineSim.matchTargetVector(20, targetVec.m_elements.data())) {
+        cosineSim.deletePopulationVector(res.index);
+        isLive[res.index] = false;
+    }
+
+    bool isSuccess = true;
+    const Element *target = targetVec.m_elements.data();
+    // roughly 1% of the rows, then roughly half
+    for (int density : {1, 50}) {
+        std::cout << "======== Bitmap allowing about " << density << "% of the rows" << std::endl;
+        xilinx_apps::cosinesim::Bitmap allow(testParams.m_numVectors);
+        std::vector<bool> isAllowed(isLive);
+        for (RowIndex row = 0; row < testParams.m_numVectors; ++row) {
+            if (std::rand() % 100 < density)
+                allow.set(row);
+            else
+                isAllowed[row] = false;
+        }
+        for (unsigned numResults : {1u, 10u, 100u})
+            isSuccess = areMatchesEqual(runSwCosineSimOver(numResults, targetVec, populationVecs, isAllowed),
+                                        cosineSim.matchTargetVector(numResults, target, allow)) && isSuccess;
+    }
+
+    std::cout << "======== RowPredicate allowing every third row" << std::endl;
+    std::vector<bool> isAllowed(isLive);
+    for (RowIndex row = 0; row < testParams.m_numVectors; ++row)
+        if (!isRowMultipleOf3(nullptr, row))
+            isAllowed[row] = false;
+    for (unsigned numResults : {1u, 10u, 100u})
+        isSuccess = areMatchesEqual(runSwCosineSimOver(numResults, targetVec, populationVecs, isAllowed),
+            cosineSim.matchTargetVector(numResults, target, isRowMultipleOf3, nullptr)) && isSuccess;
+
+    std::cout << "======== Batch of targets with a Bitmap of 10 rows" << std::endl;
+    xilinx_apps::cosinesim::Bitmap allow(testParams.m_numVectors);
+    std::fill(isAllowed.begin(), isAllowed.end(), false);
+    for (int i = 0; i < 10; ++i) {
+        const RowIndex row = std::rand() % testParams.m_numVectors;
+        allow.set(row);
+        isAllowed[row] = isLive[row];
+    }
+    const std::size_t NumTargets = 4;
+    std::vector<CosineSimVector> targetVecs(NumTargets);
+    Vector targets;
+    for (CosineSimVector &vec : targetVecs) {
+        vec.m_elements = populationVecs[std::rand() % populationVecs.size()].m_elements;
+        vec.setNormal();
+        targets.insert(targets.end(), vec.m_elements.begin(), vec.m_elements.end());
+    }
+    // asks for more results than there are allowed rows
+    const unsigned numResults = 20;
+    const std::vector<ResultVector> hwResults = cosineSim.matchTargetVectors(numResults, targets.data(), NumTargets,
+                                                                             allow);
+    for (std::size_t t = 0; t < NumTargets; ++t)
+        isSuccess = areMatchesEqual(runSwCosineSimOver(numResults, targetVecs[t], populationVecs, isAllowed),
+                                    hwResults[t]) && isSuccess;
+    return isSuccess;
+}
+
+
+struct FeatureTest {
+    const char *m_name;
+    bool m_isCpuOnly;
+    bool (*m_run)(const xilinx_apps::cosinesim::Options &baseOptions);
+};
+
+static const FeatureTest s_featureTests[] = {
+    {"int8 elements", true, testInt8Match},
+    {"int16 extreme values", true, testInt16Extremes},
+    {"batched matches", false, testBatchMatch},
+    {"asynchronous matches", false, testAsyncMatch},
+    {"bulk population loads", false, testBulkLoad},
+    {"snapshot save and load", false, testSnapshot},
+    {"upserts and deletes", false, testUpsertDelete},
+    {"IVF index", true, testIvf},
+    {"filtered matches", false, testFilter},
+};
+
+
 void printUsage(const char *progName) {
     std::cout << progName << " [options]" << std::endl
         << "where 'options' is one or more of:" << std::endl
@@ -404,6 +906,7 @@ void printUsage(const char *progName) {
         << "  -t <deviceTypes>    a space-separated list of shell names (default = xilinx_u50_gen3x16_xdma_201920_3)" << std::endl
         << "  -1 <testNum>        run one test of the given index (default = run all tests)" << std::endl
         << "  -n <numResults>     run each test with only the given numResults (default = run all numResults)" << std::endl
+        << "  --cpu               run matches on the host CPU instead of Alveo cards" << std::endl
         << "  -v                  verbose: display extra info, such as results for passing tests" << std::endl
         << "  -h                  prints this help message" << std::endl;
 }
@@ -421,6 +924,7 @@ int main(int argc, char **argv) {
     std::string xclbinPath = std::string("/opt/xilinx/apps/graphanalytics/cosinesim/") + std::string(VERSION) + 
                              std::string("/xclbin/cosinesim_32bit_xilinx_u50_gen3x16_xdma_201920_3.xclbin");
     int userNumResults = -1;  // < 0 means all values of numResults
+    bool cpuBackend = false;
 
     int curArgNum = 1;
     while (curArgNum < argc) {
@@ -485,6 +989,9 @@ int main(int argc, char **argv) {
                     return 2;
                 }
             }
+            else if (curArg == "--cpu") {
+                cpuBackend = true;
+            }
             else if (curArg == "-v") {
                 g_isVerbose = true;
             }
@@ -532,6 +1039,7 @@ int main(int argc, char **argv) {
             options.numDevices = numDevices;
             options.deviceNames = deviceTypes;
             options.xclbinPath = xclbinPath;
+            options.cpuBackend = cpuBackend;
 
             CosineSim cosineSim(options);
 
@@ -580,13 +1088,46 @@ int main(int argc, char **argv) {
         }
     }
 
+    const unsigned NumFeatureTests = sizeof(s_featureTests)/sizeof(FeatureTest);
+    std::vector<bool> featureResults;
+    std::vector<unsigned> featureTestNums;
+    if (singleTestNum < 0) {
+        xilinx_apps::cosinesim::Options options;
+        options.numDevices = numDevices;
+        options.deviceNames = deviceTypes;
+        options.xclbinPath = xclbinPath;
+        options.cpuBackend = cpuBackend;
+        for (unsigned i = 0; i < NumFeatureTests; ++i) {
+            if (s_featureTests[i].m_isCpuOnly && !cpuBackend)
+                continue;
+            std::cout << "#####################################################" << std::endl;
+            std::cout << "# FEATURE TEST " << i << ": " << s_featureTests[i].m_name << std::endl;
+            std::cout << "#####################################################" << std::endl;
+            bool isSuccess = false;
+            try {
+                isSuccess = s_featureTests[i].m_run(options);
+            }
+            catch (const xilinx_apps::cosinesim::Exception &ex) {
+                std::cout << "#### FAIL: Error during feature test: " << ex.what() << std::endl;
+            }
+            featureResults.push_back(isSuccess);
+            featureTestNums.push_back(i);
+        }
+    }
+
     std::cout << std::endl;
     std::cout << "#####################################################" << std::endl;
     std::cout << "# SUMMARY" << std::endl;
     std::cout << "#####################################################" << std::endl;
     for (unsigned i = startTestNum; i <= endTestNum; ++i)
         std::cout << "Test " << i << ": " << (testResults[i] ? "PASS" : "FAIL") << std::endl;
-    const unsigned NumTestsRan = (singleTestNum >= 0 ? 1 : NumTests);
+    for (unsigned i = 0; i < featureResults.size(); ++i) {
+        std::cout << "Feature test " << featureTestNums[i] << " (" << s_featureTests[featureTestNums[i]].m_name
+            << "): " << (featureResults[i] ? "PASS" : "FAIL") << std::endl;
+        if (featureResults[i])
+            ++numPassingTests;
+    }
+    const unsigned NumTestsRan = (singleTestNum >= 0 ? 1 : NumTests) + featureResults.size();
     std::cout << std::endl << numPassingTests << '/' << NumTestsRan << " tests passed" << std::endl;
     if (numPassingTests < NumTestsRan) {
         std::cout << "FAIL" << std::endl;
@@ -87,6 +87,55 @@ public:
         return CosineSimBase::matchTargetVector(numResults, elementsVec.data());
     }
 
+    std::vector<Result> matchTargetVectorFiltered(unsigned numResults, std::vector<DataType> elementsVec,
+                                                  const Bitmap &allow) {
+        return CosineSimBase::matchTargetVector(numResults, elementsVec.data(), allow);
+    }
+
+    std::vector<Result> matchTargetVectorExact(unsigned numResults, std::vector<DataType> elementsVec) {
+        return CosineSimBase::matchTargetVectorExact(numResults, elementsVec.data());
+    }
+
+    std::vector<std::vector<Result>> matchTargetVectors(unsigned numResults,
+                                                        const std::vector<std::vector<DataType>> &targets) {
+        std::vector<DataType> elementsVec;
+        elementsVec.reserve(targets.size() * opt_.vecLength);
+        for (const std::vector<DataType> &target : targets) {
+            if (target.size() < std::size_t(opt_.vecLength))
+                throw Exception("every target vector must have at least vecLength elements");
+            elementsVec.insert(elementsVec.end(), target.begin(), target.begin() + opt_.vecLength);
+        }
+        return CosineSimBase::matchTargetVectors(numResults, elementsVec.data(), targets.size());
+    }
+
+    void loadPopulation(const std::vector<std::vector<DataType>> &vectors) {
+        std::vector<DataType> matrix;
+        matrix.reserve(vectors.size() * opt_.vecLength);
+        for (const std::vector<DataType> &vec : vectors) {
+            if (vec.size() < std::size_t(opt_.vecLength))
+                throw Exception("every population vector must have at least vecLength elements");
+            matrix.insert(matrix.end(), vec.begin(), vec.begin() + opt_.vecLength);
+        }
+        CosineSimBase::loadPopulation(matrix.data(), vectors.size(), opt_.vecLength);
+    }
+
+    void updatePopulationVector(RowIndex rowIndex, const std::vector<DataType> &elementsVec) {
+        if (elementsVec.size() < std::size_t(opt_.vecLength))
+            throw Exception("the population vector must have at least vecLength elements");
+        CosineSimBase::updatePopulationVector(rowIndex, elementsVec.data());
+    }
+
+    RowIndex appendPopulationVectors(const std::vector<std::vector<DataType>> &vectors) {
+        std::vector<DataType> matrix;
+        matrix.reserve(vectors.size() * opt_.vecLength);
+        for (const std::vector<DataType> &vec : vectors) {
+            if (vec.size() < std::size_t(opt_.vecLength))
+                throw Exception("every population vector must have at least vecLength elements");
+            matrix.insert(matrix.end(), vec.begin(), vec.begin() + opt_.vecLength);
+        }
+        return CosineSimBase::appendPopulationVectors(matrix.data(), vectors.size(), opt_.vecLength);
+    }
+
 private:
     Options opt_;
 };
@@ -108,13 +157,23 @@ PYBIND11_MODULE (xilCosineSim, pc) {
     .def_readwrite("vecLength", &Options::vecLength)
     .def_readwrite("numDevices", &Options::numDevices)
     .def_readwrite("xclbinPath", &Options::xclbinPath)
-    .def_readwrite("deviceNames", &Options::deviceNames);
+    .def_readwrite("deviceNames", &Options::deviceNames)
+    .def_readwrite("cpuBackend", &Options::cpuBackend)
+    .def_readwrite("reserveVectors", &Options::reserveVectors)
+    .def_readwrite("ivfLists", &Options::ivfLists)
+    .def_readwrite("nprobe", &Options::nprobe);
 
   py::class_<Result>(pc, "result")
     .def(py::init<RowIndex, double>())
     .def_readonly("index", &Result::index)
     .def_readonly("similarity", &Result::similarity);
 
+  py::class_<Bitmap>(pc, "bitmap")
+    .def(py::init<RowIndex>())
+    .def("set", &Bitmap::set, py::arg("rowIndex"), py::arg("value") = true)
+    .def("test", &Bitmap::test)
+    .def("size", &Bitmap::size);
+
   py::class_<PtrWrapper<DataType>>(pc, "cpppointer")
     .def(py::init<void*, int>())
     .def(py::init<>())
@@ -128,7 +187,21 @@ PYBIND11_MODULE (xilCosineSim, pc) {
         "return pointer of weightDense buffer. user can use the pointer to write into population vector")
     .def("finishCurrentPopulationVector", &PyCSWrapper::finishCurrentPopulationVector,
         "should be called when each population vector loading finishes")
+    .def("loadPopulation", &PyCSWrapper::loadPopulation,
+        "bulk load API: loads all population vectors at once, in place of the buffer get/finish calls")
     .def("finishLoadPopulation", &PyCSWrapper::finishLoadPopulation,
         "should be called when the whole population vectors loading finishes")
-    .def("matchTargetVector", &PyCSWrapper::matchTargetVector, "Match API");
+    .def("updatePopulationVector", &PyCSWrapper::updatePopulationVector,
+        "replaces one loaded population vector, or brings back a deleted one")
+    .def("appendPopulationVectors", &PyCSWrapper::appendPopulationVectors,
+        "adds population vectors after loading finishes; returns the row index of the first one")
+    .def("deletePopulationVector", &PyCSWrapper::deletePopulationVector,
+        "removes a population vector from match results")
+    .def("matchTargetVector", &PyCSWrapper::matchTargetVector, "Match API")
+    .def("matchTargetVectorFiltered", &PyCSWrapper::matchTargetVectorFiltered,
+        "Match API limited to the population rows set in a bitmap")
+    .def("matchTargetVectorExact", &PyCSWrapper::matchTargetVectorExact,
+        "Match API that scans every population vector even when an IVF index is configured")
+    .def("matchTargetVectors", &PyCSWrapper::matchTargetVectors,
+        "batched Match API: one result list per target vector");
 }
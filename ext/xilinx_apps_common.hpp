@@ -306,7 +306,7 @@ private:
     static void copyToRawMem(const_pointer pSrcStart, const_pointer pSrcEnd, pointer pDest) {
 //        if (std::is_trivially_copyable<value_type>::value)  C++11 feature not available in GCC 4.8.4 (TG's version)!
         if (__has_trivial_copy(value_type))  // GCC extension, not part of C++11 standard
-            std::memcpy(pDest, pSrcStart, (pSrcEnd - pSrcStart) * sizeof(value_type));
+            std::memcpy(static_cast<void *>(pDest), pSrcStart, (pSrcEnd - pSrcStart) * sizeof(value_type));
         else {
             pointer pCurDest = pDest;
             for (const_pointer pCurSrc = pSrcStart; pCurSrc < pSrcEnd; ++pCurSrc, ++pCurDest)
@@ -27,6 +27,13 @@
 #include <vector>
 #include <cstring>
 #include <unordered_map>
+#include <unordered_set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <atomic>
 
 #include "xilinx_apps_common.hpp"
 
@@ -52,6 +59,7 @@ namespace fuzzymatch {
 
     struct Options;
     class FuzzyMatchImpl;
+    class PatternStore;
 
     // ------------------------------------------------------------------------
     // Utility functions 
@@ -68,6 +76,21 @@ namespace fuzzymatch {
     int load_csv(const size_t max_entry_num, const size_t max_field_len, const std::string &file_path,
                  const unsigned col, std::vector<std::string> &vec);
 
+    // throughput of the last CSV load
+    struct CsvLoadStats {
+        size_t rows = 0;    // entries extracted
+        size_t bytes = 0;   // size of the file
+        double seconds = 0;
+
+        double getRowsPerSec() const { return (seconds > 0) ? rows / seconds : 0; }
+    };
+
+    // same as above, but the selected column is grouped by length straight into store,
+    // with ids set to the entry index
+    XILINX_FUZZYMATCH_IMPL_DECL
+    int load_csv(const size_t max_entry_num, const size_t max_field_len, const std::string &file_path,
+                 const unsigned col, PatternStore &store, CsvLoadStats *stats = nullptr);
+
     XILINX_FUZZYMATCH_IMPL_DECL         
     int min(int a, int b);
     
@@ -77,6 +100,27 @@ namespace fuzzymatch {
     XILINX_FUZZYMATCH_IMPL_DECL
     float similarity(std::string str1, std::string str2);
 
+    // Input string pre-encoded for the bit-parallel (Myers/Hyyro) edit distance kernel.
+    // peq holds one match bit mask per character for every 64-character block of the string;
+    // pv/mv are per-block scratch vectors so that the comparison loop does not allocate.
+    struct EncodedPattern {
+        std::string str;
+        int len = 0;
+        int nwords = 0;
+        std::vector<uint64_t> peq;
+        std::vector<uint64_t> pv;
+        std::vector<uint64_t> mv;
+    };
+
+    XILINX_FUZZYMATCH_IMPL_DECL
+    void encodePattern(const std::string& str, EncodedPattern& ptn);
+
+    // similarity score [0..100] between an encoded input string and str2, same as the
+    // Levenshtein based score used by the FPGA kernel. returns 0 once the edit distance
+    // can no longer satisfy threshold.
+    XILINX_FUZZYMATCH_IMPL_DECL
+    int similarity(int threshold, EncodedPattern& ptn, const char* str2, int m);
+
     XILINX_FUZZYMATCH_IMPL_DECL
     size_t getMaxDistance(size_t len);
 
@@ -134,6 +178,14 @@ public:
 struct Options {
     XString xclbinPath;
     XString deviceNames;
+    // run executefuzzyMatch as a pipeline of sub-batches: persistent pinned buffers, two sub-batches
+    // in flight per CU, and the next sub-batch handed to whichever CU finishes first
+    bool pipelined = false;
+    // run the kernel calls of the pipeline on the host CPU instead of the FPGA, so the host code can
+    // be tested without an Alveo card.  Implies pipelined.
+    bool cpuEmulation = false;
+    // number of input strings per sub-batch in pipelined mode
+    int32_t pipelineBatchSize = 1024;
 };
 
 class FuzzyMatch  {
@@ -147,6 +199,20 @@ class FuzzyMatch  {
     //int fuzzyMatchLoadVec(std::vector<std::string>& patternVec);
     int fuzzyMatchLoadVec(std::vector<std::string>& vec_pattern,std::vector<int64_t> vec_id=std::vector<int64_t>());
 
+    // pack the pattern table exactly as fuzzyMatchLoadVec does and write it to fileName instead of loading it.
+    // Needs no FPGA card, so tables can be prepared offline; the table currently loaded is left untouched.
+    int fuzzyMatchPackToFile(std::vector<std::string>& vec_pattern, std::vector<int64_t> vec_id,
+                             const std::string& fileName);
+    // load a table written by fuzzyMatchPackToFile, replacing the one loaded by fuzzyMatchLoadVec
+    int fuzzyMatchLoadPackedFile(const std::string& fileName);
+
+    // Incremental updates of the loaded table. Removed patterns are cleared in place, added ones fill free rows
+    // of their length, and only the rows that changed are written to the device. The table is repacked, with
+    // some free rows per length, when an added length has no free row left or when a quarter of the rows
+    // are removed ones. vec_id[i] is the id of vec_pattern[i]; removePatterns returns the number removed.
+    int addPatterns(std::vector<std::string>& vec_pattern, std::vector<int64_t> vec_id);
+    int removePatterns(const std::vector<int64_t>& vec_id);
+
     // run fuzzymatch in batch mode
     // return vector of  hit patterns in pairs {id,score} for each input string. 
     // for each string , return maximum top 100 of hit patterns.
@@ -157,6 +223,178 @@ class FuzzyMatch  {
 
 }; // end class FuzzyMatch
 
+/**
+ * @brief Persistent work-stealing thread pool used by FuzzyMatchSW batch mode
+ *
+ * Each worker owns a contiguous range of task ids and works through it from the front.  A worker that runs out
+ * of tasks steals the back half of the range of another worker, so uneven tasks (e.g. very large length buckets)
+ * do not leave cores idle.
+ */
+class ThreadPool {
+   public:
+    explicit ThreadPool(unsigned numThreads);
+    ~ThreadPool();
+
+    unsigned getNumThreads() const { return numThreads_; }
+
+    // Call job(taskId, threadId) for every taskId in [0, numTasks) and wait until all of them are done.
+    void run(size_t numTasks, const std::function<void(size_t, unsigned)>& job);
+
+   private:
+    struct TaskRange {
+        std::mutex mtx;
+        size_t begin = 0;
+        size_t end = 0;
+    };
+
+    void workerLoop(unsigned tid);
+    bool popTask(unsigned tid, size_t& taskId);
+    bool stealTasks(unsigned tid);
+
+    unsigned numThreads_;
+    std::vector<std::thread> workers_;
+    std::unique_ptr<TaskRange[]> ranges_;
+    const std::function<void(size_t, unsigned)>* job_ = nullptr;
+    std::mutex runMtx_;  // serializes run() callers
+    std::mutex mtx_;
+    std::condition_variable startCv_;
+    std::condition_variable doneCv_;
+    uint64_t generation_ = 0;
+    unsigned numBusy_ = 0;
+    bool stop_ = false;
+}; // end class ThreadPool
+
+/**
+ * @brief Reference strings grouped by length in one contiguous character arena
+ *
+ * All strings of a length bucket have the same length, so a bucket is stored as size * len characters without
+ * separators, followed in a parallel array by the ids of the strings.  Only the lengths up to the longest string
+ * loaded are indexed.  Buckets are handed out as read-only views into the arena.  Removed strings stay in place
+ * as tombstones until the store is rebuilt.
+ */
+class PatternStore {
+   public:
+    struct Bucket {
+        const char* chars = nullptr;
+        const int* ids = nullptr;
+        size_t len = 0;
+        size_t size = 0;
+        size_t first = 0;  // index of the first string of the bucket over the whole store
+        const uint8_t* dead = nullptr;  // tombstone flags, nullptr when nothing was removed
+
+        const char* str(size_t i) const { return chars + i * len; }
+        bool isDead(size_t i) const { return dead != nullptr && dead[i] != 0; }
+    };
+
+    // group vec_pattern by length; ids[i] is the id of vec_pattern[i], or i if ids is empty
+    void build(const std::vector<std::string>& vec_pattern, const std::vector<int>& ids);
+    // same from strings packed back to back in chars, string i being [offsets[i], offsets[i+1])
+    void build(const char* chars, const std::vector<size_t>& offsets, const std::vector<int>& ids);
+    void clear();
+    // turn every live string whose id is in ids into a tombstone, return how many were removed
+    size_t remove(const std::unordered_set<int>& ids);
+
+    // longest length that has a bucket, -1 when empty
+    int getMaxLen() const { return first_.empty() ? -1 : int(first_.size()) - 2; }
+    // number of strings including tombstones
+    size_t getNumPatterns() const { return ids_.size(); }
+    size_t getNumDead() const { return numDead_; }
+
+    // view of the strings of length len, empty if there are none
+    Bucket getBucket(size_t len) const;
+
+   private:
+    // getStr(i) returns the i-th of num strings as a {pointer, length} pair
+    template <typename GetStr>
+    void buildFrom(size_t num, GetStr getStr, const std::vector<int>& ids);
+
+    std::vector<char> chars_;
+    std::vector<int> ids_;
+    std::vector<size_t> first_;     // first_[len] : index of the first string of length len, first_[len+1] ends it
+    std::vector<size_t> charBase_;  // charBase_[len] : offset of that string in chars_
+    std::vector<uint8_t> dead_;     // allocated by the first remove
+    size_t numDead_ = 0;
+}; // end class PatternStore
+
+/**
+ * @brief Inverted q-gram index over a PatternStore, used to discard candidates before the edit distance check
+ *
+ * Count filtering: if ed(x, y) <= k, x and y share at least max(|x|, |y|) - q + 1 - k * q q-grams (as multisets).
+ * A string of the store whose common q-gram count with the input is below that bound cannot reach the requested
+ * similarity level and is skipped, so results stay exact.
+ */
+class QgramIndex {
+   public:
+    static const int max_q = 4;
+
+    // per-thread state of one input string: its distinct q-grams with their counts, and the
+    // candidate counters (kept zeroed between calls)
+    struct Query {
+        std::vector<std::pair<uint32_t, uint32_t> > grams;
+        std::vector<uint32_t> counts;
+        std::vector<uint32_t> touched;
+        std::vector<uint32_t> candidates;
+    };
+
+    // q = 0 disables the filter
+    void build(const PatternStore& store, int q);
+    void clear();
+    int getQ() const { return q_; }
+
+    void encodeQuery(const std::string& str, Query& query) const;
+
+    // minimum number of common q-grams between an input string of length n and a string of
+    // length m reaching similarity_level; <= 0 when the filter cannot reject anything
+    int getMinCommon(int n, int m, int similarity_level) const;
+
+    // append to candidates the store indexes in [begin, end) sharing at least min_common q-grams with the query
+    void filter(Query& query, size_t begin, size_t end, int min_common, std::vector<uint32_t>& candidates) const;
+
+   private:
+    int q_ = 0;
+    std::vector<uint32_t> grams_;       // distinct q-grams, sorted
+    std::vector<size_t> postingBase_;   // postings of grams_[i] are [postingBase_[i], postingBase_[i+1])
+    std::vector<uint32_t> postingIdx_;  // store index, ascending within a posting list
+    std::vector<uint32_t> postingCnt_;  // occurrences of the q-gram in that string
+}; // end class QgramIndex
+
+// counters of the q-gram filter: strings in the length window of the input, and strings actually verified
+struct FilterStats {
+    uint64_t candidates = 0;
+    uint64_t verified = 0;
+};
+
+/**
+ * @brief Bounded collector of the best {id, score} hits of one input string
+ *
+ * Keeps the k best hits, by descending score then ascending id, in a min-heap whose top is the worst of them.
+ * Once k hits are held, a new hit has to score at least as much as that worst one, which is returned by
+ * getThreshold(), so that the verifier can give up on a string as soon as it cannot reach it.  k = 0 keeps
+ * every hit.
+ */
+class TopKCollector {
+   public:
+    TopKCollector(size_t k, int threshold) : k_(k), threshold_(threshold) {}
+
+    // threshold the collector was created with
+    int getBaseThreshold() const { return threshold_; }
+    // minimum score a new hit needs to be kept
+    int getThreshold() const { return (k_ > 0 && hits_.size() == k_) ? hits_.front().second : threshold_; }
+    // level to run the verifier at: the early exit of similarity() may drop a string scoring exactly its
+    // level, so a raised threshold is verified one below to still score the ties with the worst hit
+    int getVerifyLevel() const { return std::max(threshold_, getThreshold() - 1); }
+    size_t size() const { return hits_.size(); }
+
+    void push(int64_t id, int score);
+    // hits ordered by descending score then ascending id; the collector is left empty
+    void getSorted(std::vector<std::pair<int64_t, int> >& out);
+
+   private:
+    size_t k_;
+    int threshold_;
+    std::vector<std::pair<int64_t, int> > hits_;
+}; // end class TopKCollector
+
 class FuzzyMatchSW {
    public:
     FuzzyMatchSW() {
@@ -173,18 +411,54 @@ class FuzzyMatchSW {
 
     // The check method returns top result id->scores, and triggering condition if any.
     //bool check(const std::string& t);
+    // check returns every hit; checkTopK only the best getMaxResults() of them, ordered by descending score.
     std::unordered_map<int,int>  check(int threshold, const std::string &ptn_string);
+    std::vector<std::pair<int64_t,int>> checkTopK(int threshold, const std::string &ptn_string);
+
+    // number of hits kept per input string by checkTopK and executefuzzyMatch, 100 by default like the FPGA
+    void setMaxResults(size_t k) { max_results = k; }
+    size_t getMaxResults() const { return max_results; }
+
+    // run fuzzymatch in batch mode on a persistent thread pool
+    // return vector of  hit patterns in pairs {id,score} for each input string, same as FuzzyMatch::executefuzzyMatch.
+    // for each string , return maximum top getMaxResults() of hit patterns ordered by descending score.
+    std::vector<std::vector<std::pair<int64_t,int>>> executefuzzyMatch(std::vector<std::string> input_patterns, int similarity_level);
+
+    // Incremental updates. Removed patterns become tombstones in the length buckets and added ones go to a
+    // small delta store searched alongside them; both are merged back by compactPatterns, which runs on its
+    // own once tombstones or the delta store grow past a quarter / a sixteenth of the table.
+    // vec_id[i] is the id of vec_pattern[i]; removePatterns returns the number of patterns removed.
+    int addPatterns(std::vector<std::string>& vec_pattern, std::vector<int> vec_id);
+    int removePatterns(const std::vector<int>& vec_id);
+    void compactPatterns();
+
+    // enable the q-gram prefilter (q in 1..4), 0 to disable it. The index is (re)built over the
+    // patterns already loaded and by every later initialize call.
+    void setQgramFilter(int q);
+    FilterStats getFilterStats() const;
+    void resetFilterStats();
 
    protected:
     size_t max_fuzzy_len;
     size_t max_contain_len;
     size_t max_equan_len;
 
-    std::vector<std::vector<std::string> > vec_pattern_grp =
-        std::vector<std::vector<std::string> >(max_len_in_char);
-
-    std::vector<std::vector<int> > vec_pattern_id = 
-        std::vector<std::vector<int> >(max_len_in_char);
+    size_t max_results = 100;
+    PatternStore pattern_store;
+    int qgram_len = 0;
+    QgramIndex qgram_index;
+    // patterns added since the last compaction
+    std::vector<std::string> delta_patterns;
+    std::vector<int> delta_ids;
+    PatternStore delta_store;
+    QgramIndex delta_index;
+
+    void rebuildDelta();
+    std::atomic<uint64_t> num_candidates{0};
+    std::atomic<uint64_t> num_verified{0};
+
+    // created by the first executefuzzyMatch call and kept for the lifetime of the object
+    std::unique_ptr<ThreadPool> pool_;
 
 }; // end class FuzzyMatchSW
 
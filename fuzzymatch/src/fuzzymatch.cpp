@@ -15,11 +15,18 @@
 */
 
 #include <cassert>
+#include <cstring>
 #include <iostream>
+#include <fstream>
 #include <sstream>
 #include <limits>
 //#include <regex>
 #include <string>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <unordered_set>
 #include "ap_int.h"
 #include "xilinx_runtime_common.hpp"
 #include "fuzzymatch.hpp"
@@ -63,32 +70,82 @@ namespace fuzzymatch {
         cl::Kernel fuzzy[4];
         int buf_f_i_idx=0;
     
-        int sum_line;
-        std::vector<std::vector<std::string> > vec_pattern_grp =
-            std::vector<std::vector<std::string> >(max_len_in_char);
-        std::vector<std::vector<int64_t> > vec_pattern_id = 
-            std::vector<std::vector<int64_t> > (max_len_in_char);
+        int sum_line = 0;
       
         std::vector<int> vec_base ;
         std::vector<int> vec_offset ;
         cl::Buffer buf_csv[2 * PU_NUM];
         cl::Buffer buf_field_i[2];
         cl::Buffer buf_field_o[2];
+        // packed pattern table of each PU, kept on the host as the backing store of buf_csv
+        char* csv_part[PU_NUM] = {nullptr};
+        // rows holding a pattern, and rows cleared by removePatterns since the last packing and not reused
+        // by addPatterns; dead_row flags the latter, at p * sum_line + j
+        size_t num_live_rows = 0;
+        size_t num_dead_rows = 0;
+        std::vector<char> dead_row;
 
+        // pipelined mode: SLOT_NUM sub-batches in flight on each of the CU_NUM CUs. The pinned
+        // buffers of every slot are allocated once, when the pattern table is loaded.
+        static const int CU_NUM = 2;
+        static const int SLOT_NUM = 2;
+        struct PipelineSlot {
+            FuzzyMatchImpl* impl = nullptr;
+            int cu = 0;
+            int batch_num = 0;
+            std::vector<int> input_idx;  // index in the caller's input vector of each string
+            ap_uint<32>* buf_in = nullptr;
+            ap_uint<32>* buf_out = nullptr;
+            cl::Buffer buf_field_i;
+            cl::Buffer buf_field_o;
+            cl::Event event_read;
+            std::thread emu_thread;
+        };
+        PipelineSlot slots[CU_NUM][SLOT_NUM];
+        int pipeline_batch_size = 0;
+        std::mutex done_mtx;
+        std::condition_variable done_cv;
+        std::deque<PipelineSlot*> done_slots;
+
+        ~FuzzyMatchImpl();
     
         int getDevice(const std::string& deviceNames);
         int startFuzzyMatch(const std::string& xclbinPath, const std::string& deviceNames);
 
         int fuzzyMatchLoadVec(std::vector<std::string>& vec_pattern,std::vector<int64_t> vec_id=std::vector<int64_t>());
+        int fuzzyMatchPackToFile(std::vector<std::string>& vec_pattern, std::vector<int64_t> vec_id,
+                                 const std::string& fileName);
+        int fuzzyMatchLoadPackedFile(const std::string& fileName);
+        int addPatterns(std::vector<std::string>& vec_pattern, std::vector<int64_t>& vec_id);
+        int removePatterns(const std::vector<int64_t>& vec_id);
         
         // batch mode
         // for each string in input_patterns vectors, run fuzzymatch, return maximum top 100 matched results in pair format {id,score} 
         std::vector<std::vector<std::pair<int64_t,int>>> executefuzzyMatch(std::vector<std::string> input_patterns, int similarity_level);
 
-        void preCalculateOffsetPerPU(
-                    std::vector<std::vector<std::pair<int, std::string> > >& vec_grp_str,
+        int preCalculateOffsetPerPU(
+                    const std::vector<int>& vec_len_cnt,
                     std::vector<int> &vec_base,
                     std::vector<int> &vec_offset);
+
+        void packPatternTable(std::vector<std::string>& vec_pattern, std::vector<int64_t>& vec_id,
+                              std::vector<int>& vec_base, std::vector<int>& vec_offset, int& sum_line,
+                              char* csv_part[PU_NUM], int headroom_pct = 0);
+        void replacePatternTable(std::vector<int>& new_base, std::vector<int>& new_offset, int new_sum_line,
+                                 char* new_csv_part[PU_NUM]);
+        void compactPatternTable(std::vector<std::string>& vec_pattern, std::vector<int64_t>& vec_id);
+        void migratePatternTable();
+        void migrateRows(std::vector<std::vector<int> >& rows);
+        void freePatternTable();
+        void initPipeline();
+        void freePipeline();
+        void fillSlot(PipelineSlot& slot, std::vector<std::string>& input_patterns, int& next, int similarity_level);
+        void launchSlot(PipelineSlot& slot);
+        void notifySlotDone(PipelineSlot* slot);
+        PipelineSlot* waitSlotDone();
+        void emulateKernel(int batch_num, const ap_uint<32>* buf_in, ap_uint<32>* buf_out);
+        std::vector<std::vector<std::pair<int64_t,int>>> executefuzzyMatchPipelined(
+            std::vector<std::string>& input_patterns, int similarity_level);
     
     };
        
@@ -132,30 +189,53 @@ namespace fuzzymatch {
 
         return 0;
     }
-    void FuzzyMatchImpl::preCalculateOffsetPerPU(
-                            std::vector<std::vector<std::pair<int, std::string> > >& vec_grp_str,
+
+    const int fold_len_per_str = 1 + (max_fuzzy_len + 3) / 4;
+    const int input_rec_len = 3 + fold_len_per_str;
+    const int output_rec_len = 201;
+
+    // kernel input record of one string: base row, number of rows, threshold, then the characters
+    // packed 4 per word (first one in the most significant byte) with the length in the last word
+    void encodeInputRecord(int similarity_level,
+                           std::string& input,
+                           std::vector<int>& vec_base,
+                           std::vector<int>& vec_offset,
+                           ap_uint<32>* rec) {
+        int base = 0;
+        int nrow = 0;
+        getRange(similarity_level, input, vec_base, vec_offset, base, nrow);
+        rec[0] = base;
+        rec[1] = nrow;
+        rec[2] = similarity_level;
+        for (unsigned int j = 0; j < max_fuzzy_len; j++) {
+            if (j < input.size())
+                rec[3 + (j / 4)]((3 - j % 4) * 8 + 7, (3 - j % 4) * 8) = input.at(j);
+            else
+                rec[3 + (j / 4)]((3 - j % 4) * 8 + 7, (3 - j % 4) * 8) = 0;
+        }
+        rec[input_rec_len - 1](7, 0) = input.size();
+    }
+    int FuzzyMatchImpl::preCalculateOffsetPerPU(
+                            const std::vector<int>& vec_len_cnt,
                             std::vector<int> &vec_base,
                             std::vector<int> &vec_offset)
     {
         // the input table already grouped by length
-        // scan the string vec for each length, compute:
+        // from the number of strings of each length, compute:
         // vec_base : base address for each length in each PU
         // vec_offset : each PU get the vec size
-        this->sum_line = 0;
+        // returns the total number of rows per PU
+        int sum_line = 0;
         for (size_t i = 0; i <= max_fuzzy_len; i++)
         {
-            //vec_grp_str[i] = this->vec_pattern_grp[i];
-            int size = this->vec_pattern_grp[i].size();
-            for (int j = 0; j < size; j++) {
-                vec_grp_str[i].push_back(std::make_pair(this->vec_pattern_id[i][j], this->vec_pattern_grp[i][j]));
-            }
+            int size = vec_len_cnt[i];
             int delta = (size + this->PU_NUM - 1) / this->PU_NUM;
     
-            vec_base[i] = this->sum_line;
+            vec_base[i] = sum_line;
             vec_offset[i] = delta;
-            this->sum_line += delta;
+            sum_line += delta;
         }
-    
+        return sum_line;
     }
     
     int FuzzyMatchImpl::getDevice(const std::string& deviceNames)
@@ -196,6 +276,10 @@ namespace fuzzymatch {
 
     int FuzzyMatchImpl::startFuzzyMatch(const std::string &xclbinPath, const std::string& deviceNames)
     {
+        if (options_.cpuEmulation) {
+            std::cout << "INFO: Start Fuzzy Match in CPU emulation mode" << std::endl;
+            return 0;
+        }
         if (getDevice(deviceNames) < 0) {
             std::cout << "ERROR: Unable to find device " << deviceNames << std::endl;
             return -2;
@@ -247,6 +331,42 @@ namespace fuzzymatch {
     int FuzzyMatchImpl::fuzzyMatchLoadVec(std::vector<std::string>& vec_pattern,std::vector<int64_t> vec_id)
     {
         std::cout << "INFO: FuzzyMatchImpl::fuzzyMatchLoadVec vec_pattern size=" << vec_pattern.size() << std::endl;
+        std::vector<int> new_base, new_offset;
+        int new_sum_line = 0;
+        char* new_csv_part[PU_NUM];
+        packPatternTable(vec_pattern, vec_id, new_base, new_offset, new_sum_line, new_csv_part);
+        replacePatternTable(new_base, new_offset, new_sum_line, new_csv_part);
+        migratePatternTable();
+        return 0;
+    }
+
+    // swap in a newly packed table and recount its rows
+    void FuzzyMatchImpl::replacePatternTable(std::vector<int>& new_base, std::vector<int>& new_offset,
+                                             int new_sum_line, char* new_csv_part[PU_NUM])
+    {
+        const int line_per_elem = (max_fuzzy_len + 1 + 4 + 15) / 16;
+        freePatternTable();
+        vec_base.swap(new_base);
+        vec_offset.swap(new_offset);
+        sum_line = new_sum_line;
+        num_live_rows = 0;
+        num_dead_rows = 0;
+        dead_row.assign((size_t)PU_NUM * sum_line, 0);
+        for (int i = 0; i < PU_NUM; i++) {
+            csv_part[i] = new_csv_part[i];
+            for (int r = 0; r < sum_line; r++)
+                num_live_rows += csv_part[i][16 * (line_per_elem * r + line_per_elem - 1)] != 0;
+        }
+    }
+
+    // Group the patterns by length and pack them into csv_part.  Within a length, pattern PU_NUM * j + p goes
+    // to row vec_base[len] + j of PU p; each row holds the characters byte-reversed per 16-byte line followed by
+    // a line with the length and the 32-bit id.  Rows are packed in parallel, straight from vec_pattern.
+    // headroom_pct adds that share of free rows, plus one per PU, to every length for later addPatterns.
+    void FuzzyMatchImpl::packPatternTable(std::vector<std::string>& vec_pattern, std::vector<int64_t>& vec_id,
+                                          std::vector<int>& vec_base, std::vector<int>& vec_offset, int& sum_line,
+                                          char* csv_part[PU_NUM], int headroom_pct)
+    {
         // check big table size should ot larger than max_num_of_entries_for_big_tbl
         if (vec_pattern.size() > max_num_of_entries_for_big_tbl) {
             std::ostringstream oss;
@@ -255,95 +375,96 @@ namespace fuzzymatch {
             std::cerr << "Input Pattern vector size should not larger than" << max_num_of_entries_for_big_tbl << "; Please split pattern vector properly and run again" <<std::endl;
             abort();
         }
-        this->vec_pattern_id.clear();
-        this->vec_pattern_id.resize(max_len_in_char);
-        this->vec_pattern_grp.clear();
-        this->vec_pattern_grp.resize(max_len_in_char);
-        //group the pattern id
-        if(!vec_id.empty()){    
-            for (int idx=0; idx < vec_pattern.size(); idx++) {
-                size_t len = vec_pattern[idx].length();
-                //assert(len < max_pattern_len_in_char && "Defined <max_people_len_in_char> is not enough!");
-                 if (len > max_fuzzy_len) {
-                    std::ostringstream oss;
-                    oss << "the string " << vec_pattern[idx] << " length should not larger than" << max_fuzzy_len <<std::endl;
-                    throw xilinx_apps::fuzzymatch::Exception(oss.str());
-                    std::cerr << "ERROR: the string " << vec_pattern[idx] << " length should not larger than" << max_fuzzy_len <<std::endl;
-                    abort();
-                }
-                //std::cout << "DEBUG:: vec_pattern:" << vec_pattern[idx] << "; vec_id:"<< vec_id[idx]<<std::endl;
-                vec_pattern_id[len].push_back(vec_id[idx]);
-            }
-        } else {
-            //default assignment
-            int id_cnt = 0;
-            for (std::vector<std::string>::iterator it = vec_pattern.begin(); it != vec_pattern.end(); ++it) {
-                size_t len = it->length();
-                //assert(len < max_pattern_len_in_char && "Defined <max_people_len_in_char> is not enough!");
-                if (len > max_fuzzy_len) {
-                    std::ostringstream oss;
-                    oss << "the string " << *it << " length should not larger than" << max_fuzzy_len <<std::endl;
-                    throw xilinx_apps::fuzzymatch::Exception(oss.str());
-                    std::cerr << "ERROR: the string " << *it << " length should not larger than" << max_fuzzy_len <<std::endl;
-                    abort();
-                }
-                vec_pattern_id[len].push_back(id_cnt++);
+        for (size_t idx = 0; idx < vec_pattern.size(); idx++) {
+            size_t len = vec_pattern[idx].length();
+            //assert(len < max_pattern_len_in_char && "Defined <max_people_len_in_char> is not enough!");
+            if (len > max_fuzzy_len) {
+                std::ostringstream oss;
+                oss << "the string " << vec_pattern[idx] << " length should not larger than" << max_fuzzy_len <<std::endl;
+                throw xilinx_apps::fuzzymatch::Exception(oss.str());
             }
         }
-        preSortbyLength(vec_pattern, this->vec_pattern_grp);
-        // Do pre-group process for People deny list to boost Fuzzy function
-    
-        vec_base.resize(100, 0);
-        vec_offset.resize(100, 0);
-    
-        //std::cout << "    Pre-sorting..." << std::flush;
-        std::vector<std::vector<std::pair<int, std::string> > > vec_grp_str(100);
-        preCalculateOffsetPerPU(vec_grp_str, vec_base, vec_offset);
-        int sum_line_num = sum_line;
-        //std::cout << "    Pre-sort completed" << std::endl;
-    
         const int line_per_elem = (max_fuzzy_len + 1 + 4 + 15) / 16;
-        char *csv_part[PU_NUM];
-        for (int i = 0; i < PU_NUM; i++)
+        const int row_bytes = 16 * line_per_elem;
+
+        // stable counting sort of the pattern indices by length
+        std::vector<int> vec_len_cnt(max_fuzzy_len + 1, 0);
+        for (size_t idx = 0; idx < vec_pattern.size(); idx++)
+            vec_len_cnt[vec_pattern[idx].length()]++;
+        std::vector<size_t> vec_len_first(max_fuzzy_len + 2, 0);
+        for (int i = 0; i <= max_fuzzy_len; i++)
+            vec_len_first[i + 1] = vec_len_first[i] + vec_len_cnt[i];
+        std::vector<int> order(vec_pattern.size());
         {
-            //csv_part[i] = (char *)malloc(16 * 3 * sum_line_num);
-            csv_part[i] = aligned_alloc<char>(16 * line_per_elem  * sum_line_num);
+            std::vector<size_t> pos(vec_len_first.begin(), vec_len_first.end() - 1);
+            for (size_t idx = 0; idx < vec_pattern.size(); idx++)
+                order[pos[vec_pattern[idx].length()]++] = idx;
         }
-    
-        for (uint32_t i = 0; i < vec_grp_str.size(); i++)
-        {
-            for (int j = 0; j < vec_offset[i]; j++)
-            {
-                for (int p = 0; p < PU_NUM; p++)
-                {
-                    std::string str = "";
-                    char len = 0;
-                    int id = 0;
-                    if (unsigned(PU_NUM * j + p) < vec_grp_str[i].size())
-                    {
-                        str = vec_grp_str[i][PU_NUM * j + p].second;
-                        id = vec_grp_str[i][PU_NUM * j + p].first;
-                        len = i;
-                    }
-    
-                    char tmp[(line_per_elem - 1) * 16] = {0};
 
-                    for (int j = 0; j < len; j++) tmp[j] = str.at(j);
+        vec_base.assign(100, 0);
+        vec_offset.assign(100, 0);
+        std::vector<int> vec_row_cnt(vec_len_cnt);
+        if (headroom_pct > 0) {
+            for (int i = 1; i <= max_fuzzy_len; i++)
+                vec_row_cnt[i] += (int64_t)vec_len_cnt[i] * headroom_pct / 100 + PU_NUM;
+        }
+        sum_line = preCalculateOffsetPerPU(vec_row_cnt, vec_base, vec_offset);
+        for (int i = 0; i < PU_NUM; i++)
+            csv_part[i] = aligned_alloc<char>((size_t)row_bytes * sum_line);
+
+        // one task per slice of rows of one length
+        const int slice_rows = 4096;
+        struct PackTask {
+            int len;
+            int row_begin;
+            int row_end;
+        };
+        std::vector<PackTask> tasks;
+        for (int i = 0; i <= max_fuzzy_len; i++) {
+            for (int j = 0; j < vec_offset[i]; j += slice_rows)
+                tasks.push_back({i, j, std::min(j + slice_rows, vec_offset[i])});
+        }
 
-                    for (int m = 0; m < line_per_elem - 1; m++) {
-                        for (int k = 0; k < 16; k++) {
-                            csv_part[p][16 * (line_per_elem * (vec_base[i] + j) + m) + 15 - k] = tmp[m * 16 + k];
-                        }
-                    }
-                    csv_part[p][16 * (line_per_elem * (vec_base[i] + j) + line_per_elem - 1) + 0] = len;
-                    csv_part[p][16 * (line_per_elem * (vec_base[i] + j) + line_per_elem - 1) + 1] = id & 0xFF;
-                    csv_part[p][16 * (line_per_elem * (vec_base[i] + j) + line_per_elem - 1) + 2] = (id >> 8) & 0xFF;
-                    csv_part[p][16 * (line_per_elem * (vec_base[i] + j) + line_per_elem - 1) + 3] = (id >> 16) & 0xFF;
-                    csv_part[p][16 * (line_per_elem * (vec_base[i] + j) + line_per_elem - 1) + 4] = (id >> 24) & 0xFF;
+        unsigned num_threads = std::thread::hardware_concurrency();
+        ThreadPool pool(num_threads == 0 ? 1 : num_threads);
+        pool.run(tasks.size(), [&](size_t t, unsigned) {
+            const PackTask& task = tasks[t];
+            const int len = task.len;
+            const size_t first = vec_len_first[len];
+            const size_t cnt = vec_len_cnt[len];
+            for (int p = 0; p < PU_NUM; p++) {
+                char* row = csv_part[p] + (size_t)row_bytes * (vec_base[len] + task.row_begin);
+                for (int j = task.row_begin; j < task.row_end; j++, row += row_bytes) {
+                    memset(row, 0, row_bytes);
+                    size_t k = (size_t)PU_NUM * j + p;
+                    if (k >= cnt)
+                        continue;
+                    int idx = order[first + k];
+                    const char* str = vec_pattern[idx].data();
+                    for (int c = 0; c < len; c++)
+                        row[16 * (c / 16) + 15 - c % 16] = str[c];
+                    int id = vec_id.empty() ? idx : vec_id[idx];
+                    char* tail = row + 16 * (line_per_elem - 1);
+                    tail[0] = len;
+                    tail[1] = id & 0xFF;
+                    tail[2] = (id >> 8) & 0xFF;
+                    tail[3] = (id >> 16) & 0xFF;
+                    tail[4] = (id >> 24) & 0xFF;
                 }
             }
-        }
-    
+        });
+    }
+
+    // create buf_csv on top of csv_part and move it to the device
+    void FuzzyMatchImpl::migratePatternTable()
+    {
+        const int line_per_elem = (max_fuzzy_len + 1 + 4 + 15) / 16;
+        int sum_line_num = sum_line;
+        if (options_.pipelined || options_.cpuEmulation)
+            initPipeline();
+        if (options_.cpuEmulation)
+            return;
+
         //transfer pattern vec
         cl_mem_ext_ptr_t mext_t[2 * PU_NUM];
 
@@ -368,11 +489,98 @@ namespace fuzzymatch {
             ob_in.push_back(buf_csv[i]);
         queue.enqueueMigrateMemObjects(ob_in, 0, nullptr, nullptr);
         queue.finish();
-    
-        // free memory
-        for (int i = 0; i < PU_NUM; i++)
+    }
+
+    // Packed table file: header, vec_base/vec_offset of lengths 0..max_fuzzy_len, then the rows of each PU
+    static const char packed_file_magic[8] = {'X', 'F', 'M', 'P', 'A', 'C', 'K', '1'};
+
+    struct PackedFileHeader {
+        char magic[8];
+        int32_t pu_num;
+        int32_t line_per_elem;
+        int32_t max_len;
+        int32_t sum_line;
+    };
+
+    int FuzzyMatch::fuzzyMatchPackToFile(std::vector<std::string>& vec_pattern, std::vector<int64_t> vec_id,
+                                         const std::string& fileName)
+    {
+        return pImpl_->fuzzyMatchPackToFile(vec_pattern, vec_id, fileName);
+    }
+
+    int FuzzyMatchImpl::fuzzyMatchPackToFile(std::vector<std::string>& vec_pattern, std::vector<int64_t> vec_id,
+                                             const std::string& fileName)
+    {
+        // packed into a separate table, so the one loaded for matching is left alone
+        const int line_per_elem = (max_fuzzy_len + 1 + 4 + 15) / 16;
+        std::vector<int> vec_base, vec_offset;
+        int sum_line = 0;
+        char* csv_part[PU_NUM];
+        packPatternTable(vec_pattern, vec_id, vec_base, vec_offset, sum_line, csv_part);
+
+        std::ofstream f(fileName, std::ios::binary);
+        PackedFileHeader hdr;
+        memcpy(hdr.magic, packed_file_magic, sizeof(hdr.magic));
+        hdr.pu_num = PU_NUM;
+        hdr.line_per_elem = line_per_elem;
+        hdr.max_len = max_fuzzy_len;
+        hdr.sum_line = sum_line;
+        f.write((const char*)&hdr, sizeof(hdr));
+        f.write((const char*)vec_base.data(), sizeof(int) * (max_fuzzy_len + 1));
+        f.write((const char*)vec_offset.data(), sizeof(int) * (max_fuzzy_len + 1));
+        for (int i = 0; i < PU_NUM; i++) {
+            f.write(csv_part[i], (std::streamsize)16 * line_per_elem * sum_line);
             free(csv_part[i]);
-    
+        }
+        if (!f.good()) {
+            std::cout << "ERROR: Failed to write " << fileName << std::endl;
+            return -1;
+        }
+        std::cout << "INFO: packed " << vec_pattern.size() << " patterns into " << fileName << std::endl;
+        return 0;
+    }
+
+    int FuzzyMatch::fuzzyMatchLoadPackedFile(const std::string& fileName)
+    {
+        return pImpl_->fuzzyMatchLoadPackedFile(fileName);
+    }
+
+    int FuzzyMatchImpl::fuzzyMatchLoadPackedFile(const std::string& fileName)
+    {
+        const int line_per_elem = (max_fuzzy_len + 1 + 4 + 15) / 16;
+        std::ifstream f(fileName, std::ios::binary);
+        if (!f.good()) {
+            std::cout << "ERROR: Failed to open " << fileName << std::endl;
+            return -1;
+        }
+        PackedFileHeader hdr;
+        f.read((char*)&hdr, sizeof(hdr));
+        if (!f.good() || memcmp(hdr.magic, packed_file_magic, sizeof(hdr.magic)) != 0 || hdr.pu_num != PU_NUM ||
+            hdr.line_per_elem != line_per_elem || hdr.max_len != max_fuzzy_len || hdr.sum_line < 0) {
+            std::ostringstream oss;
+            oss << fileName << " is not a packed pattern table of this FuzzyMatch build" << std::endl;
+            throw xilinx_apps::fuzzymatch::Exception(oss.str());
+        }
+        std::vector<int> new_base(100, 0), new_offset(100, 0);
+        f.read((char*)new_base.data(), sizeof(int) * (max_fuzzy_len + 1));
+        f.read((char*)new_offset.data(), sizeof(int) * (max_fuzzy_len + 1));
+        char* new_csv_part[PU_NUM];
+        for (int i = 0; i < PU_NUM; i++) {
+            new_csv_part[i] = aligned_alloc<char>((size_t)16 * line_per_elem * hdr.sum_line);
+            f.read(new_csv_part[i], (std::streamsize)16 * line_per_elem * hdr.sum_line);
+        }
+        if (!f.good()) {
+            for (int i = 0; i < PU_NUM; i++)
+                free(new_csv_part[i]);
+            std::ostringstream oss;
+            oss << fileName << " is truncated" << std::endl;
+            throw xilinx_apps::fuzzymatch::Exception(oss.str());
+        }
+
+        replacePatternTable(new_base, new_offset, hdr.sum_line, new_csv_part);
+        migratePatternTable();
+        std::cout << "INFO: loaded packed pattern table " << fileName << " with " << sum_line << " rows per PU"
+                  << std::endl;
         return 0;
     }
     
@@ -386,6 +594,9 @@ namespace fuzzymatch {
     //bool FuzzyMatchImpl::executefuzzyMatch(const std::string& t, int similarity_level)
     std::vector<std::vector<std::pair<int64_t,int>>> FuzzyMatchImpl::executefuzzyMatch(std::vector<std::string> input_patterns, int similarity_level)
     {
+        if (options_.pipelined || options_.cpuEmulation)
+            return executefuzzyMatchPipelined(input_patterns, similarity_level);
+
         int batch_num = input_patterns.size();
         //check batch_num should not larger than max_batch_num due to memroy size
         if (batch_num > max_batch_num) {
@@ -408,14 +619,11 @@ namespace fuzzymatch {
         }
 
         const int threshold = similarity_level;
-        const int fold_len_per_str = 1 + (max_fuzzy_len + 3) / 4;
-        int base_trans = 0;
-        int nrow_trans = 0;
         ap_uint<32>* buf_f_i[2];
         ap_uint<32>* buf_result[2];
 
         for (int i = 0; i < 2; i++) {
-            buf_f_i[i] = (ap_uint<32>*)malloc(sizeof(ap_uint<32>) * batch_num * (3 + fold_len_per_str));
+            buf_f_i[i] = (ap_uint<32>*)malloc(sizeof(ap_uint<32>) * batch_num * input_rec_len);
             buf_result[i] = (ap_uint<32>*)malloc(sizeof(ap_uint<32>) * batch_num * 201);  
         }
         double avg_time = 0.0;
@@ -436,20 +644,8 @@ namespace fuzzymatch {
             std::string ptn_string = input_patterns[i];
             //std::cout << "Trans-" << i << ", Pattern String: <" << ptn_string
             //            << "> being allocated to kernel-" << k << std::endl;
-            getRange(threshold, ptn_string, vec_base, vec_offset, base_trans, nrow_trans);
-            
             int localIdx = i % ((batch_num+1)/2);
-            buf_f_i[k][localIdx * (3 + fold_len_per_str)] = base_trans;
-            buf_f_i[k][localIdx * (3 + fold_len_per_str) + 1] = nrow_trans;
-            buf_f_i[k][localIdx * (3 + fold_len_per_str) + 2] = threshold;
-            for (unsigned int j = 0; j < max_fuzzy_len; j++) {
-                if (j < ptn_string.size())
-                    buf_f_i[k][localIdx * (3 + fold_len_per_str) + 3 + (j / 4)]((3 - j % 4) * 8 + 7, (3 - j % 4) * 8) =
-                        ptn_string.at(j);
-                else
-                    buf_f_i[k][localIdx * (3 + fold_len_per_str) + 3 + (j / 4)]((3 - j % 4) * 8 + 7, (3 - j % 4) * 8) = 0;
-            }
-            buf_f_i[k][(localIdx + 1) * (3 + fold_len_per_str) - 1](7, 0) = ptn_string.size();
+            encodeInputRecord(threshold, ptn_string, vec_base, vec_offset, buf_f_i[k] + localIdx * input_rec_len);
         }
 
         std::vector<std::vector<cl::Event> > events_write =
@@ -464,7 +660,7 @@ namespace fuzzymatch {
         int idx=0;
         while(idx<batch_num && idx<2) {
             int k = idx%2;
-            queue.enqueueWriteBuffer(buf_field_i[k], CL_FALSE, 0, sizeof(uint32_t) * batch_num * (3 + fold_len_per_str),
+            queue.enqueueWriteBuffer(buf_field_i[k], CL_FALSE, 0, sizeof(uint32_t) * batch_num * input_rec_len,
                                         buf_f_i[k], nullptr, &events_write[k][0]);
             int j = 0;
             
@@ -494,7 +690,406 @@ namespace fuzzymatch {
         
         return results;
     }
-       
+
+    int FuzzyMatch::addPatterns(std::vector<std::string>& vec_pattern, std::vector<int64_t> vec_id)
+    {
+        return pImpl_->addPatterns(vec_pattern, vec_id);
+    }
+
+    int FuzzyMatch::removePatterns(const std::vector<int64_t>& vec_id)
+    {
+        return pImpl_->removePatterns(vec_id);
+    }
+
+    int FuzzyMatchImpl::addPatterns(std::vector<std::string>& vec_pattern, std::vector<int64_t>& vec_id)
+    {
+        const int line_per_elem = (max_fuzzy_len + 1 + 4 + 15) / 16;
+        const int row_bytes = 16 * line_per_elem;
+        if (vec_id.size() != vec_pattern.size()) {
+            std::ostringstream oss;
+            oss << "addPatterns got " << vec_pattern.size() << " patterns but " << vec_id.size() << " ids" << std::endl;
+            throw xilinx_apps::fuzzymatch::Exception(oss.str());
+        }
+        std::vector<std::vector<int> > vec_add(max_fuzzy_len + 1);
+        for (size_t idx = 0; idx < vec_pattern.size(); idx++) {
+            size_t len = vec_pattern[idx].length();
+            if (len > max_fuzzy_len) {
+                std::ostringstream oss;
+                oss << "the string " << vec_pattern[idx] << " length should not larger than" << max_fuzzy_len <<std::endl;
+                throw xilinx_apps::fuzzymatch::Exception(oss.str());
+            }
+            // an empty pattern is packed as a free row and never matches, nothing to add
+            if (len > 0)
+                vec_add[len].push_back(idx);
+        }
+
+        // free rows of every length that gets new patterns; repack if one of them is short
+        std::vector<std::vector<std::pair<int, int> > > vec_free(max_fuzzy_len + 1);
+        for (int len = 1; len <= max_fuzzy_len; len++) {
+            if (vec_add[len].empty())
+                continue;
+            if (csv_part[0] != nullptr) {
+                for (int j = vec_base[len]; j < vec_base[len] + vec_offset[len] && vec_free[len].size() < vec_add[len].size(); j++) {
+                    for (int p = 0; p < PU_NUM; p++) {
+                        if (csv_part[p][(size_t)row_bytes * j + 16 * (line_per_elem - 1)] == 0)
+                            vec_free[len].push_back(std::make_pair(p, j));
+                    }
+                }
+            }
+            if (vec_free[len].size() < vec_add[len].size()) {
+                std::cout << "INFO: FuzzyMatchImpl::addPatterns no free row left for length " << len
+                          << ", repacking the pattern table" << std::endl;
+                compactPatternTable(vec_pattern, vec_id);
+                return 0;
+            }
+        }
+
+        std::vector<std::vector<int> > dirty(PU_NUM);
+        for (int len = 1; len <= max_fuzzy_len; len++) {
+            for (size_t a = 0; a < vec_add[len].size(); a++) {
+                int p = vec_free[len][a].first;
+                int j = vec_free[len][a].second;
+                const std::string& str = vec_pattern[vec_add[len][a]];
+                int id = vec_id[vec_add[len][a]];
+                char* row = csv_part[p] + (size_t)row_bytes * j;
+                memset(row, 0, row_bytes);
+                for (int c = 0; c < len; c++)
+                    row[16 * (c / 16) + 15 - c % 16] = str[c];
+                char* tail = row + 16 * (line_per_elem - 1);
+                tail[0] = len;
+                tail[1] = id & 0xFF;
+                tail[2] = (id >> 8) & 0xFF;
+                tail[3] = (id >> 16) & 0xFF;
+                tail[4] = (id >> 24) & 0xFF;
+                dirty[p].push_back(j);
+                num_live_rows++;
+                if (dead_row[(size_t)p * sum_line + j]) {
+                    dead_row[(size_t)p * sum_line + j] = 0;
+                    num_dead_rows--;
+                }
+            }
+        }
+        migrateRows(dirty);
+        return 0;
+    }
+
+    int FuzzyMatchImpl::removePatterns(const std::vector<int64_t>& vec_id)
+    {
+        const int line_per_elem = (max_fuzzy_len + 1 + 4 + 15) / 16;
+        const int row_bytes = 16 * line_per_elem;
+        // the table only holds the low 32 bits of every id, as returned by the kernel
+        std::unordered_set<int> ids;
+        for (size_t i = 0; i < vec_id.size(); i++)
+            ids.insert(int(vec_id[i]));
+
+        std::vector<std::vector<int> > dirty(PU_NUM);
+        if (csv_part[0] != nullptr) {
+            unsigned num_threads = std::thread::hardware_concurrency();
+            ThreadPool pool(num_threads == 0 ? 1 : num_threads);
+            pool.run(PU_NUM, [&](size_t p, unsigned) {
+                for (int j = 0; j < sum_line; j++) {
+                    char* row = csv_part[p] + (size_t)row_bytes * j;
+                    const unsigned char* tail = (const unsigned char*)row + 16 * (line_per_elem - 1);
+                    if (tail[0] == 0)
+                        continue;
+                    int id = tail[1] | (tail[2] << 8) | (tail[3] << 16) | (tail[4] << 24);
+                    if (ids.find(id) == ids.end())
+                        continue;
+                    // a cleared row is the same as the padding rows of a bucket
+                    memset(row, 0, row_bytes);
+                    dead_row[(size_t)p * sum_line + j] = 1;
+                    dirty[p].push_back(j);
+                }
+            });
+        }
+
+        int removed = 0;
+        for (int p = 0; p < PU_NUM; p++)
+            removed += dirty[p].size();
+        num_live_rows -= removed;
+        num_dead_rows += removed;
+        if (num_dead_rows > num_live_rows / 4) {
+            std::vector<std::string> vec_pattern;
+            std::vector<int64_t> vec_new_id;
+            compactPatternTable(vec_pattern, vec_new_id);
+        } else {
+            migrateRows(dirty);
+        }
+        return removed;
+    }
+
+    // repack the live rows of the table together with vec_pattern, leaving free rows for later additions
+    void FuzzyMatchImpl::compactPatternTable(std::vector<std::string>& vec_pattern, std::vector<int64_t>& vec_id)
+    {
+        const int line_per_elem = (max_fuzzy_len + 1 + 4 + 15) / 16;
+        const int row_bytes = 16 * line_per_elem;
+        const int headroom_pct = 6;
+        std::vector<std::string> vec_all;
+        std::vector<int64_t> vec_all_id;
+        vec_all.reserve(num_live_rows + vec_pattern.size());
+        vec_all_id.reserve(num_live_rows + vec_pattern.size());
+        for (int p = 0; p < PU_NUM && csv_part[0] != nullptr; p++) {
+            for (int j = 0; j < sum_line; j++) {
+                const char* row = csv_part[p] + (size_t)row_bytes * j;
+                const unsigned char* tail = (const unsigned char*)row + 16 * (line_per_elem - 1);
+                int len = tail[0];
+                if (len == 0)
+                    continue;
+                std::string str(len, 0);
+                for (int c = 0; c < len; c++)
+                    str[c] = row[16 * (c / 16) + 15 - c % 16];
+                vec_all.push_back(str);
+                vec_all_id.push_back(int(tail[1] | (tail[2] << 8) | (tail[3] << 16) | (tail[4] << 24)));
+            }
+        }
+        vec_all.insert(vec_all.end(), vec_pattern.begin(), vec_pattern.end());
+        vec_all_id.insert(vec_all_id.end(), vec_id.begin(), vec_id.end());
+
+        std::vector<int> new_base, new_offset;
+        int new_sum_line = 0;
+        char* new_csv_part[PU_NUM];
+        packPatternTable(vec_all, vec_all_id, new_base, new_offset, new_sum_line, new_csv_part, headroom_pct);
+        replacePatternTable(new_base, new_offset, new_sum_line, new_csv_part);
+        migratePatternTable();
+    }
+
+    // write the given rows of every PU to both CUs, merging adjacent rows into one transfer
+    void FuzzyMatchImpl::migrateRows(std::vector<std::vector<int> >& rows)
+    {
+        const int line_per_elem = (max_fuzzy_len + 1 + 4 + 15) / 16;
+        const size_t row_bytes = 16 * line_per_elem;
+        if (options_.cpuEmulation)
+            return;
+        for (int p = 0; p < PU_NUM; p++) {
+            std::sort(rows[p].begin(), rows[p].end());
+            for (size_t r = 0; r < rows[p].size();) {
+                size_t e = r + 1;
+                while (e < rows[p].size() && rows[p][e] <= rows[p][e - 1] + 1)
+                    e++;
+                size_t offset = row_bytes * rows[p][r];
+                size_t size = row_bytes * (rows[p][e - 1] + 1) - offset;
+                for (int k = 0; k < 2; k++)
+                    queue.enqueueWriteBuffer(buf_csv[k * PU_NUM + p], CL_FALSE, offset, size, csv_part[p] + offset);
+                r = e;
+            }
+        }
+        queue.finish();
+    }
+
+    FuzzyMatchImpl::~FuzzyMatchImpl()
+    {
+        freePipeline();
+        freePatternTable();
+    }
+
+    void FuzzyMatchImpl::freePatternTable()
+    {
+        // release the device buffers before the host memory they wrap
+        for (int i = 0; i < 2 * PU_NUM; i++)
+            buf_csv[i] = cl::Buffer();
+        for (int i = 0; i < PU_NUM; i++) {
+            free(csv_part[i]);
+            csv_part[i] = nullptr;
+        }
+    }
+
+    void FuzzyMatchImpl::initPipeline()
+    {
+        if (slots[0][0].buf_in != nullptr)
+            return;
+        pipeline_batch_size = options_.pipelineBatchSize > 0 ? options_.pipelineBatchSize : 1024;
+        if (pipeline_batch_size > max_batch_num)
+            pipeline_batch_size = max_batch_num;
+        for (int k = 0; k < CU_NUM; k++) {
+            for (int s = 0; s < SLOT_NUM; s++) {
+                PipelineSlot& slot = slots[k][s];
+                slot.impl = this;
+                slot.cu = k;
+                slot.input_idx.reserve(pipeline_batch_size);
+                slot.buf_in = aligned_alloc<ap_uint<32> >((size_t)pipeline_batch_size * input_rec_len);
+                slot.buf_out = aligned_alloc<ap_uint<32> >((size_t)pipeline_batch_size * output_rec_len);
+                if (options_.cpuEmulation)
+                    continue;
+                cl_mem_ext_ptr_t mext_i = {1, slot.buf_in, fuzzy[k]()};
+                cl_mem_ext_ptr_t mext_o = {10, slot.buf_out, fuzzy[k]()};
+                slot.buf_field_i = cl::Buffer(ctx, CL_MEM_EXT_PTR_XILINX | CL_MEM_USE_HOST_PTR | CL_MEM_READ_ONLY,
+                                              sizeof(uint32_t) * pipeline_batch_size * input_rec_len, &mext_i);
+                slot.buf_field_o = cl::Buffer(ctx, CL_MEM_EXT_PTR_XILINX | CL_MEM_USE_HOST_PTR | CL_MEM_WRITE_ONLY,
+                                              sizeof(uint32_t) * pipeline_batch_size * output_rec_len, &mext_o);
+            }
+        }
+    }
+
+    void FuzzyMatchImpl::freePipeline()
+    {
+        for (int k = 0; k < CU_NUM; k++) {
+            for (int s = 0; s < SLOT_NUM; s++) {
+                PipelineSlot& slot = slots[k][s];
+                if (slot.emu_thread.joinable())
+                    slot.emu_thread.join();
+                // release the device buffers before the host memory they wrap
+                slot.buf_field_i = cl::Buffer();
+                slot.buf_field_o = cl::Buffer();
+                free(slot.buf_in);
+                free(slot.buf_out);
+                slot.buf_in = nullptr;
+                slot.buf_out = nullptr;
+            }
+        }
+    }
+
+    // encode the next sub-batch of input strings into the pinned input buffer of the slot
+    void FuzzyMatchImpl::fillSlot(PipelineSlot& slot, std::vector<std::string>& input_patterns, int& next,
+                                  int similarity_level)
+    {
+        int end = std::min<int>(next + pipeline_batch_size, input_patterns.size());
+        slot.batch_num = end - next;
+        slot.input_idx.clear();
+        for (int i = next; i < end; i++) {
+            encodeInputRecord(similarity_level, input_patterns[i], vec_base, vec_offset,
+                              slot.buf_in + slot.input_idx.size() * input_rec_len);
+            slot.input_idx.push_back(i);
+        }
+        next = end;
+    }
+
+    static void CL_CALLBACK pipelineSlotDone(cl_event, cl_int, void* user_data)
+    {
+        FuzzyMatchImpl::PipelineSlot* slot = static_cast<FuzzyMatchImpl::PipelineSlot*>(user_data);
+        slot->impl->notifySlotDone(slot);
+    }
+
+    // h2d + kernel run + d2h of one slot; completion is reported through notifySlotDone
+    void FuzzyMatchImpl::launchSlot(PipelineSlot& slot)
+    {
+        if (options_.cpuEmulation) {
+            PipelineSlot* p = &slot;
+            slot.emu_thread = std::thread([this, p] {
+                emulateKernel(p->batch_num, p->buf_in, p->buf_out);
+                notifySlotDone(p);
+            });
+            return;
+        }
+        int k = slot.cu;
+        std::vector<cl::Event> events_write(1);
+        std::vector<cl::Event> events_kernel(1);
+        queue.enqueueWriteBuffer(slot.buf_field_i, CL_FALSE, 0, sizeof(uint32_t) * slot.batch_num * input_rec_len,
+                                 slot.buf_in, nullptr, &events_write[0]);
+        int j = 0;
+        fuzzy[k].setArg(j++, slot.batch_num);
+        fuzzy[k].setArg(j++, slot.buf_field_i);
+        for (int m = k * PU_NUM; m < (k + 1) * PU_NUM; m++) fuzzy[k].setArg(j++, buf_csv[m]);
+        fuzzy[k].setArg(j++, slot.buf_field_o);
+        queue.enqueueTask(fuzzy[k], &events_write, &events_kernel[0]);
+        queue.enqueueReadBuffer(slot.buf_field_o, CL_FALSE, 0, sizeof(uint32_t) * slot.batch_num * output_rec_len,
+                                slot.buf_out, &events_kernel, &slot.event_read);
+        slot.event_read.setCallback(CL_COMPLETE, pipelineSlotDone, &slot);
+        queue.flush();
+    }
+
+    void FuzzyMatchImpl::notifySlotDone(PipelineSlot* slot)
+    {
+        {
+            std::lock_guard<std::mutex> lock(done_mtx);
+            done_slots.push_back(slot);
+        }
+        done_cv.notify_one();
+    }
+
+    FuzzyMatchImpl::PipelineSlot* FuzzyMatchImpl::waitSlotDone()
+    {
+        std::unique_lock<std::mutex> lock(done_mtx);
+        done_cv.wait(lock, [this] { return !done_slots.empty(); });
+        PipelineSlot* slot = done_slots.front();
+        done_slots.pop_front();
+        return slot;
+    }
+
+    // host model of fuzzy_kernel: scan the rows of every PU selected by the input record, and
+    // return up to 100 {id, score} pairs reaching the threshold in the same 201-word layout
+    void FuzzyMatchImpl::emulateKernel(int batch_num, const ap_uint<32>* buf_in, ap_uint<32>* buf_out)
+    {
+        const int line_per_elem = (max_fuzzy_len + 1 + 4 + 15) / 16;
+        EncodedPattern ptn;
+        std::string input;
+        char str[max_fuzzy_len];
+        for (int b = 0; b < batch_num; b++) {
+            const ap_uint<32>* rec = buf_in + b * input_rec_len;
+            ap_uint<32>* res = buf_out + b * output_rec_len;
+            int row_begin = rec[0].to_int() / line_per_elem;
+            int row_end = row_begin + rec[1].to_int() / line_per_elem;
+            int threshold = rec[2].to_int();
+            int len = rec[input_rec_len - 1].to_uint() & 0xFF;
+            input.resize(len);
+            for (int j = 0; j < len; j++)
+                input[j] = (rec[3 + (j / 4)].to_uint() >> ((3 - j % 4) * 8)) & 0xFF;
+            encodePattern(input, ptn);
+
+            int cnt = 0;
+            for (int p = 0; p < PU_NUM && cnt < 100; p++) {
+                for (int e = row_begin; e < row_end && cnt < 100; e++) {
+                    const char* elem = csv_part[p] + 16 * line_per_elem * e;
+                    const char* tail = elem + 16 * (line_per_elem - 1);
+                    int m = (unsigned char)tail[0];
+                    if (m == 0)
+                        continue;
+                    for (int j = 0; j < m; j++)
+                        str[j] = elem[16 * (j / 16) + 15 - j % 16];
+                    int score = similarity(threshold, ptn, str, m);
+                    if (score >= threshold) {
+                        int id = (unsigned char)tail[1] | ((unsigned char)tail[2] << 8) |
+                                 ((unsigned char)tail[3] << 16) | ((unsigned char)tail[4] << 24);
+                        res[1 + cnt] = id;
+                        res[101 + cnt] = score;
+                        cnt++;
+                    }
+                }
+            }
+            res[0] = cnt;
+        }
+    }
+
+    std::vector<std::vector<std::pair<int64_t,int>>> FuzzyMatchImpl::executefuzzyMatchPipelined(
+        std::vector<std::string>& input_patterns, int similarity_level)
+    {
+        int batch_num = input_patterns.size();
+        std::vector<std::vector<std::pair<int64_t,int>>> results(batch_num);
+        if (slots[0][0].buf_in == nullptr)
+            initPipeline();
+
+        // prime every slot, the first slot of each CU first so that all CUs start right away
+        int next = 0;
+        int in_flight = 0;
+        for (int s = 0; s < SLOT_NUM; s++) {
+            for (int k = 0; k < CU_NUM && next < batch_num; k++) {
+                fillSlot(slots[k][s], input_patterns, next, similarity_level);
+                launchSlot(slots[k][s]);
+                in_flight++;
+            }
+        }
+
+        // the CU keeps running its other queued slot while the host decodes this one and
+        // encodes the next sub-batch into it
+        while (in_flight > 0) {
+            PipelineSlot* slot = waitSlotDone();
+            in_flight--;
+            if (slot->emu_thread.joinable())
+                slot->emu_thread.join();
+            for (int i = 0; i < slot->batch_num; i++) {
+                const ap_uint<32>* res = slot->buf_out + i * output_rec_len;
+                std::vector<std::pair<int64_t,int>>& out = results[slot->input_idx[i]];
+                int cnt = res[0];
+                for (int j = 0; j < cnt; j++)
+                    out.push_back(std::make_pair(res[1 + j], res[101 + j]));
+            }
+            if (next < batch_num) {
+                fillSlot(*slot, input_patterns, next, similarity_level);
+                launchSlot(*slot);
+                in_flight++;
+            }
+        }
+        return results;
+    }
 
 } // namespace fuzzymatch
 } // namespace xilinx_apps
@@ -18,6 +18,10 @@
 #include <iostream>
 #include <sstream>
 #include <limits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "fuzzymatch.hpp"
 
@@ -49,87 +53,180 @@ namespace fuzzymatch {
         }
     }
 
-    XILINX_FUZZYMATCH_IMPL_DECL
-    int load_csv(const size_t max_entry_num, const size_t max_field_len, const std::string &file_path,
-                    const unsigned col, std::vector<std::string> &vec)
+    // Column col of every line of a CSV file, packed back to back in chars. Entry i is
+    // [offsets[i], offsets[i+1]).
+    struct CsvColumn {
+        std::vector<char> chars;
+        std::vector<size_t> offsets;
+    };
+
+    // extract column col from the lines in [begin, end), stopping after max_entry_num + 1 entries
+    inline void parseCsvChunk(const char* begin, const char* end, const size_t max_entry_num,
+                              const size_t max_field_len, const unsigned col, CsvColumn& out)
     {
-        //std::cout << "INFO: Loading " << max_entry_num << " entities from CSV file " << file_path << std::endl;
-    
-        std::ifstream file(file_path.c_str());
-        if (!file.is_open())
-        {
-            std::cerr << "\nError:" << file_path << " file cannot be opened for reading!" << std::endl;
-            return -1;
-        }
-    
-        size_t n = 0;
-        std::string line;
-        // skip the header
-        std::getline(file, line);
-        while (std::getline(file, line))
-        {
+        out.offsets.assign(1, 0);
+        const char* line = begin;
+        while (line < end && out.offsets.size() - 1 <= max_entry_num) {
+            const char* line_end = (const char*)memchr(line, '\n', end - line);
+            if (line_end == nullptr)
+                line_end = end;
+
             unsigned cur_col = 0;
             bool in_escape_str = false;
-            std::stringstream ins(line), outs;
-            char c;
-            while (ins.get(c))
-            {
-                if (c == '"')
-                {
-                    if (ins.peek() == '"')
-                    {
+            size_t field_start = out.chars.size();
+            for (const char* p = line; p < line_end; p++) {
+                char c = *p;
+                if (c == '"') {
+                    if (p + 1 < line_end && p[1] == '"') {
                         // escaped, not state change, just unescape
-                        ins.get(c);
-                        outs.put(c);
-                    }
-                    else
-                    {
+                        out.chars.push_back(c);
+                        p++;
+                    } else {
                         // toggle state
                         in_escape_str = !in_escape_str;
                     }
-                }
-                else if (c == ',' && !in_escape_str)
-                {
-                    if (cur_col == col)
-                    {
+                } else if (c == ',' && !in_escape_str) {
+                    if (cur_col == col) {
                         // already got our column
                         break;
-                    }
-                    else
-                    {
+                    } else {
                         // empty buffer and continue to next column
                         cur_col++;
-                        //outs = std::stringstream();
-                        outs.str("");
+                        out.chars.resize(field_start);
                     }
-                }
-                else if (c == '\r')
-                {
+                } else if (c == '\r') {
                     // in-case we are working with MS new line...
-                }
-                else
-                {
-                    outs.put(c);
+                } else {
+                    out.chars.push_back(c);
                 }
             }
             assert(cur_col == col && "not enough column!");
-            std::string data = outs.str();
-            //std::cout << data << std::endl;
-            if (data.length() <= max_field_len)
-            {
-                vec.push_back(data);
-                // std::cerr << line << "\n\t{" << data << "}" << std::endl;
-                n++;
-            }
-            if (n > max_entry_num)
-            {
-                std::cout << "\nWarning: the input file " << file_path << " contains more enties than " << max_entry_num
-                            << " which will not be added in this check." << std::endl;
-                file.close();
-                return 0;
+            if (out.chars.size() - field_start <= max_field_len)
+                out.offsets.push_back(out.chars.size());
+            else
+                out.chars.resize(field_start);
+            line = line_end + 1;
+        }
+    }
+
+    // mmap the file and extract one column with one thread per chunk of lines. Quoting and
+    // escaping follow the original line-by-line parser: lines are split on '\n' only, "" is an
+    // escaped quote, a single " toggles quoted mode in which ',' is not a separator, and '\r' is
+    // dropped. The header line is skipped.
+    inline int parseCsvColumn(const size_t max_entry_num, const size_t max_field_len, const std::string &file_path,
+                              const unsigned col, CsvColumn& column, CsvLoadStats& stats)
+    {
+        auto ts = std::chrono::high_resolution_clock::now();
+        column.chars.clear();
+        column.offsets.assign(1, 0);
+
+        int fd = open(file_path.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            if (fd >= 0)
+                close(fd);
+            std::cerr << "\nError:" << file_path << " file cannot be opened for reading!" << std::endl;
+            return -1;
+        }
+        stats.bytes = st.st_size;
+        if (stats.bytes == 0) {
+            close(fd);
+            return 0;
+        }
+        void* addr = mmap(nullptr, stats.bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED) {
+            std::cerr << "\nError:" << file_path << " file cannot be mapped for reading!" << std::endl;
+            return -1;
+        }
+        madvise(addr, stats.bytes, MADV_SEQUENTIAL);
+        const char* data = (const char*)addr;
+        const char* data_end = data + stats.bytes;
+
+        // skip the header
+        const char* body = (const char*)memchr(data, '\n', stats.bytes);
+        body = (body == nullptr) ? data_end : body + 1;
+
+        // cut the body in chunks ending on a line boundary
+        unsigned num_chunks = std::max(1u, (unsigned)totalThreadNum);
+        std::vector<const char*> bounds(1, body);
+        for (unsigned i = 1; i < num_chunks; i++) {
+            const char* p = body + (data_end - body) * i / num_chunks;
+            if (p < bounds.back())
+                p = bounds.back();
+            const char* nl = (const char*)memchr(p, '\n', data_end - p);
+            bounds.push_back((nl == nullptr) ? data_end : nl + 1);
+        }
+        bounds.push_back(data_end);
+
+        std::vector<CsvColumn> chunks(num_chunks);
+        std::vector<std::thread> workers;
+        for (unsigned i = 0; i < num_chunks; i++)
+            workers.push_back(std::thread(parseCsvChunk, bounds[i], bounds[i + 1], max_entry_num, max_field_len,
+                                          col, std::ref(chunks[i])));
+        for (unsigned i = 0; i < num_chunks; i++)
+            workers[i].join();
+        munmap(addr, stats.bytes);
+
+        // concatenate the chunks in file order
+        size_t n = 0;
+        bool truncated = false;
+        for (unsigned i = 0; i < num_chunks && !truncated; i++) {
+            size_t num = chunks[i].offsets.size() - 1;
+            // like the line-by-line parser, one entry past max_entry_num is kept before stopping
+            if (n + num > max_entry_num) {
+                num = max_entry_num - n + 1;
+                truncated = true;
             }
+            size_t base = column.chars.size();
+            column.chars.insert(column.chars.end(), chunks[i].chars.begin(),
+                                chunks[i].chars.begin() + chunks[i].offsets[num]);
+            for (size_t j = 1; j <= num; j++)
+                column.offsets.push_back(base + chunks[i].offsets[j]);
+            n += num;
+            std::vector<char>().swap(chunks[i].chars);
         }
-        file.close();
+        if (truncated)
+            std::cout << "\nWarning: the input file " << file_path << " contains more enties than " << max_entry_num
+                        << " which will not be added in this check." << std::endl;
+
+        auto te = std::chrono::high_resolution_clock::now();
+        stats.rows = n;
+        stats.seconds = std::chrono::duration_cast<std::chrono::microseconds>(te - ts).count() / 1000000.0;
+        return 0;
+    }
+
+    XILINX_FUZZYMATCH_IMPL_DECL
+    int load_csv(const size_t max_entry_num, const size_t max_field_len, const std::string &file_path,
+                    const unsigned col, std::vector<std::string> &vec)
+    {
+        //std::cout << "INFO: Loading " << max_entry_num << " entities from CSV file " << file_path << std::endl;
+        CsvColumn column;
+        CsvLoadStats stats;
+        if (parseCsvColumn(max_entry_num, max_field_len, file_path, col, column, stats))
+            return -1;
+
+        vec.reserve(vec.size() + column.offsets.size() - 1);
+        for (size_t i = 0; i + 1 < column.offsets.size(); i++)
+            vec.push_back(std::string(column.chars.data() + column.offsets[i],
+                                      column.offsets[i + 1] - column.offsets[i]));
+        return 0;
+    }
+
+    XILINX_FUZZYMATCH_IMPL_DECL
+    int load_csv(const size_t max_entry_num, const size_t max_field_len, const std::string &file_path,
+                 const unsigned col, PatternStore &store, CsvLoadStats *stats)
+    {
+        CsvColumn column;
+        CsvLoadStats load_stats;
+        if (parseCsvColumn(max_entry_num, max_field_len, file_path, col, column, load_stats))
+            return -1;
+
+        store.build(column.chars.data(), column.offsets, std::vector<int>());
+        std::cout << "INFO: loaded " << load_stats.rows << " entries from " << file_path << " in "
+                  << load_stats.seconds << " s (" << (uint64_t)load_stats.getRowsPerSec() << " rows/sec)" << std::endl;
+        if (stats != nullptr)
+            *stats = load_stats;
         return 0;
     }
 
@@ -154,7 +251,12 @@ namespace fuzzymatch {
     float similarity(std::string str1, std::string str2);
 */
     XILINX_FUZZYMATCH_IMPL_DECL
-    int similarity(int threshold, std::string str1, std::string str2);
+    int similarity(int threshold, const std::string& str1, const std::string& str2);
+
+    XILINX_FUZZYMATCH_IMPL_DECL
+    void scanBucket(EncodedPattern& ptn, const QgramIndex& qgram_index,
+                    QgramIndex::Query& query, const PatternStore::Bucket& bucket, size_t begin, size_t end,
+                    TopKCollector& hits, FilterStats& stats);
 
     XILINX_FUZZYMATCH_IMPL_DECL
     size_t getMaxDistance(size_t len)
@@ -162,43 +264,39 @@ namespace fuzzymatch {
         return (len / 10);
     }
 
+    // add the hits of pattern in pattern_store to hits, at the threshold hits was created with
     XILINX_FUZZYMATCH_IMPL_DECL
-    bool isGreater(std::pair<int, int> a, std::pair<int, int> b) {
-        return a.second > b.second;
-    }
-
-    XILINX_FUZZYMATCH_IMPL_DECL
-    void doFuzzyTask(const int similarity_level,
-                    const size_t upper_limit,
+    void doFuzzyTask(const size_t upper_limit,
                     const std::string& pattern,
-                    const std::vector<std::vector<std::string> >& vec_grp_str,
-                    const std::vector<std::vector<int> >& vec_id_people,
-                    std::unordered_map<int, int>& result_map) {
-        result_map.clear();
-        std::vector<std::pair<int, int> > result_vec;
+                    const PatternStore& pattern_store,
+                    const QgramIndex& qgram_index,
+                    FilterStats& stats,
+                    TopKCollector& hits) {
+        // the length window of the base threshold: a collector reused for another store (checkTopK runs the
+        // delta store after the main one) has a raised level that must not narrow it
+        const int similarity_level = hits.getBaseThreshold();
         size_t len = pattern.length();
         size_t med = len * (100 - similarity_level) / 100;
         // size_t start_len = (len > (upper_limit - 3) && len <= upper_limit) ? (upper_limit + 1) : (len -
         // med);
-        size_t start_len = len - med;
-        size_t end_len = len + med;
 
-        for (size_t n = start_len; n <= end_len; n++) {
-            std::vector<std::string> deny_list = vec_grp_str[n];
-            std::vector<int> id_list = vec_id_people[n];
-            for (unsigned int i = 0; i < deny_list.size(); i++) {
-                int sim = similarity(similarity_level, pattern, deny_list.at(i));
-                if (sim >= similarity_level) {
-                    result_vec.push_back(std::make_pair(id_list.at(i), sim));
-                }
+        EncodedPattern ptn;
+        encodePattern(pattern, ptn);
+        QgramIndex::Query query;
+        qgram_index.encodeQuery(pattern, query);
+
+        // lengths closest to the input first: they give the best scores, which raises the
+        // threshold of a full collector early
+        for (size_t d = 0; d <= med; d++) {
+            for (int side = 0; side < (d == 0 ? 1 : 2); side++) {
+                size_t n = (side == 0) ? len - d : len + d;
+                // same length check as similarity(), for the whole bucket at the current threshold
+                if (std::max(len, n) * (100 - hits.getVerifyLevel()) / 100 < d)
+                    continue;
+                PatternStore::Bucket deny_list = pattern_store.getBucket(n);
+                scanBucket(ptn, qgram_index, query, deny_list, 0, deny_list.size, hits, stats);
             }
         }
-
-        std::sort(result_vec.begin(), result_vec.end(), &isGreater);
-        // if (result_vec.size() > 100) result_vec.resize(100);
-        std::for_each(result_vec.begin(), result_vec.end(), [&](const std::pair<int, int> t) {
-            result_map.insert({t.first, t.second});
-        });
     }
 /*
     XILINX_FUZZYMATCH_IMPL_DECL
@@ -235,39 +333,110 @@ namespace fuzzymatch {
         return match;
     }*/
     XILINX_FUZZYMATCH_IMPL_DECL
-    int similarity(int threshold, std::string str1, std::string str2) {
-        const int n = str1.length();
-        const int m = str2.length();
+    void encodePattern(const std::string& str, EncodedPattern& ptn)
+    {
+        ptn.str = str;
+        ptn.len = str.length();
+        ptn.nwords = (ptn.len + 63) / 64;
+        // peq[c * nwords + b] : bit i set when str[64 * b + i] == c
+        ptn.peq.assign(256 * ptn.nwords, 0);
+        for (int i = 0; i < ptn.len; i++)
+            ptn.peq[(unsigned char)str[i] * ptn.nwords + i / 64] |= uint64_t(1) << (i % 64);
+        ptn.pv.resize(ptn.nwords);
+        ptn.mv.resize(ptn.nwords);
+    }
+
+    // Advance one 64-row block of the DP column by one character (Hyyro's block-based
+    // formulation of Myers' algorithm). hin is the horizontal delta entering the top of the
+    // block, ph/mh return the horizontal deltas of every row before the shift.
+    inline int advanceBlock(uint64_t& pv, uint64_t& mv, uint64_t eq, int hin, uint64_t& ph, uint64_t& mh)
+    {
+        const uint64_t hinIsNeg = (hin < 0) ? 1 : 0;
+        const uint64_t xv = eq | mv;
+        eq |= hinIsNeg;
+        const uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+        ph = mv | ~(xh | pv);
+        mh = pv & xh;
+
+        int hout = 0;
+        if (ph >> 63) hout = 1;
+        else if (mh >> 63) hout = -1;
+
+        uint64_t phs = (ph << 1) | ((hin > 0) ? 1 : 0);
+        uint64_t mhs = (mh << 1) | hinIsNeg;
+        pv = mhs | ~(xv | phs);
+        mv = phs & xv;
+        return hout;
+    }
+
+    // Bit-parallel replacement of the textbook O(n*m) Levenshtein DP. The rows of the DP are
+    // the characters of the encoded input string, one bit per row, and str2 is scanned one
+    // character per column. The score and the early exit rule are identical to the DP version:
+    // the DP returns 0 as soon as, past column maxDistance, every row of a column exceeds
+    // maxDistance. Column minimums never decrease, so that test only has to be made on the
+    // last column, and only when the final distance itself is already too large.
+    XILINX_FUZZYMATCH_IMPL_DECL
+    int similarity(int threshold, EncodedPattern& ptn, const char* str2, int m)
+    {
+        const int n = ptn.len;
         if (n == 0 || m == 0) return 0;
 
         int maxDistance = (int)(max(n, m) * (100 - threshold) / 100);
 
         if (maxDistance < abs(m, n)) return 0;
 
-        std::vector<int> p(n + 1, 0);
-        std::vector<int> d(n + 1, 0);
+        const int nwords = ptn.nwords;
+        const int last = nwords - 1;
+        const uint64_t lastBit = uint64_t(1) << ((n - 1) % 64);
+        int dist = n;
+        uint64_t ph, mh;
 
-        for (int i = 0; i <= n; i++) p[i] = i;
+        if (nwords == 1) {
+            uint64_t pv = ~uint64_t(0);
+            uint64_t mv = 0;
+            for (int j = 0; j < m; j++) {
+                advanceBlock(pv, mv, ptn.peq[(unsigned char)str2[j]], 1, ph, mh);
+                if (ph & lastBit) dist++;
+                else if (mh & lastBit) dist--;
+            }
+            ptn.pv[0] = pv;
+            ptn.mv[0] = mv;
+        } else {
+            for (int b = 0; b < nwords; b++) {
+                ptn.pv[b] = ~uint64_t(0);
+                ptn.mv[b] = 0;
+            }
+            for (int j = 0; j < m; j++) {
+                const uint64_t* eq = &ptn.peq[(unsigned char)str2[j] * nwords];
+                int hin = 1;
+                for (int b = 0; b < last; b++)
+                    hin = advanceBlock(ptn.pv[b], ptn.mv[b], eq[b], hin, ph, mh);
+                advanceBlock(ptn.pv[last], ptn.mv[last], eq[last], hin, ph, mh);
+                if (ph & lastBit) dist++;
+                else if (mh & lastBit) dist--;
+            }
+        }
 
-        for (int j = 1; j <= m; j++) {
+        if (dist > maxDistance && m > maxDistance) {
+            // minimum over rows 1..n of the last column, rebuilt from its vertical deltas
+            int v = m;
             int bestPossibleEditDistance = m;
-            char t_j = str2.at(j - 1);
-            d[0] = j;
-
-            for (int i = 1; i <= n; i++) {
-                if (t_j != str1.at(i - 1))
-                    d[i] = min(min(d[i - 1], p[i]), p[i - 1]) + 1;
-                else
-                    d[i] = min(min(d[i - 1] + 1, p[i] + 1), p[i - 1]);
-                bestPossibleEditDistance = min(bestPossibleEditDistance, d[i]);
+            for (int i = 0; i < n; i++) {
+                v += int((ptn.pv[i / 64] >> (i % 64)) & 1) - int((ptn.mv[i / 64] >> (i % 64)) & 1);
+                bestPossibleEditDistance = min(bestPossibleEditDistance, v);
             }
-
-            if (j > maxDistance && bestPossibleEditDistance > maxDistance) return 0;
-
-            std::swap_ranges(p.begin(), p.end(), d.begin());
+            if (bestPossibleEditDistance > maxDistance) return 0;
         }
 
-        return (100 - (100 * p[n] / max(m, n)));
+        return (100 - (100 * dist / max(m, n)));
+    }
+
+    XILINX_FUZZYMATCH_IMPL_DECL
+    int similarity(int threshold, const std::string& str1, const std::string& str2)
+    {
+        EncodedPattern ptn;
+        encodePattern(str1, ptn);
+        return similarity(threshold, ptn, str2.data(), str2.length());
     }
 /*
     XILINX_FUZZYMATCH_IMPL_DECL
@@ -328,14 +497,414 @@ namespace fuzzymatch {
         return sw_match;
     }*/
 
+    template <typename GetStr>
+    void PatternStore::buildFrom(size_t num, GetStr getStr, const std::vector<int>& ids)
+    {
+        clear();
+        if (num == 0)
+            return;
+        size_t max_len = 0;
+        for (size_t i = 0; i < num; i++)
+            max_len = std::max(max_len, getStr(i).second);
+        assert(max_len < max_pattern_len_in_char && "Defined <max_pattern_len_in_char> is not enough!");
+
+        // count strings per length, then turn the counts into bucket boundaries
+        first_.assign(max_len + 2, 0);
+        charBase_.assign(max_len + 2, 0);
+        for (size_t i = 0; i < num; i++)
+            first_[getStr(i).second + 1]++;
+        for (size_t len = 1; len < first_.size(); len++) {
+            charBase_[len] = charBase_[len - 1] + first_[len] * (len - 1);
+            first_[len] += first_[len - 1];
+        }
+
+        chars_.resize(charBase_[max_len + 1]);
+        ids_.resize(num);
+        std::vector<size_t> cursor(first_.begin(), first_.end() - 1);
+        for (size_t i = 0; i < num; i++) {
+            std::pair<const char*, size_t> str = getStr(i);
+            size_t len = str.second;
+            size_t idx = cursor[len]++;
+            ids_[idx] = ids.empty() ? int(i) : ids[i];
+            memcpy(&chars_[charBase_[len] + (idx - first_[len]) * len], str.first, len);
+        }
+    }
+
+    XILINX_FUZZYMATCH_IMPL_DECL
+    void PatternStore::build(const std::vector<std::string>& vec_pattern, const std::vector<int>& ids)
+    {
+        buildFrom(vec_pattern.size(), [&](size_t i) {
+            return std::make_pair(vec_pattern[i].data(), vec_pattern[i].length());
+        }, ids);
+    }
+
+    XILINX_FUZZYMATCH_IMPL_DECL
+    void PatternStore::build(const char* chars, const std::vector<size_t>& offsets, const std::vector<int>& ids)
+    {
+        buildFrom(offsets.empty() ? 0 : offsets.size() - 1, [&](size_t i) {
+            return std::make_pair(chars + offsets[i], offsets[i + 1] - offsets[i]);
+        }, ids);
+    }
+
+    XILINX_FUZZYMATCH_IMPL_DECL
+    void PatternStore::clear()
+    {
+        std::vector<char>().swap(chars_);
+        std::vector<int>().swap(ids_);
+        first_.clear();
+        charBase_.clear();
+        std::vector<uint8_t>().swap(dead_);
+        numDead_ = 0;
+    }
+
+    XILINX_FUZZYMATCH_IMPL_DECL
+    size_t PatternStore::remove(const std::unordered_set<int>& ids)
+    {
+        size_t removed = 0;
+        for (size_t i = 0; i < ids_.size(); i++) {
+            if ((!dead_.empty() && dead_[i]) || ids.find(ids_[i]) == ids.end())
+                continue;
+            if (dead_.empty())
+                dead_.assign(ids_.size(), 0);
+            dead_[i] = 1;
+            removed++;
+        }
+        numDead_ += removed;
+        return removed;
+    }
+
+    XILINX_FUZZYMATCH_IMPL_DECL
+    PatternStore::Bucket PatternStore::getBucket(size_t len) const
+    {
+        Bucket bucket;
+        bucket.len = len;
+        if (int(len) > getMaxLen())
+            return bucket;
+        bucket.first = first_[len];
+        bucket.size = first_[len + 1] - first_[len];
+        bucket.ids = ids_.data() + first_[len];
+        bucket.chars = chars_.data() + charBase_[len];
+        if (!dead_.empty())
+            bucket.dead = dead_.data() + first_[len];
+        return bucket;
+    }
+
+    // pack the q characters starting at str into one key, first character in the most significant byte
+    inline uint32_t packQgram(const char* str, int q)
+    {
+        uint32_t gram = 0;
+        for (int i = 0; i < q; i++)
+            gram = (gram << 8) | (unsigned char)str[i];
+        return gram;
+    }
+
+    XILINX_FUZZYMATCH_IMPL_DECL
+    void QgramIndex::build(const PatternStore& store, int q)
+    {
+        clear();
+        if (q <= 0)
+            return;
+        if (q > max_q) {
+            std::ostringstream oss;
+            oss << "q-gram length " << q << " should not be larger than " << max_q;
+            throw xilinx_apps::fuzzymatch::Exception(oss.str());
+        }
+        q_ = q;
+
+        struct Posting {
+            uint32_t gram;
+            uint32_t idx;
+            uint32_t cnt;
+        };
+        std::vector<Posting> postings;
+        std::vector<uint32_t> grams;
+        for (int len = q; len <= store.getMaxLen(); len++) {
+            PatternStore::Bucket bucket = store.getBucket(len);
+            for (size_t i = 0; i < bucket.size; i++) {
+                const char* str = bucket.str(i);
+                grams.clear();
+                for (int j = 0; j + q <= len; j++)
+                    grams.push_back(packQgram(str + j, q));
+                std::sort(grams.begin(), grams.end());
+                for (size_t j = 0; j < grams.size();) {
+                    size_t k = j;
+                    while (k < grams.size() && grams[k] == grams[j])
+                        k++;
+                    postings.push_back({grams[j], uint32_t(bucket.first + i), uint32_t(k - j)});
+                    j = k;
+                }
+            }
+        }
+        // postings were produced in store order, a stable sort keeps every posting list sorted by index
+        std::stable_sort(postings.begin(), postings.end(),
+                         [](const Posting& a, const Posting& b) { return a.gram < b.gram; });
+
+        postingIdx_.resize(postings.size());
+        postingCnt_.resize(postings.size());
+        for (size_t i = 0; i < postings.size(); i++) {
+            if (i == 0 || postings[i].gram != postings[i - 1].gram) {
+                grams_.push_back(postings[i].gram);
+                postingBase_.push_back(i);
+            }
+            postingIdx_[i] = postings[i].idx;
+            postingCnt_[i] = postings[i].cnt;
+        }
+        postingBase_.push_back(postings.size());
+    }
+
+    XILINX_FUZZYMATCH_IMPL_DECL
+    void QgramIndex::clear()
+    {
+        q_ = 0;
+        std::vector<uint32_t>().swap(grams_);
+        std::vector<size_t>().swap(postingBase_);
+        std::vector<uint32_t>().swap(postingIdx_);
+        std::vector<uint32_t>().swap(postingCnt_);
+    }
+
+    XILINX_FUZZYMATCH_IMPL_DECL
+    void QgramIndex::encodeQuery(const std::string& str, Query& query) const
+    {
+        query.grams.clear();
+        if (q_ == 0)
+            return;
+        std::vector<uint32_t> grams;
+        for (size_t j = 0; j + q_ <= str.length(); j++)
+            grams.push_back(packQgram(str.data() + j, q_));
+        std::sort(grams.begin(), grams.end());
+        for (size_t j = 0; j < grams.size();) {
+            size_t k = j;
+            while (k < grams.size() && grams[k] == grams[j])
+                k++;
+            query.grams.push_back(std::make_pair(grams[j], uint32_t(k - j)));
+            j = k;
+        }
+    }
+
+    XILINX_FUZZYMATCH_IMPL_DECL
+    int QgramIndex::getMinCommon(int n, int m, int similarity_level) const
+    {
+        if (q_ == 0)
+            return 0;
+        // largest edit distance that still gives a score >= similarity_level. This is at least
+        // the early exit distance of similarity(), whose last column check can let one more through.
+        int len = max(n, m);
+        int k = (len * (101 - similarity_level) - 1) / 100;
+        return len - q_ + 1 - k * q_;
+    }
+
+    XILINX_FUZZYMATCH_IMPL_DECL
+    void QgramIndex::filter(Query& query, size_t begin, size_t end, int min_common,
+                            std::vector<uint32_t>& candidates) const
+    {
+        if (query.counts.size() < end - begin)
+            query.counts.resize(end - begin, 0);
+
+        for (size_t g = 0; g < query.grams.size(); g++) {
+            std::vector<uint32_t>::const_iterator it =
+                std::lower_bound(grams_.begin(), grams_.end(), query.grams[g].first);
+            if (it == grams_.end() || *it != query.grams[g].first)
+                continue;
+            size_t k = it - grams_.begin();
+            const uint32_t* idx = postingIdx_.data();
+            size_t p = std::lower_bound(idx + postingBase_[k], idx + postingBase_[k + 1], uint32_t(begin)) - idx;
+            for (; p < postingBase_[k + 1] && idx[p] < end; p++) {
+                uint32_t& count = query.counts[idx[p] - begin];
+                if (count == 0)
+                    query.touched.push_back(idx[p] - begin);
+                count += std::min(query.grams[g].second, postingCnt_[p]);
+            }
+        }
+
+        // keep the store order so that the verifier sees candidates in the same order as a full scan
+        std::sort(query.touched.begin(), query.touched.end());
+        for (size_t t = 0; t < query.touched.size(); t++) {
+            uint32_t i = query.touched[t];
+            if (int(query.counts[i]) >= min_common)
+                candidates.push_back(begin + i);
+            query.counts[i] = 0;
+        }
+        query.touched.clear();
+    }
+
+    XILINX_FUZZYMATCH_IMPL_DECL
+    void scanBucket(EncodedPattern& ptn, const QgramIndex& qgram_index,
+                    QgramIndex::Query& query, const PatternStore::Bucket& bucket, size_t begin, size_t end,
+                    TopKCollector& hits, FilterStats& stats)
+    {
+        stats.candidates += end - begin;
+        // the threshold of hits only goes up, so the bound computed here stays valid for the whole bucket
+        int min_common = qgram_index.getMinCommon(ptn.len, bucket.len, hits.getVerifyLevel());
+        if (min_common <= 0) {
+            // the filter cannot reject anything at this length, verify every string
+            for (size_t i = begin; i < end; i++) {
+                if (bucket.isDead(i))
+                    continue;
+                int sim = similarity(hits.getVerifyLevel(), ptn, bucket.str(i), bucket.len);
+                if (sim >= hits.getThreshold())
+                    hits.push(bucket.ids[i], sim);
+            }
+            stats.verified += end - begin;
+            return;
+        }
+
+        query.candidates.clear();
+        qgram_index.filter(query, bucket.first + begin, bucket.first + end, min_common, query.candidates);
+        for (size_t c = 0; c < query.candidates.size(); c++) {
+            size_t i = query.candidates[c] - bucket.first;
+            if (bucket.isDead(i))
+                continue;
+            int sim = similarity(hits.getVerifyLevel(), ptn, bucket.str(i), bucket.len);
+            if (sim >= hits.getThreshold())
+                hits.push(bucket.ids[i], sim);
+        }
+        stats.verified += query.candidates.size();
+    }
+
+    // heap order: a is a better hit than b
+    inline bool isBetterHit(const std::pair<int64_t, int>& a, const std::pair<int64_t, int>& b)
+    {
+        return (a.second != b.second) ? (a.second > b.second) : (a.first < b.first);
+    }
+
+    XILINX_FUZZYMATCH_IMPL_DECL
+    void TopKCollector::push(int64_t id, int score)
+    {
+        std::pair<int64_t, int> hit(id, score);
+        if (k_ == 0) {
+            hits_.push_back(hit);
+            return;
+        }
+        if (hits_.size() < k_) {
+            hits_.push_back(hit);
+            std::push_heap(hits_.begin(), hits_.end(), &isBetterHit);
+        } else if (isBetterHit(hit, hits_.front())) {
+            std::pop_heap(hits_.begin(), hits_.end(), &isBetterHit);
+            hits_.back() = hit;
+            std::push_heap(hits_.begin(), hits_.end(), &isBetterHit);
+        }
+    }
+
+    XILINX_FUZZYMATCH_IMPL_DECL
+    void TopKCollector::getSorted(std::vector<std::pair<int64_t, int> >& out)
+    {
+        std::sort(hits_.begin(), hits_.end(), &isBetterHit);
+        out.swap(hits_);
+        hits_.clear();
+    }
+
+    XILINX_FUZZYMATCH_IMPL_DECL
+    ThreadPool::ThreadPool(unsigned numThreads)
+        : numThreads_(numThreads > 0 ? numThreads : 1), ranges_(new TaskRange[numThreads > 0 ? numThreads : 1])
+    {
+        for (unsigned i = 0; i < numThreads_; i++)
+            workers_.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+    }
+
+    XILINX_FUZZYMATCH_IMPL_DECL
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            stop_ = true;
+        }
+        startCv_.notify_all();
+        for (unsigned i = 0; i < numThreads_; i++)
+            workers_[i].join();
+    }
+
+    XILINX_FUZZYMATCH_IMPL_DECL
+    void ThreadPool::run(size_t numTasks, const std::function<void(size_t, unsigned)>& job)
+    {
+        if (numTasks == 0)
+            return;
+
+        std::lock_guard<std::mutex> runLock(runMtx_);
+        // initial static split, rebalanced by stealing
+        for (unsigned i = 0; i < numThreads_; i++) {
+            std::lock_guard<std::mutex> lock(ranges_[i].mtx);
+            ranges_[i].begin = numTasks * i / numThreads_;
+            ranges_[i].end = numTasks * (i + 1) / numThreads_;
+        }
+
+        std::unique_lock<std::mutex> lock(mtx_);
+        job_ = &job;
+        numBusy_ = numThreads_;
+        generation_++;
+        startCv_.notify_all();
+        doneCv_.wait(lock, [this] { return numBusy_ == 0; });
+        job_ = nullptr;
+    }
+
+    XILINX_FUZZYMATCH_IMPL_DECL
+    void ThreadPool::workerLoop(unsigned tid)
+    {
+        uint64_t seenGeneration = 0;
+        while (true) {
+            const std::function<void(size_t, unsigned)>* job;
+            {
+                std::unique_lock<std::mutex> lock(mtx_);
+                startCv_.wait(lock, [&] { return stop_ || generation_ != seenGeneration; });
+                if (stop_)
+                    return;
+                seenGeneration = generation_;
+                job = job_;
+            }
+
+            size_t taskId;
+            while (true) {
+                if (popTask(tid, taskId))
+                    (*job)(taskId, tid);
+                else if (!stealTasks(tid))
+                    break;
+            }
+
+            std::lock_guard<std::mutex> lock(mtx_);
+            if (--numBusy_ == 0)
+                doneCv_.notify_all();
+        }
+    }
+
+    XILINX_FUZZYMATCH_IMPL_DECL
+    bool ThreadPool::popTask(unsigned tid, size_t& taskId)
+    {
+        std::lock_guard<std::mutex> lock(ranges_[tid].mtx);
+        if (ranges_[tid].begin == ranges_[tid].end)
+            return false;
+        taskId = ranges_[tid].begin++;
+        return true;
+    }
+
+    XILINX_FUZZYMATCH_IMPL_DECL
+    bool ThreadPool::stealTasks(unsigned tid)
+    {
+        // tasks are never added during a run, so once every range is empty the run is over
+        for (unsigned i = 1; i < numThreads_; i++) {
+            TaskRange& victim = ranges_[(tid + i) % numThreads_];
+            size_t begin, end;
+            {
+                std::lock_guard<std::mutex> lock(victim.mtx);
+                if (victim.begin == victim.end)
+                    continue;
+                end = victim.end;
+                begin = end - (end - victim.begin + 1) / 2;
+                victim.end = begin;
+            }
+            std::lock_guard<std::mutex> lock(ranges_[tid].mtx);
+            ranges_[tid].begin = begin;
+            ranges_[tid].end = end;
+            return true;
+        }
+        return false;
+    }
+
     XILINX_FUZZYMATCH_IMPL_DECL   
     int FuzzyMatchSW::initialize(const std::string &fileName)
     {
-        std::vector<std::string> vec_pattern;
-        // Read Watch List data
+        // Read Watch List data straight into the length-grouped pattern store
         int nerror = 0;
         //std::cout << "INFO: Loading "  << fileName << std::endl;
-        nerror = load_csv(max_validated_pattern, -1U, fileName, 1, vec_pattern);
+        nerror = load_csv(max_validated_pattern, -1U, fileName, 1, pattern_store);
         if (nerror)
         {
             std::cout << "ERROR: Failed to load file " << fileName << std::endl;
@@ -344,9 +913,10 @@ namespace fuzzymatch {
         else
             std::cout << "INFO: completed loading " << fileName << std::endl;
     
-        // do pre-sort on pattern LIST
-        //preSortbyLength(vec_pattern,this->vec_pattern_grp);
-        initialize(vec_pattern);
+        qgram_index.build(pattern_store, qgram_len);
+        delta_patterns.clear();
+        delta_ids.clear();
+        rebuildDelta();
         return nerror;
     }
 /*
@@ -360,34 +930,252 @@ namespace fuzzymatch {
     XILINX_FUZZYMATCH_IMPL_DECL   
     int FuzzyMatchSW::initialize(std::vector<std::string>& vec_pattern, std::vector<int> vec_id)
     {
-        if(!vec_id.empty()){
-            for (int idx=0; idx < vec_pattern.size(); idx++) {
-                size_t len = vec_pattern[idx].length();
-                assert(len < max_pattern_len_in_char && "Defined <max_people_len_in_char> is not enough!");
-                vec_pattern_id[len].push_back(vec_id[idx]);
-            }
-        } else {
-            //default assignment
-            int id_cnt = 0;
-            for (std::vector<std::string>::iterator it = vec_pattern.begin(); it != vec_pattern.end(); ++it) {
-                size_t len = it->length();
-                assert(len < max_pattern_len_in_char && "Defined <max_people_len_in_char> is not enough!");
-                vec_pattern_id[len].push_back(id_cnt++);
-            }
-        }
-        
+        //if vec_id is empty, default assignment is the index in vec_pattern
+        pattern_store.build(vec_pattern, vec_id);
+        qgram_index.build(pattern_store, qgram_len);
+        delta_patterns.clear();
+        delta_ids.clear();
+        rebuildDelta();
+        return 0;
+    }
 
-        preSortbyLength(vec_pattern,this->vec_pattern_grp);  
+    XILINX_FUZZYMATCH_IMPL_DECL
+    void FuzzyMatchSW::rebuildDelta()
+    {
+        delta_store.build(delta_patterns, delta_ids);
+        delta_index.build(delta_store, qgram_len);
+    }
+
+    XILINX_FUZZYMATCH_IMPL_DECL
+    int FuzzyMatchSW::addPatterns(std::vector<std::string>& vec_pattern, std::vector<int> vec_id)
+    {
+        if (vec_id.size() != vec_pattern.size()) {
+            std::ostringstream oss;
+            oss << "addPatterns got " << vec_pattern.size() << " patterns but " << vec_id.size() << " ids";
+            throw xilinx_apps::fuzzymatch::Exception(oss.str());
+        }
+        delta_patterns.insert(delta_patterns.end(), vec_pattern.begin(), vec_pattern.end());
+        delta_ids.insert(delta_ids.end(), vec_id.begin(), vec_id.end());
+        size_t num_live = pattern_store.getNumPatterns() - pattern_store.getNumDead();
+        if (delta_patterns.size() > num_live / 16)
+            compactPatterns();
+        else
+            rebuildDelta();
         return 0;
-    }       
+    }
+
+    XILINX_FUZZYMATCH_IMPL_DECL
+    int FuzzyMatchSW::removePatterns(const std::vector<int>& vec_id)
+    {
+        std::unordered_set<int> ids(vec_id.begin(), vec_id.end());
+        size_t removed = pattern_store.remove(ids);
+
+        size_t num_delta = 0;
+        for (size_t i = 0; i < delta_ids.size(); i++) {
+            if (ids.find(delta_ids[i]) != ids.end())
+                continue;
+            delta_patterns[num_delta] = delta_patterns[i];
+            delta_ids[num_delta] = delta_ids[i];
+            num_delta++;
+        }
+        if (num_delta != delta_ids.size()) {
+            removed += delta_ids.size() - num_delta;
+            delta_patterns.resize(num_delta);
+            delta_ids.resize(num_delta);
+            rebuildDelta();
+        }
+
+        if (pattern_store.getNumDead() > (pattern_store.getNumPatterns() - pattern_store.getNumDead()) / 4)
+            compactPatterns();
+        return removed;
+    }
+
+    XILINX_FUZZYMATCH_IMPL_DECL
+    void FuzzyMatchSW::compactPatterns()
+    {
+        // live strings of the store followed by the delta store, packed back to back
+        std::vector<char> chars;
+        std::vector<size_t> offsets(1, 0);
+        std::vector<int> ids;
+        for (int len = 0; len <= pattern_store.getMaxLen(); len++) {
+            PatternStore::Bucket bucket = pattern_store.getBucket(len);
+            for (size_t i = 0; i < bucket.size; i++) {
+                if (bucket.isDead(i))
+                    continue;
+                chars.insert(chars.end(), bucket.str(i), bucket.str(i) + len);
+                offsets.push_back(chars.size());
+                ids.push_back(bucket.ids[i]);
+            }
+        }
+        for (size_t i = 0; i < delta_patterns.size(); i++) {
+            chars.insert(chars.end(), delta_patterns[i].begin(), delta_patterns[i].end());
+            offsets.push_back(chars.size());
+            ids.push_back(delta_ids[i]);
+        }
+        pattern_store.build(chars.data(), offsets, ids);
+        qgram_index.build(pattern_store, qgram_len);
+        delta_patterns.clear();
+        delta_ids.clear();
+        rebuildDelta();
+    }
     XILINX_FUZZYMATCH_IMPL_DECL   
     std::unordered_map<int,int> FuzzyMatchSW::check(int threshold, const std::string &ptn_string)
     {
         //bool r = strFuzzy(this->max_fuzzy_len, t, vec_pattern_grp);
+        TopKCollector hits(0, threshold);
+        FilterStats stats;
+        doFuzzyTask(this->max_fuzzy_len, ptn_string, pattern_store, qgram_index, stats, hits);
+        if (delta_store.getNumPatterns() > 0)
+            doFuzzyTask(this->max_fuzzy_len, ptn_string, delta_store, delta_index, stats, hits);
+        num_candidates += stats.candidates;
+        num_verified += stats.verified;
+
+        std::vector<std::pair<int64_t, int> > result_vec;
+        hits.getSorted(result_vec);
         std::unordered_map<int, int> result_map;
-        doFuzzyTask(threshold, this->max_fuzzy_len, ptn_string, vec_pattern_grp, vec_pattern_id, result_map);
+        for (size_t i = 0; i < result_vec.size(); i++)
+            result_map.insert({int(result_vec[i].first), result_vec[i].second});
         return result_map;
     }
+
+    XILINX_FUZZYMATCH_IMPL_DECL
+    std::vector<std::pair<int64_t,int>> FuzzyMatchSW::checkTopK(int threshold, const std::string &ptn_string)
+    {
+        TopKCollector hits(max_results, threshold);
+        FilterStats stats;
+        doFuzzyTask(this->max_fuzzy_len, ptn_string, pattern_store, qgram_index, stats, hits);
+        if (delta_store.getNumPatterns() > 0)
+            doFuzzyTask(this->max_fuzzy_len, ptn_string, delta_store, delta_index, stats, hits);
+        num_candidates += stats.candidates;
+        num_verified += stats.verified;
+
+        std::vector<std::pair<int64_t, int> > result_vec;
+        hits.getSorted(result_vec);
+        return result_vec;
+    }
+
+    XILINX_FUZZYMATCH_IMPL_DECL
+    void FuzzyMatchSW::setQgramFilter(int q)
+    {
+        if (q < 0 || q > QgramIndex::max_q) {
+            std::ostringstream oss;
+            oss << "q-gram length " << q << " is out of range [0," << QgramIndex::max_q << "]";
+            throw xilinx_apps::fuzzymatch::Exception(oss.str());
+        }
+        qgram_len = q;
+        qgram_index.build(pattern_store, qgram_len);
+        delta_index.build(delta_store, qgram_len);
+    }
+
+    XILINX_FUZZYMATCH_IMPL_DECL
+    FilterStats FuzzyMatchSW::getFilterStats() const
+    {
+        FilterStats stats;
+        stats.candidates = num_candidates;
+        stats.verified = num_verified;
+        return stats;
+    }
+
+    XILINX_FUZZYMATCH_IMPL_DECL
+    void FuzzyMatchSW::resetFilterStats()
+    {
+        num_candidates = 0;
+        num_verified = 0;
+    }
+
+    XILINX_FUZZYMATCH_IMPL_DECL
+    std::vector<std::vector<std::pair<int64_t,int>>> FuzzyMatchSW::executefuzzyMatch(
+        std::vector<std::string> input_patterns, int similarity_level)
+    {
+        // number of reference strings compared by one task; big length buckets are split in
+        // slices of this size so that a single input string can also be spread over the pool
+        const size_t slice_size = 4096;
+
+        struct Task {
+            int input_idx;
+            const PatternStore* store;
+            const QgramIndex* index;
+            size_t len;
+            size_t begin;
+            size_t end;
+        };
+        struct Hit {
+            int input_idx;
+            int id;
+            int score;
+        };
+
+        if (!pool_)
+            pool_.reset(new ThreadPool(totalThreadNum));
+        const unsigned num_threads = pool_->getNumThreads();
+
+        int batch_num = input_patterns.size();
+        std::vector<Task> tasks;
+        for (int i = 0; i < batch_num; i++) {
+            size_t len = input_patterns[i].length();
+            if (len == 0)
+                continue;
+            size_t med = len * (100 - similarity_level) / 100;
+            size_t end_len = len + med;
+            for (size_t n = len - med; n <= end_len; n++) {
+                size_t size = pattern_store.getBucket(n).size;
+                for (size_t b = 0; b < size; b += slice_size)
+                    tasks.push_back({i, &pattern_store, &qgram_index, n, b, std::min(b + slice_size, size)});
+                size = delta_store.getBucket(n).size;
+                for (size_t b = 0; b < size; b += slice_size)
+                    tasks.push_back({i, &delta_store, &delta_index, n, b, std::min(b + slice_size, size)});
+            }
+        }
+
+        // per-thread encoded input string and hit list; consecutive tasks usually belong to the
+        // same input string, so it is only re-encoded when a worker moves to another one
+        std::vector<EncodedPattern> ptns(num_threads);
+        std::vector<QgramIndex::Query> queries(num_threads);
+        std::vector<int> encoded_idx(num_threads, -1);
+        std::vector<const QgramIndex*> encoded_index(num_threads, nullptr);
+        std::vector<std::vector<Hit> > hits(num_threads);
+        std::vector<std::vector<std::pair<int64_t, int> > > task_hits(num_threads);
+        std::vector<FilterStats> stats(num_threads);
+
+        pool_->run(tasks.size(), [&](size_t t, unsigned tid) {
+            const Task& task = tasks[t];
+            EncodedPattern& ptn = ptns[tid];
+            if (encoded_idx[tid] != task.input_idx) {
+                encodePattern(input_patterns[task.input_idx], ptn);
+                encoded_idx[tid] = task.input_idx;
+                encoded_index[tid] = nullptr;
+            }
+            if (encoded_index[tid] != task.index) {
+                task.index->encodeQuery(input_patterns[task.input_idx], queries[tid]);
+                encoded_index[tid] = task.index;
+            }
+            PatternStore::Bucket deny_list = task.store->getBucket(task.len);
+            // the best hits of the whole input are among the best ones of each task
+            TopKCollector collector(max_results, similarity_level);
+            scanBucket(ptn, *task.index, queries[tid], deny_list, task.begin, task.end, collector, stats[tid]);
+            collector.getSorted(task_hits[tid]);
+            for (size_t i = 0; i < task_hits[tid].size(); i++)
+                hits[tid].push_back({task.input_idx, int(task_hits[tid][i].first), task_hits[tid][i].second});
+        });
+
+        for (unsigned t = 0; t < num_threads; t++) {
+            num_candidates += stats[t].candidates;
+            num_verified += stats[t].verified;
+        }
+
+        std::vector<std::vector<std::pair<int64_t,int>>> results(batch_num);
+        for (unsigned t = 0; t < num_threads; t++) {
+            for (const Hit& hit : hits[t])
+                results[hit.input_idx].push_back(std::make_pair(int64_t(hit.id), hit.score));
+        }
+        for (int i = 0; i < batch_num; i++) {
+            std::sort(results[i].begin(), results[i].end(), &isBetterHit);
+            if (max_results > 0 && results[i].size() > max_results)
+                results[i].resize(max_results);
+        }
+
+        return results;
+    }
     
 } // namespace fuzzymatch
 } // namespace xilinx_apps
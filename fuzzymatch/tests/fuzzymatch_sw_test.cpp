@@ -0,0 +1,371 @@
+/**
+* Copyright (C) 2020 Xilinx, Inc
+*
+* Licensed under the Apache License, Version 2.0 (the "License"). You may
+* not use this file except in compliance with the License. A copy of the
+* License is located at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+* WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+* License for the specific language governing permissions and limitations
+* under the License.
+*/
+
+/*
+ * CPU-only tests of FuzzyMatchSW against a brute-force reference: the row-by-row edit distance DP and a scan of
+ * every pattern.  They need no Alveo card and link with fuzzymatch_utils.cpp only.
+ *
+ * Usage: fuzzymatch_sw_test
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <random>
+#include "fuzzymatch.hpp"
+
+using namespace xilinx_apps::fuzzymatch;
+
+typedef std::vector<std::pair<int64_t, int> > HitVector;
+
+// The row-by-row Levenshtein DP that the bit-parallel kernel replaced, with the same score and early exit
+int refSimilarity(int threshold, const std::string& str1, const std::string& str2) {
+    const int n = str1.length();
+    const int m = str2.length();
+    if (n == 0 || m == 0) return 0;
+
+    int maxDistance = (int)(std::max(n, m) * (100 - threshold) / 100);
+    if (maxDistance < std::abs(m - n)) return 0;
+
+    std::vector<int> p(n + 1, 0);
+    std::vector<int> d(n + 1, 0);
+    for (int i = 0; i <= n; i++) p[i] = i;
+    for (int j = 1; j <= m; j++) {
+        int bestPossibleEditDistance = m;
+        d[0] = j;
+        for (int i = 1; i <= n; i++) {
+            if (str2[j - 1] != str1[i - 1])
+                d[i] = std::min(std::min(d[i - 1], p[i]), p[i - 1]) + 1;
+            else
+                d[i] = std::min(std::min(d[i - 1] + 1, p[i] + 1), p[i - 1]);
+            bestPossibleEditDistance = std::min(bestPossibleEditDistance, d[i]);
+        }
+        if (j > maxDistance && bestPossibleEditDistance > maxDistance) return 0;
+        p.swap(d);
+    }
+    return (100 - (100 * p[n] / std::max(m, n)));
+}
+
+// Every live pattern by id, matched by scanning all of them
+class RefTable {
+   public:
+    void add(const std::vector<std::string>& patterns, const std::vector<int>& ids) {
+        for (size_t i = 0; i < patterns.size(); i++) patterns_[ids[i]] = patterns[i];
+    }
+    int remove(const std::vector<int>& ids) {
+        int removed = 0;
+        for (int id : ids) removed += patterns_.erase(id);
+        return removed;
+    }
+    // hits of the length window len +/- len * (100 - threshold) / 100, best first, at most k of them (0 = all)
+    HitVector check(int threshold, const std::string& str, size_t k) const {
+        const size_t len = str.length();
+        const size_t med = len * (100 - threshold) / 100;
+        HitVector hits;
+        for (const auto& entry : patterns_) {
+            const size_t n = entry.second.length();
+            if (n + med < len || n > len + med) continue;
+            int score = refSimilarity(threshold, str, entry.second);
+            if (score >= threshold) hits.push_back(std::make_pair(int64_t(entry.first), score));
+        }
+        std::sort(hits.begin(), hits.end(), [](const std::pair<int64_t, int>& a, const std::pair<int64_t, int>& b) {
+            return a.second != b.second ? a.second > b.second : a.first < b.first;
+        });
+        if (k > 0 && hits.size() > k) hits.resize(k);
+        return hits;
+    }
+
+   private:
+    std::map<int, std::string> patterns_;
+};
+
+std::string randomString(std::mt19937& rng, int minLen, int maxLen, int alphabet) {
+    std::string str(minLen + rng() % (maxLen - minLen + 1), 'a');
+    for (char& c : str) c = 'a' + rng() % alphabet;
+    return str;
+}
+
+HitVector sortedHits(const std::unordered_map<int, int>& hitMap) {
+    HitVector hits(hitMap.begin(), hitMap.end());
+    std::sort(hits.begin(), hits.end(), [](const std::pair<int64_t, int>& a, const std::pair<int64_t, int>& b) {
+        return a.second != b.second ? a.second > b.second : a.first < b.first;
+    });
+    return hits;
+}
+
+// the first few hits as id:score
+std::string formatHits(const HitVector& hits) {
+    std::string res;
+    for (size_t i = 0; i < hits.size() && i < 5; i++)
+        res += " " + std::to_string(hits[i].first) + ":" + std::to_string(hits[i].second);
+    return hits.size() > 5 ? res + " ..." : res;
+}
+
+bool reportMismatch(const char* what, int threshold, const std::string& str, const HitVector& ref,
+                    const HitVector& hits) {
+    if (hits == ref) return true;
+    std::cout << "ERROR: " << what << " threshold=" << threshold << " input=" << str << " returned " << hits.size()
+              << " hits" << formatHits(hits) << ", the reference " << ref.size() << formatHits(ref) << std::endl;
+    return false;
+}
+
+// check, checkTopK and executefuzzyMatch of sw against ref for the given inputs
+bool compareMatches(FuzzyMatchSW& sw, const RefTable& ref, const std::vector<std::string>& inputs) {
+    bool isSuccess = true;
+    for (int threshold : {60, 80, 90}) {
+        for (const std::string& str : inputs) {
+            isSuccess = reportMismatch("check", threshold, str, ref.check(threshold, str, 0),
+                                       sortedHits(sw.check(threshold, str))) && isSuccess;
+            isSuccess = reportMismatch("checkTopK", threshold, str, ref.check(threshold, str, sw.getMaxResults()),
+                                       sw.checkTopK(threshold, str)) && isSuccess;
+        }
+        std::vector<std::vector<std::pair<int64_t, int> > > batch = sw.executefuzzyMatch(inputs, threshold);
+        for (size_t i = 0; i < inputs.size(); i++)
+            isSuccess = reportMismatch("executefuzzyMatch", threshold, inputs[i],
+                                       ref.check(threshold, inputs[i], sw.getMaxResults()), batch[i]) && isSuccess;
+    }
+    return isSuccess;
+}
+
+// The bit-parallel kernel against the DP, across the 64-character block boundaries of the encoded input
+bool testEditDistance() {
+    std::mt19937 rng(1);
+    bool isSuccess = true;
+    EncodedPattern ptn;
+    for (int i = 0; i < 20000 && isSuccess; i++) {
+        const int alphabet = 2 + rng() % 25;
+        const std::string str1 = randomString(rng, 1, 150, alphabet);
+        // mostly a few edits away from str1, so that the scores spread over the whole range
+        std::string str2 = str1;
+        for (int e = rng() % (str1.length() / 4 + 2); e > 0; e--) {
+            const size_t pos = rng() % (str2.length() + 1);
+            const int op = rng() % 3;
+            if (op == 0 || str2.empty())
+                str2.insert(pos, 1, char('a' + rng() % alphabet));
+            else if (op == 1 && pos < str2.length())
+                str2.erase(pos, 1);
+            else if (pos < str2.length())
+                str2[pos] = 'a' + rng() % alphabet;
+        }
+        if (rng() % 8 == 0) str2 = randomString(rng, 1, 150, alphabet);
+        const int threshold = rng() % 101;
+        encodePattern(str1, ptn);
+        const int score = similarity(threshold, ptn, str2.data(), str2.length());
+        const int refScore = refSimilarity(threshold, str1, str2);
+        if (score != refScore) {
+            std::cout << "ERROR: similarity(" << threshold << ", " << str1 << ", " << str2 << ") = " << score
+                      << ", the DP gives " << refScore << std::endl;
+            isSuccess = false;
+        }
+    }
+    return isSuccess;
+}
+
+// check, checkTopK and executefuzzyMatch over a small alphabet, where most inputs have many hits
+bool testMatch() {
+    std::mt19937 rng(2);
+    std::vector<std::string> patterns;
+    std::vector<int> ids;
+    for (int i = 0; i < 3000; i++) {
+        patterns.push_back(randomString(rng, 3, 30, 3));
+        ids.push_back(7 * i + 1);
+    }
+    std::vector<std::string> inputs;
+    for (int i = 0; i < 100; i++) inputs.push_back(randomString(rng, 3, 30, 3));
+
+    FuzzyMatchSW sw;
+    sw.setMaxResults(10);
+    sw.initialize(patterns, ids);
+    RefTable ref;
+    ref.add(patterns, ids);
+    return compareMatches(sw, ref, inputs);
+}
+
+// The q-gram filter skips only strings that cannot reach the threshold
+bool testQgramFilter() {
+    std::mt19937 rng(3);
+    std::vector<std::string> patterns;
+    std::vector<int> ids;
+    for (int i = 0; i < 3000; i++) {
+        patterns.push_back(randomString(rng, 5, 40, 6));
+        ids.push_back(i);
+    }
+    std::vector<std::string> inputs;
+    for (int i = 0; i < 50; i++) {
+        // half the inputs close to a pattern
+        std::string str = (i % 2 == 0) ? patterns[rng() % patterns.size()] : randomString(rng, 5, 40, 6);
+        str[rng() % str.length()] = 'a' + rng() % 6;
+        inputs.push_back(str);
+    }
+
+    FuzzyMatchSW sw;
+    sw.setMaxResults(10);
+    sw.initialize(patterns, ids);
+    RefTable ref;
+    ref.add(patterns, ids);
+    bool isSuccess = true;
+    for (int q = 0; q <= QgramIndex::max_q; q++) {
+        sw.setQgramFilter(q);
+        sw.resetFilterStats();
+        isSuccess = compareMatches(sw, ref, inputs) && isSuccess;
+        FilterStats stats = sw.getFilterStats();
+        std::cout << "q=" << q << ": verified " << stats.verified << " of " << stats.candidates << " candidates"
+                  << std::endl;
+        if (stats.verified > stats.candidates || (q == 0 && stats.verified != stats.candidates)) {
+            std::cout << "ERROR: q=" << q << " verified " << stats.verified << " of " << stats.candidates
+                      << " candidates" << std::endl;
+            isSuccess = false;
+        }
+    }
+    return isSuccess;
+}
+
+// Removals leave tombstones, additions go to the delta store, and both are merged back by compactPatterns,
+// called directly or once the tombstones pass a quarter of the table
+bool testUpdates() {
+    std::mt19937 rng(4);
+    std::vector<std::string> patterns;
+    std::vector<int> ids;
+    for (int i = 0; i < 2000; i++) {
+        patterns.push_back(randomString(rng, 3, 20, 3));
+        ids.push_back(i);
+    }
+    std::vector<std::string> inputs;
+    for (int i = 0; i < 50; i++) inputs.push_back(randomString(rng, 3, 20, 3));
+
+    FuzzyMatchSW sw;
+    sw.setMaxResults(10);
+    sw.setQgramFilter(2);
+    sw.initialize(patterns, ids);
+    RefTable ref;
+    ref.add(patterns, ids);
+    bool isSuccess = true;
+
+    // tombstones, with ids that are not in the table
+    std::vector<int> removeIds;
+    for (int id = 0; id < 300; id += 3) removeIds.push_back(id);
+    removeIds.push_back(-5);
+    int removed = sw.removePatterns(removeIds);
+    if (removed != ref.remove(removeIds)) {
+        std::cout << "ERROR: removePatterns removed " << removed << " patterns" << std::endl;
+        isSuccess = false;
+    }
+    isSuccess = compareMatches(sw, ref, inputs) && isSuccess;
+
+    // the delta store, then the removal of some of its patterns and of some of the table
+    std::vector<std::string> addPatterns;
+    std::vector<int> addIds;
+    for (int i = 0; i < 100; i++) {
+        addPatterns.push_back(randomString(rng, 3, 20, 3));
+        addIds.push_back(100000 + i);
+    }
+    sw.addPatterns(addPatterns, addIds);
+    ref.add(addPatterns, addIds);
+    isSuccess = compareMatches(sw, ref, inputs) && isSuccess;
+    removeIds = {100000, 100001, 100050, 1, 2};
+    removed = sw.removePatterns(removeIds);
+    if (removed != ref.remove(removeIds)) {
+        std::cout << "ERROR: removePatterns removed " << removed << " patterns" << std::endl;
+        isSuccess = false;
+    }
+    isSuccess = compareMatches(sw, ref, inputs) && isSuccess;
+
+    sw.compactPatterns();
+    isSuccess = compareMatches(sw, ref, inputs) && isSuccess;
+
+    // enough additions to compact on their own, then enough removals
+    addPatterns.clear();
+    addIds.clear();
+    for (int i = 0; i < 200; i++) {
+        addPatterns.push_back(randomString(rng, 3, 20, 3));
+        addIds.push_back(200000 + i);
+    }
+    sw.addPatterns(addPatterns, addIds);
+    ref.add(addPatterns, addIds);
+    isSuccess = compareMatches(sw, ref, inputs) && isSuccess;
+    removeIds.clear();
+    for (int id = 300; id < 1000; id++) removeIds.push_back(id);
+    removed = sw.removePatterns(removeIds);
+    if (removed != ref.remove(removeIds)) {
+        std::cout << "ERROR: removePatterns removed " << removed << " patterns" << std::endl;
+        isSuccess = false;
+    }
+    isSuccess = compareMatches(sw, ref, inputs) && isSuccess;
+    return isSuccess;
+}
+
+// checkTopK reuses its collector for the delta store after the table has raised its level; the length window
+// must still be that of the threshold asked for
+bool testDeltaStoreWindow() {
+    const int threshold = 60;
+    const std::string input = "cabcbcccba";
+    std::vector<std::string> patterns;
+    std::vector<int> ids;
+    patterns.push_back("xyzcbcccba");  // 3 substitutions: 70
+    ids.push_back(1);
+    for (int i = 0; i < 20; i++) {
+        patterns.push_back(std::string(10, 'd' + i % 20));
+        ids.push_back(100 + i);
+    }
+    FuzzyMatchSW sw;
+    sw.setMaxResults(1);
+    sw.initialize(patterns, ids);
+    RefTable ref;
+    ref.add(patterns, ids);
+
+    // 4 insertions: 72, 4 characters longer than the input so outside the window of a level of 70
+    std::vector<std::string> addPatterns(1, "cabcbcccbaxxxx");
+    std::vector<int> addIds(1, 2);
+    sw.addPatterns(addPatterns, addIds);
+    ref.add(addPatterns, addIds);
+
+    const HitVector expected(1, std::make_pair(int64_t(2), 72));
+    bool isSuccess = reportMismatch("reference", threshold, input, expected, ref.check(threshold, input, 1));
+    isSuccess = reportMismatch("checkTopK", threshold, input, expected, sw.checkTopK(threshold, input)) && isSuccess;
+    return isSuccess;
+}
+
+struct SwTest {
+    const char* m_name;
+    bool (*m_run)();
+};
+
+static const SwTest s_tests[] = {
+    {"edit distance kernel", testEditDistance},
+    {"matches", testMatch},
+    {"q-gram filter", testQgramFilter},
+    {"tombstones, delta store and compaction", testUpdates},
+    {"delta store length window", testDeltaStoreWindow},
+};
+
+int main(int argc, char** argv) {
+    const unsigned numTests = sizeof(s_tests) / sizeof(SwTest);
+    unsigned numPassed = 0;
+    for (unsigned i = 0; i < numTests; i++) {
+        std::cout << "#### TEST " << i << ": " << s_tests[i].m_name << std::endl;
+        bool isSuccess = false;
+        try {
+            isSuccess = s_tests[i].m_run();
+        } catch (const xilinx_apps::fuzzymatch::Exception& ex) {
+            std::cout << "ERROR: " << ex.what() << std::endl;
+        }
+        std::cout << "Test " << i << ": " << (isSuccess ? "PASS" : "FAIL") << std::endl;
+        numPassed += isSuccess;
+    }
+    std::cout << numPassed << "/" << numTests << " tests passed" << std::endl;
+    std::cout << (numPassed == numTests ? "PASS" : "FAIL") << std::endl;
+    return numPassed == numTests ? 0 : 1;
+}
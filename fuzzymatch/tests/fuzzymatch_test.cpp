@@ -90,11 +90,14 @@ int main(int argc, const char* argv[]) {
         std::cout
             << "Option:\n\t-xclbin XCLBIN_PATH\t\trequired, path to xclbin binary\n\t-d WATCH_LIST_PATH\t\trequired, "
                "the folder of watch list csv files\n\t-c 0|1|2\t\t\toptional, default 0 for FPAG only, 1 for CPU only, "
-               "2 for both and comparing results\n";
+               "2 for both and comparing results\n\t--pipelined\t\t\toptional, run FPGA batches as a pipeline of "
+               "sub-batches\n\t--cpu_emulation\t\t\toptional, run the pipeline with the kernel emulated on CPU\n";
         return 0;
     }
 
-    if (!parser.getCmdOption("--xclbin", xclbin_path)) {
+    bool pipelined = parser.getCmdOption("--pipelined");
+    bool cpu_emulation = parser.getCmdOption("--cpu_emulation");
+    if (!parser.getCmdOption("--xclbin", xclbin_path) && !cpu_emulation) {
         std::cout << "ERROR: xclbin path is not set!\n";
         return -1;
     }
@@ -216,6 +219,8 @@ int main(int argc, const char* argv[]) {
         Options options;
         options.xclbinPath=xclbin_path;
         options.deviceNames=deviceNames;
+        options.pipelined = pipelined;
+        options.cpuEmulation = cpu_emulation;
         FuzzyMatch fm(options);
         
         if (fm.startFuzzyMatch() < 0) {
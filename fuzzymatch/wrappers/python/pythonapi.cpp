@@ -35,13 +35,20 @@ PYBIND11_MODULE (xilFuzzyMatchPython, pc) {
   py::class_<Options>(pc, "options")
     .def(py::init())
     .def_readwrite("xclbinPath", &Options::xclbinPath)
-    .def_readwrite("deviceNames", &Options::deviceNames);
+    .def_readwrite("deviceNames", &Options::deviceNames)
+    .def_readwrite("pipelined", &Options::pipelined)
+    .def_readwrite("cpuEmulation", &Options::cpuEmulation)
+    .def_readwrite("pipelineBatchSize", &Options::pipelineBatchSize);
     
     
   py::class_<FuzzyMatch>(pc, "FuzzyMatch")
     .def(py::init<const Options &>())
     .def("startFuzzyMatch", &FuzzyMatch::startFuzzyMatch)
     .def("fuzzyMatchLoadVec", &FuzzyMatch::fuzzyMatchLoadVec)
+    .def("fuzzyMatchPackToFile", &FuzzyMatch::fuzzyMatchPackToFile)
+    .def("fuzzyMatchLoadPackedFile", &FuzzyMatch::fuzzyMatchLoadPackedFile)
+    .def("addPatterns", &FuzzyMatch::addPatterns)
+    .def("removePatterns", &FuzzyMatch::removePatterns)
     .def("executefuzzyMatch", &FuzzyMatch::executefuzzyMatch);
 
 }
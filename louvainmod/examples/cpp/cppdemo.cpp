@@ -54,6 +54,7 @@ int main(int argc, char **argv) {
     options.alveoProject = toolOptions.alveoProject;
     options.numDevices = toolOptions.numDevices;
     options.deviceNames = toolOptions.deviceNames;   
+    options.pruning = toolOptions.pruning;
     if (toolOptions.modeZmq == ZMQ_DRIVER)
         options.nodeId = 0;
     else if (toolOptions.modeZmq == ZMQ_WORKER)
@@ -81,6 +81,7 @@ struct clustering_parameters {
     bool output;        // Printout the clustering data
     bool VF;            // Vertex following turned on
     bool coloring;      // If coloring is turned on
+    bool pruning;       // Re-evaluate only vertices next to a community change
 
     double C_thresh;   // Threshold with coloring on
     long minGraphSize; // Min |V| to enable coloring
@@ -93,12 +94,33 @@ struct clustering_parameters {
 
 /////////////////// FUNCTION CALLS ////////////////////
 void displayGraphCharacteristics(graphNew* G);
+// Copies G into a new graphCompact; returns 0 if G has 2^32 or more vertices or a weight that a float would round
+graphCompact* compactGraph(graphNew* G);
+void freeCompactGraph(graphCompact* Gc);
 void displayGraph(graphNew* G);
 void displayGraphEdgeList(graphNew* G);
 void displayGraphEdgeList(graphNew* G, FILE* out);
 // Graph Clustering (Community detection)
-double parallelLouvianMethod(
-    graphNew* G, long* C, int nThreads, double Lower, double thresh, double* totTime, int* numItr);
+// pruning: re-evaluate only the vertices next to a community change in each iteration after the first
+// M: optional ghost marks of a partition; vertices with M[v] < 0 stay in their own community
+double parallelLouvianMethod(graphNew* G,
+                             long* C,
+                             int nThreads,
+                             double Lower,
+                             double thresh,
+                             double* totTime,
+                             int* numItr,
+                             bool pruning = false,
+                             const long* M = 0);
+double parallelLouvianMethod(graphCompact* G,
+                             long* C,
+                             int nThreads,
+                             double Lower,
+                             double thresh,
+                             double* totTime,
+                             int* numItr,
+                             bool pruning = false,
+                             const long* M = 0);
 double algoLouvainWithDistOneColoring(graphNew* G,
                                       long* C,
                                       int nThreads,
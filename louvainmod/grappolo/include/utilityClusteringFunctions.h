@@ -39,11 +39,46 @@
 //
 // ************************************************************************
 
+#ifndef _UTILITY_CLUSTERING_FUNCTIONS_H
+#define _UTILITY_CLUSTERING_FUNCTIONS_H
+
 #include "defs.h"
 
 using namespace std;
 
-void sumVertexDegree(edge* vtxInd, long* vtxPtr, long* vDegree, long NV, Comm* cInfo);
+// Sparse accumulator (SPA) of the edge weight from one vertex to each of its
+// neighboring clusters.  Each thread keeps one and reuses it for every vertex,
+// so the inner loop does no allocation.  Entry 0 is the vertex's own cluster;
+// the others follow in the order their first edge is seen.  With up to
+// DenseLimit clusters, an entry is found through a dense slot per cluster id;
+// past that, through an open-addressing table sized to the vertex degree.
+class ClusterAccumulator {
+   public:
+    static const long DenseLimit = 1L << 21;
+
+    explicit ClusterAccumulator(long numClusters);
+
+    // Forget the previous vertex and start one in cluster sc with the given number of edges
+    void reset(long sc, long numEdges);
+    void add(long cluster, double weight);
+    long size() const { return (long)clusters.size(); }
+
+    vector<long> clusters;  // cluster id of each entry
+    vector<double> weights; // edge weight incident on each entry's cluster
+
+   private:
+    long hashSlot(long cluster) const;
+
+    vector<long> slot;      // dense: entry of each cluster id, -1 if none
+    vector<long> tableKeys; // sparse: cluster id per table position, -1 if empty
+    vector<long> tableVals; // sparse: entry per table position
+    vector<long> usedPos;   // sparse: table positions to empty on reset
+    int tableBits;
+};
+
+// EdgeT is edge (graphNew) or edgeCompact (graphCompact)
+template <class EdgeT>
+void sumVertexDegree(EdgeT* vtxInd, long* vtxPtr, long* vDegree, long NV, Comm* cInfo);
 
 double calConstantForSecondTerm(long* vDegree, long NV);
 
@@ -64,3 +99,11 @@ long max(map<long, long>& clusterLocalMap,
          long degree,
          long sc,
          double constant);
+
+// Same as the map-based versions above, accumulating into a reused ClusterAccumulator
+template <class EdgeT>
+long buildLocalMapCounter(long adj1, long adj2, ClusterAccumulator& acc, EdgeT* vtxInd, long* currCommAss, long me);
+
+long max(ClusterAccumulator& acc, long selfLoop, Comm* cInfo, long degree, long sc, double constant);
+
+#endif
@@ -43,33 +43,74 @@
 
 using namespace std;
 
+// Exclusive prefix sum of A[0..n-1] in place, one block of A per thread
+// Returns the sum of all the elements
+static long parallelPrefixSum(long* A, long n) {
+    int nT = omp_get_max_threads();
+    long* partial = (long*)malloc((nT + 1) * sizeof(long));
+    assert(partial != 0);
+    long total = 0;
+#pragma omp parallel num_threads(nT)
+    {
+        int t = omp_get_thread_num();
+        int nt = omp_get_num_threads();
+        long begin = n * t / nt;
+        long end = n * (t + 1) / nt;
+        long sum = 0;
+        for (long i = begin; i < end; i++) sum += A[i];
+        partial[t + 1] = sum;
+#pragma omp barrier
+#pragma omp single
+        {
+            partial[0] = 0;
+            for (int k = 0; k < nt; k++) partial[k + 1] += partial[k];
+            total = partial[nt];
+        } // Implicit barrier
+        sum = partial[t];
+        for (long i = begin; i < end; i++) {
+            long value = A[i];
+            A[i] = sum;
+            sum += value;
+        }
+    } // End of parallel region
+    free(partial);
+    return total;
+} // End of parallelPrefixSum()
+
 // WARNING: Will overwrite the old cluster vector
 // Returns the number of unique clusters
+// Clusters are numbered in the order of their first vertex, like a serial scan of C would number them
 long renumberClustersContiguously(long* C, long size) {
 #ifdef PRINT_DETAILED_STATS_
     printf("Within renumberClustersContiguously()\n");
 #endif
     double time1 = omp_get_wtime();
-    // Count the number of unique communities and internal edges
-    map<long, long> clusterLocalMap; // Map each neighbor's cluster to a local number
-    map<long, long>::iterator storedAlready;
-    long numUniqueClusters = 0;
+    long* firstVertex = (long*)malloc(size * sizeof(long)); // Lowest vertex of each old cluster id
+    assert(firstVertex != 0);
+    long* newId = (long*)malloc(size * sizeof(long)); // 1 at the first vertex of a cluster, then the prefix sum
+    assert(newId != 0);
 
-    // Do this loop in serial
-    // Will overwrite the old cluster id with the new cluster id
+#pragma omp parallel for
+    for (long i = 0; i < size; i++) firstVertex[i] = size;
+    // Atomic minimum: a cluster's entry only ever decreases, so the loop retries only while i is still lower
+#pragma omp parallel for
     for (long i = 0; i < size; i++) {
         assert(C[i] < size);
-        if (C[i] >= 0) {                                  // Only if it is a valid number
-            storedAlready = clusterLocalMap.find(C[i]);   // Check if it already exists
-            if (storedAlready != clusterLocalMap.end()) { // Already exists
-                C[i] = storedAlready->second;             // Renumber the cluster id
-            } else {
-                clusterLocalMap[C[i]] = numUniqueClusters; // Does not exist, add to the map
-                C[i] = numUniqueClusters;                  // Renumber the cluster id
-                numUniqueClusters++;                       // Increment the number
-            }
-        } // End of if()
-    }     // End of for(i)
+        if (C[i] >= 0) { // Only if it is a valid number
+            long old = firstVertex[C[i]];
+            while (i < old && !__sync_bool_compare_and_swap(&firstVertex[C[i]], old, i)) old = firstVertex[C[i]];
+        }
+    }
+#pragma omp parallel for
+    for (long i = 0; i < size; i++) newId[i] = (C[i] >= 0 && firstVertex[C[i]] == i) ? 1 : 0;
+    long numUniqueClusters = parallelPrefixSum(newId, size);
+    // Will overwrite the old cluster id with the new cluster id
+#pragma omp parallel for
+    for (long i = 0; i < size; i++) {
+        if (C[i] >= 0) C[i] = newId[firstVertex[C[i]]];
+    }
+    free(firstVertex);
+    free(newId);
     time1 = omp_get_wtime() - time1;
 #ifdef PRINT_DETAILED_STATS_
     printf("Time to renumber clusters: %lf\n", time1);
@@ -124,8 +165,57 @@ long renumberClustersContiguously_ghost(long *C, long size, long NV_l) {
   return numUniqueClusters; //Return the number of unique cluster ids
 }//End of renumberClustersContiguously_ghost()
 
+// An edge of the next level graph: key = head cluster * NV_out + tail cluster
+typedef struct {
+    unsigned long key;
+    long weight;
+} clusterEdge;
+
+// LSD radix sort of A[0..n-1] on the low keyBits bits of the key, 8 bits per pass, with Tmp as scratch space.
+// Each thread counts and scatters its own block of the array, so the sort is stable and takes no locks or atomics.
+// Returns whichever of A and Tmp holds the sorted edges
+static clusterEdge* parallelRadixSort(clusterEdge* A, clusterEdge* Tmp, long n, int keyBits) {
+    const int RadixBits = 8;
+    const int Buckets = 1 << RadixBits;
+    int nT = omp_get_max_threads();
+    long* offsets = (long*)malloc((long)nT * Buckets * sizeof(long)); // Bucket counts, then offsets, per thread
+    assert(offsets != 0);
+    for (int shift = 0; shift < keyBits; shift += RadixBits) {
+#pragma omp parallel num_threads(nT)
+        {
+            int t = omp_get_thread_num();
+            int nt = omp_get_num_threads();
+            long begin = n * t / nt;
+            long end = n * (t + 1) / nt;
+            long* myOffsets = offsets + (long)t * Buckets;
+            for (int b = 0; b < Buckets; b++) myOffsets[b] = 0;
+            for (long i = begin; i < end; i++) myOffsets[(A[i].key >> shift) & (Buckets - 1)]++;
+#pragma omp barrier
+#pragma omp single
+            {
+                long sum = 0;
+                for (int b = 0; b < Buckets; b++) {
+                    for (int k = 0; k < nt; k++) {
+                        long count = offsets[(long)k * Buckets + b];
+                        offsets[(long)k * Buckets + b] = sum;
+                        sum += count;
+                    }
+                }
+            } // Implicit barrier
+            for (long i = begin; i < end; i++) Tmp[myOffsets[(A[i].key >> shift) & (Buckets - 1)]++] = A[i];
+        } // End of parallel region
+        clusterEdge* sorted = Tmp;
+        Tmp = A;
+        A = sorted;
+    } // End of for(shift)
+    free(offsets);
+    return A;
+} // End of parallelRadixSort()
+
 // WARNING: Will assume that the cluster id have been renumbered contiguously
 // Return the total time for building the next level of graph
+// Every input edge is relabeled with (C[head], C[tail]) and the relabeled edges are radix sorted, so the edges
+// between two clusters end up next to each other and the output CSR falls out of prefix sums: no locks, no maps.
 double buildNextLevelGraphOpt(graphNew* Gin, graphNew* Gout, long* C, long numUniqueClusters, int nThreads) {
 #ifdef PRINT_DETAILED_STATS_
     printf("Within buildNextLevelGraphOpt(): # of unique clusters= %ld\n", numUniqueClusters);
@@ -148,10 +238,8 @@ double buildNextLevelGraphOpt(graphNew* Gin, graphNew* Gout, long* C, long numUn
 #endif
 
     double time1, time2, TotTime = 0; // For timing purposes
-    // double total = 0, totItr = 0;//-Wunused-variable
     // Pointers into the input graph structure:
     long NV_in = Gin->numVertices;
-    // long    NE_in        = Gin->numEdges;//-Wunused-variable
     long* vtxPtrIn = Gin->edgeListPtrs;
     edge* vtxIndIn = Gin->edgeList;
 
@@ -161,111 +249,104 @@ double buildNextLevelGraphOpt(graphNew* Gin, graphNew* Gout, long* C, long numUn
     long NE_out = 0;
     long* vtxPtrOut = (long*)malloc((NV_out + 1) * sizeof(long));
     assert(vtxPtrOut != 0);
-    vtxPtrOut[0] = 0; // First location is always a zero
-    /* Step 1 : Regroup the node into cluster node */
-    map<long, long>** cluPtrIn = (map<long, long>**)malloc(numUniqueClusters * sizeof(map<long, long>*));
-    assert(cluPtrIn != 0);
-
+    assert(NV_out <= (1L << 32)); // The (head, tail) key must fit in 64 bits
+    int keyBits = 0;
+    while (keyBits < 64 && ((unsigned long)NV_out * NV_out - 1) >> keyBits) keyBits++;
+
+    /* Step 1 : Relabel the edges with their clusters */
+    // An edge i-->tail is kept from the endpoint with the larger cluster id, as C[i]-->C[tail] and C[tail]-->C[i]
+    long* edgeCount = (long*)malloc(NV_in * sizeof(long)); // Relabeled edges of each vertex, then their offsets
+    assert(edgeCount != 0);
 #pragma omp parallel for
-    for (long i = 0; i < numUniqueClusters; i++) {
-        cluPtrIn[i] = new map<long, long>();
-        (*(cluPtrIn[i]))[i] = 0; // Add for a self loop with zero weight
+    for (long i = 0; i < NV_in; i++) {
+        long count = 0;
+        assert(C[i] < numUniqueClusters);
+        for (long j = vtxPtrIn[i]; j < vtxPtrIn[i + 1]; j++) {
+            long tail = vtxIndIn[j].tail;
+            assert(C[tail] < numUniqueClusters);
+            if (C[i] > C[tail])
+                count += 2;
+            else if (C[i] == C[tail])
+                count++;
+        }
+        edgeCount[i] = count;
     }
+    long numRelabeled = parallelPrefixSum(edgeCount, NV_in);
+    long numRecords = numRelabeled + NV_out; // Plus a self loop with zero weight for every cluster
+    clusterEdge* records = (clusterEdge*)malloc(numRecords * sizeof(clusterEdge));
+    assert(records != 0);
+    clusterEdge* scratch = (clusterEdge*)malloc(numRecords * sizeof(clusterEdge));
+    assert(scratch != 0);
 #pragma omp parallel for
-    for (long i = 1; i <= NV_out; i++) vtxPtrOut[i] = 1; // Count self-loops for every vertex
-
-    // Create an array of locks for each cluster
-    omp_lock_t* nlocks = (omp_lock_t*)malloc(numUniqueClusters * sizeof(omp_lock_t));
-    assert(nlocks != 0);
+    for (long i = 0; i < NV_in; i++) {
+        long Where = edgeCount[i];
+        for (long j = vtxPtrIn[i]; j < vtxPtrIn[i + 1]; j++) {
+            long tail = vtxIndIn[j].tail;
+            if (C[i] >= C[tail]) {
+                records[Where].key = (unsigned long)C[i] * NV_out + C[tail];
+                records[Where++].weight = (long)vtxIndIn[j].weight;
+                if (C[i] > C[tail]) {
+                    records[Where].key = (unsigned long)C[tail] * NV_out + C[i];
+                    records[Where++].weight = (long)vtxIndIn[j].weight;
+                }
+            }
+        } // End of for(j)
+    }     // End of for(i)
 #pragma omp parallel for
-    for (long i = 0; i < numUniqueClusters; i++) {
-        omp_init_lock(&nlocks[i]); // Initialize locks
+    for (long i = 0; i < NV_out; i++) {
+        records[numRelabeled + i].key = (unsigned long)i * NV_out + i;
+        records[numRelabeled + i].weight = 0;
     }
+    free(edgeCount);
     time2 = omp_get_wtime();
     TotTime += (time2 - time1);
 #ifdef PRINT_DETAILED_STATS_
     printf("Time to initialize: %3.3lf\n", time2 - time1);
 #endif
+
+    /* Step 2 : Sort the relabeled edges and count the distinct ones */
     time1 = omp_get_wtime();
+    clusterEdge* sorted = parallelRadixSort(records, scratch, numRecords, keyBits);
+    long* edgeIndex = (long*)malloc(numRecords * sizeof(long)); // 1 where a key starts, then the output edge index
+    assert(edgeIndex != 0);
 #pragma omp parallel for
-    for (long i = 0; i < NV_in; i++) {
-        long adj1 = vtxPtrIn[i];
-        long adj2 = vtxPtrIn[i + 1];
-        map<long, long>::iterator localIterator;
-        assert(C[i] < numUniqueClusters);
-        // Now look for all the neighbors of this cluster
-        for (long j = adj1; j < adj2; j++) {
-            long tail = vtxIndIn[j].tail;
-            assert(C[tail] < numUniqueClusters);
-            // Add the edge from one endpoint
-            if (C[i] >= C[tail]) {
-                omp_set_lock(&nlocks[C[i]]); // Locking the cluster
-
-                localIterator = cluPtrIn[C[i]]->find(C[tail]); // Check if it exists
-                if (localIterator != cluPtrIn[C[i]]->end()) {  // Already exists
-                    //(*(cluPtrIn[C[i]]))[C[tail]] += (long)vtxIndIn[j].weight;
-                    localIterator->second += (long)vtxIndIn[j].weight;
-                } else {
-                    (*(cluPtrIn[C[i]]))[C[tail]] = (long)vtxIndIn[j].weight; // Add edge i-->j
-                    __sync_fetch_and_add(&vtxPtrOut[C[i] + 1], 1);
-                    if (C[i] > C[tail]) {
-                        __sync_fetch_and_add(&NE_out, 1);                 // Keep track of non-self #edges
-                        __sync_fetch_and_add(&vtxPtrOut[C[tail] + 1], 1); // Count edge
-                                                                          // j-->i
-                    }
-                }
-
-                omp_unset_lock(&nlocks[C[i]]); // Unlocking the cluster
-            }                                  // End of if
-        }                                      // End of for(j)
-    }                                          // End of for(i)
-    // Prefix sum:
-    for (long i = 0; i < NV_out; i++) {
-        vtxPtrOut[i + 1] += vtxPtrOut[i];
+    for (long p = 0; p < numRecords; p++) edgeIndex[p] = (p == 0 || sorted[p].key != sorted[p - 1].key) ? 1 : 0;
+    long numEdges = parallelPrefixSum(edgeIndex, numRecords);
+    long* runStart = (long*)malloc((numEdges + 1) * sizeof(long)); // First record of every output edge
+    assert(runStart != 0);
+#pragma omp parallel for
+    for (long p = 0; p < numRecords; p++) {
+        if (p == 0 || sorted[p].key != sorted[p - 1].key) runStart[edgeIndex[p]] = p;
     }
-
+    runStart[numEdges] = numRecords;
+    // Every cluster has its self loop, so every head starts a run of output edges
+#pragma omp parallel for
+    for (long e = 0; e < numEdges; e++) {
+        long head = sorted[runStart[e]].key / NV_out;
+        if (e == 0 || head != (long)(sorted[runStart[e - 1]].key / NV_out)) vtxPtrOut[head] = e;
+    }
+    vtxPtrOut[NV_out] = numEdges;
+    NE_out = (numEdges - NV_out) / 2; // Keep track of non-self #edges
     time2 = omp_get_wtime();
     TotTime += (time2 - time1);
-// printf("These should match: %ld == %ld\n",(2*NE_out + NV_out),
-// vtxPtrOut[NV_out]);
 #ifdef PRINT_DETAILED_STATS_
     printf("Time to count edges: %3.3lf\n", time2 - time1);
 #endif
     assert(vtxPtrOut[NV_out] == (NE_out * 2 + NV_out)); // Sanity check
 
     time1 = omp_get_wtime();
-    // Step 3 : build the edge list:
-    long numEdges = vtxPtrOut[NV_out];
+    // Step 3 : build the edge list, sorted by tail within each vertex:
     long realEdges = numEdges - NE_out; // Self-loops appear once, others appear twice
     edge* vtxIndOut = (edge*)malloc(numEdges * sizeof(edge));
     assert(vtxIndOut != 0);
-    long* Added = (long*)malloc(NV_out * sizeof(long)); // Keep track of what got added
-    assert(Added != 0);
-
 #pragma omp parallel for
-    for (long i = 0; i < NV_out; i++) {
-        Added[i] = 0;
+    for (long e = 0; e < numEdges; e++) {
+        long weight = 0;
+        for (long p = runStart[e]; p < runStart[e + 1]; p++) weight += sorted[p].weight;
+        vtxIndOut[e].head = sorted[runStart[e]].key / NV_out;   // Head
+        vtxIndOut[e].tail = sorted[runStart[e]].key % NV_out;   // Tail
+        vtxIndOut[e].weight = weight;                           // Weight
     }
-// Now add the edges in no particular order
-#pragma omp parallel for
-    for (long i = 0; i < NV_out; i++) {
-        long Where;
-        map<long, long>::iterator localIterator = cluPtrIn[i]->begin();
-        // Now go through the other edges:
-        while (localIterator != cluPtrIn[i]->end()) {
-            Where = vtxPtrOut[i] + __sync_fetch_and_add(&Added[i], 1);
-            vtxIndOut[Where].head = i;                       // Head
-            vtxIndOut[Where].tail = localIterator->first;    // Tail
-            vtxIndOut[Where].weight = localIterator->second; // Weight
-            if (i != localIterator->first) {
-                Where = vtxPtrOut[localIterator->first] + __sync_fetch_and_add(&Added[localIterator->first], 1);
-                vtxIndOut[Where].head = localIterator->first;
-                vtxIndOut[Where].tail = i;                       // Tail
-                vtxIndOut[Where].weight = localIterator->second; // Weight
-            }
-            localIterator++;
-        }
-    } // End of for(i)
     time2 = omp_get_wtime();
     TotTime += (time2 - time1);
 #ifdef PRINT_DETAILED_STATS_
@@ -284,16 +365,10 @@ double buildNextLevelGraphOpt(graphNew* Gin, graphNew* Gout, long* C, long numUn
     Gout->edgeList = vtxIndOut;
 
     // Clean up
-    free(Added);
-#pragma omp parallel for
-    for (long i = 0; i < numUniqueClusters; i++) delete cluPtrIn[i];
-    free(cluPtrIn);
-
-#pragma omp parallel for
-    for (long i = 0; i < numUniqueClusters; i++) {
-        omp_destroy_lock(&nlocks[i]);
-    }
-    free(nlocks);
+    free(runStart);
+    free(edgeIndex);
+    free(records);
+    free(scratch);
 
     return TotTime;
 } // End of buildNextLevelGraph2()
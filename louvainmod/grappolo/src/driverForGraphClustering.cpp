@@ -52,6 +52,7 @@ int host_ParserParameters(int argc,
                           bool& opts_coloring,     //
                           bool& opts_output,       //;
                           bool& opts_VF,           //;
+                          bool& opts_pruning,      //; //Re-evaluate only vertices next to a change
                           char opts_xclbinPath[4096]) {
     // step1: parser parameters: xclbinPath, coloring, int fType ,
     // opts.minGraphSize, opts.threshold
@@ -68,6 +69,7 @@ int host_ParserParameters(int argc,
     opts_output = opts.output;
     opts_coloring = opts.coloring;
     opts_VF = opts.VF;
+    opts_pruning = opts.pruning;
     strcpy(opts_inFile, (char*)opts.inFile);
     strcpy(opts_xclbinPath, (char*)opts.xclbin);
     return 0;
@@ -44,8 +44,24 @@
 
 using namespace std;
 
-double parallelLouvianMethod(
-    graphNew* G, long* C, int nThreads, double Lower, double thresh, double* totTime, int* numItr) {
+// Active-vertex bitmaps: bit v of word v/64
+inline bool isActive(const unsigned long* bits, long v) {
+    return (bits[v >> 6] >> (v & 63)) & 1;
+}
+
+inline void markActive(unsigned long* bits, long v) {
+    unsigned long mask = 1UL << (v & 63);
+    if (!(bits[v >> 6] & mask)) __sync_fetch_and_or(&bits[v >> 6], mask);
+}
+
+// With pruning, an iteration only re-evaluates the vertices that changed community in the previous iteration and
+// their neighbors.  Every other vertex keeps its community and its e_ix, which cannot have changed since.
+// Ghost vertices (M[v] < 0) belong to another partition: their e_ix is counted but they never leave their community.
+// GraphT is graphNew or graphCompact, and EdgeT its edge type.
+template <class GraphT, class EdgeT>
+static double louvainMethod(
+    GraphT* G, long* C, int nThreads, double Lower, double thresh, double* totTime, int* numItr, bool pruning,
+    const long* M) {
 #ifdef PRINT_DETAILED_STATS_
     printf("Within parallelLouvianMethod()\n");
 #endif
@@ -66,7 +82,7 @@ double parallelLouvianMethod(
     // long    NS        = G->sVertices;//-Wunused-variable
     // long    NE        = G->numEdges;//-Wunused-variable
     long* vtxPtr = G->edgeListPtrs;
-    edge* vtxInd = G->edgeList;
+    EdgeT* vtxInd = G->edgeList;
 
     /* Variables for computing modularity */
     // long totalEdgeWeightTwice;//-Wunused-variable
@@ -111,6 +127,28 @@ double parallelLouvianMethod(
     // Initialize each vertex to its own cluster
     initCommAss(pastCommAss, currCommAss, NV);
 
+    // One neighbor-cluster accumulator per thread, reused for every vertex
+    // Each thread builds its own, so the dense slot arrays are filled in parallel and first-touched on its node
+    vector<ClusterAccumulator*> accumulators(nT);
+#pragma omp parallel
+    { accumulators[omp_get_thread_num()] = new ClusterAccumulator(NV); }
+
+    // Vertices to evaluate in this iteration and in the next one; all are active in the first iteration
+    long numWords = (NV + 63) / 64;
+    unsigned long* active = 0;
+    unsigned long* nextActive = 0;
+    if (pruning) {
+        active = (unsigned long*)malloc(numWords * sizeof(unsigned long));
+        assert(active != 0);
+        nextActive = (unsigned long*)malloc(numWords * sizeof(unsigned long));
+        assert(nextActive != 0);
+#pragma omp parallel for
+        for (long w = 0; w < numWords; w++) {
+            active[w] = ~0UL;
+            nextActive[w] = 0;
+        }
+    }
+
     time2 = omp_get_wtime();
     printf("Time to initialize: %3.3lf\n", time2 - time1);
 
@@ -137,35 +175,38 @@ double parallelLouvianMethod(
 /* Re-initialize datastructures */
 #pragma omp parallel for
         for (long i = 0; i < NV; i++) {
-            clusterWeightInternal[i] = 0;
+            if (!pruning || isActive(active, i)) clusterWeightInternal[i] = 0;
             cUpdate[i].degree = 0;
             cUpdate[i].size = 0;
         }
 
-#pragma omp parallel for
+        long numActive = 0;
+#pragma omp parallel for reduction(+ : numActive)
         for (long i = 0; i < NV; i++) {
+            if (pruning && !isActive(active, i)) {
+                targetCommAss[i] = currCommAss[i]; // Nothing around it changed
+                continue;
+            }
+            numActive++;
             long adj1 = vtxPtr[i];
             long adj2 = vtxPtr[i + 1];
             long selfLoop = 0;
-            // Build a datastructure to hold the cluster structure of its neighbors
-            map<long, long> clusterLocalMap; // Map each neighbor's cluster to a local number
-            map<long, long>::iterator storedAlready;
-            vector<double> Counter; // Number of edges in each unique cluster
-            // Add v's current cluster:
+            // The cluster structure of its neighbors
+            ClusterAccumulator& acc = *accumulators[omp_get_thread_num()];
             if (adj1 != adj2) {
-                clusterLocalMap[currCommAss[i]] = 0;
-                Counter.push_back(0); // Initialize the counter to ZERO (no edges incident yet)
+                // Add v's current cluster:
+                acc.reset(currCommAss[i], adj2 - adj1);
                 // Find unique cluster ids and #of edges incident (eicj) to them
-                selfLoop = buildLocalMapCounter(adj1, adj2, clusterLocalMap, Counter, vtxInd, currCommAss, i);
+                selfLoop = buildLocalMapCounter(adj1, adj2, acc, vtxInd, currCommAss, i);
                 // Update delta Q calculation
-                clusterWeightInternal[i] += (long)Counter[0]; //(e_ix)
+                clusterWeightInternal[i] += (long)acc.weights[0]; //(e_ix)
                 // Calculate the max
-                targetCommAss[i] =
-                    max(clusterLocalMap, Counter, selfLoop, cInfo, vDegree[i], currCommAss[i], constantForSecondTerm);
+                targetCommAss[i] = max(acc, selfLoop, cInfo, vDegree[i], currCommAss[i], constantForSecondTerm);
                 // assert((targetCommAss[i] >= 0)&&(targetCommAss[i] < NV));
             } else {
                 targetCommAss[i] = -1;
             }
+            if (M != 0 && M[i] < 0) targetCommAss[i] = currCommAss[i];
 
             // Update
             if (targetCommAss[i] != currCommAss[i] && targetCommAss[i] != -1) {
@@ -173,9 +214,11 @@ double parallelLouvianMethod(
                 __sync_fetch_and_add(&cUpdate[targetCommAss[i]].size, 1);
                 __sync_fetch_and_sub(&cUpdate[currCommAss[i]].degree, vDegree[i]);
                 __sync_fetch_and_sub(&cUpdate[currCommAss[i]].size, 1);
+                if (pruning) { // Re-evaluate it and its neighbors in the next iteration
+                    markActive(nextActive, i);
+                    for (long j = adj1; j < adj2; j++) markActive(nextActive, vtxInd[j].tail);
+                }
             } // End of If()
-            clusterLocalMap.clear();
-            Counter.clear();
         } // End of for(i)
         time2 = omp_get_wtime();
 
@@ -201,6 +244,9 @@ double parallelLouvianMethod(
 #ifdef PRINT_TERSE_STATS_
         printf("%d \t %lf \t %3.3lf  \t %3.3lf\n", numItrs, currMod, totItr, total);
 #endif
+#ifdef PRINT_DETAILED_STATS_
+        if (pruning) printf("Iteration %d: %ld of %ld vertices active\n", numItrs, numActive, NV);
+#endif
 
         // Break if modularity gain is not sufficient
         if ((currMod - prevMod) < thresMod) {
@@ -222,6 +268,13 @@ double parallelLouvianMethod(
         pastCommAss = currCommAss;   // Previous holds the current
         currCommAss = targetCommAss; // Current holds the chosen assignment
         targetCommAss = tmp;         // Reuse the vector
+        if (pruning) {
+            unsigned long* tmpActive = active;
+            active = nextActive;
+            nextActive = tmpActive;
+#pragma omp parallel for
+            for (long w = 0; w < numWords; w++) nextActive[w] = 0;
+        }
 
     }                 // End of while(true)
     *totTime = total; // Return back the total time for clustering
@@ -254,6 +307,7 @@ double parallelLouvianMethod(
         C[i] = pastCommAss[i];
     }
     // Cleanup
+    for (size_t t = 0; t < accumulators.size(); t++) delete accumulators[t];
     free(pastCommAss);
     free(currCommAss);
     free(targetCommAss);
@@ -261,6 +315,32 @@ double parallelLouvianMethod(
     free(cInfo);
     free(cUpdate);
     free(clusterWeightInternal);
+    free(active);
+    free(nextActive);
 
     return prevMod;
 }
+
+double parallelLouvianMethod(graphNew* G,
+                             long* C,
+                             int nThreads,
+                             double Lower,
+                             double thresh,
+                             double* totTime,
+                             int* numItr,
+                             bool pruning,
+                             const long* M) {
+    return louvainMethod<graphNew, edge>(G, C, nThreads, Lower, thresh, totTime, numItr, pruning, M);
+}
+
+double parallelLouvianMethod(graphCompact* G,
+                             long* C,
+                             int nThreads,
+                             double Lower,
+                             double thresh,
+                             double* totTime,
+                             int* numItr,
+                             bool pruning,
+                             const long* M) {
+    return louvainMethod<graphCompact, edgeCompact>(G, C, nThreads, Lower, thresh, totTime, numItr, pruning, M);
+}
@@ -150,6 +150,10 @@ double algoLouvainWithDistOneColoring(graphNew* G,
         long Where = colorPtr[tc] + __sync_fetch_and_add(&(colorAdded[tc]), 1);
         colorIndex[Where] = i;
     }
+    // One neighbor-cluster accumulator per thread, reused for every vertex and allocated by its own thread
+    vector<ClusterAccumulator*> accumulators(omp_get_max_threads());
+#pragma omp parallel
+    { accumulators[omp_get_thread_num()] = new ClusterAccumulator(NV); }
     time2 = omp_get_wtime();
     printf("Time to initialize: %3.3lf\n", time2 - time1);
 #ifdef PRINT_DETAILED_STATS_
@@ -190,20 +194,16 @@ double algoLouvainWithDistOneColoring(graphNew* G,
                 long adj1 = vtxPtr[i];
                 long adj2 = vtxPtr[i + 1];
                 long selfLoop = 0;
-                // Build a datastructure to hold the cluster structure of its neighbors:
-                map<long, long> clusterLocalMap; // Map each neighbor's cluster to a local number
-                map<long, long>::iterator storedAlready;
-                vector<double> Counter; // Number of edges to each unique cluster
+                // The cluster structure of its neighbors:
+                ClusterAccumulator& acc = *accumulators[omp_get_thread_num()];
 
                 if (adj1 != adj2) {
                     // Add v's current cluster:
-                    clusterLocalMap[currCommAss[i]] = 0;
-                    Counter.push_back(0); // Initialize the counter to ZERO (no edges incident yet)
+                    acc.reset(currCommAss[i], adj2 - adj1);
                     // Find unique cluster ids and #of edges incident (eicj) to them
-                    selfLoop = buildLocalMapCounter(adj1, adj2, clusterLocalMap, Counter, vtxInd, currCommAss, i);
+                    selfLoop = buildLocalMapCounter(adj1, adj2, acc, vtxInd, currCommAss, i);
                     // Calculate the max
-                    localTarget = max(clusterLocalMap, Counter, selfLoop, cInfo, vDegree[i], currCommAss[i],
-                                      constantForSecondTerm);
+                    localTarget = max(acc, selfLoop, cInfo, vDegree[i], currCommAss[i], constantForSecondTerm);
                 } else {
                     localTarget = -1;
                 }
@@ -215,7 +215,6 @@ double algoLouvainWithDistOneColoring(graphNew* G,
                     __sync_fetch_and_sub(&cUpdate[currCommAss[i]].size, 1);
                 } // End of If()
                 currCommAss[i] = localTarget;
-                clusterLocalMap.clear();
             } // End of for(i)
 
 // UPDATE
@@ -295,6 +294,7 @@ double algoLouvainWithDistOneColoring(graphNew* G,
         "===================================\n");
 #endif
     // Cleanup:
+    for (size_t t = 0; t < accumulators.size(); t++) delete accumulators[t];
     free(vDegree);
     free(cInfo);
     free(cUpdate);
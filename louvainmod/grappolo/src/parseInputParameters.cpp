@@ -49,6 +49,7 @@ clustering_parameters::clustering_parameters()
       output(false),
       VF(false),
       coloring(false),
+      pruning(false),
       C_thresh(0.0001),
       minGraphSize(100000),
       threshold(0.000001) {}
@@ -77,6 +78,7 @@ void clustering_parameters::usage() {
     cout << "VF             : -v         -- default=false" << endl;
     cout << "Output         : -o         -- default=false" << endl;
     cout << "Coloring       : -c         -- default=false" << endl;
+    cout << "Pruning        : -p         -- default=false" << endl;
     cout << "--------------------------------------------------------------------"
             "------------------"
          << endl;
@@ -89,7 +91,7 @@ void clustering_parameters::usage() {
 } // end of usage()
 
 bool clustering_parameters::parse(int argc, char* argv[]) {
-    static const char* opt_string = "x:csvof:t:d:m:";
+    static const char* opt_string = "x:cpsvof:t:d:m:";
     int opt = getopt(argc, argv, opt_string);
     while (opt != -1) {
         switch (opt) {
@@ -99,6 +101,9 @@ bool clustering_parameters::parse(int argc, char* argv[]) {
             case 'c':
                 coloring = true;
                 break;
+            case 'p':
+                pruning = true;
+                break;
             case 's':
                 strongScaling = true;
                 break;
@@ -43,7 +43,8 @@
 
 using namespace std;
 
-void sumVertexDegree(edge* vtxInd, long* vtxPtr, long* vDegree, long NV, Comm* cInfo) {
+template <class EdgeT>
+void sumVertexDegree(EdgeT* vtxInd, long* vtxPtr, long* vDegree, long NV, Comm* cInfo) {
 #pragma omp parallel for
     for (long i = 0; i < NV; i++) {
         long adj1 = vtxPtr[i];     // Begining
@@ -58,6 +59,9 @@ void sumVertexDegree(edge* vtxInd, long* vtxPtr, long* vDegree, long NV, Comm* c
     }
 } // End of sumVertexDegree()
 
+template void sumVertexDegree(edge* vtxInd, long* vtxPtr, long* vDegree, long NV, Comm* cInfo);
+template void sumVertexDegree(edgeCompact* vtxInd, long* vtxPtr, long* vDegree, long NV, Comm* cInfo);
+
 double calConstantForSecondTerm(long* vDegree, long NV) {
     long totalEdgeWeightTwice = 0;
 #pragma omp parallel
@@ -149,3 +153,103 @@ long max(map<long, long>& clusterLocalMap,
 
     return maxIndex;
 } // End max()
+
+ClusterAccumulator::ClusterAccumulator(long numClusters) : tableBits(0) {
+    if (numClusters <= DenseLimit) slot.assign(numClusters, -1);
+}
+
+// Fibonacci hashing: the top tableBits bits of the product spread consecutive ids
+long ClusterAccumulator::hashSlot(long cluster) const {
+    return (long)(((unsigned long)cluster * 0x9E3779B97F4A7C15UL) >> (64 - tableBits));
+}
+
+void ClusterAccumulator::reset(long sc, long numEdges) {
+    if (!slot.empty()) {
+        for (long k = 0; k < (long)clusters.size(); k++) slot[clusters[k]] = -1;
+    } else {
+        for (long k = 0; k < (long)usedPos.size(); k++) tableKeys[usedPos[k]] = -1;
+        usedPos.clear();
+        // At most numEdges + 1 entries; keep the table at most half full
+        tableBits = 4;
+        while ((1L << tableBits) < 2 * (numEdges + 1)) tableBits++;
+        if ((long)tableKeys.size() < (1L << tableBits)) {
+            tableKeys.assign(1L << tableBits, -1);
+            tableVals.resize(1L << tableBits);
+        }
+    }
+    clusters.clear();
+    weights.clear();
+    add(sc, 0); // Initialize the counter to ZERO (no edges incident yet)
+} // End of reset()
+
+void ClusterAccumulator::add(long cluster, double weight) {
+    long* entry;
+    if (!slot.empty()) {
+        entry = &slot[cluster];
+    } else {
+        const long mask = (1L << tableBits) - 1;
+        long pos = hashSlot(cluster);
+        while (tableKeys[pos] != -1 && tableKeys[pos] != cluster) pos = (pos + 1) & mask;
+        if (tableKeys[pos] == -1) {
+            tableKeys[pos] = cluster;
+            tableVals[pos] = -1;
+            usedPos.push_back(pos);
+        }
+        entry = &tableVals[pos];
+    }
+    if (*entry >= 0) {
+        weights[*entry] += weight; // Increment the counter with weight
+    } else {
+        *entry = (long)clusters.size(); // Does not exist, add an entry
+        clusters.push_back(cluster);
+        weights.push_back(weight);
+    }
+} // End of add()
+
+template <class EdgeT>
+long buildLocalMapCounter(long adj1, long adj2, ClusterAccumulator& acc, EdgeT* vtxInd, long* currCommAss, long me) {
+    long selfLoop = 0;
+    for (long j = adj1; j < adj2; j++) {
+        if (vtxInd[j].tail == me) { // SelfLoop need to be recorded
+            selfLoop += (long)vtxInd[j].weight;
+        }
+        acc.add(currCommAss[vtxInd[j].tail], vtxInd[j].weight);
+    } // End of for(j)
+
+    return selfLoop;
+} // End of buildLocalMapCounter()
+
+template long buildLocalMapCounter(
+    long adj1, long adj2, ClusterAccumulator& acc, edge* vtxInd, long* currCommAss, long me);
+template long buildLocalMapCounter(
+    long adj1, long adj2, ClusterAccumulator& acc, edgeCompact* vtxInd, long* currCommAss, long me);
+
+// Visits the clusters in first-seen order rather than by id, but ties go to the
+// lowest cluster id either way, so the result is the same as the map version
+long max(ClusterAccumulator& acc, long selfLoop, Comm* cInfo, long degree, long sc, double constant) {
+    long maxIndex = sc; // Assign the initial value as self community
+    double curGain = 0;
+    double maxGain = 0;
+    double eix = acc.weights[0] - selfLoop;
+    double ax = cInfo[sc].degree - degree;
+    double eiy = 0;
+    double ay = 0;
+
+    for (long k = 1; k < acc.size(); k++) {
+        const long cluster = acc.clusters[k];
+        ay = cInfo[cluster].degree; // degree of cluster y
+        eiy = acc.weights[k];       // Total edges incident on cluster y
+        curGain = 2 * (eiy - eix) - 2 * degree * (ay - ax) * constant;
+
+        if ((curGain > maxGain) || ((curGain == maxGain) && (curGain != 0) && (cluster < maxIndex))) {
+            maxGain = curGain;
+            maxIndex = cluster;
+        }
+    }
+
+    if (cInfo[maxIndex].size == 1 && cInfo[sc].size == 1 && maxIndex > sc) { // Swap protection
+        maxIndex = sc;
+    }
+
+    return maxIndex;
+} // End max()
@@ -183,3 +183,38 @@ void displayGraphCharacteristics(graphNew* G) {
         printf("*******************************************\n");
     } // End of bipartite graphNew
 }
+
+graphCompact* compactGraph(graphNew* G) {
+    long NV = G->numVertices;
+    if (NV >= (1L << 32)) return 0;
+    long numEntries = G->edgeListPtrs[NV]; // Edges stored twice, self loops once
+    graphCompact* Gc = (graphCompact*)malloc(sizeof(graphCompact));
+    assert(Gc != 0);
+    Gc->numVertices = NV;
+    Gc->sVertices = G->sVertices;
+    Gc->numEdges = G->numEdges;
+    Gc->edgeListPtrs = (long*)malloc((NV + 1) * sizeof(long));
+    assert(Gc->edgeListPtrs != 0);
+    Gc->edgeList = (edgeCompact*)malloc(numEntries * sizeof(edgeCompact));
+    assert(Gc->edgeList != 0);
+#pragma omp parallel for
+    for (long i = 0; i <= NV; i++) Gc->edgeListPtrs[i] = G->edgeListPtrs[i];
+    long numRounded = 0;
+#pragma omp parallel for reduction(+ : numRounded)
+    for (long j = 0; j < numEntries; j++) {
+        Gc->edgeList[j].tail = (unsigned int)G->edgeList[j].tail;
+        Gc->edgeList[j].weight = (float)G->edgeList[j].weight;
+        if ((double)Gc->edgeList[j].weight != G->edgeList[j].weight) numRounded++;
+    }
+    if (numRounded > 0) { // The compact graph would not cluster exactly like G
+        freeCompactGraph(Gc);
+        return 0;
+    }
+    return Gc;
+} // End of compactGraph()
+
+void freeCompactGraph(graphCompact* Gc) {
+    free(Gc->edgeListPtrs);
+    free(Gc->edgeList);
+    free(Gc);
+}
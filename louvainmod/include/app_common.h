@@ -49,6 +49,7 @@ struct ToolOptions {
     char *nameWorkers[128];
     int max_level;
     int max_iter;
+    bool pruning;  // -pruning: CPU Louvain re-evaluates only vertices next to a community change
     
     ToolOptions(int argc, char **argv);
 };
@@ -33,7 +33,8 @@ void runLouvainWithFPGA_demo(graphNew* G,
         long   opts_minGraphSize,
         double opts_threshold,
         double opts_C_thresh,
-        int    numThreads);
+        int    numThreads,
+        bool   opts_pruning = false);
 
 //MD_NORMAL
 void runLouvainWithFPGA_demo_par_core(
@@ -59,6 +60,12 @@ void runLouvainWithFPGA_demo_par_core_prune(
 		double opts_threshold,
 		double opts_C_thresh,
 		int    numThreads);
+//MD_CPU: host threads only, no device
+void runLouvainWithCPU_par_core(
+		GLV*         pglv_orig,
+		GLV*         pglv_iter,
+		LouvainPara* para_lv,
+		int          numThreads);
 
 GLV* LouvainGLV_general(
 		bool hasGhost,
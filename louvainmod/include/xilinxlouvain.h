@@ -49,6 +49,9 @@ enum {
     LOUVAINMOD_RENUM_KERNEL = 3,
     LOUVAINMOD_2CU_U55C_KERNEL = 4,
     LOUVAINMOD_2CU_DDR_KERNEL = 5,
+    // no Alveo card: partitions, merge and final Louvain all run on host CPU threads and no device is opened.
+    // The library is still built and linked against XRT and XRM, which must be installed.
+    LOUVAINMOD_CPU_KERNEL = 6,
 };
 
 enum {
@@ -80,7 +83,7 @@ float loadAlveoAndComputeLouvain(
     char* alveoProject, unsigned mode_zmq, unsigned numPureWorker, 
     char* nameWorkers[128], unsigned int nodeID,  char* opts_outputFile, 
     unsigned int max_iter, unsigned int max_level, float tolerance, 
-    bool intermediateResult, bool verbose, bool final_Q, bool all_Q);
+    bool intermediateResult, bool verbose, bool final_Q, bool all_Q, bool pruning);
 
 XILINX_LOUVAINMOD_IMPL_DECL
 xilinx_apps::louvainmod::LouvainModImpl *xilinx_louvainmod_createImpl(const xilinx_apps::louvainmod::Options& options);
@@ -158,6 +161,7 @@ struct Options {
     XString clusterIpAddresses;  // space-separated list of server IP addresses in the cluster, or empty for 1 server
     XString hostIpAddress;  // IP address of this server, or empty for 1 server
     PartitionNameMode partitionNameMode = PartitionNameMode::Auto;  // format of partition names
+    bool pruning = false;  // CPU Louvain re-evaluates only vertices next to a community change
 };
 
 
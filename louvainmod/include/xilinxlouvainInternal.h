@@ -90,6 +90,24 @@ class graphNew {
     edge* edgeList;     /* end   vertex of edge, sorted, secondary key      */
 };
 
+// Compact graphNew for the CPU Louvain: the CSR row already gives the head, and vertex ids and weights are 32-bit
+// like the FPGA buffers, so an edge entry is 8 bytes instead of 24.  Only for graphs of fewer than 2^32 vertices
+// whose weights a float holds exactly, which rules out contracted graphs with weights above 2^24.
+// The CPU phase loop clusters on a per-phase copy to cut iteration bandwidth; the graphs it keeps stay graphNew.
+struct edgeCompact {
+    unsigned int tail;
+    float weight;
+};
+
+class graphCompact {
+   public:
+    long numVertices;       /* Number of columns                                */
+    long sVertices;         /* Number of rows: Bipartite graph: number of S vertices; T = N - S */
+    long numEdges;          /* Each edge stored twice, but counted once        */
+    long* edgeListPtrs;     /* start of each vertex's edges in edgeList        */
+    edgeCompact* edgeList;  /* tail and weight of each edge, grouped by head   */
+};
+
 struct TimeLv{
 	int parNo;
 	int phase;
@@ -440,6 +458,7 @@ int host_ParserParameters(int argc,
                           bool& opts_coloring,     //
                           bool& opts_output,       //;
                           bool& opts_VF,           //;
+                          bool& opts_pruning,      //; //Re-evaluate only vertices next to a change
                           char* opts_xclbinPath);
 
 graphNew* host_PrepareGraph(int opts_ftype, char* opts_inFile, bool opts_VF);
@@ -453,7 +472,8 @@ void runLouvainWithFPGA(graphNew* G,  // Input graph, undirectioned
                         long opts_minGraphSize,
                         double opts_threshold,
                         double opts_C_thresh,
-                        int numThreads);
+                        int numThreads,
+                        bool opts_pruning = false); // CPU phases re-evaluate only vertices next to a change
 
 long renumberClustersContiguously_ghost(long *C, long size, long NV_l);
 
@@ -589,6 +609,7 @@ struct LouvainPara{
     int    numThreads; //Number of threads
     int    max_num_level;
     int    max_num_iter;
+    bool   opts_pruning; //CPU Louvain re-evaluates only vertices next to a community change
 };
 
 #endif
@@ -14,7 +14,9 @@
  * limitations under the License.
 */
 #include <thread>
+#include <atomic>
 #include <chrono>
+#include <vector>
 
 #include "defs.h"
 #include "ParLV.h"
@@ -955,7 +957,8 @@ int host_ParserParameters(int argc,
                           int& nodeID,
 						  int& numNodes,
 						  int& max_num_level,
-						  int& max_num_iter
+						  int& max_num_iter,
+						  bool& opts_pruning
                           ) 
 {
     const int max_parameter = 100;
@@ -969,6 +972,7 @@ int host_ParserParameters(int argc,
     int has_opts_coloring = general_findPara(argc, argv, "-c");
     int has_opts_output = general_findPara(argc, argv, "-o");
     int has_opts_VF = general_findPara(argc, argv, "-v");
+    int has_opts_pruning = general_findPara(argc, argv, "-pruning");
     int hasXclbinPath = general_findPara(argc, argv, "-x");
     int hasDeviceNames = general_findPara(argc, argv, "-devices");
     int has_numThread = general_findPara(argc, argv, "-thread");
@@ -1115,6 +1119,14 @@ int host_ParserParameters(int argc,
 #ifdef PRINTINFO
     printf("PARAMETER  opts_VF = %d\n", opts_VF);
 #endif
+    opts_pruning = false;
+    if (has_opts_pruning != -1) {
+        rec[has_opts_pruning] = true;
+        opts_pruning = true;
+    }
+#ifdef PRINTINFO
+    printf("PARAMETER  opts_pruning = %d\n", opts_pruning);
+#endif
 
     if (hasXclbinPath != -1 && hasXclbinPath < (argc - 1)) {
         rec[hasXclbinPath] = true;
@@ -1281,7 +1293,7 @@ ToolOptions::ToolOptions(int argcIn, char** argvIn) {
         opts_coloring, opts_output, outputFile, opts_VF, xclbinPath, deviceNames, 
         numThreads, numPars, gh_par, kernelMode, numDevices, modeZmq, path_zmq, 
         useCmd, mode_alveo, nameProj, alveoProject, numPureWorker, nameWorkers, 
-        nodeId, numNodes, max_level, max_iter);
+        nodeId, numNodes, max_level, max_iter, pruning);
 }
 
 void PrintTimeRpt(GLV* glv, int num_dev, bool isHead) {
@@ -2723,6 +2735,45 @@ GLV* L3_LouvainGLV_general(int& id_glv,
     return glv_iter;
 }
 
+// LOUVAINMOD_CPU_KERNEL: each thread takes the next partition off a shared counter until none are left, so a few
+// large partitions do not hold up the rest of the threads.
+static void SubLouvain_cpu_thread(ParLV* parlv, GLV** glv, std::atomic<int>* nextPar, LouvainPara* para_lv,
+                                  int numThreads)
+{
+    for (int p = (*nextPar)++; p < parlv->num_par; p = (*nextPar)++) {
+        parlv->timesPar.timeLv[p] = getTime();
+        runLouvainWithCPU_par_core(parlv->par_src[p], glv[p], para_lv, numThreads);
+        parlv->timesPar.timeLv[p] = getTime() - parlv->timesPar.timeLv[p];
+    }
+}
+
+// Splits para_lv->numThreads host threads into one worker per partition (at most), each running the OpenMP
+// Louvain of its partitions with an equal share of the threads.
+static void Server_SubLouvain_cpu(ParLV& parlv, GLV** glv, LouvainPara* para_lv)
+{
+    int numCores = (para_lv->numThreads > 0) ? para_lv->numThreads : 1;
+    int numWorkers = (parlv.num_par < numCores) ? parlv.num_par : numCores;
+    if (numWorkers < 1)
+        return;
+    int threadsPerPar = numCores / numWorkers;
+    printf("INFO: Running %d partitions on %d CPU workers with %d threads each\n", parlv.num_par, numWorkers,
+           threadsPerPar);
+
+    std::atomic<int> nextPar(0);
+    std::vector<std::thread> td;
+    for (int w = 0; w < numWorkers; w++)
+        td.push_back(std::thread(SubLouvain_cpu_thread, &parlv, glv, &nextPar, para_lv, threadsPerPar));
+    for (int w = 0; w < numWorkers; w++)
+        td[w].join();
+
+    for (int p = 0; p < parlv.num_par; p++) {
+        parlv.par_lved[p] = glv[p];
+        char tmp_name[1024];
+        strcpy(tmp_name, parlv.par_src[p]->name);
+        parlv.par_lved[p]->SetName(strcat(tmp_name, "_wrk_lv"));
+    }
+}
+
 /*
 
 */
@@ -2744,6 +2795,12 @@ void Server_SubLouvain(std::shared_ptr<xf::graph::L3::Handle>& handle0,
     for (int p = 0; p < parlv.num_par; p++) {
         glv[p] = parlv.par_src[p]->CloneSelf(id_glv);
     }
+    if (parlv.kernelMode == LOUVAINMOD_CPU_KERNEL) {
+        Server_SubLouvain_cpu(parlv, glv, para_lv);
+        parlv.st_ParLved = true;
+        parlv.timesPar.timeLv_all = getTime() - parlv.timesPar.timeLv_all;
+        return;
+    }
     int cuPerBoard = handle0->oplouvainmod->cuPerBoardLouvainModularity;
     int parCnt = 0;
     while (parCnt < parlv.num_par) {
@@ -2964,6 +3021,15 @@ GLV* Driver_Merge_Final_LoacalPar(std::shared_ptr<xf::graph::L3::Handle>& handle
 #endif
 
     GLV* glv_final = parlv.plv_merged;//->CloneSelf(id_glv);
+    if (parlv.kernelMode == LOUVAINMOD_CPU_KERNEL) {
+        // On the host the final Louvain of the merged graph is cheap next to the partitions, so run it.
+        // The phases work on a copy; the communities, Q and NC end up in plv_merged.
+        GLV* glv_iter = parlv.plv_merged->CloneSelf(id_glv);
+        assert(glv_iter);
+        glv_iter->SetName_lv(glv_iter->ID, parlv.plv_merged->ID);
+        runLouvainWithCPU_par_core(parlv.plv_merged, glv_iter, para_lv, para_lv->numThreads);
+        delete glv_iter;
+    }
 #ifdef PRINTINFO_2
     printf("\033[1;37;40mINFO: Now doing BackAnnotationg... \033[0m\n");
 #endif
@@ -4655,7 +4721,7 @@ int compute_louvain_alveo_seperated_load(
 extern "C" float compute_louvain_alveo_seperated_compute(
     int mode_zmq, int numPureWorker, char* nameWorkers[128], unsigned int nodeID,
     char* opts_outputFile, unsigned int max_iter, unsigned int max_level, 
-    float tolerance, bool intermediateResult, bool verbose, bool final_Q, bool all_Q, 
+    float tolerance, bool intermediateResult, bool verbose, bool final_Q, bool all_Q, bool pruning,
     std::shared_ptr<xf::graph::L3::Handle>& handle0, ParLV* p_parlv_dvr, ParLV* p_parlv_wkr)
 {
 #ifndef NDEBUG
@@ -4670,7 +4736,8 @@ extern "C" float compute_louvain_alveo_seperated_compute(
     printf("\n    intermediateResult=%d", intermediateResult);
     printf("\n    verbose=%d", verbose);
     printf("\n    final_Q=%d", final_Q);
-    printf("\n    all_Q=%d\n", all_Q);
+    printf("\n    all_Q=%d", all_Q);
+    printf("\n    pruning=%d\n", pruning);
 
     for (int i=0; i<numPureWorker; i++)
         std::cout << "DEBUG: nameWorker " << i << "=" << nameWorkers[i] << std::endl;
@@ -4683,6 +4750,8 @@ extern "C" float compute_louvain_alveo_seperated_compute(
     double opts_threshold = 0.000001;  // Value of threshold
     int numThreads = 16;
     int numNode = numPureWorker + 1;
+    if (p_parlv_wkr->kernelMode == LOUVAINMOD_CPU_KERNEL && std::thread::hardware_concurrency() > 0)
+        numThreads = std::thread::hardware_concurrency();  // all cores of this server go to the Louvain
 
     LouvainPara* para_lv = new(LouvainPara);
     para_lv->opts_coloring = true;
@@ -4692,6 +4761,7 @@ extern "C" float compute_louvain_alveo_seperated_compute(
     para_lv->numThreads = numThreads;
     para_lv->max_num_level = max_level;
     para_lv->max_num_iter = max_iter;
+    para_lv->opts_pruning = pruning;
 
     if (mode_alveo == ALVEOAPI_RUN) {
         if (mode_zmq == ZMQ_DRIVER) {
@@ -4855,7 +4925,7 @@ extern "C" float loadAlveoAndComputeLouvain(
     char* xclbinPath, int kernelMode, unsigned int numDevices, std::string shortDeviceNames,
     char* alveoProject, unsigned mode_zmq, unsigned numPureWorker, char* nameWorkers[128], 
     unsigned int nodeID, char* opts_outputFile, unsigned int max_iter, unsigned int max_level, 
-    float tolerance, bool intermediateResult, bool verbose, bool final_Q, bool all_Q) 
+    float tolerance, bool intermediateResult, bool verbose, bool final_Q, bool all_Q, bool pruning) 
 {
 
     ParLV parlv_drv, parlv_wkr;
@@ -4892,12 +4962,16 @@ extern "C" float loadAlveoAndComputeLouvain(
         deviceNames = "xilinx_u250_gen3x16_xdma_shell_2_1";
     }
 
-    int status = createSharedHandle(xclbinPath, kernelMode, numDevices, deviceNames, opts_coloring,
-                                    opts_minGraphSize, opts_C_thresh, numThreads);
-    if (status < 0)
-        return status;
+    // The CPU kernel mode runs every step on host threads and needs no handle
+    std::shared_ptr<xf::graph::L3::Handle> handle0;
+    if (kernelMode != LOUVAINMOD_CPU_KERNEL) {
+        int status = createSharedHandle(xclbinPath, kernelMode, numDevices, deviceNames, opts_coloring,
+                                        opts_minGraphSize, opts_C_thresh, numThreads);
+        if (status < 0)
+            return status;
 
-    std::shared_ptr<xf::graph::L3::Handle> handle0 = sharedHandlesLouvainMod::instance().handlesMap[0];
+        handle0 = sharedHandlesLouvainMod::instance().handlesMap[0];
+    }
     ret = compute_louvain_alveo_seperated_load(
             kernelMode, numDevices, numPartitions, alveoProject,
             mode_zmq, numPureWorker, nameWorkers, nodeID, tolerance, verbose, handle0, 
@@ -4910,7 +4984,7 @@ extern "C" float loadAlveoAndComputeLouvain(
     ret = compute_louvain_alveo_seperated_compute(
         mode_zmq, numPureWorker, nameWorkers, nodeID, 
         opts_outputFile, max_iter, max_level, tolerance, intermediateResult,
-        verbose, final_Q, all_Q, handle0, &parlv_drv, &parlv_wkr);
+        verbose, final_Q, all_Q, pruning, handle0, &parlv_drv, &parlv_wkr);
 
 
 	return ret;
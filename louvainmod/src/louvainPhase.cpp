@@ -613,6 +613,31 @@ void UsingFPGA_MapHostClBuff(
     PhaseLoop_MapClBuff ( NV, NE_mem_1, NE_mem_2, mext_in, context, buff_cl);
 }
 
+//Clusters on a compact copy of G (32-bit ids, float weights, no head field) when compactGraph() accepts G, which
+//cuts the edge traffic of every iteration to a third; the partition and modularity are the same as on G.
+//This trades memory for bandwidth: the copy lives next to G for the phase, adding 8 bytes per edge entry.
+static double ParallelLouvain_CPU(
+		graphNew*   G,
+		long*       C,
+		int         numThreads,
+		double      currMod,
+		double      opts_threshold,
+		double*     tmpTime,
+		int*        tmpItr,
+		bool        opts_pruning,
+		const long* M)
+{
+	graphCompact* Gc = compactGraph(G);
+	if (Gc == 0) {
+		printf("INFO: CPU Louvain on the 64-bit graph: %ld vertices or a weight a float would round\n",
+				G->numVertices);
+		return parallelLouvianMethod(G, C, numThreads, currMod, opts_threshold, tmpTime, tmpItr, opts_pruning, M);
+	}
+	currMod = parallelLouvianMethod(Gc, C, numThreads, currMod, opts_threshold, tmpTime, tmpItr, opts_pruning, M);
+	freeCompactGraph(Gc);
+	return currMod;
+}
+
 int PhaseLoop_UsingCPU(
 		double opts_threshold,
 		int    numThreads,
@@ -622,12 +647,13 @@ int PhaseLoop_UsingCPU(
 		long*  &C_orig,
 		int    &totItr,
 		bool   &nonColor,
-		double &totTimeClustering
+		double &totTimeClustering,
+		bool   opts_pruning
 		)
 {
 	double tmpTime;
 	int tmpItr = 0;
-    currMod = parallelLouvianMethod(G, C, numThreads, currMod, opts_threshold, &tmpTime, &tmpItr);
+    currMod = ParallelLouvain_CPU(G, C, numThreads, currMod, opts_threshold, &tmpTime, &tmpItr, opts_pruning, 0);
     totTimeClustering += tmpTime;
     totItr += tmpItr;
     nonColor = true;
@@ -1155,7 +1181,8 @@ void runLouvainWithFPGA(graphNew* G,                 //Input graphNew, undirecti
                         long   opts_minGraphSize,
                         double opts_threshold,
                         double opts_C_thresh,
-                        int    numThreads)
+                        int    numThreads,
+                        bool   opts_pruning)
 {
     long NV          = G->numVertices;
     long NE_org      = G->numEdges;
@@ -1231,7 +1258,7 @@ void runLouvainWithFPGA(graphNew* G,                 //Input graphNew, undirecti
         } else {
             PhaseLoop_UsingCPU(
             		opts_threshold, numThreads, currMod, G, C, C_orig, totItr,
-					nonColor, totTimeClustering);
+					nonColor, totTimeClustering, opts_pruning);
         }
         /* General post-processing for both FPGA and CPU */
         isItrStop = PhaseLoop_CommPostProcessing(NV, numThreads, opts_threshold, opts_coloring, prevMod, currMod,
@@ -1278,7 +1305,8 @@ void runLouvainWithFPGA_demo(graphNew* G,
                         long   opts_minGraphSize,
                         double opts_threshold,
                         double opts_C_thresh,
-                        int    numThreads)
+                        int    numThreads,
+                        bool   opts_pruning)
 {
     long NV          = G->numVertices;
     long NE_org      = G->numEdges;
@@ -1367,7 +1395,7 @@ void runLouvainWithFPGA_demo(graphNew* G,
         } else {
             PhaseLoop_UsingCPU(
             		opts_threshold, numThreads, currMod, G, C, C_orig, totItr,
-					nonColor, totTimeClustering);
+					nonColor, totTimeClustering, opts_pruning);
         }
         isItrStop = PhaseLoop_CommPostProcessing(NV, numThreads, opts_threshold, opts_coloring, prevMod, currMod,
           		G, C, C_orig, nonColor, phase, totItr, numClusters,  totTimeBuildingPhase );
@@ -2502,6 +2530,64 @@ void runLouvainWithFPGA_demo_par_core_prune(
     printf("TOTAL PostPost                 : %lf = %lf + %lf\n",timePostPost, timePostPost_feature, timePostPost - timePostPost_feature);//eachTimePhase
 } // End of runM
 
+//MD_CPU: the phase loop of runLouvainWithFPGA_demo_par_core_prune with grappolo's parallel Louvain in place of the
+//kernel. Ghost vertices (M<0) stay in their own community as in the kernel, so the ghost-aware post-processing and
+//the partition merge work on the result unchanged.
+void runLouvainWithCPU_par_core(
+		GLV*         pglv_orig,
+		GLV*         pglv_iter,
+		LouvainPara* para_lv,
+		int          numThreads)
+{
+    double totTimeClustering    = 0; //time accumulator for clustering by CPU
+    double totTimeBuildingPhase = 0; //time accumulator for Building new graphNew for next phase by CPU
+    double prevMod   = -1;    // Last-phase modularity
+    double currMod   = -1;    // Current modularity
+    long numClusters = pglv_iter->NV;
+
+    int phase        = 1;     // Total phase counter
+    int totItr       = 0;     // Total iteration counter
+    bool nonColor    = false;
+    bool isItrStop   = false;
+    double totTimeAll = omp_get_wtime();
+
+    while ( !isItrStop ) {
+        double tmpTime;
+        int tmpItr = 0;
+        currMod = ParallelLouvain_CPU(pglv_iter->G, pglv_iter->C, numThreads, currMod, para_lv->opts_C_thresh,
+                                      &tmpTime, &tmpItr, para_lv->opts_pruning, pglv_iter->M);
+        totTimeClustering += tmpTime;
+        totItr += tmpItr;
+        PhaseLoop_CommPostProcessing_par(pglv_orig, pglv_iter, numThreads, para_lv->opts_threshold, false,
+        		nonColor, phase, totItr, numClusters, totTimeBuildingPhase);
+        pglv_orig->NC = numClusters;
+        pglv_iter->NC = numClusters;
+        pglv_orig->Q = currMod;
+        pglv_iter->Q = currMod;
+    	if ((phase > MAX_NUM_PHASE) || (totItr > MAX_NUM_TOTITR)) {
+    		isItrStop = true;// Break if too many phases or iterations
+    	}else if ((para_lv->max_num_level > 0 && phase >= para_lv->max_num_level) ||
+    			  (para_lv->max_num_iter > 0 && totItr >= para_lv->max_num_iter)) {
+    		isItrStop = true;
+    	}else if ((currMod - prevMod) <= para_lv->opts_threshold) {
+    		isItrStop = true;
+    	}else if( pglv_iter->NV <= para_lv->opts_minGraphSize) {
+    		isItrStop = true;
+    	}else{
+			phase++;
+    	}
+    	prevMod = currMod;
+    } // End of while(1) = End of Louvain
+    totTimeAll = omp_get_wtime() -totTimeAll;
+
+    printf("INFO: CPU Louvain on %s: %d phases, %d iterations, %ld clusters, Q=%lf\n"
+    		"INFO: CPU Louvain time %lf = %lf(clustering) + %lf(building) + %lf\n",
+    		pglv_orig->name, phase, totItr, numClusters, currMod, totTimeAll, totTimeClustering, totTimeBuildingPhase,
+			totTimeAll - totTimeClustering - totTimeBuildingPhase);
+    pglv_orig->PushFeature(phase, totItr, totTimeAll, false);
+    pglv_iter->PushFeature(phase, totItr, totTimeAll, false);
+} // End of runLouvainWithCPU_par_core
+
 
 GLV* LouvainGLV_general(bool hasGhost, int mode_flow, int id_dev, GLV* glv_src, char* xclbinPath, int numThreads, int& id_glv, long minGraphSize, double threshold, double C_threshold, bool isParallel, int numPhase){
 	double time1 = omp_get_wtime();
@@ -100,9 +100,9 @@ public:
     {
         int kernelMode = globalOpts.kernelMode;
 
-        if (kernelMode < 2 || kernelMode > 5) {
+        if (kernelMode < 2 || kernelMode > 6) {
             std::ostringstream oss;
-            oss << "Invalid kernelMode value " << kernelMode << ". The supported values are 2, 3, 4, and 5.";
+            oss << "Invalid kernelMode value " << kernelMode << ". The supported values are 2, 3, 4, 5, and 6 (CPU).";
             throw Exception(oss.str());
         }
         
@@ -472,9 +472,9 @@ float LouvainMod::loadAlveoAndComputeLouvain(const ComputeOptions &computeOpts)
 #endif    
 
     int kernelMode = pImpl_->options_.kernelMode;
-    if (kernelMode < 2 || kernelMode > 5) {
+    if (kernelMode < 2 || kernelMode > 6) {
         std::ostringstream oss;
-        oss << "Invalid kernelMode value " << kernelMode << ". The supported values are 2, 3, 4, and 5.";
+        oss << "Invalid kernelMode value " << kernelMode << ". The supported values are 2, 3, 4, 5, and 6 (CPU).";
         throw Exception(oss.str());
     }
 
@@ -498,7 +498,8 @@ float LouvainMod::loadAlveoAndComputeLouvain(const ComputeOptions &computeOpts)
                 (char *)(computeOpts.outputFile.c_str()), 
                 computeOpts.max_iter, computeOpts.max_level, 
                 computeOpts.tolerance, computeOpts.intermediateResult, 
-                pImpl_->options_.verbose, computeOpts.final_Q, computeOpts.all_Q);
+                pImpl_->options_.verbose, computeOpts.final_Q, computeOpts.all_Q,
+                pImpl_->options_.pruning);
                 //,computeOpts.LBW_partition); 
 
 #ifndef NDEBUG  
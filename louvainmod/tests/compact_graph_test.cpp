@@ -0,0 +1,112 @@
+/*
+ * File:   compact_graph_test.cpp
+ *
+ * Runs the phases of the CPU Louvain on a graphNew and on its graphCompact copy and checks that both give the same
+ * partition and modularity in every phase, with and without pruning.
+ */
+
+#include "defs.h"
+#include "islands.h"
+#include <vector>
+#include <iostream>
+
+static graphNew* buildGraph(const std::vector<std::vector<std::pair<long, double> > >& adj) {
+    long NV = adj.size();
+    long numEntries = 0;
+    for (long v = 0; v < NV; v++) numEntries += adj[v].size();
+    graphNew* G = (graphNew*)malloc(sizeof(graphNew));
+    G->numVertices = NV;
+    G->sVertices = NV;
+    G->numEdges = numEntries / 2;
+    G->edgeListPtrs = (long*)malloc((NV + 1) * sizeof(long));
+    G->edgeList = (edge*)malloc(numEntries * sizeof(edge));
+    long e = 0;
+    G->edgeListPtrs[0] = 0;
+    for (long v = 0; v < NV; v++) {
+        for (size_t j = 0; j < adj[v].size(); j++) G->edgeList[e++] = edge(v, adj[v][j].first, adj[v][j].second);
+        G->edgeListPtrs[v + 1] = e;
+    }
+    return G;
+}
+
+static void freeGraph(graphNew* G) {
+    free(G->edgeListPtrs);
+    free(G->edgeList);
+    free(G);
+}
+
+// Returns the number of phases whose partition or modularity differs between the two representations
+static int comparePhases(graphNew* G, bool pruning) {
+    const double threshold = 0.000001;
+    int numMismatches = 0;
+    double prevMod = -1;
+    double currMod = -1;
+    for (int phase = 1; phase <= 20; phase++) {
+        long NV = G->numVertices;
+        std::vector<long> C(NV), Ccompact(NV);
+        double tmpTime;
+        int tmpItr;
+        double mod = parallelLouvianMethod(G, C.data(), 1, currMod, threshold, &tmpTime, &tmpItr, pruning);
+        graphCompact* Gc = compactGraph(G);
+        if (Gc == 0) {
+            std::cout << "ERROR: phase " << phase << " graph could not be compacted" << std::endl;
+            return numMismatches + 1;
+        }
+        double modCompact =
+            parallelLouvianMethod(Gc, Ccompact.data(), 1, currMod, threshold, &tmpTime, &tmpItr, pruning);
+        freeCompactGraph(Gc);
+        if (mod != modCompact || C != Ccompact) {
+            std::cout << "ERROR: phase " << phase << " pruning=" << pruning << " Q=" << mod
+                      << " compact Q=" << modCompact << std::endl;
+            numMismatches++;
+        }
+        currMod = mod;
+        if (currMod - prevMod <= threshold) break;
+        prevMod = currMod;
+
+        long numClusters = renumberClustersContiguously(C.data(), NV);
+        graphNew* Gnext = (graphNew*)malloc(sizeof(graphNew));
+        buildNextLevelGraphOpt(G, Gnext, C.data(), numClusters, 1);
+        freeGraph(G);
+        G = Gnext;
+    }
+    std::cout << "pruning=" << pruning << " final Q=" << currMod << std::endl;
+    freeGraph(G);
+    return numMismatches;
+}
+
+int main(int argc, char** argv) {
+    Islands::Options options;
+    options.communitySize_ = 10;
+    options.numLevels_ = 4;
+    options.internalConnectionProbability_ = 0.5;
+    options.numEdgesPerConnection_ = 2;
+    options.firstVertexId_ = 0;
+    Islands islands(options);
+    Islands::VertexId numVertices = 0;
+    Islands::EdgeIndex numEdges = 0;
+    islands.getGraphSize(numVertices, numEdges);
+
+    std::vector<std::vector<std::pair<long, double> > > adj(numVertices);
+    islands.generate([&adj](const Islands::Edge& edge) -> bool {
+        adj[edge.src_].push_back(std::make_pair(long(edge.dest_), edge.weight_));
+        adj[edge.dest_].push_back(std::make_pair(long(edge.src_), edge.weight_));
+        return true;
+    });
+
+    int numMismatches = comparePhases(buildGraph(adj), false) + comparePhases(buildGraph(adj), true);
+
+    // A weight that a float rounds keeps the clustering on the 64-bit graph
+    adj[0][0].second = 0.1;
+    graphNew* G = buildGraph(adj);
+    graphCompact* Gc = compactGraph(G);
+    if (Gc != 0) {
+        std::cout << "ERROR: graph with a 0.1 weight was compacted" << std::endl;
+        freeCompactGraph(Gc);
+        numMismatches++;
+    }
+    freeGraph(G);
+
+    std::cout << (numMismatches == 0 ? "PASS" : "FAIL") << std::endl;
+    return numMismatches == 0 ? 0 : 1;
+}
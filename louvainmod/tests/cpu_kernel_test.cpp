@@ -0,0 +1,192 @@
+/*
+ * File:   cpu_kernel_test.cpp
+ *
+ * Partitions a small Islands graph, runs the whole LouvainMod flow with LOUVAINMOD_CPU_KERNEL and checks the
+ * modularity and the communities against grappolo's Louvain on the whole graph.  No Alveo card is used, but the
+ * library it links with needs the XRT and XRM shared libraries.
+ *
+ * Usage: cpu_kernel_test [outputDir]
+ */
+
+#include "xilinxlouvain.h"
+#include "defs.h"
+#include "islands.h"
+#include <vector>
+#include <map>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <cmath>
+#include <sys/stat.h>
+
+using namespace xilinx_apps::louvainmod;
+
+// Modularity of the community assignment C on G
+static double computeModularity(graphNew* G, const std::vector<long>& C) {
+    std::map<long, double> totalWeight, internalWeight;
+    double sumWeight = 0;
+    for (long v = 0; v < G->numVertices; v++) {
+        for (long e = G->edgeListPtrs[v]; e < G->edgeListPtrs[v + 1]; e++) {
+            double w = G->edgeList[e].weight;
+            sumWeight += w;
+            totalWeight[C[v]] += w;
+            if (C[v] == C[G->edgeList[e].tail]) internalWeight[C[v]] += w;
+        }
+    }
+    double Q = 0;
+    for (auto it = totalWeight.begin(); it != totalWeight.end(); ++it)
+        Q += internalWeight[it->first] / sumWeight - (it->second / sumWeight) * (it->second / sumWeight);
+    return Q;
+}
+
+// Reference: the phases of grappolo's Louvain on the whole graph, without partitions
+static std::vector<long> louvainWholeGraph(graphNew* G) {
+    const double threshold = 0.000001;
+    long NV = G->numVertices;
+    std::vector<long> C_orig(NV);
+    for (long v = 0; v < NV; v++) C_orig[v] = v;
+    double prevMod = -1;
+    double currMod = -1;
+    graphNew* Gphase = G;
+    while (true) {
+        std::vector<long> C(Gphase->numVertices);
+        double tmpTime;
+        int tmpItr;
+        currMod = parallelLouvianMethod(Gphase, C.data(), 1, currMod, 0.0001, &tmpTime, &tmpItr);
+        long numClusters = renumberClustersContiguously(C.data(), Gphase->numVertices);
+        for (long v = 0; v < NV; v++) C_orig[v] = C[C_orig[v]];
+        graphNew* Gnext = (graphNew*)malloc(sizeof(graphNew));
+        buildNextLevelGraphOpt(Gphase, Gnext, C.data(), numClusters, 1);
+        if (Gphase != G) {
+            free(Gphase->edgeListPtrs);
+            free(Gphase->edgeList);
+            free(Gphase);
+        }
+        Gphase = Gnext;
+        if (currMod - prevMod <= threshold) break;
+        prevMod = currMod;
+    }
+    free(Gphase->edgeListPtrs);
+    free(Gphase->edgeList);
+    free(Gphase);
+    return C_orig;
+}
+
+// Fraction of the edges of G whose two ends are together in A exactly when they are together in B
+static double edgeAgreement(graphNew* G, const std::vector<long>& A, const std::vector<long>& B) {
+    long numEntries = G->edgeListPtrs[G->numVertices];
+    long numAgree = 0;
+    for (long v = 0; v < G->numVertices; v++) {
+        for (long e = G->edgeListPtrs[v]; e < G->edgeListPtrs[v + 1]; e++) {
+            long t = G->edgeList[e].tail;
+            if ((A[v] == A[t]) == (B[v] == B[t])) numAgree++;
+        }
+    }
+    return (double)numAgree / numEntries;
+}
+
+int main(int argc, char** argv) {
+    const std::string outDir = (argc > 1) ? argv[1] : "cpu_kernel_test-out";
+    const std::string graphFile = outDir + "/islands.mtx";
+    const std::string projName = outDir + "/islands";
+    const std::string communityFile = outDir + "/islands.communities";
+    mkdir(outDir.c_str(), 0755);
+
+    // Write a graph of nested communities in the Pajek .mtx format read by partitionDataFile
+    Islands::Options islandsOptions;
+    islandsOptions.communitySize_ = 10;
+    islandsOptions.numLevels_ = 3;
+    islandsOptions.internalConnectionProbability_ = 0.5;
+    islandsOptions.numEdgesPerConnection_ = 2;
+    Islands islands(islandsOptions);
+    Islands::VertexId numVertices = 0;
+    Islands::EdgeIndex numEdges = 0;
+    islands.getGraphSize(numVertices, numEdges);
+    std::vector<Islands::Edge> edges;
+    islands.generate([&edges](const Islands::Edge& edge) -> bool {
+        edges.push_back(edge);
+        return true;
+    });
+    {
+        std::ofstream out(graphFile.c_str());
+        out << "*Vertices " << numVertices << "\n*Edges " << edges.size() << "\n";
+        for (size_t i = 0; i < edges.size(); i++)
+            out << edges[i].src_ << ' ' << edges[i].dest_ << ' ' << edges[i].weight_ << '\n';
+    }
+
+    Options options;
+    options.kernelMode = LOUVAINMOD_CPU_KERNEL;
+    options.nameProj = projName;
+    options.alveoProject = projName + ".par.proj";
+    options.hostName = "localhost";
+    options.hostIpAddress = "127.0.0.1";
+    options.clusterIpAddresses = "127.0.0.1";
+    {
+        LouvainMod louvainMod(options);
+        LouvainMod::PartitionOptions partOpts;
+        partOpts.LBW_partition = false;
+        partOpts.numPars = 4;
+        partOpts.par_prune = 1;
+        louvainMod.partitionDataFile(graphFile.c_str(), partOpts);
+    }
+    float finalQ;
+    {
+        LouvainMod louvainMod(options);
+        LouvainMod::ComputeOptions computeOpts;
+        computeOpts.outputFile = communityFile;
+        computeOpts.max_iter = 100;
+        computeOpts.max_level = 100;
+        computeOpts.tolerance = 0.0001;
+        computeOpts.intermediateResult = false;
+        computeOpts.final_Q = true;
+        computeOpts.all_Q = false;
+        finalQ = louvainMod.loadAlveoAndComputeLouvain(computeOpts);
+    }
+    if (finalQ < -1) {
+        std::cout << "ERROR: loadAlveoAndComputeLouvain returned error code " << finalQ << std::endl;
+        return 1;
+    }
+
+    graphNew* G = host_PrepareGraph(3, const_cast<char*>(graphFile.c_str()), false);
+    std::vector<long> C(G->numVertices, -1);
+    {
+        std::ifstream in((communityFile + ".clustInfo").c_str());
+        long v, c;
+        while (in >> v >> c)
+            if (v >= 0 && v < G->numVertices) C[v] = c;
+    }
+    int numErrors = 0;
+    for (long v = 0; v < G->numVertices; v++) {
+        if (C[v] < 0) {
+            std::cout << "ERROR: vertex " << v << " has no community" << std::endl;
+            numErrors++;
+            break;
+        }
+    }
+    if (numErrors == 0) {
+        std::vector<long> C_ref = louvainWholeGraph(G);
+        double Q = computeModularity(G, C);
+        double Q_ref = computeModularity(G, C_ref);
+        double agreement = edgeAgreement(G, C, C_ref);
+        std::cout << "Partitioned flow Q=" << finalQ << " (" << Q << " on the input graph), whole graph Q=" << Q_ref
+                  << ", edge agreement=" << agreement << std::endl;
+        if (std::fabs(Q - finalQ) > 0.02) {
+            std::cout << "ERROR: reported Q differs from the Q of the communities written out" << std::endl;
+            numErrors++;
+        }
+        if (Q < Q_ref - 0.02) {
+            std::cout << "ERROR: partitioned flow Q is below the whole graph Q" << std::endl;
+            numErrors++;
+        }
+        if (agreement < 0.9) {
+            std::cout << "ERROR: partitioned and whole graph communities disagree" << std::endl;
+            numErrors++;
+        }
+    }
+    free(G->edgeListPtrs);
+    free(G->edgeList);
+    free(G);
+
+    std::cout << (numErrors == 0 ? "PASS" : "FAIL") << std::endl;
+    return numErrors == 0 ? 0 : 1;
+}
@@ -48,7 +48,8 @@ PYBIND11_MODULE (xilLouvainmod, pc) {
     .def_readwrite("nodeId", &Options::nodeId)
     .def_readwrite("hostName", &Options::hostName)
     .def_readwrite("hostIpAddress", &Options::hostIpAddress)
-    .def_readwrite("clusterIpAddresses", &Options::clusterIpAddresses);
+    .def_readwrite("clusterIpAddresses", &Options::clusterIpAddresses)
+    .def_readwrite("pruning", &Options::pruning);
     
   py::class_<LouvainMod::PartitionOptions>(pc, "partitionOptions")
     .def(py::init())
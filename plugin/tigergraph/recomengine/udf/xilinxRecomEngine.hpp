@@ -200,15 +200,16 @@ inline int udf_xilinx_recom_load_population_vectors(ListAccum<ListAccum<int64_t>
         xilRecom::CosineSim *pCosineSim = pContext->getCosineSimObj();
     //    pCosineSim->openFpga();
         pCosineSim->startLoadPopulation(numVectors);
+        // Gather the vectors into one matrix so that the library can scatter them to the devices in parallel
+        std::vector<xilRecom::CosineSim::ValueType> matrix(numVectors * vectorLength);
         for (xilinx_apps::cosinesim::RowIndex vecNum = 0; vecNum < numVectors; ++vecNum) {
             const ListAccum<int64_t> &curRowVec = popVectors.get(vecNum);
-            xilinx_apps::cosinesim::RowIndex rowIndex = 0;
-            xilRecom::CosineSim::ValueType *pBuf = pCosineSim->getPopulationVectorBuffer(rowIndex);
+            xilRecom::CosineSim::ValueType *pRow = &matrix[vecNum * vectorLength];
             for (xilinx_apps::cosinesim::ColIndex eltNum = 0; eltNum < vectorLength; ++eltNum)
-                *pBuf++ = xilRecom::CosineSim::ValueType(curRowVec.get(eltNum));
-            pCosineSim->finishCurrentPopulationVector(pBuf);
-            idMap[rowIndex] = ids.get(vecNum);
+                pRow[eltNum] = xilRecom::CosineSim::ValueType(curRowVec.get(eltNum));
+            idMap[vecNum] = ids.get(vecNum);
         }
+        pCosineSim->loadPopulation(matrix.data(), numVectors, vectorLength);
         pCosineSim->finishLoadPopulation();
         pContext->setInitialized();  // FPGA(s) now ready to match
         return 0;
@@ -220,6 +221,41 @@ inline int udf_xilinx_recom_load_population_vectors(ListAccum<ListAccum<int64_t>
     }
 }
 
+// Writes the loaded population and its vertex ID map to a snapshot file for fast restarts
+inline bool udf_xilinx_recom_save_snapshot(std::string path) {
+    xilRecom::Lock lock(xilRecom::getMutex());
+    xilRecom::Context *pContext = xilRecom::Context::getInstance();
+    if (!pContext->isInitialized())
+        return false;
+
+    try {
+        pContext->getCosineSimObj()->saveSnapshot(path, pContext->getIdMap());
+        return true;
+    }
+    catch (const xilinx_apps::cosinesim::Exception &ex) {
+        std::cout << "ERROR: xilinxRecomEngine: " << ex.what() << std::endl;
+        return false;
+    }
+}
+
+// Restores a population saved by udf_xilinx_recom_save_snapshot in place of a full load from the graph
+inline bool udf_xilinx_recom_load_snapshot(std::string path, int64_t vectorLength) {
+    xilRecom::Lock lock(xilRecom::getMutex());
+    xilRecom::Context *pContext = xilRecom::Context::getInstance();
+    pContext->setVectorLength(xilinx_apps::cosinesim::ColIndex(vectorLength));
+
+    try {
+        xilRecom::CosineSim *pCosineSim = pContext->getCosineSimObj();
+        pContext->getIdMap() = pCosineSim->loadSnapshot(path);
+        pContext->setInitialized();  // FPGA(s) now ready to match
+        return true;
+    }
+    catch (const xilinx_apps::cosinesim::Exception &ex) {
+        std::cout << "ERROR: xilinxRecomEngine: " << ex.what() << std::endl;
+        return false;
+    }
+}
+
 // Enable this to print profiling messages to the log (via stdout)
 #define XILINX_RECOM_PROFILE_ON
 
@@ -329,6 +365,95 @@ inline ListAccum<XilCosinesimMatch> udf_xilinx_recom_match_target_vector(int64_t
     return result;
 }
 
+// Batched form of udf_xilinx_recom_match_target_vector: one match list per target vector, in target order.
+// All targets go to the Alveo card(s) in a single call, so the per-call overhead is paid once per batch.
+inline ListAccum<ListAccum<XilCosinesimMatch> > udf_xilinx_recom_match_target_vectors(int64_t topK,
+        ListAccum<ListAccum<int64_t> > targetVectors)
+{
+    xilRecom::Lock lock(xilRecom::getMutex());
+    ListAccum<ListAccum<XilCosinesimMatch> > result;
+    xilRecom::Context *pContext = xilRecom::Context::getInstance();
+
+    if (!pContext->isInitialized())
+        return result;
+    xilRecom::Context::IdMap &idMap = pContext->getIdMap();
+
+    const std::size_t numTargets = targetVectors.size();
+    const xilinx_apps::cosinesim::ColIndex vectorLength = pContext->getVectorLength();
+    std::vector<xilRecom::CosineSim::ValueType> nativeTargetVectors;
+    nativeTargetVectors.reserve(numTargets * vectorLength);
+    for (std::size_t targetNum = 0; targetNum < numTargets; ++targetNum) {
+        const ListAccum<int64_t> &targetVector = targetVectors.get(targetNum);
+        for (xilinx_apps::cosinesim::ColIndex eltNum = 0; eltNum < vectorLength; ++eltNum)
+            nativeTargetVectors.push_back(targetVector.get(eltNum));
+    }
+
+    try {
+        xilRecom::CosineSim *pCosineSim = pContext->getCosineSimObj();
+        std::vector<std::vector<xilinx_apps::cosinesim::Result> > apiResults
+                = pCosineSim->matchTargetVectors(topK, nativeTargetVectors.data(), numTargets);
+        for (std::vector<xilinx_apps::cosinesim::Result> &targetResults : apiResults) {
+            ListAccum<XilCosinesimMatch> matches;
+            for (xilinx_apps::cosinesim::Result &apiResult : targetResults) {
+                if (apiResult.index < 0 || apiResult.index >= xilinx_apps::cosinesim::RowIndex(idMap.size()))
+                    continue;
+                matches += XilCosinesimMatch(VERTEX(idMap[apiResult.index]), apiResult.similarity);
+            }
+            result += matches;
+        }
+    }
+    catch (const xilinx_apps::cosinesim::Exception &ex) {
+        std::cout << "ERROR: xilinxRecomEngine: " << ex.what() << std::endl;
+    }
+
+    return result;
+}
+
+// Filtered form of udf_xilinx_recom_match_target_vector: only the vertices whose IDs (getvid()) are in allowedIds
+// can be returned, and up to topK of them are, without over-fetching and filtering in GSQL
+inline ListAccum<XilCosinesimMatch> udf_xilinx_recom_match_target_vector_filtered(int64_t topK,
+        ListAccum<int64_t> targetVector, ListAccum<uint64_t> allowedIds)
+{
+    xilRecom::Lock lock(xilRecom::getMutex());
+    ListAccum<XilCosinesimMatch> result;
+    xilRecom::Context *pContext = xilRecom::Context::getInstance();
+
+    if (!pContext->isInitialized())
+        return result;
+    xilRecom::Context::IdMap &idMap = pContext->getIdMap();
+
+    const xilinx_apps::cosinesim::ColIndex vectorLength = pContext->getVectorLength();
+    std::vector<xilRecom::CosineSim::ValueType> nativeTargetVector;
+    nativeTargetVector.reserve(vectorLength);
+    for (xilinx_apps::cosinesim::ColIndex eltNum = 0; eltNum < vectorLength; ++eltNum)
+        nativeTargetVector.push_back(targetVector.get(eltNum));
+
+    // only the allowed IDs are looked up, so the cost follows the filter rather than the population size
+    const xilRecom::Context::RowMap &rowMap = pContext->getRowMap();
+    xilinx_apps::cosinesim::Bitmap allow(idMap.size());
+    for (std::size_t i = 0; i < allowedIds.size(); ++i) {
+        xilRecom::Context::RowMap::const_iterator it = rowMap.find(allowedIds.get(i));
+        if (it != rowMap.end())
+            allow.set(it->second);
+    }
+
+    try {
+        xilRecom::CosineSim *pCosineSim = pContext->getCosineSimObj();
+        std::vector<xilinx_apps::cosinesim::Result> apiResults
+                = pCosineSim->matchTargetVector(topK, nativeTargetVector.data(), allow);
+        for (xilinx_apps::cosinesim::Result &apiResult : apiResults) {
+            if (apiResult.index < 0 || apiResult.index >= xilinx_apps::cosinesim::RowIndex(idMap.size()))
+                continue;
+            result += XilCosinesimMatch(VERTEX(idMap[apiResult.index]), apiResult.similarity);
+        }
+    }
+    catch (const xilinx_apps::cosinesim::Exception &ex) {
+        std::cout << "ERROR: xilinxRecomEngine: " << ex.what() << std::endl;
+    }
+
+    return result;
+}
+
 /* End Xilinx Cosine Similarity Additions */
 // mergeHeaders 1 section body end xilinxRecomEngine DO NOT REMOVE!
 
@@ -17,6 +17,8 @@
 #ifndef XILINXRECOMENGINE_HPP
 #define XILINXRECOMENGINE_HPP
 
+#include <unordered_map>
+
 // Use inline definitions for dynamic loading functions
 #define XILINX_COSINESIM_INLINE_IMPL
 #include "cosinesim.hpp"
@@ -59,6 +61,7 @@ using CosineSim = xilinx_apps::cosinesim::CosineSim<std::int32_t>;
 class Context {
 public:
     using IdMap = std::vector<std::uint64_t>;
+    using RowMap = std::unordered_map<std::uint64_t, xilinx_apps::cosinesim::RowIndex>;
     
 private:
     unsigned nodeId_;
@@ -73,6 +76,8 @@ private:
     bool isInitialized_ = false;
     CosineSim *pCosineSim_ = nullptr;
     IdMap idMap_;  // maps from vector ID to FPGA row number
+    RowMap rowMap_;  // inverse of idMap_, built by the first filtered match after each load
+    bool rowMapValid_ = false;
     
 public:
     std::string curNodeHostname_;
@@ -204,8 +209,23 @@ public:
     }
 
     IdMap &getIdMap() { return idMap_; }
+
+    const RowMap &getRowMap() {
+        if (!rowMapValid_) {
+            rowMap_.clear();
+            rowMap_.reserve(idMap_.size());
+            for (std::size_t row = 0; row < idMap_.size(); ++row)
+                rowMap_[idMap_[row]] = xilinx_apps::cosinesim::RowIndex(row);
+            rowMapValid_ = true;
+        }
+        return rowMap_;
+    }
     
-    void setInitialized() { isInitialized_ = true; }
+    // Every population load ends here, so this is also where the ID map stops changing
+    void setInitialized() {
+        isInitialized_ = true;
+        rowMapValid_ = false;
+    }
     
     bool isInitialized() const { return isInitialized_; }
 
@@ -213,6 +233,8 @@ public:
         isInitialized_ = false;
         vectorLengthSet_ = false;
         idMap_.clear();
+        rowMap_.clear();
+        rowMapValid_ = false;
         delete pCosineSim_;
         pCosineSim_ = nullptr;
     }